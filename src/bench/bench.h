@@ -0,0 +1,163 @@
+/**
+ * @file bench.h
+ * @brief Benchmark Timing Helpers
+ *
+ * Small helpers shared by the microbenchmarks in this directory, and a
+ * harness that times a case in batches after a warmup and reports
+ * percentiles of the per operation time, as text and as JSON.
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef __BENCH_H
+#define __BENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_NSAMPLES 200          /* samples per case at most */
+#define BENCH_SAMPLE_NS 20000       /* target duration of one sample */
+#define BENCH_BUDGET_NS 300000000ull /* target duration of one case */
+
+/* keep the compiler from optimizing away a benchmarked result */
+#define bench_keep(x) __asm__ __volatile__("" : : "g"(x) : "memory")
+
+/**
+ * bench_now_ns() - Monotonic clock in nanoseconds.
+ */
+static inline uint64_t
+bench_now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * struct bench_case - One thing to time
+ * @name: reported name, "function/size" by convention
+ * @setup: untimed, run before each sample of @batch operations, may be NULL
+ * @run: one operation
+ * @arg: passed to @setup and @run
+ * @bytes: bytes processed per operation, 0 if not meaningful
+ * @maxbatch: operations per sample at most, 0 for no limit
+ */
+struct bench_case {
+  const char *name;
+  void (*setup)(void *arg, uint64_t batch);
+  void (*run)(void *arg);
+  void *arg;
+  size_t bytes;
+  uint64_t maxbatch;
+};
+
+/**
+ * struct bench_stats - Per operation time of a case, in nanoseconds
+ */
+struct bench_stats {
+  double min, p50, p90, p99, mean;
+  uint64_t samples, batch;
+};
+
+static inline int
+__bench_cmp(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/* ns for one sample of @batch operations */
+static inline double
+__bench_sample(const struct bench_case *c, uint64_t batch)
+{
+  uint64_t start, stop;
+
+  if (c->setup) {
+    c->setup(c->arg, batch);
+  }
+  start = bench_now_ns();
+  for (uint64_t i = 0; i < batch; i++) {
+    c->run(c->arg);
+  }
+  stop = bench_now_ns();
+
+  return (double)(stop - start);
+}
+
+/**
+ * bench_measure() - Warm up, size the batches and time @c.
+ */
+static inline void
+bench_measure(const struct bench_case *c, struct bench_stats *st)
+{
+  static double ns[BENCH_NSAMPLES];
+  uint64_t batch = 1, n;
+  double one, sum = 0;
+
+  /* warm up caches and lazy binding, a cold first run would end the sizing early */
+  for (int i = 0; i < 3; i++) {
+    __bench_sample(c, 1);
+  }
+  /* grow the batch until a sample is long enough to time */
+  while ((one = __bench_sample(c, batch)) < BENCH_SAMPLE_NS
+         && (c->maxbatch == 0 || batch * 2 <= c->maxbatch)) {
+    batch *= 2;
+  }
+  n = BENCH_BUDGET_NS / (one + 1);
+  n = n < 10 ? 10 : n > BENCH_NSAMPLES ? BENCH_NSAMPLES : n;
+
+  for (uint64_t i = 0; i < n; i++) {
+    ns[i] = __bench_sample(c, batch) / batch;
+    sum += ns[i];
+  }
+  qsort(ns, n, sizeof ns[0], __bench_cmp);
+
+  st->min = ns[0];
+  st->p50 = ns[n / 2];
+  st->p90 = ns[n * 90 / 100];
+  st->p99 = ns[n * 99 / 100];
+  st->mean = sum / n;
+  st->samples = n;
+  st->batch = batch;
+}
+
+/**
+ * bench_json_result() - Write one case as a JSON object.
+ *
+ * @out: stream to write to
+ * @c: the case
+ * @st: its stats
+ * @first: 0 to prefix a comma
+ */
+static inline void
+bench_json_result(FILE *out, const struct bench_case *c, const struct bench_stats *st, int first)
+{
+  fprintf(out, "%s\n    {\"name\": \"%s\", \"samples\": %llu, \"batch\": %llu, "
+          "\"ns_per_op\": {\"min\": %.2f, \"p50\": %.2f, \"p90\": %.2f, \"p99\": %.2f, \"mean\": %.2f}",
+          first ? "" : ",", c->name, (unsigned long long)st->samples, (unsigned long long)st->batch,
+          st->min, st->p50, st->p90, st->p99, st->mean);
+  if (c->bytes) {
+    fprintf(out, ", \"bytes_per_op\": %zu, \"mb_per_s\": %.1f", c->bytes, c->bytes * 1e3 / st->p50);
+  }
+  fprintf(out, "}");
+}
+
+#endif /* __BENCH_H */
@@ -0,0 +1,324 @@
+/**
+ * @file bench_core.c
+ * @brief Core Primitive Benchmark Suite
+ *
+ * Times the string primitives, line reading, command parsing and lookup,
+ * the socket wrappers and the file transfer loop over a socketpair. A table
+ * goes to stderr and the results as JSON to the file named on the command
+ * line, or to stdout.
+ *
+ *   bench_core [out.json]
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "../mystring.h"
+#include "../memscan.h"
+#include "../cpufeatures.h"
+#include "../syscalls.h"
+#include "../networktcp.h"
+#include "../client_core.h"
+#include "../command_handler.h"
+#include "../pipeline.h"
+#include "../bufpool.h"
+#include "../pathcache.h"
+#include "../resultcache.h"
+
+#define LINELEN 40                  /* myreadline() line, newline included */
+#define READLINE_MAXBATCH 1024      /* lines queued at once, within the socket buffer */
+#define TRANSFER_SIZE (4 << 20)     /* file sent by the transfer loop */
+#define COMMANDLINE "ls -l -a /tmp | grep foo | sort -r | wc -l"
+
+struct strarg {
+  char a[0x1000 + 64];
+  char b[0x1000 + 64];
+  size_t len;
+};
+
+struct fdarg {
+  int fd[2];
+  char buf[0x1000];
+  size_t len;
+};
+
+/* mystring.c */
+static void run_strlen(void *p) { struct strarg *s = p; bench_keep(mystrlen(s->a)); }
+static void run_strcmp(void *p) { struct strarg *s = p; bench_keep(mystrcmp(s->a, s->b)); }
+static void run_strchr(void *p) { struct strarg *s = p; bench_keep(mystrchr(s->a, '|')); }
+static void run_memcpy(void *p) { struct strarg *s = p; bench_keep(mymemcpy(s->b, s->a, s->len)); }
+static void run_memset(void *p) { struct strarg *s = p; bench_keep(mymemset(s->b, 0, s->len)); }
+static void run_itoa(void *p) { struct strarg *s = p; bench_keep(myitoa(-1234567, s->b)); }
+
+static void
+run_snprintf(void *p)
+{
+  struct strarg *s = p;
+  bench_keep(mysnprintf(s->b, sizeof s->b, "::client %d sent %s\n", 42, "get big.bin"));
+}
+
+/* myreadline() over a socketpair, the lines are queued untimed in one write */
+static void
+setup_readline(void *p, uint64_t batch)
+{
+  struct fdarg *f = p;
+  static char lines[LINELEN * READLINE_MAXBATCH];
+
+  for (uint64_t i = 0; i < batch; i++) {
+    mymemset(lines + i * LINELEN, 'x', LINELEN - 1);
+    lines[i * LINELEN + LINELEN - 1] = '\n';
+  }
+  mysckwrite(f->fd[1], lines, batch * LINELEN);
+}
+
+static void
+run_readline(void *p)
+{
+  struct fdarg *f = p;
+  bench_keep(myreadline(f->fd[0], f->buf, sizeof f->buf));
+}
+
+/* command parsing, the line is copied first since parsing splits it in place */
+static void
+run_cmd_parse(void *p)
+{
+  struct strarg *s = p;
+  struct cmd_pipeline *list;
+  struct arena arena;
+  const char *err;
+  char mem[1024] __attribute__((aligned(16)));
+
+  mymemcpy(s->b, COMMANDLINE, sizeof COMMANDLINE);
+  arena_init(&arena, mem, sizeof mem);
+  bench_keep(cmd_parse(s->b, &arena, &list, &err));
+}
+
+/* what runcommand() does before forking: parse and fill the pipeline table */
+static void
+run_build_pipeline(void *p)
+{
+  struct strarg *s = p;
+  struct cmd_pipeline *list;
+  struct arena arena;
+  const char *err;
+  char *mem = bufpool_get();
+  Pipeline *pipe;
+
+  mymemcpy(s->b, COMMANDLINE, sizeof COMMANDLINE);
+  arena_init(&arena, mem, BUFPOOL_BUFSIZE);
+  cmd_parse(s->b, &arena, &list, &err);
+  pipe = arena_alloc(&arena, list->nstages * sizeof(*pipe));
+  bench_keep(build_pipeline(pipe, list, -1));
+  bufpool_put(mem);
+}
+
+/* command resolution, from the shared cache and by probing PATH */
+static void
+run_pathcache_hit(void *p)
+{
+  struct strarg *s = p;
+  bench_keep(pathcache_resolve("wc", s->b, sizeof s->b));
+}
+
+static void
+run_pathcache_miss(void *p)
+{
+  struct strarg *s = p;
+
+  pathcache_invalidate();
+  bench_keep(pathcache_resolve("wc", s->b, sizeof s->b));
+}
+
+/* a dashboard's repeated command, served from the shared cache or run and stored */
+static void
+run_resultcache(void *p, int invalidate)
+{
+  struct fdarg *f = p;
+  char *argv[] = { "md5sum", f->buf, NULL };
+  Pipeline stage;
+
+  if (invalidate) {
+    resultcache_invalidate();
+  }
+  init_pipelines(&stage, 1, f->fd[1]);
+  stage.argv = argv;
+  stage.argc = 2;
+  if (!resultcache_serve(&stage, 1, f->fd[1])) {
+    resultcache_store(run_pipeline(&stage, 1));
+  }
+  bench_keep(mysckread(f->fd[0], f->buf + MAX_PATH_SIZE, sizeof f->buf - MAX_PATH_SIZE));
+}
+
+static void run_resultcache_hit(void *p) { run_resultcache(p, 0); }
+static void run_resultcache_miss(void *p) { run_resultcache(p, 1); }
+
+/* syscalls.c socket wrappers, a write and the read that drains it */
+static void
+run_sckwrite_sckread(void *p)
+{
+  struct fdarg *f = p;
+
+  mysckwrite(f->fd[1], f->buf, f->len);
+  bench_keep(mysckread(f->fd[0], f->buf, f->len));
+}
+
+/* the file transfer loop: a child sends the file, we drain the socket */
+static void
+run_transfer(void *p)
+{
+  struct fdarg *f = p;
+  int sv[2];
+  size_t n, total = 0;
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+    printerr_exit("socketpair() error\n");
+  }
+  if (myfork() == 0) {
+    myclose(sv[0]);
+    lseek(f->fd[0], 0, SEEK_SET);
+    readfd_writesocket(sv[1], f->buf, sizeof f->buf, f->fd[0], 1);
+    _exit(0);
+  }
+  myclose(sv[1]);
+  for (;;) {
+    do_poll(sv[0]);
+    if ((n = mysckread(sv[0], f->buf, sizeof f->buf)) == 0) {
+      break;
+    }
+    total += n;
+  }
+  myclose(sv[0]);
+  mywait(NULL);
+  if (total != TRANSFER_SIZE) {
+    printerr_exit("transfer came up short\n");
+  }
+}
+
+static struct strarg s16, s80, s4k, misc;
+static struct fdarg lines, sock4k, transfer, cached;
+
+static const struct bench_case cases[] = {
+  { "mystrlen/16",          NULL,            run_strlen,            &s16,      16 },
+  { "mystrlen/80",          NULL,            run_strlen,            &s80,      80 },
+  { "mystrlen/4096",        NULL,            run_strlen,            &s4k,      4096 },
+  { "mystrcmp/16",          NULL,            run_strcmp,            &s16,      16 },
+  { "mystrcmp/80",          NULL,            run_strcmp,            &s80,      80 },
+  { "mystrcmp/4096",        NULL,            run_strcmp,            &s4k,      4096 },
+  { "mystrchr/80",          NULL,            run_strchr,            &s80,      80 },
+  { "mymemcpy/80",          NULL,            run_memcpy,            &s80,      80 },
+  { "mymemcpy/4096",        NULL,            run_memcpy,            &s4k,      4096 },
+  { "mymemset/4096",        NULL,            run_memset,            &s4k,      4096 },
+  { "myitoa",               NULL,            run_itoa,              &misc,     0 },
+  { "mysnprintf/logline",   NULL,            run_snprintf,          &misc,     0 },
+  { "myreadline/40",        setup_readline,  run_readline,          &lines,    LINELEN, READLINE_MAXBATCH },
+  { "cmd_parse",            NULL,            run_cmd_parse,         &misc,     0 },
+  { "build_pipeline",       NULL,            run_build_pipeline,    &misc,     0 },
+  { "pathcache/hit",        NULL,            run_pathcache_hit,     &misc,     0 },
+  { "pathcache/miss",       NULL,            run_pathcache_miss,    &misc,     0 },
+  { "resultcache/hit",      NULL,            run_resultcache_hit,   &cached,   0 },
+  { "resultcache/miss",     NULL,            run_resultcache_miss,  &cached,   0 },
+  { "mysckwrite+read/4096", NULL,            run_sckwrite_sckread,  &sock4k,   4096 },
+  { "transfer/4M",          NULL,            run_transfer,          &transfer, TRANSFER_SIZE, 1 },
+};
+
+static void
+init_cases(void)
+{
+  struct strarg *strs[] = { &s16, &s80, &s4k };
+  size_t lens[] = { 16, 80, 4096 };
+  char tmpl[] = "/tmp/bench_coreXXXXXX";
+  int fd;
+
+  for (size_t i = 0; i < 3; i++) {
+    memset(strs[i]->a, 'a', lens[i]);
+    memset(strs[i]->b, 'a', lens[i]);
+    strs[i]->a[lens[i]] = strs[i]->b[lens[i]] = '\0';
+    strs[i]->a[lens[i] - 1] = '|';
+    strs[i]->len = lens[i];
+  }
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, lines.fd) == -1
+      || socketpair(AF_UNIX, SOCK_STREAM, 0, sock4k.fd) == -1
+      || socketpair(AF_UNIX, SOCK_STREAM, 0, cached.fd) == -1) {
+    printerr_exit("socketpair() error\n");
+  }
+  sock4k.len = sizeof sock4k.buf;
+
+  /* the transfer source, unlinked so it goes away with us */
+  if ((transfer.fd[0] = mkstemp(tmpl)) == -1) {
+    printerr_exit("mkstemp() error\n");
+  }
+  unlink(tmpl);
+  memset(transfer.buf, 'f', sizeof transfer.buf);
+  for (size_t n = 0; n < TRANSFER_SIZE; n += sizeof transfer.buf) {
+    mywrite(transfer.fd[0], transfer.buf, sizeof transfer.buf);
+  }
+
+  /* the cached command's operand has to stay, main() removes it */
+  mystrcpy(cached.buf, "/tmp/bench_coreXXXXXX");
+  if ((fd = mkstemp(cached.buf)) == -1) {
+    printerr_exit("mkstemp() error\n");
+  }
+  mywrite(fd, "status: ok\n", 11);
+  myclose(fd);
+  resultcache_init("3600000");
+}
+
+int
+main(int argc, char *argv[])
+{
+  FILE *out = argc > 1 ? fopen(argv[1], "w") : stdout;
+  unsigned int features = cpu_features();
+  struct bench_stats st;
+
+  if (out == NULL) {
+    perror(argv[1]);
+    return 1;
+  }
+  init_cases();
+
+  fprintf(stderr, "%-22s %10s %10s %10s %10s %8s\n", "case", "min", "p50", "p90", "p99", "MB/s");
+  fprintf(out, "{\n  \"suite\": \"core\",\n  \"cpu_features\": {\"sse2\": %s, \"avx2\": %s},\n  \"results\": [",
+          features & CPU_SSE2 ? "true" : "false", features & CPU_AVX2 ? "true" : "false");
+
+  for (size_t i = 0; i < sizeof cases / sizeof cases[0]; i++) {
+    bench_measure(&cases[i], &st);
+    fprintf(stderr, "%-22s %10.1f %10.1f %10.1f %10.1f", cases[i].name, st.min, st.p50, st.p90, st.p99);
+    if (cases[i].bytes) {
+      fprintf(stderr, " %8.0f", cases[i].bytes * 1e3 / st.p50);
+    }
+    fprintf(stderr, "\n");
+    bench_json_result(out, &cases[i], &st, i == 0);
+  }
+
+  unlink(cached.buf);
+  fprintf(out, "\n  ]\n}\n");
+  if (out != stdout) {
+    fclose(out);
+  }
+
+  return 0;
+}
@@ -0,0 +1,119 @@
+/**
+ * @file bench_fprintf.c
+ * @brief Formatted Output Benchmark
+ *
+ * Times a typical server log line through the old character at a time
+ * myfprintf(), the buffered myfprintf(), and snprintf() plus write(), all
+ * writing to /dev/null. Also times formatting alone, mysnprintf() against
+ * snprintf(), to separate the formatting cost from the syscalls.
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "../mystring.h"
+
+#define ITERS 200000
+
+/* the implementation myfprintf() had before the formatting engine */
+static void
+legacy_myfprintf(int fd, const char *strn, ...)
+{
+  va_list ap;
+  int d, c, curchar, i, neg;
+  char buf[16], *s;
+
+  va_start(ap, strn);
+  while (*strn) {
+    curchar = *strn++;
+    if (curchar != '%') {
+      write(fd, &curchar, 1);
+      continue;
+    }
+    switch (*strn++) {
+    case 's':
+      s = va_arg(ap, char *);
+      write(fd, s, strlen(s));
+      break;
+    case 'd':
+      d = va_arg(ap, int);
+      neg = d < 0;
+      i = sizeof buf;
+      do {
+        buf[--i] = '0' + (neg ? -(d % 10) : d % 10);
+        d /= 10;
+      } while (d);
+      if (neg) {
+        buf[--i] = '-';
+      }
+      write(fd, buf + i, sizeof buf - i);
+      break;
+    case 'c':
+      c = (char)va_arg(ap, int);
+      write(fd, &c, 1);
+      break;
+    }
+  }
+  va_end(ap);
+}
+
+static void
+snprintf_write(int fd, int id, const char *cmd)
+{
+  char buf[1024];
+  int n = snprintf(buf, sizeof buf, "::client %d sent %s\n", id, cmd);
+  write(fd, buf, n);
+}
+
+#define TIME(label, stmt)                                               \
+  do {                                                                  \
+    uint64_t start = bench_now_ns();                                    \
+    for (int i = 0; i < ITERS; i++) {                                   \
+      stmt;                                                             \
+    }                                                                   \
+    printf("%-22s %8.1f ns/call\n", label,                              \
+           (double)(bench_now_ns() - start) / ITERS);                   \
+  } while (0)
+
+int
+main(void)
+{
+  int null = open("/dev/null", O_WRONLY);
+  char buf[128];
+
+  printf("\"::client %%d sent %%s\\n\" to /dev/null\n");
+  TIME("legacy myfprintf", legacy_myfprintf(null, "::client %d sent %s\n", i, "ls -l"));
+  TIME("myfprintf", myfprintf(null, "::client %d sent %s\n", i, "ls -l"));
+  TIME("snprintf + write", snprintf_write(null, i, "ls -l"));
+
+  printf("\nformatting only, \"%%s %%zu %%08x %%lld\"\n");
+  TIME("mysnprintf", bench_keep(mysnprintf(buf, sizeof buf, "%s %zu %08x %lld",
+                                           "size", (size_t)i, i, -1234567890123ll * i)));
+  TIME("snprintf", bench_keep(snprintf(buf, sizeof buf, "%s %zu %08x %lld",
+                                       "size", (size_t)i, i, -1234567890123ll * i)));
+
+  close(null);
+  return 0;
+}
@@ -0,0 +1,128 @@
+/**
+ * @file bench_memops.c
+ * @brief String and Memory Primitive Benchmark
+ *
+ * Compares the byte, word, SSE2 and AVX2 variants of mymemset(),
+ * mymemcpy() and mystrcmp() with libc over a range of lengths.
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "../memops.h"
+#include "../memscan.h"
+#include "../cpufeatures.h"
+
+#define ITERS 20000
+
+static char dst[0x1000 + 64] __attribute__((aligned(64)));
+static char src[0x1000 + 64] __attribute__((aligned(64)));
+
+/* every kernel takes (dst, src, len) so they share one timing loop */
+#define SET(name, fn) \
+  static void name(char *d, const char *s, size_t n) { bench_keep(fn(d, 'a', n)); }
+#define CPY(name, fn) \
+  static void name(char *d, const char *s, size_t n) { bench_keep(fn(d, s, n)); }
+#define CMP(name, fn) \
+  static void name(char *d, const char *s, size_t n) { bench_keep(fn(d, s)); }
+
+SET(set_scalar, mymemset_scalar)
+SET(set_word, mymemset_word)
+SET(set_sse2, mymemset_sse2)
+SET(set_avx2, mymemset_avx2)
+SET(set_libc, memset)
+CPY(cpy_scalar, mymemcpy_scalar)
+CPY(cpy_word, mymemcpy_word)
+CPY(cpy_sse2, mymemcpy_sse2)
+CPY(cpy_avx2, mymemcpy_avx2)
+CPY(cpy_libc, memcpy)
+CMP(cmp_scalar, mystrcmp_scalar)
+CMP(cmp_word, mystrcmp_word)
+CMP(cmp_sse2, mystrcmp_sse2)
+CMP(cmp_avx2, mystrcmp_avx2)
+CMP(cmp_libc, strcmp)
+
+struct kernel {
+  const char *name;
+  void (*fn)(char *, const char *, size_t);
+  unsigned int needs;
+};
+
+static const struct kernel kernels[] = {
+  { "memset_scalar", set_scalar, 0 },
+  { "memset_word",   set_word,   0 },
+  { "memset_sse2",   set_sse2,   CPU_SSE2 },
+  { "memset_avx2",   set_avx2,   CPU_AVX2 },
+  { "libc_memset",   set_libc,   0 },
+  { "memcpy_scalar", cpy_scalar, 0 },
+  { "memcpy_word",   cpy_word,   0 },
+  { "memcpy_sse2",   cpy_sse2,   CPU_SSE2 },
+  { "memcpy_avx2",   cpy_avx2,   CPU_AVX2 },
+  { "libc_memcpy",   cpy_libc,   0 },
+  { "strcmp_scalar", cmp_scalar, 0 },
+  { "strcmp_word",   cmp_word,   0 },
+  { "strcmp_sse2",   cmp_sse2,   CPU_SSE2 },
+  { "strcmp_avx2",   cmp_avx2,   CPU_AVX2 },
+  { "libc_strcmp",   cmp_libc,   0 },
+};
+
+int
+main(void)
+{
+  static const size_t lens[] = { 8, 32, 80, 256, 1024, 4096 };
+  unsigned int features = cpu_features();
+
+  printf("%-18s", "kernel");
+  for (size_t l = 0; l < sizeof lens / sizeof lens[0]; l++) {
+    printf("%10zuB", lens[l]);
+  }
+  printf("   (ns per call)\n");
+
+  for (size_t k = 0; k < sizeof kernels / sizeof kernels[0]; k++) {
+    if ((kernels[k].needs & features) != kernels[k].needs) {
+      continue;
+    }
+    printf("%-18s", kernels[k].name);
+    for (size_t l = 0; l < sizeof lens / sizeof lens[0]; l++) {
+      size_t len = lens[l];
+      uint64_t start, stop;
+
+      /* equal strings of len bytes for strcmp */
+      memset(src, 'a', sizeof src);
+      memset(dst, 'a', sizeof dst);
+      src[len] = dst[len] = '\0';
+
+      for (int i = 0; i < ITERS / 10; i++) { /* warmup */
+        kernels[k].fn(dst, src, len);
+      }
+      start = bench_now_ns();
+      for (int i = 0; i < ITERS; i++) {
+        kernels[k].fn(dst, src, len);
+      }
+      stop = bench_now_ns();
+      printf("%11.1f", (double)(stop - start) / ITERS);
+    }
+    printf("\n");
+  }
+
+  return 0;
+}
@@ -0,0 +1,132 @@
+/**
+ * @file bench_scan.c
+ * @brief Newline and Delimiter Scanning Benchmark
+ *
+ * Compares the scalar, SSE2 and AVX2 scanning kernels from memscan.c with the
+ * old byte at a time loop and libc memchr() over a range of line lengths.
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "../memscan.h"
+#include "../cpufeatures.h"
+
+#define BUFSIZE 0x10000
+#define ITERS 20000
+
+static char buf[BUFSIZE + 64] __attribute__((aligned(64)));
+
+/* the loop the line reader used before memscan.c */
+static const void *
+bytewise_memchr(const void *s, int c, size_t n)
+{
+  const char *p = s;
+  for (size_t i = 0; i < n; i++) {
+    if (p[i] == c) {
+      return p + i;
+    }
+  }
+  return NULL;
+}
+
+static const void *
+libc_memchr(const void *s, int c, size_t n)
+{
+  return memchr(s, c, n);
+}
+
+static const void *
+strchrnul_scalar(const void *s, int c, size_t n)
+{
+  return mystrchrnul_scalar(s, c);
+}
+
+static const void *
+strchrnul_sse2(const void *s, int c, size_t n)
+{
+  return mystrchrnul_sse2(s, c);
+}
+
+static const void *
+strchrnul_avx2(const void *s, int c, size_t n)
+{
+  return mystrchrnul_avx2(s, c);
+}
+
+struct kernel {
+  const char *name;
+  const void *(*fn)(const void *, int, size_t);
+  unsigned int needs;
+};
+
+static const struct kernel kernels[] = {
+  { "bytewise",          bytewise_memchr,  0 },
+  { "memchr_scalar",     mymemchr_scalar,  0 },
+  { "memchr_sse2",       mymemchr_sse2,    CPU_SSE2 },
+  { "memchr_avx2",       mymemchr_avx2,    CPU_AVX2 },
+  { "libc_memchr",       libc_memchr,      0 },
+  { "strchrnul_scalar",  strchrnul_scalar, 0 },
+  { "strchrnul_sse2",    strchrnul_sse2,   CPU_SSE2 },
+  { "strchrnul_avx2",    strchrnul_avx2,   CPU_AVX2 },
+};
+
+int
+main(void)
+{
+  static const size_t lens[] = { 8, 32, 80, 256, 1024, 4096 };
+  unsigned int features = cpu_features();
+
+  printf("%-18s", "kernel");
+  for (size_t l = 0; l < sizeof lens / sizeof lens[0]; l++) {
+    printf("%10zuB", lens[l]);
+  }
+  printf("   (ns per scan)\n");
+
+  for (size_t k = 0; k < sizeof kernels / sizeof kernels[0]; k++) {
+    if ((kernels[k].needs & features) != kernels[k].needs) {
+      continue;
+    }
+    printf("%-18s", kernels[k].name);
+    for (size_t l = 0; l < sizeof lens / sizeof lens[0]; l++) {
+      size_t len = lens[l];
+      uint64_t start, stop;
+
+      memset(buf, 'a', sizeof buf);
+      buf[len] = '\n';
+      buf[len + 1] = '\0';
+
+      for (int i = 0; i < ITERS / 10; i++) { /* warmup */
+        bench_keep(kernels[k].fn(buf, '\n', len + 1));
+      }
+      start = bench_now_ns();
+      for (int i = 0; i < ITERS; i++) {
+        bench_keep(kernels[k].fn(buf, '\n', len + 1));
+      }
+      stop = bench_now_ns();
+      printf("%11.1f", (double)(stop - start) / ITERS);
+    }
+    printf("\n");
+  }
+
+  return 0;
+}
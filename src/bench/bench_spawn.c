@@ -0,0 +1,111 @@
+/**
+ * @file bench_spawn.c
+ * @brief Process Launch Latency against Resident Set Size
+ *
+ * Grows the process by touching anonymous memory, then times starting and
+ * reaping /usr/bin/true the old way, fork() + dup2() + execve(), and through
+ * run_pipeline(), which uses posix_spawn(). fork() copies the page tables of
+ * the whole process, so its cost climbs with RSS; the spawn should not. The
+ * builtin true, which run_pipeline() runs without a process, is the floor.
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "../globals.h"
+#include "../syscalls.h"
+#include "../pipeline.h"
+
+static char *true_argv[] = { "/usr/bin/true", NULL };
+static char *builtin_argv[] = { "true", NULL };
+static int devnull;
+
+static void
+run_fork(void *p)
+{
+  pid_t pid = fork();
+
+  if (pid == 0) {
+    dup2(devnull, sys_stdout);
+    close(devnull);
+    execve(true_argv[0], true_argv, g_envp);
+    _exit(127);
+  }
+  waitpid(pid, NULL, 0);
+}
+
+static void
+run_pipeline_argv(void *p)
+{
+  Pipeline pipe;
+
+  init_pipeline(&pipe, devnull);
+  pipe.argv = p;
+  pipe.argc = 1;
+  bench_keep(run_pipeline(&pipe, 1));
+}
+
+int
+main(int argc, char *argv[], char *envp[])
+{
+  static const size_t mb[] = { 0, 64, 256, 1024 };
+  struct bench_stats st;
+  char name[3][32];
+  struct bench_case cases[3] = {
+    { name[0], NULL, run_fork,          NULL,         0, 0 },
+    { name[1], NULL, run_pipeline_argv, true_argv,    0, 0 },
+    { name[2], NULL, run_pipeline_argv, builtin_argv, 0, 0 },
+  };
+  size_t have = 0;
+  char *mem;
+
+  g_envp = envp;
+  devnull = myopen("/dev/null", O_WRONLY | O_CLOEXEC, 0);
+
+  fprintf(stderr, "%-22s %10s %10s %10s %10s   (us)\n", "case", "min", "p50", "p90", "p99");
+  for (size_t i = 0; i < sizeof mb / sizeof mb[0]; i++) {
+    /* grow to the next size and fault every page in */
+    if (mb[i] > have) {
+      mem = mmap(NULL, (mb[i] - have) << 20, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (mem == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+      }
+      memset(mem, 1, (mb[i] - have) << 20);
+      have = mb[i];
+    }
+    snprintf(name[0], sizeof name[0], "fork+execve/%zuM", mb[i]);
+    snprintf(name[1], sizeof name[1], "posix_spawn/%zuM", mb[i]);
+    snprintf(name[2], sizeof name[2], "builtin/%zuM", mb[i]);
+    for (int c = 0; c < 3; c++) {
+      bench_measure(&cases[c], &st);
+      fprintf(stderr, "%-22s %10.1f %10.1f %10.1f %10.1f\n", cases[c].name,
+              st.min / 1e3, st.p50 / 1e3, st.p90 / 1e3, st.p99 / 1e3);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,185 @@
+/**
+ * @file idle_sessions.c
+ * @brief Idle Session Memory Measurement
+ *
+ * Opens a number of logged in sessions against a running server, runs one
+ * command on each so every session has been through a full read and reply,
+ * then leaves them idle and adds up the memory of the server's session
+ * processes from /proc/PID/smaps_rollup.
+ *
+ *   SHELLSERVE_USER=u SHELLSERVE_PASS=p idle_sessions SERVERPID [N [ip [port]]]
+ *
+ * Private_Dirty is what each session costs on its own; Rss also counts the
+ * pages still shared with the listening server after fork().
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "../client_core.h"
+#include "../syscalls.h"
+
+#define DEFAULT_SESSIONS 100
+#define PROBE_COMMAND "pwd\n"
+
+struct memsum {
+  long rss, pss, dirty; /* kB */
+  int nproc;
+};
+
+static pid_t
+parent_of(const char *pid)
+{
+  char path[64], stat[512], *p;
+  FILE *f;
+  pid_t ppid = -1;
+
+  snprintf(path, sizeof path, "/proc/%s/stat", pid);
+  if ((f = fopen(path, "r")) == NULL) {
+    return -1;
+  }
+  /* the command name may hold spaces, the fields after it do not */
+  if (fgets(stat, sizeof stat, f) && (p = strrchr(stat, ')')) != NULL) {
+    sscanf(p + 2, "%*c %d", &ppid);
+  }
+  fclose(f);
+
+  return ppid;
+}
+
+static void
+add_rollup(const char *pid, struct memsum *sum)
+{
+  char path[64], line[256];
+  long kb;
+  FILE *f;
+
+  snprintf(path, sizeof path, "/proc/%s/smaps_rollup", pid);
+  if ((f = fopen(path, "r")) == NULL) {
+    return;
+  }
+  while (fgets(line, sizeof line, f)) {
+    if (sscanf(line, "Rss: %ld", &kb) == 1) {
+      sum->rss += kb;
+    } else if (sscanf(line, "Pss: %ld", &kb) == 1) {
+      sum->pss += kb;
+    } else if (sscanf(line, "Private_Dirty: %ld", &kb) == 1) {
+      sum->dirty += kb;
+    }
+  }
+  fclose(f);
+  sum->nproc++;
+}
+
+static void
+measure_children(pid_t server, struct memsum *sum)
+{
+  struct dirent *d;
+  DIR *proc = opendir("/proc");
+
+  memset(sum, 0, sizeof *sum);
+  while ((d = readdir(proc)) != NULL) {
+    if (d->d_name[0] >= '0' && d->d_name[0] <= '9' && parent_of(d->d_name) == server) {
+      add_rollup(d->d_name, sum);
+    }
+  }
+  closedir(proc);
+}
+
+static int
+open_session(const char *ip, const char *port, const char *login, size_t loginlen)
+{
+  static const char * const prompts[] = { SERVER_PROMPT, NULL };
+  int fd = do_connect_server_login(ip, port, login, loginlen);
+
+  if (relay_until_prompt(fd, -1, prompts, 0) == -1) {
+    return -1;
+  }
+  mysckwrite(fd, PROBE_COMMAND, sizeof PROBE_COMMAND - 1);
+  if (relay_until_prompt(fd, -1, prompts, 0) == -1) {
+    return -1;
+  }
+
+  return fd;
+}
+
+int
+main(int argc, char *argv[])
+{
+  char login[2 * MAX_USER_NAME + 3];
+  size_t loginlen = build_login_preamble(login, sizeof login);
+  int n = argc > 2 ? atoi(argv[2]) : DEFAULT_SESSIONS, quiet, *fds;
+  const char *ip = argc > 3 ? argv[3] : DEFAULT_IP;
+  const char *port = argc > 4 ? argv[4] : DEFAULT_PORT;
+  struct rlimit rl;
+  struct memsum before, after;
+  pid_t server;
+
+  if (argc < 2 || loginlen == 0 || n <= 0) {
+    fprintf(stderr, "usage: %s=user %s=pass %s SERVERPID [N [ip [port]]]\n",
+            USER_ENV, PASS_ENV, argv[0]);
+    return 1;
+  }
+  server = atoi(argv[1]);
+
+  getrlimit(RLIMIT_NOFILE, &rl);
+  rl.rlim_cur = rl.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &rl);
+
+  measure_children(server, &before);
+
+  /* do_connect_server() reports every connect on stderr */
+  quiet = open("/dev/null", O_WRONLY);
+  dup2(quiet, sys_stderr);
+
+  fds = calloc(n, sizeof *fds);
+  for (int i = 0; i < n; i++) {
+    if ((fds[i] = open_session(ip, port, login, loginlen)) == -1) {
+      printf("session %d was refused, check the credentials\n", i);
+      return 1;
+    }
+  }
+  sleep(1); /* let the sessions settle back into their idle wait */
+
+  measure_children(server, &after);
+  after.rss -= before.rss;
+  after.pss -= before.pss;
+  after.dirty -= before.dirty;
+  after.nproc -= before.nproc;
+
+  printf("%d idle sessions, %d session processes\n", n, after.nproc);
+  printf("%-14s %12s %12s\n", "", "total kB", "B/session");
+  printf("%-14s %12ld %12ld\n", "Rss", after.rss, after.rss * 1024 / n);
+  printf("%-14s %12ld %12ld\n", "Pss", after.pss, after.pss * 1024 / n);
+  printf("%-14s %12ld %12ld\n", "Private_Dirty", after.dirty, after.dirty * 1024 / n);
+
+  for (int i = 0; i < n; i++) {
+    close(fds[i]);
+  }
+  free(fds);
+
+  return 0;
+}
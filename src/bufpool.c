@@ -0,0 +1,78 @@
+/**
+ * @file bufpool.c
+ * @brief Per-Process Page Buffer Pool
+ *
+ * A fixed arena of page sized buffers tracked with a free bitmap.
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h> /* _exit */
+
+#include "bufpool.h"
+#include "mystring.h"
+#include "syscalls.h"
+
+static char *__pool;
+static uint32_t __poolfree = ~(uint32_t)0; /* bit set = buffer is free */
+
+_Static_assert(BUFPOOL_NBUF <= 32, "pool bitmap is a single uint32_t");
+
+void *
+bufpool_get(void)
+{
+  int i;
+
+  if (__pool == NULL) {
+    /* anonymous pages are not resident until they are touched */
+    __pool = mymalloc((size_t)BUFPOOL_NBUF * BUFPOOL_BUFSIZE);
+  }
+  if (__poolfree == 0) {
+    printerr_exit("bufpool_get() error: pool exhausted\n");
+  }
+
+  i = __builtin_ctz(__poolfree);
+  __poolfree &= ~((uint32_t)1 << i);
+
+  return __pool + (size_t)i * BUFPOOL_BUFSIZE;
+}
+
+void
+bufpool_put(void *buf)
+{
+  size_t i;
+
+  if (buf == NULL) {
+    return;
+  }
+
+  i = ((char *)buf - __pool) / BUFPOOL_BUFSIZE;
+  if (madvise(buf, BUFPOOL_BUFSIZE, MADV_DONTNEED) == -1) {
+    printerr_exit("madvise() error\n");
+  }
+  __poolfree |= (uint32_t)1 << i;
+}
+
+int
+bufpool_inuse(void)
+{
+  return BUFPOOL_NBUF - __builtin_popcount(__poolfree);
+}
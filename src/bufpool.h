@@ -0,0 +1,64 @@
+/**
+ * @file bufpool.h
+ * @brief Per-Process Page Buffer Pool
+ *
+ * Sessions spend nearly all their time blocked waiting for the next line.
+ * Rather than keeping buffers of their own, they borrow a page from this
+ * pool while a read or write is in progress and hand it back afterwards.
+ * Returned pages are given back to the kernel, so an idle session keeps no
+ * buffer memory resident. The pool is not shared: each process has its
+ * own, mapped on first use.
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef __BUFPOOL_H
+#define __BUFPOOL_H
+
+#include "globals.h"
+
+#define BUFPOOL_BUFSIZE MAX_DATA_SIZE
+#define BUFPOOL_NBUF 32
+
+/**
+ * bufpool_get() - Borrow a zeroed BUFPOOL_BUFSIZE buffer.
+ *
+ * The pool is mapped on first use. Exits the process if every buffer is
+ * already lent out, which means a caller forgot to return one.
+ *
+ * Return: page aligned buffer of BUFPOOL_BUFSIZE bytes.
+ */
+void *bufpool_get(void)
+  __attribute__((__returns_nonnull__));
+
+/**
+ * bufpool_put() - Return a buffer borrowed with bufpool_get().
+ * @buf: the buffer, NULL is ignored
+ *
+ * The page is released with MADV_DONTNEED and reads back as zeroes the
+ * next time it is lent out.
+ */
+void bufpool_put(void *buf);
+
+/**
+ * bufpool_inuse() - Number of buffers currently lent out.
+ */
+int bufpool_inuse(void);
+
+#endif /* __BUFPOOL_H */
@@ -0,0 +1,1392 @@
+/**
+ * @file builtins.c
+ * @brief In-Process Builtin Commands
+ *
+ * Each builtin writes through a pool buffer that is flushed to the output
+ * with one write, or as one frame in a framed session, and to the transcript
+ * when the session keeps one. The
+ * output matches the GNU programs for the options accepted here, in the C
+ * locale apart from ls, which sorts with the server's collation like ls.
+ * jobs, wait and kill work on the session's background jobs, see jobs.h,
+ * usage prints the counters of the session's cgroup, see cgroup.h,
+ * stats the server's command timing histograms, see cmdstats.h, and
+ * parallel runs commands side by side, see start_pipeline().
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <locale.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <signal.h>
+#include <stdlib.h> /* qsort */
+#include <string.h> /* strerror, strcoll, memmove */
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "builtins.h"
+#include "bufpool.h"
+#include "cgroup.h"
+#include "cmdparse.h"
+#include "cmdstats.h"
+#include "frames.h"
+#include "jobs.h"
+#include "memscan.h"
+#include "mystring.h"
+#include "pathcache.h"
+#include "pipeline.h"
+#include "syscalls.h"
+#include "transcript.h"
+#include "resultcache.h"
+
+struct bout {
+  int fd;
+  int err;
+  int flags;                                   /* BUILTIN_TEE, BUILTIN_FRAMED */
+  size_t len;
+  char *buf;                                   /* BUFPOOL_BUFSIZE */
+};
+
+/*
+ * stderr of the stages before the builtin and the socket it is relayed to,
+ * set by builtin_run(). A stage blocked on a full stderr pipe would never
+ * get to write the input the builtin waits for.
+ */
+static int __errin = -1, __errsock = -1;
+
+struct builtin {
+  const char *name;
+  const char *spec;                            /* option letters, ':' after one taking a count */
+  int (*parse)(const char *spec, int argc, char **argv, struct builtin_args *a);
+  int (*run)(int argc, char **argv, const struct builtin_args *a, int in, struct bout *o);
+  int session;                                 /* no program can stand in for it */
+};
+
+static void
+__send(struct bout *o, const void *p, size_t n)
+{
+  if (o->flags & BUILTIN_TEE) {
+    transcript_write(p, n);
+    resultcache_capture(p, n);
+  }
+  if (o->flags & BUILTIN_FRAMED) {
+    frame_send(o->fd, FRAME_STDOUT, 0, p, n);
+  } else {
+    mysckwrite(o->fd, p, n);
+  }
+}
+
+static void
+__flush(struct bout *o)
+{
+  if (o->len) {
+    __send(o, o->buf, o->len);
+    o->len = 0;
+  }
+}
+
+static void
+__write(struct bout *o, const void *p, size_t n)
+{
+  if (o->len + n > BUFPOOL_BUFSIZE) {
+    __flush(o);
+    if (n >= BUFPOOL_BUFSIZE) {
+      __send(o, p, n);
+      return;
+    }
+  }
+  mymemcpy(o->buf + o->len, p, n);
+  o->len += n;
+}
+
+static void
+__puts(struct bout *o, const char *s)
+{
+  __write(o, s, mystrlen(s));
+}
+
+/* a diagnostic, in GNU wording */
+static void
+__error(struct bout *o, const char *fmt, ...)
+{
+  char msg[PATH_MAX + 128];
+  va_list ap;
+  size_t n;
+
+  va_start(ap, fmt);
+  n = myvsnprintf(msg, sizeof msg, fmt, ap);
+  va_end(ap);
+  frame_send(o->err, FRAME_STDERR, 0, msg, n < sizeof msg ? n : sizeof msg - 1);
+}
+
+/* pass on what the stages before us wrote to stderr; at EOF stop watching */
+static void
+__relay_stderr(void)
+{
+  char buf[FRAME_MAXLEN];
+  ssize_t n;
+
+  while ((n = read(__errin, buf, sizeof buf)) == -1 && errno == EINTR) {
+    ;
+  }
+  if (n <= 0) {
+    __errin = -1; /* relay_output() still reads the EOF and closes it */
+    return;
+  }
+  frame_send(__errsock, FRAME_STDERR, 0, buf, n);
+}
+
+static ssize_t
+__read(int fd, void *buf, size_t n)
+{
+  struct pollfd fds[2];
+  ssize_t r;
+
+  if (fd == -1) { /* no stdin */
+    return 0;
+  }
+  while (__errin != -1) {
+    fds[0] = (struct pollfd){ fd, POLLIN, 0 };
+    fds[1] = (struct pollfd){ __errin, POLLIN, 0 };
+    if (poll(fds, 2, -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    if (fds[1].revents) {
+      __relay_stderr();
+    }
+    if (fds[0].revents) {
+      break;
+    }
+  }
+  while ((r = read(fd, buf, n)) == -1 && errno == EINTR) {
+    ;
+  }
+  return r;
+}
+
+static int
+__is_stdin(const char *name)
+{
+  return name[0] == '-' && name[1] == '\0';
+}
+
+/* the operand's fd, in itself for "-"; -1 with errno set on failure */
+static int
+__open(const char *name, int in)
+{
+  return __is_stdin(name) ? in : open(name, O_RDONLY | O_CLOEXEC);
+}
+
+static void
+__close(int fd, int in)
+{
+  if (fd != in && fd != -1) {
+    close(fd);
+  }
+}
+
+/* a non-negative decimal count */
+static int
+__count(const char *s, long *n)
+{
+  long v = 0;
+
+  if (*s == '\0') {
+    return -1;
+  }
+  for (; *s; s++) {
+    if (*s < '0' || *s > '9' || v > 100000000000000L) {
+      return -1;
+    }
+    v = v * 10 + (*s - '0');
+  }
+  *n = v;
+  return 0;
+}
+
+/* getopt style single letter options, -1 for one the builtin does not have */
+static int
+__parse_opts(const char *spec, int argc, char **argv, struct builtin_args *a)
+{
+  const char *p, *s, *v;
+  int i;
+
+  a->flags = 0;
+  a->n = 10;
+  for (i = 1; i < argc; i++) {
+    p = argv[i];
+    if (p[0] != '-' || p[1] == '\0') {
+      break;
+    }
+    if (p[1] == '-' && p[2] == '\0') {
+      i++;
+      break;
+    }
+    for (p++; *p; p++) {
+      if (*p >= '0' && *p <= '9' && p == argv[i] + 1 && mystrchr(spec, 'n')) { /* head -5 */
+        if (__count(p, &a->n) == -1) {
+          return -1;
+        }
+        break;
+      }
+      if (*p == ':' || (s = mystrchr(spec, *p)) == NULL) {
+        return -1;
+      }
+      if (s[1] == ':') {
+        v = p[1] ? p + 1 : argv[++i];
+        if (v == NULL || __count(v, &a->n) == -1) {
+          return -1;
+        }
+        break;
+      }
+      a->flags |= BUILTIN_OPT(*p);
+    }
+  }
+  a->first = i;
+  return 0;
+}
+
+/* echo takes -n, prints other arguments as they are, and has no -- */
+static int
+__parse_echo(const char *spec, int argc, char **argv, struct builtin_args *a)
+{
+  const char *p;
+  int i;
+
+  a->flags = 0;
+  for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+    for (p = argv[i] + 1; *p == 'n'; p++) {
+      ;
+    }
+    if (*p == 'e' || *p == 'E') {
+      return -1; /* escapes are the program's business */
+    }
+    if (*p) {
+      break;
+    }
+    a->flags |= BUILTIN_OPT('n');
+  }
+  a->first = i;
+  return 0;
+}
+
+static const struct {
+  const char *name;
+  int sig;
+} __signals[] = {
+  { "HUP", SIGHUP }, { "INT", SIGINT }, { "QUIT", SIGQUIT }, { "KILL", SIGKILL },
+  { "USR1", SIGUSR1 }, { "USR2", SIGUSR2 }, { "ALRM", SIGALRM }, { "TERM", SIGTERM },
+  { "CONT", SIGCONT }, { "STOP", SIGSTOP }, { "TSTP", SIGTSTP },
+};
+
+/* a signal number, or a name with or without SIG; -1 if kill does not know it */
+static long
+__signum(const char *s)
+{
+  long n;
+
+  if (__count(s, &n) == 0) {
+    return n <= SIGRTMAX ? n : -1;
+  }
+  if (s[0] == 'S' && s[1] == 'I' && s[2] == 'G') {
+    s += 3;
+  }
+  for (size_t i = 0; i < sizeof __signals / sizeof __signals[0]; i++) {
+    if (mystrcmp(__signals[i].name, s) == 0) {
+      return __signals[i].sig;
+    }
+  }
+  return -1;
+}
+
+/* kill [-s SIG | -SIG] target..., with the signal in n; listing signals is the program's */
+static int
+__parse_kill(const char *spec, int argc, char **argv, struct builtin_args *a)
+{
+  int i = 1;
+
+  a->flags = 0;
+  a->n = SIGTERM;
+  if (i < argc && mystrcmp(argv[i], "-s") == 0) {
+    if (i + 1 == argc || (a->n = __signum(argv[i+1])) == -1) {
+      return -1;
+    }
+    i += 2;
+  } else if (i < argc && argv[i][0] == '-' && argv[i][1] && mystrcmp(argv[i], "--") != 0) {
+    if ((a->n = __signum(argv[i] + 1)) == -1) {
+      return -1;
+    }
+    i++;
+  }
+  if (i < argc && mystrcmp(argv[i], "--") == 0) {
+    i++;
+  }
+  a->first = i;
+  return i < argc ? 0 : -1;
+}
+
+/* parallel [-k] [-j N] [--], with N in n and -1 when not given */
+static int
+__parse_parallel(const char *spec, int argc, char **argv, struct builtin_args *a)
+{
+  const char *v;
+  int i;
+
+  a->flags = 0;
+  a->n = -1;
+  for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+    if (mystrcmp(argv[i], "--") == 0) {
+      i++;
+      break;
+    }
+    if (mystrcmp(argv[i], "-k") == 0) {
+      a->flags |= BUILTIN_OPT('k');
+      continue;
+    }
+    if (argv[i][1] != 'j') {
+      return -1;
+    }
+    v = argv[i][2] ? argv[i] + 2 : argv[++i];
+    if (v == NULL || __count(v, &a->n) == -1) {
+      return -1;
+    }
+  }
+  a->first = i;
+  return 0;
+}
+
+/* "==> name <==" between inputs, as head and tail print them */
+static void
+__header(struct bout *o, const char *name, int *printed)
+{
+  __puts(o, *printed ? "\n==> " : "==> ");
+  __puts(o, __is_stdin(name) ? "standard input" : name);
+  __puts(o, " <==\n");
+  *printed = 1;
+}
+
+static int
+bi_true(int argc, char **argv, const struct builtin_args *a, int in, struct bout *o)
+{
+  return 0;
+}
+
+static int
+bi_false(int argc, char **argv, const struct builtin_args *a, int in, struct bout *o)
+{
+  return 1;
+}
+
+static int
+bi_echo(int argc, char **argv, const struct builtin_args *a, int in, struct bout *o)
+{
+  for (int i = a->first; i < argc; i++) {
+    if (i != a->first) {
+      __write(o, " ", 1);
+    }
+    __puts(o, argv[i]);
+  }
+  if (!(a->flags & BUILTIN_OPT('n'))) {
+    __write(o, "\n", 1);
+  }
+  return 0;
+}
+
+static int
+bi_frames(int argc, char **argv, const struct builtin_args *a, int in, struct bout *o)
+{
+  if (a->first == argc) {
+    __puts(o, frames_enabled() ? "on\n" : "off\n");
+    return 0;
+  }
+  if (a->first + 1 == argc && mystrcmp(argv[a->first], "on") == 0) {
+    frames_enable(1); /* from the exit frame of this line on */
+    return 0;
+  }
+  if (a->first + 1 == argc && mystrcmp(argv[a->first], "off") == 0) {
+    frames_enable(0);
+    return 0;
+  }
+  __error(o, "frames: usage: frames [on|off]\n");
+  return 2;
+}
+
+static int
+bi_pwd(int argc, char **argv, const struct builtin_args *a, int in, struct bout *o)
+{
+  char cwd[PATH_MAX];
+
+  if (getcwd(cwd, sizeof cwd) == NULL) {
+    __error(o, "pwd: %s\n", strerror(errno));
+    return 1;
+  }
+  __puts(o, cwd);
+  __write(o, "\n", 1);
+  return 0;
+}
+
+static int
+bi_usage(int argc, char **argv, const struct builtin_args *a, int in, struct bout *o)
+{
+  const char *dir = cgroup_dir();
+
+  if (a->first != argc) {
+    __error(o, "usage: usage\n");
+    return 2;
+  }
+  if (dir == NULL) {
+    __error(o, "usage: session has no cgroup\n");
+    return 1;
+  }
+  o->len = cgroup_usage(dir, o->buf, BUFPOOL_BUFSIZE); /* the buffer is empty, flushed on return */
+  return 0;
+}
+
+static int
+bi_stats(int argc, char **argv, const struct builtin_args *a, int in, struct bout *o)
+{
+  if (a->first != argc) {
+    __error(o, "stats: usage: stats\n");
+    return 2;
+  }
+  if ((o->len = cmdstats_histograms(o->buf, BUFPOOL_BUFSIZE)) == 0) {
+    __error(o, "stats: server keeps no statistics\n");
+    return 1;
+  }
+  return 0;
+}
+
+static int
+bi_hash(int argc, char **argv, const struct builtin_args *a, int in, struct bout *o)
+{
+  char path[PATH_MAX];
+  int status = 0;
+
+  if (a->flags & BUILTIN_OPT('r')) {
+    pathcache_invalidate();
+  }
+  for (int i = a->first; i < argc; i++) {
+    if (pathcache_resolve(argv[i], path, sizeof path) == -1) {
+      __error(o, "hash: %s: not found\n", argv[i]);
+      status = 1;
+    }
+  }
+  return status;
+}
+
+/* one line of jobs, -p for the pid alone, -l with it */
+static void
+__job_line(struct bout *o, const struct job *j, const struct builtin_args *a)
+{
+  char line[JOBS_CMDLEN + 64], state[32];
+  pid_t pid = j->pids[0] != -1 ? j->pids[0] : j->pids[j->npids-1];
+
+  if (a->flags & BUILTIN_OPT('p')) {
+    mysnprintf(line, sizeof line, "%d\n", (int)pid);
+  } else if (a->flags & BUILTIN_OPT('l')) {
+    mysnprintf(line, sizeof line, "[%d]%c %d %-24s%s%s\n", j->id, jobs_mark(j), (int)pid,
+               jobs_state(j, state, sizeof state), j->cmd, j->nlive ? " &" : "");
+  } else {
+    mysnprintf(line, sizeof line, "[%d]%c  %-24s%s%s\n", j->id, jobs_mark(j),
+               jobs_state(j, state, sizeof state), j->cmd, j->nlive ? " &" : "");
+  }
+  __puts(o, line);
+}
+
+static int
+bi_jobs(int argc, char **argv, const struct builtin_args *a, int in, struct bout *o)
+{
+  struct job *j, *next;
+  int status = 0;
+
+  jobs_reap();
+  if (a->first == argc) {
+    for (j = jobs_next(NULL); j; j = jobs_next(j)) {
+      __job_line(o, j, a);
+    }
+  }
+  for (int i = a->first; i < argc; i++) {
+    if ((j = jobs_find(argv[i])) == NULL) {
+      __error(o, "jobs: %s: no such job\n", argv[i]);
+      status = 1;
+      continue;
+    }
+    __job_line(o, j, a);
+  }
+  /* finished jobs are reported once */
+  for (j = jobs_next(NULL); j; j = next) {
+    next = jobs_next(j);
+    if (j->nlive == 0) {
+      jobs_forget(j);
+    }
+  }
+  return status;
+}
+
+static int
+bi_wait(int argc, char **argv, const struct builtin_args *a, int in, struct bout *o)
+{
+  struct job *j;
+  int status = 0;
+
+  if (a->first == argc) {
+    while ((j = jobs_next(NULL)) != NULL) {
+      jobs_wait(j);
+    }
+    return 0;
+  }
+  for (int i = a->first; i < argc; i++) {
+    if ((j = jobs_find(argv[i])) != NULL) {
+      status = jobs_wait(j);
+    } else if (argv[i][0] == '%') {
+      __error(o, "wait: %s: no such job\n", argv[i]);
+      status = 127;
+    } else {
+      __error(o, "wait: pid %s is not a child of this shell\n", argv[i]);
+      status = 127;
+    }
+  }
+  return status;
+}
+
+static int
+bi_kill(int argc, char **argv, const struct builtin_args *a, int in, struct bout *o)
+{
+  const char *p;
+  struct job *j;
+  long pid;
+  int status = 0;
+
+  for (int i = a->first; i < argc; i++) {
+    p = argv[i];
+    if (p[0] == '%') {
+      if ((j = jobs_find(p)) == NULL) {
+        __error(o, "kill: %s: no such job\n", p);
+        status = 1;
+      } else if (jobs_signal(j, a->n) == -1) {
+        __error(o, "kill: %s: %s\n", p, strerror(errno));
+        status = 1;
+      }
+      continue;
+    }
+    if (__count(p + (p[0] == '-'), &pid) == -1) { /* -pid is a process group */
+      __error(o, "kill: %s: arguments must be process or job IDs\n", p);
+      status = 1;
+    } else if (kill(p[0] == '-' ? -pid : pid, a->n) == -1) {
+      __error(o, "kill: (%s) - %s\n", p, strerror(errno));
+      status = 1;
+    }
+  }
+  return status;
+}
+
+enum {
+  PJOB_RUNNING = 1,
+  PJOB_DONE,
+  PJOB_EMITTED,
+};
+
+/* one command of parallel and what it printed, kept until its turn */
+struct pjob {
+  Pipeline *pipe;                              /* in mem */
+  int npipes;
+  char *mem;                                   /* BUFPOOL_BUFSIZE, while it runs */
+  int fd[2];                                   /* read ends of its stdout and stderr, -1 once at EOF */
+  char *buf[2];
+  size_t len[2], cap[2];
+  int state;
+  int status;
+};
+
+static void
+__pjob_append(struct pjob *p, int k, const void *s, size_t n)
+{
+  char *bigger;
+
+  while (p->len[k] + n > p->cap[k]) {
+    bigger = mymalloc(p->cap[k] ? p->cap[k] * 2 : BUFPOOL_BUFSIZE);
+    if (p->cap[k]) {
+      mymemcpy(bigger, p->buf[k], p->len[k]);
+      myfree(p->buf[k], p->cap[k]);
+    }
+    p->buf[k] = bigger;
+    p->cap[k] = p->cap[k] ? p->cap[k] * 2 : BUFPOOL_BUFSIZE;
+  }
+  mymemcpy(p->buf[k] + p->len[k], s, n);
+  p->len[k] += n;
+}
+
+/* a pipe whose ends other commands started meanwhile do not inherit */
+static void
+__pjob_pipe(int fd[2])
+{
+  mypipe(fd);
+  fcntl(fd[0], F_SETFD, FD_CLOEXEC);
+  fcntl(fd[1], F_SETFD, FD_CLOEXEC);
+}
+
+/*
+ * The template with {} replaced by the operand, or the operand appended,
+ * as one stage; without a template the operand is a pipeline of its own.
+ */
+static void
+__pjob_start(struct pjob *p, char *operand, int ntmpl, char **tmpl)
+{
+  struct arena arena;
+  struct cmd_pipeline *list = NULL;
+  const char *err = "parallel: not one pipeline";
+  int out[2], errp[2], n = 0, placed = 0;
+  char **v;
+
+  p->mem = mymalloc(BUFPOOL_BUFSIZE);
+  arena_init(&arena, p->mem, BUFPOOL_BUFSIZE);
+  if (ntmpl) {
+    if ((v = arena_alloc(&arena, (ntmpl + 2) * sizeof *v)) == NULL
+        || (p->pipe = arena_alloc(&arena, sizeof *p->pipe)) == NULL) {
+      goto fail;
+    }
+    for (int i = 0; i < ntmpl; i++) {
+      placed |= mystrcmp(tmpl[i], "{}") == 0;
+      v[n++] = mystrcmp(tmpl[i], "{}") == 0 ? operand : tmpl[i];
+    }
+    if (!placed) {
+      v[n++] = operand;
+    }
+    v[n] = NULL;
+    init_pipeline(p->pipe, -1);
+    p->pipe->argv = v;
+    p->pipe->argc = n;
+    p->npipes = 1;
+  } else {
+    if (cmd_parse(operand, &arena, &list, &err) == -1 || list == NULL || list->next || list->background
+        || (p->pipe = arena_alloc(&arena, list->nstages * sizeof *p->pipe)) == NULL) {
+      goto fail;
+    }
+    p->npipes = build_pipeline(p->pipe, list, -1);
+  }
+
+  __pjob_pipe(out);
+  __pjob_pipe(errp);
+  for (int i = 0; i < p->npipes; i++) {
+    p->pipe[i].sockfd = out[1]; /* the last stage's stdout */
+  }
+  start_pipeline(p->pipe, p->npipes, errp[1]);
+  myclose(out[1]);
+  myclose(errp[1]);
+  p->fd[0] = out[0];
+  p->fd[1] = errp[0];
+  p->state = PJOB_RUNNING;
+  return;
+
+ fail:
+  __pjob_append(p, 1, err, mystrlen(err));
+  __pjob_append(p, 1, "\n", 1);
+  myfree(p->mem, BUFPOOL_BUFSIZE);
+  p->fd[0] = p->fd[1] = -1;
+  p->status = 2;
+  p->state = PJOB_DONE;
+}
+
+static void
+__pjob_reap(struct pjob *p)
+{
+  int wstatus = 0;
+
+  for (int i = 0; i < p->npipes; i++) {
+    if (p->pipe[i].pid != -1) {
+      mywaitpid(p->pipe[i].pid, &wstatus, 0);
+    } else {
+      wstatus = p->pipe[i].nostart << 8;
+    }
+  }
+  p->status = WIFSIGNALED(wstatus) ? 128 + WTERMSIG(wstatus) : WEXITSTATUS(wstatus);
+  myfree(p->mem, BUFPOOL_BUFSIZE);
+  p->state = PJOB_DONE;
+}
+
+/* stdout as the builtin's output, stderr as a diagnostic */
+static void
+__pjob_emit(struct pjob *p, struct bout *o)
+{
+  if (p->len[0]) {
+    __write(o, p->buf[0], p->len[0]);
+    __flush(o);
+  }
+  if (p->len[1]) {
+    frame_send(o->err, FRAME_STDERR, 0, p->buf[1], p->len[1]);
+  }
+  for (int k = 0; k < 2; k++) {
+    if (p->cap[k]) {
+      myfree(p->buf[k], p->cap[k]);
+    }
+  }
+  p->state = PJOB_EMITTED;
+}
+
+/* the operands after ::: or, without them, the lines of stdin */
+static char **
+__parallel_operands(int argc, char **argv, int first, int in, char **input, size_t *cap, size_t *nops)
+{
+  size_t len = 0, n = 0;
+  char **ops, *bigger, *line, *nl;
+  int sep;
+  ssize_t r;
+
+  for (sep = first; sep < argc && mystrcmp(argv[sep], ":::") != 0; sep++) {
+    ;
+  }
+  *input = NULL;
+  *cap = 0;
+  if (sep < argc) {
+    *nops = argc - sep - 1;
+    if (*nops == 0) {
+      return NULL;
+    }
+    ops = mymalloc(*nops * sizeof *ops);
+    for (size_t i = 0; i < *nops; i++) {
+      ops[i] = argv[sep + 1 + i];
+    }
+    return ops;
+  }
+
+  *cap = BUFPOOL_BUFSIZE;
+  *input = mymalloc(*cap);
+  for (;;) {
+    if (len == *cap - 1) {
+      bigger = mymalloc(*cap * 2);
+      mymemcpy(bigger, *input, len);
+      myfree(*input, *cap);
+      *input = bigger;
+      *cap *= 2;
+    }
+    if ((r = __read(in, *input + len, *cap - 1 - len)) <= 0) {
+      break;
+    }
+    len += r;
+  }
+  (*input)[len] = '\0';
+
+  for (line = *input; *line; line = nl + (*nl != '\0')) {
+    nl = mystrchrnul(line, '\n');
+    n += nl != line;
+  }
+  if ((*nops = n) == 0) {
+    return NULL;
+  }
+  ops = mymalloc(n * sizeof *ops);
+  for (n = 0, line = *input; *line; line = nl + 1) {
+    nl = mystrchrnul(line, '\n');
+    if (nl != line) {
+      ops[n++] = line;
+    }
+    if (*nl == '\0') {
+      break;
+    }
+    *nl = '\0';
+  }
+  return ops;
+}
+
+/* as many as asked, or the CPUs, within what the session's cgroup allows */
+static size_t
+__parallelism(long want)
+{
+  long cap = cgroup_parallelism(), n;
+
+  n = want < 0 ? sysconf(_SC_NPROCESSORS_ONLN) : want == 0 ? BUILTIN_PARALLEL_MAX : want;
+  if (cap > 0 && n > cap) {
+    n = cap;
+  }
+  return n < 1 ? 1 : n > BUILTIN_PARALLEL_MAX ? BUILTIN_PARALLEL_MAX : (size_t)n;
+}
+
+/*
+ * parallel [-k] [-j N] [command [arg...]] [::: operand...]
+ * Runs the command once per operand, or each operand as a command line,
+ * with up to N at once. Each one's output is kept until it is done and then
+ * printed whole, in the order they finish, or that of the operands with -k.
+ */
+static int
+bi_parallel(int argc, char **argv, const struct builtin_args *a, int in, struct bout *o)
+{
+  struct pollfd fds[2 * BUILTIN_PARALLEL_MAX];
+  struct pjob *jobs, *owner[2 * BUILTIN_PARALLEL_MAX];
+  size_t nops, cap, bytes, jmax = __parallelism(a->n), next = 0, first = 0, nrunning = 0, nfds;
+  int ntmpl, nfailed = 0, kind[2 * BUILTIN_PARALLEL_MAX];
+  char **ops, *input, *buf = bufpool_get();
+  ssize_t n;
+
+  for (ntmpl = 0; a->first + ntmpl < argc && mystrcmp(argv[a->first + ntmpl], ":::") != 0; ntmpl++) {
+    ;
+  }
+  if ((ops = __parallel_operands(argc, argv, a->first, in, &input, &cap, &nops)) == NULL) {
+    goto out;
+  }
+  bytes = nops * sizeof *jobs;
+  jobs = mymalloc(bytes);
+  mymemset(jobs, 0, bytes);
+
+  while (first < nops) {
+    for ( ; nrunning < jmax && next < nops; next++) {
+      __pjob_start(&jobs[next], ops[next], ntmpl, argv + a->first);
+      nrunning += jobs[next].state == PJOB_RUNNING;
+    }
+
+    nfds = 0;
+    for (size_t i = first; i < next; i++) {
+      for (int k = 0; k < 2; k++) {
+        if (jobs[i].state == PJOB_RUNNING && jobs[i].fd[k] != -1) {
+          fds[nfds] = (struct pollfd){ jobs[i].fd[k], POLLIN, 0 };
+          owner[nfds] = &jobs[i];
+          kind[nfds++] = k;
+        }
+      }
+    }
+    if (nfds && poll(fds, nfds, -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      printerr_exit("poll() error\n");
+    }
+    for (size_t i = 0; i < nfds; i++) {
+      struct pjob *p = owner[i];
+
+      if (fds[i].revents == 0) {
+        continue;
+      }
+      if ((n = read(fds[i].fd, buf, BUFPOOL_BUFSIZE)) > 0) {
+        __pjob_append(p, kind[i], buf, n);
+        continue;
+      }
+      if (n == -1 && errno == EINTR) {
+        continue;
+      }
+      myclose(p->fd[kind[i]]);
+      p->fd[kind[i]] = -1;
+      if (p->fd[0] == -1 && p->fd[1] == -1) {
+        __pjob_reap(p);
+        nrunning--;
+      }
+    }
+
+    for (size_t i = first; i < next; i++) {
+      if (jobs[i].state == PJOB_DONE && (i == first || !(a->flags & BUILTIN_OPT('k')))) {
+        nfailed += jobs[i].status != 0;
+        __pjob_emit(&jobs[i], o);
+      }
+      if (i == first && jobs[i].state == PJOB_EMITTED) {
+        first++;
+      }
+    }
+  }
+  myfree(jobs, bytes);
+  myfree(ops, nops * sizeof *ops);
+
+ out:
+  if (input) {
+    myfree(input, cap);
+  }
+  bufpool_put(buf);
+  return nfailed > 101 ? 101 : nfailed; /* as GNU parallel counts failures */
+}
+
+static int
+bi_cat(int argc, char **argv, const struct builtin_args *a, int in, struct bout *o)
+{
+  char *buf = bufpool_get();
+  const char *name;
+  int fd, status = 0;
+  ssize_t n;
+
+  for (int i = a->first; i < argc || i == a->first; i++) {
+    name = i < argc ? argv[i] : "-";
+    if ((fd = __open(name, in)) == -1 && !__is_stdin(name)) {
+      __error(o, "cat: %s: %s\n", name, strerror(errno));
+      status = 1;
+      continue;
+    }
+    while ((n = __read(fd, buf, BUFPOOL_BUFSIZE)) > 0) {
+      __write(o, buf, n);
+    }
+    if (n == -1) {
+      __error(o, "cat: %s: %s\n", name, strerror(errno));
+      status = 1;
+    }
+    __close(fd, in);
+  }
+  bufpool_put(buf);
+  return status;
+}
+
+static int
+bi_head(int argc, char **argv, const struct builtin_args *a, int in, struct bout *o)
+{
+  char *buf = bufpool_get();
+  const char *name, *nl;
+  int fd, status = 0, printed = 0;
+  ssize_t n = 0;
+  long left;
+
+  for (int i = a->first; i < argc || i == a->first; i++) {
+    name = i < argc ? argv[i] : "-";
+    if ((fd = __open(name, in)) == -1 && !__is_stdin(name)) {
+      __error(o, "head: cannot open '%s' for reading: %s\n", name, strerror(errno));
+      status = 1;
+      continue;
+    }
+    if (argc - a->first > 1) {
+      __header(o, name, &printed);
+    }
+    for (left = a->n; left > 0 && (n = __read(fd, buf, BUFPOOL_BUFSIZE)) > 0; ) {
+      for (nl = buf; left > 0 && (nl = mymemchr(nl, '\n', buf + n - nl)) != NULL; nl++) {
+        left--;
+      }
+      __write(o, buf, left > 0 ? (size_t)n : (size_t)(nl - buf)); /* nl is past the last newline */
+    }
+    if (left > 0 && n == -1) {
+      __error(o, "head: error reading '%s': %s\n", name, strerror(errno));
+      status = 1;
+    }
+    __close(fd, in);
+  }
+  bufpool_put(buf);
+  return status;
+}
+
+/* offset in buf of the last n lines, an unterminated last line counts */
+static size_t
+__tail_start(const char *buf, size_t len, long n)
+{
+  size_t i = len;
+
+  if (n == 0) {
+    return len;
+  }
+  if (i && buf[i-1] == '\n') {
+    i--;
+  }
+  for (; i > 0; i--) {
+    if (buf[i-1] == '\n' && --n == 0) {
+      break;
+    }
+  }
+  return i;
+}
+
+/* a regular file is read backwards from its end */
+static int
+__tail_file(int fd, off_t size, long n, char *buf, struct bout *o)
+{
+  off_t pos = size, start = 0;
+  size_t blk, i;
+  ssize_t r;
+  int last = 1;
+
+  if (n == 0) {
+    return 0;
+  }
+  while (pos > 0 && start == 0) {
+    blk = pos < BUFPOOL_BUFSIZE ? pos : BUFPOOL_BUFSIZE;
+    pos -= blk;
+    if (pread(fd, buf, blk, pos) != (ssize_t)blk) {
+      return -1;
+    }
+    i = blk;
+    if (last && buf[i-1] == '\n') {
+      i--;
+    }
+    last = 0;
+    for (; i > 0; i--) {
+      if (buf[i-1] == '\n' && --n == 0) {
+        start = pos + i;
+        break;
+      }
+    }
+  }
+  while ((r = pread(fd, buf, BUFPOOL_BUFSIZE, start)) > 0) {
+    __write(o, buf, r);
+    start += r;
+  }
+  return r == -1 ? -1 : 0;
+}
+
+/* anything else is read to the end, keeping no more than the last n lines */
+static int
+__tail_stream(int fd, long n, struct bout *o)
+{
+  size_t cap = 0x10000, len = 0, keep;
+  char *buf = mymalloc(cap), *bigger;
+  ssize_t r;
+
+  for (;;) {
+    if (len == cap) {
+      if ((keep = __tail_start(buf, len, n)) > 0) {
+        memmove(buf, buf + keep, len - keep);
+        len -= keep;
+      } else { /* the lines fill it, grow */
+        bigger = mymalloc(cap * 2);
+        mymemcpy(bigger, buf, len);
+        myfree(buf, cap);
+        buf = bigger;
+        cap *= 2;
+      }
+    }
+    if ((r = __read(fd, buf + len, cap - len)) <= 0) {
+      break;
+    }
+    len += r;
+  }
+  keep = __tail_start(buf, len, n);
+  __write(o, buf + keep, len - keep);
+  myfree(buf, cap);
+  return r == -1 ? -1 : 0;
+}
+
+static int
+bi_tail(int argc, char **argv, const struct builtin_args *a, int in, struct bout *o)
+{
+  char *buf = bufpool_get();
+  const char *name;
+  int fd, r, status = 0, printed = 0;
+  struct stat st;
+
+  for (int i = a->first; i < argc || i == a->first; i++) {
+    name = i < argc ? argv[i] : "-";
+    if ((fd = __open(name, in)) == -1 && !__is_stdin(name)) {
+      __error(o, "tail: cannot open '%s' for reading: %s\n", name, strerror(errno));
+      status = 1;
+      continue;
+    }
+    if (argc - a->first > 1) {
+      __header(o, name, &printed);
+    }
+    if (fd != -1 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+      r = __tail_file(fd, st.st_size, a->n, buf, o);
+    } else {
+      r = __tail_stream(fd, a->n, o);
+    }
+    if (r == -1) {
+      __error(o, "tail: error reading '%s': %s\n", name, strerror(errno));
+      status = 1;
+    }
+    __close(fd, in);
+  }
+  bufpool_put(buf);
+  return status;
+}
+
+struct wcount {
+  unsigned long long lines, words, bytes;
+  int failed, regular;
+  off_t size;
+};
+
+static int
+__wc_count(int fd, struct wcount *c, char *buf)
+{
+  int inword = 0;
+  unsigned char ch;
+  ssize_t n;
+
+  while ((n = __read(fd, buf, BUFPOOL_BUFSIZE)) > 0) {
+    c->bytes += n;
+    for (ssize_t i = 0; i < n; i++) {
+      ch = buf[i];
+      if (ch == '\n') {
+        c->lines++;
+      }
+      /* space ends a word, a printable character starts one, others do neither */
+      if (ch == ' ' || (ch >= '\t' && ch <= '\r')) {
+        inword = 0;
+      } else if (ch > ' ' && ch < 0x7f && !inword) {
+        c->words++;
+        inword = 1;
+      }
+    }
+  }
+  return n == -1 ? -1 : 0;
+}
+
+static void
+__wc_line(struct bout *o, const struct builtin_args *a, const struct wcount *c, int width, const char *name)
+{
+  const unsigned long long v[3] = { c->lines, c->words, c->bytes };
+  static const char opt[3] = { 'l', 'w', 'c' };
+  char num[32];
+  int sep = 0;
+
+  for (int k = 0; k < 3; k++) {
+    if (a->flags == 0 || (a->flags & BUILTIN_OPT(opt[k]))) {
+      mysnprintf(num, sizeof num, "%s%*llu", sep ? " " : "", width, v[k]);
+      __puts(o, num);
+      sep = 1;
+    }
+  }
+  if (name) {
+    __write(o, " ", 1);
+    __puts(o, name);
+  }
+  __write(o, "\n", 1);
+}
+
+static int
+bi_wc(int argc, char **argv, const struct builtin_args *a, int in, struct bout *o)
+{
+  int nin = argc > a->first ? argc - a->first : 1, status = 0, width = 1, minwidth = 1, fd;
+  size_t size = nin * sizeof(struct wcount);
+  struct wcount *c = mymalloc(size), total = { 0 };
+  unsigned long long regular = 0;
+  char *buf = bufpool_get();
+  const char *name;
+  struct stat st;
+
+  for (int i = 0; i < nin; i++) {
+    name = argc > a->first ? argv[a->first + i] : "-";
+    c[i] = (struct wcount){ 0 };
+    if ((fd = __open(name, in)) == -1 && !__is_stdin(name)) {
+      __error(o, "wc: %s: %s\n", name, strerror(errno));
+      c[i].failed = status = 1;
+      continue;
+    }
+    c[i].regular = fd != -1 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    c[i].size = c[i].regular ? st.st_size : 0;
+    if (__wc_count(fd, &c[i], buf) == -1) {
+      __error(o, "wc: %s: %s\n", name, strerror(errno));
+      status = 1;
+    }
+    __close(fd, in);
+  }
+
+  /* the widths GNU wc picks: one column of one input is not padded, otherwise
+     wide enough for the total size of the files, 7 if any is not a file */
+  if (nin > 1 || a->flags == 0 || (a->flags & (a->flags - 1))) {
+    for (int i = 0; i < nin; i++) {
+      if (!c[i].failed) {
+        regular += c[i].size;
+        minwidth = c[i].regular ? minwidth : 7;
+      }
+    }
+    for (; regular >= 10; regular /= 10) {
+      width++;
+    }
+    width = width < minwidth ? minwidth : width;
+  }
+
+  for (int i = 0; i < nin; i++) {
+    if (!c[i].failed) {
+      __wc_line(o, a, &c[i], width, argc > a->first ? argv[a->first + i] : NULL);
+    }
+    total.lines += c[i].lines;
+    total.words += c[i].words;
+    total.bytes += c[i].bytes;
+  }
+  if (nin > 1) {
+    __wc_line(o, a, &total, width, "total");
+  }
+
+  bufpool_put(buf);
+  myfree(c, size);
+  return status;
+}
+
+static int
+__collate(const void *x, const void *y)
+{
+  return strcoll(*(char * const *)x, *(char * const *)y);
+}
+
+/* names of a directory, sorted, in one allocation of *size at *base */
+static char **
+__readdir(const char *path, uint64_t flags, size_t *count, char **base, size_t *size)
+{
+  size_t cap = 0x4000, used = 0, n = 0, len;
+  char *pool = mymalloc(cap), *bigger, **v, *s;
+  struct dirent *de;
+  DIR *dir;
+
+  if ((dir = opendir(path)) == NULL) {
+    myfree(pool, cap);
+    return NULL;
+  }
+  while ((de = readdir(dir)) != NULL) {
+    s = de->d_name;
+    if (s[0] == '.' && !(flags & BUILTIN_OPT('a'))
+        && (!(flags & BUILTIN_OPT('A')) || s[1] == '\0' || (s[1] == '.' && s[2] == '\0'))) {
+      continue;
+    }
+    len = mystrlen(s) + 1;
+    /* strings grow up from the start, room is kept for the aligned pointers */
+    while (used + len + (n + 2) * sizeof(char *) > cap) {
+      bigger = mymalloc(cap * 2);
+      mymemcpy(bigger, pool, used);
+      myfree(pool, cap);
+      pool = bigger;
+      cap *= 2;
+    }
+    mymemcpy(pool + used, s, len);
+    used += len;
+    n++;
+  }
+  closedir(dir);
+
+  v = (char **)(pool + ((used + sizeof(char *) - 1) & ~(sizeof(char *) - 1)));
+  for (size_t i = 0, off = 0; i < n; i++, off += mystrlen(pool + off) + 1) {
+    v[i] = pool + off;
+  }
+  qsort(v, n, sizeof(char *), __collate);
+  *count = n;
+  *base = pool;
+  *size = cap;
+  return v;
+}
+
+static int
+bi_ls(int argc, char **argv, const struct builtin_args *a, int in, struct bout *o)
+{
+  static int locale;
+  char *dot[] = { ".", NULL }, **ops = argv + a->first, **dirs, **names, *pool;
+  int nops = argc - a->first, nfiles = 0, ndirs = 0, status = 0, printed = 0;
+  size_t count, size, dsize;
+  struct stat st;
+
+  if (!locale) {
+    setlocale(LC_COLLATE, ""); /* sort like ls does */
+    locale = 1;
+  }
+  if (nops == 0) {
+    ops = dot;
+    nops = 1;
+  }
+
+  /* errors in command line order, files then directories each sorted */
+  dsize = nops * sizeof(char *);
+  dirs = mymalloc(dsize);
+  for (int i = 0; i < nops; i++) {
+    if (stat(ops[i], &st) == -1) {
+      __error(o, "ls: cannot access '%s': %s\n", ops[i], strerror(errno));
+      status = 2;
+    } else if (S_ISDIR(st.st_mode)) {
+      dirs[ndirs++] = ops[i];
+    } else {
+      ops[nfiles++] = ops[i];
+    }
+  }
+  qsort(ops, nfiles, sizeof(char *), __collate);
+  qsort(dirs, ndirs, sizeof(char *), __collate);
+
+  for (int i = 0; i < nfiles; i++) {
+    __puts(o, ops[i]);
+    __write(o, "\n", 1);
+    printed = 1;
+  }
+  for (int i = 0; i < ndirs; i++) {
+    if ((names = __readdir(dirs[i], a->flags, &count, &pool, &size)) == NULL) {
+      __error(o, "ls: cannot open directory '%s': %s\n", dirs[i], strerror(errno));
+      status = 2;
+      continue;
+    }
+    if (printed) {
+      __write(o, "\n", 1);
+    }
+    if (nops > 1) {
+      __puts(o, dirs[i]);
+      __write(o, ":\n", 2);
+    }
+    for (size_t j = 0; j < count; j++) {
+      __puts(o, names[j]);
+      __write(o, "\n", 1);
+    }
+    printed = 1;
+    myfree(pool, size);
+  }
+  myfree(dirs, dsize);
+  return status;
+}
+
+/* sorted by name */
+static const struct builtin __builtins[] = {
+  { "cat",    "",    __parse_opts, bi_cat, 0 },
+  { "echo",   NULL,  __parse_echo, bi_echo, 0 },
+  { "false",  "",    __parse_opts, bi_false, 0 },
+  { "frames", "",    __parse_opts, bi_frames, 1 },
+  { "hash",   "r",   __parse_opts, bi_hash, 1 },
+  { "head",   "n:",  __parse_opts, bi_head, 0 },
+  { "jobs",   "lp",  __parse_opts, bi_jobs, 1 },
+  { "kill",   NULL,  __parse_kill, bi_kill, 0 },
+  { "ls",     "aA1", __parse_opts, bi_ls, 0 },
+  { "parallel", NULL, __parse_parallel, bi_parallel, 1 },
+  { "pwd",    "",    __parse_opts, bi_pwd, 0 },
+  { "stats",  "",    __parse_opts, bi_stats, 1 },
+  { "tail",   "n:",  __parse_opts, bi_tail, 0 },
+  { "true",   "",    __parse_opts, bi_true, 0 },
+  { "usage",  "",    __parse_opts, bi_usage, 1 },
+  { "wait",   "",    __parse_opts, bi_wait, 1 },
+  { "wc",     "lwc", __parse_opts, bi_wc, 0 },
+};
+
+const struct builtin *
+builtin_find(int argc, char **argv, struct builtin_args *args)
+{
+  const struct builtin *b;
+
+  for (size_t i = 0; i < sizeof __builtins / sizeof __builtins[0]; i++) {
+    b = &__builtins[i];
+    if (mystrcmp(b->name, argv[0]) == 0) {
+      return b->parse(b->spec, argc, argv, args) == 0 ? b : NULL;
+    }
+  }
+  return NULL;
+}
+
+int
+builtin_session(const char *name)
+{
+  for (size_t i = 0; i < sizeof __builtins / sizeof __builtins[0]; i++) {
+    if (mystrcmp(__builtins[i].name, name) == 0) {
+      return __builtins[i].session;
+    }
+  }
+  return 0;
+}
+
+int
+builtin_run(const struct builtin *b, int argc, char **argv, const struct builtin_args *args,
+            int in, int out, int err, int errin, int flags)
+{
+  struct bout o = { .fd = out, .err = err, .flags = flags, .len = 0, .buf = bufpool_get() };
+  int status;
+
+  __errin = errin;
+  __errsock = err;
+  status = b->run(argc, argv, args, in, &o);
+  __errin = __errsock = -1;
+  __flush(&o);
+  bufpool_put(o.buf);
+  return status;
+}
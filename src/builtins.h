@@ -0,0 +1,105 @@
+/**
+ * @file builtins.h
+ * @brief In-Process Builtin Commands
+ *
+ * The everyday read-only utilities, cat, echo, head, ls, pwd, tail and wc,
+ * plus true, false and hash, run inside the session instead of through a
+ * spawn, exec and wait. run_pipeline() uses a builtin for the last stage of
+ * a pipeline when builtin_find() accepts its arguments; anything it does not
+ * accept, such as an unsupported option, runs the real program, unless
+ * builtin_session() says there is none to run.
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef __BUILTINS_H
+#define __BUILTINS_H
+
+#include <stdint.h>
+
+/**
+ * struct builtin_args - Options of a builtin, parsed by builtin_find()
+ * @flags: BUILTIN_OPT() of each single letter option given
+ * @n: value of -n N, or of -N, where the builtin takes a count
+ * @first: index in argv of the first operand
+ */
+struct builtin_args {
+  uint64_t flags;
+  long n;
+  int first;
+};
+
+#define BUILTIN_OPT(c) (1ull << ((c) & 63))
+
+#define BUILTIN_TEE    0x1 /* also copy the output to the transcript and result cache */
+#define BUILTIN_FRAMED 0x2 /* out is the client socket of a framed session */
+
+#define BUILTIN_PARALLEL_MAX 32 /* commands parallel runs at once, at most */
+
+struct builtin;
+
+/**
+ * builtin_find() - Look up argv[0] among the builtins.
+ *
+ * @argc: number of arguments
+ * @argv: NULL terminated arguments
+ * @args: receives the parsed options
+ *
+ * Return: the builtin, or NULL if there is none or it does not support the
+ *         options, in which case the command is run as a program.
+ */
+const struct builtin *builtin_find(int argc, char **argv, struct builtin_args *args)
+  __attribute__((__nonnull__(2, 3)));
+
+/**
+ * builtin_session() - Whether a builtin works on the session itself.
+ *
+ * @name: argv[0]
+ *
+ * frames, hash, jobs, parallel, stats, usage and wait have no program that
+ * could run in their place, or one that does something else. They only run
+ * as the last stage of a foreground pipeline, with options they support.
+ *
+ * Return: 1 if @name is such a builtin, 0 if not
+ */
+int builtin_session(const char *name)
+  __attribute__((__nonnull__(1)));
+
+/**
+ * builtin_run() - Run a builtin found by builtin_find().
+ *
+ * @b: the builtin
+ * @argc: number of arguments
+ * @argv: NULL terminated arguments
+ * @args: options from builtin_find()
+ * @in: standard input, -1 for none
+ * @out: standard output
+ * @err: standard error, the server's like that of the programs, or the
+ *       client socket in a framed session, see frame_send()
+ * @errin: stderr of the stages before it in a framed session, relayed to
+ *         @err while the builtin waits for input; -1 for none
+ * @flags: BUILTIN_TEE and BUILTIN_FRAMED
+ *
+ * Return: exit status, as the program would have returned it
+ */
+int builtin_run(const struct builtin *b, int argc, char **argv, const struct builtin_args *args,
+                int in, int out, int err, int errin, int flags)
+  __attribute__((__nonnull__(1, 3, 4)));
+
+#endif /* __BUILTINS_H */
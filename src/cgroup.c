@@ -0,0 +1,314 @@
+/**
+ * @file cgroup.c
+ * @brief Per-Session cgroup v2 Placement
+ *
+ * The delegated directory holds the server's cgroup and one cgroup per
+ * session, as siblings: cgroup v2 lets only leaves hold processes once
+ * controllers are enabled for the children. The server never writes to a
+ * session's cgroup except to remove it.
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/magic.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cgroup.h"
+#include "globals.h"
+#include "mystring.h"
+#include "syscalls.h"
+#include "debug.h"
+
+#define CGROUP_FILEMAX 4096                    /* io.stat of a few devices */
+
+static char __root[MAX_PATH_SIZE];             /* "" when disabled */
+static char __dir[MAX_PATH_SIZE];              /* this session's, "" if none */
+
+static const struct {
+  const char *name;
+  const char *file;
+  const char *key;                             /* NULL when the file is one number */
+} __counters[] = {
+  { "cpu.usage_usec",  "cpu.stat",       "usage_usec " },
+  { "cpu.user_usec",   "cpu.stat",       "user_usec " },
+  { "cpu.system_usec", "cpu.stat",       "system_usec " },
+  { "memory.current",  "memory.current", NULL },
+  { "memory.peak",     "memory.peak",    NULL },
+  { "io.rbytes",       "io.stat",        "rbytes=" },
+  { "io.wbytes",       "io.stat",        "wbytes=" },
+  { "pids.current",    "pids.current",   NULL },
+};
+
+/* dir/name = value; no stdio, this runs in a signal handler */
+static int
+__write(const char *dir, const char *name, const char *value)
+{
+  char path[MAX_PATH_SIZE];
+  size_t len = mystrlen(value);
+  int fd, ret;
+
+  mysnprintf(path, sizeof path, "%s/%s", dir, name);
+  if ((fd = open(path, O_WRONLY | O_CLOEXEC)) == -1) {
+    return -1;
+  }
+  ret = write(fd, value, len) == (ssize_t)len ? 0 : -1;
+  close(fd);
+  return ret;
+}
+
+static int
+__writepid(const char *dir, pid_t pid)
+{
+  char value[16];
+
+  mysnprintf(value, sizeof value, "%d", (int)pid);
+  return __write(dir, "cgroup.procs", value);
+}
+
+static int
+__read(const char *dir, const char *name, char *buf, size_t size)
+{
+  char path[MAX_PATH_SIZE];
+  ssize_t n;
+  int fd;
+
+  mysnprintf(path, sizeof path, "%s/%s", dir, name);
+  if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+    return -1;
+  }
+  n = read(fd, buf, size - 1);
+  close(fd);
+  if (n < 0) {
+    return -1;
+  }
+  buf[n] = '\0';
+  return 0;
+}
+
+static unsigned long long
+__number(const char *p)
+{
+  unsigned long long n = 0;
+
+  for ( ; *p >= '0' && *p <= '9'; p++) {
+    n = n * 10 + (*p - '0');
+  }
+  return n;
+}
+
+/* the numbers after key, summed over the lines of text that have it */
+static unsigned long long
+__sum(const char *text, const char *key)
+{
+  size_t klen = mystrlen(key);
+  unsigned long long total = 0;
+
+  for (const char *p = text; *p; p++) {
+    if ((p == text || p[-1] == ' ' || p[-1] == '\n') && mystrncmp(p, key, klen) == 0) {
+      total += __number(p + klen);
+    }
+  }
+  return total;
+}
+
+/* "populated 1" in cgroup.events while a process is in the cgroup or below */
+static int
+__populated(const char *dir)
+{
+  char text[128];
+
+  return __read(dir, "cgroup.events", text, sizeof text) == 0 && __sum(text, "populated ") != 0;
+}
+
+/* left over from sessions that are gone, a live one may not have entered its cgroup yet */
+static void
+__sweep(const char *root)
+{
+  char path[MAX_PATH_SIZE];
+  struct dirent *d;
+  DIR *dir;
+
+  if ((dir = opendir(root)) == NULL) {
+    return;
+  }
+  while ((d = readdir(dir)) != NULL) {
+    if (mystrncmp(d->d_name, "session-", 8) == 0
+        && (kill((pid_t)__number(d->d_name + 8), 0) == -1 && errno == ESRCH)) {
+      mysnprintf(path, sizeof path, "%s/%s", root, d->d_name);
+      rmdir(path);
+    }
+  }
+  closedir(dir);
+}
+
+int
+cgroup_init(void)
+{
+  const char *root = mygetenv(CGROUP_ENV);
+  const char *ctl[] = { "+cpu", "+memory", "+io", "+pids" };
+  char server[MAX_PATH_SIZE];
+  struct statfs sfs;
+
+  __root[0] = '\0';
+  if (root == NULL) {
+    return -1;
+  }
+  if (mystrlen(root) + sizeof "/session-2147483647" > sizeof __root
+      || statfs(root, &sfs) == -1 || sfs.f_type != CGROUP2_SUPER_MAGIC || access(root, W_OK) == -1) {
+    debugf(SYSCALLDEBUG, DBG_WARN, "cgroup: %s is not a writable cgroup2 directory, sessions are not confined\n", root);
+    return -1;
+  }
+
+  /* the root may not hold processes once its children have controllers */
+  mysnprintf(server, sizeof server, "%s/%s", root, CGROUP_SERVER);
+  if ((mkdir(server, 0755) == -1 && errno != EEXIST) || __writepid(server, getpid()) == -1) {
+    debugf(SYSCALLDEBUG, DBG_WARN, "cgroup: cannot move the server into %s, sessions are not confined\n", server);
+    return -1;
+  }
+  __write(server, "cpu.weight", CGROUP_SERVER_WEIGHT);
+
+  /* one by one, a controller the parent does not delegate fails alone */
+  for (size_t i = 0; i < sizeof ctl / sizeof ctl[0]; i++) {
+    if (__write(root, "cgroup.subtree_control", ctl[i]) == -1) {
+      debugf(SYSCALLDEBUG, DBG_WARN, "cgroup: %s controller unavailable\n", ctl[i] + 1);
+    }
+  }
+  __sweep(root);
+  mystrcpy(__root, root);
+  return 0;
+}
+
+int
+cgroup_enter(void)
+{
+  const struct { const char *env, *file; } limits[] = {
+    { CGROUP_CPU_WEIGHT_ENV, "cpu.weight" },
+    { CGROUP_MEMORY_MAX_ENV, "memory.max" },
+    { CGROUP_IO_MAX_ENV,     "io.max" },
+    { CGROUP_CPU_MAX_ENV,    "cpu.max" },
+    { CGROUP_PIDS_MAX_ENV,   "pids.max" },
+  };
+  const char *value;
+
+  __dir[0] = '\0';
+  if (__root[0] == '\0') {
+    return -1;
+  }
+
+  mysnprintf(__dir, sizeof __dir, "%s/session-%d", __root, (int)getpid());
+  if (mkdir(__dir, 0755) == -1 && errno != EEXIST) {
+    debugf(SYSCALLDEBUG, DBG_WARN, "cgroup: mkdir %s failed\n", __dir);
+    __dir[0] = '\0';
+    return -1;
+  }
+  for (size_t i = 0; i < sizeof limits / sizeof limits[0]; i++) {
+    if ((value = mygetenv(limits[i].env)) && __write(__dir, limits[i].file, value) == -1) {
+      debugf(SYSCALLDEBUG, DBG_WARN, "cgroup: %s=%s rejected\n", limits[i].file, value);
+    }
+  }
+  if (__writepid(__dir, getpid()) == -1) {
+    debugf(SYSCALLDEBUG, DBG_WARN, "cgroup: cannot move session %d into %s\n", (int)getpid(), __dir);
+    rmdir(__dir);
+    __dir[0] = '\0';
+    return -1;
+  }
+  return 0;
+}
+
+const char *
+cgroup_dir(void)
+{
+  return __dir[0] ? __dir : NULL;
+}
+
+size_t
+cgroup_usage(const char *dir, char *buf, size_t size)
+{
+  char text[CGROUP_FILEMAX];
+  size_t len = 0;
+
+  for (size_t i = 0; i < sizeof __counters / sizeof __counters[0] && len < size; i++) {
+    if (__read(dir, __counters[i].file, text, sizeof text) == -1) {
+      continue;
+    }
+    len += mysnprintf(buf + len, size - len, "%-16s %llu\n", __counters[i].name,
+                      __counters[i].key ? __sum(text, __counters[i].key) : __number(text));
+  }
+  return len < size ? len : size - 1;
+}
+
+long
+cgroup_parallelism(void)
+{
+  char text[64];
+  const char *p;
+  unsigned long long quota, period, max, current, room;
+  long n = -1;
+
+  if (__dir[0] == '\0') {
+    return -1;
+  }
+  /* "max 100000" when unlimited */
+  if (__read(__dir, "cpu.max", text, sizeof text) == 0 && text[0] >= '0' && text[0] <= '9'
+      && (p = mystrchr(text, ' ')) != NULL && (period = __number(p + 1)) != 0) {
+    quota = __number(text);
+    n = (long)((quota + period - 1) / period);
+  }
+  if (__read(__dir, "pids.max", text, sizeof text) == 0 && text[0] >= '0' && text[0] <= '9') {
+    max = __number(text);
+    current = __read(__dir, "pids.current", text, sizeof text) == 0 ? __number(text) : 0;
+    room = max > current ? max - current : 0;
+    if (n == -1 || room < (unsigned long long)n) {
+      n = (long)room;
+    }
+  }
+  return n == 0 ? 1 : n;
+}
+
+void
+cgroup_remove(pid_t pid)
+{
+  char dir[MAX_PATH_SIZE];
+
+  if (__root[0] == '\0') {
+    return;
+  }
+  mysnprintf(dir, sizeof dir, "%s/session-%d", __root, (int)pid);
+  __write(dir, "cgroup.kill", "1");
+  /* the kill is only sent, rmdir fails with EBUSY until the last process is gone */
+  for (int ms = 0; __populated(dir) && ms < CGROUP_KILL_WAIT_MS; ms++) {
+    nanosleep(&(struct timespec){ 0, 1000000 }, NULL);
+  }
+  rmdir(dir);
+}
+
+void
+cgroup_sweep(void)
+{
+  if (__root[0] != '\0') {
+    __sweep(__root);
+  }
+}
@@ -0,0 +1,116 @@
+/**
+ * @file cgroup.h
+ * @brief Per-Session cgroup v2 Placement
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef __CGROUP_H
+#define __CGROUP_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define CGROUP_ENV "SHELLSERVE_CGROUP"                       /* a cgroup2 directory delegated to us */
+#define CGROUP_CPU_WEIGHT_ENV "SHELLSERVE_CGROUP_CPU_WEIGHT" /* cpu.weight of a session, 1..10000 */
+#define CGROUP_MEMORY_MAX_ENV "SHELLSERVE_CGROUP_MEMORY_MAX" /* memory.max of a session, bytes or "max" */
+#define CGROUP_IO_MAX_ENV "SHELLSERVE_CGROUP_IO_MAX"         /* io.max of a session, "MAJ:MIN rbps=N ..." */
+#define CGROUP_CPU_MAX_ENV "SHELLSERVE_CGROUP_CPU_MAX"       /* cpu.max of a session, "QUOTA PERIOD" in us */
+#define CGROUP_PIDS_MAX_ENV "SHELLSERVE_CGROUP_PIDS_MAX"     /* pids.max of a session, processes or "max" */
+#define CGROUP_SERVER "server"                               /* the listener's cgroup, under the root */
+#define CGROUP_SERVER_WEIGHT "10000"                         /* so sessions cannot starve accept */
+#define CGROUP_KILL_WAIT_MS 100                              /* cgroup_remove() waits this long to rmdir */
+
+/**
+ * cgroup_init() - Move the server into its own cgroup, if configured.
+ *
+ * The server goes into CGROUP_SERVER under CGROUP_ENV with the highest
+ * cpu.weight, and the cpu, memory, io and pids controllers are enabled for the
+ * session cgroups next to it. Session cgroups a previous server left
+ * behind are removed. A directory that is not a writable cgroup2 mount
+ * leaves sessions unconfined, with a warning.
+ *
+ * Return: 0 if sessions will get cgroups, -1 if not.
+ */
+int cgroup_init(void);
+
+/**
+ * cgroup_enter() - Move this session into a cgroup of its own.
+ *
+ * Called by the session after login, so logins still run in the server's
+ * cgroup. The cgroup is "session-<pid>" and gets the limits from the
+ * CGROUP_*_ENV variables that are set; commands the session starts
+ * inherit it. A no-op when cgroup_init() did not succeed.
+ *
+ * Return: 0 if the session is in its cgroup, -1 if not.
+ */
+int cgroup_enter(void);
+
+/**
+ * cgroup_dir() - This session's cgroup directory, NULL if it has none.
+ */
+const char *cgroup_dir(void);
+
+/**
+ * cgroup_usage() - Format the usage counters of a cgroup.
+ *
+ * @dir: cgroup directory
+ * @buf: receives one "name value" line per counter
+ * @size: size of @buf
+ *
+ * CPU time from cpu.stat, memory.current and memory.peak, and the bytes
+ * read and written summed over the devices in io.stat. Counters whose file
+ * is missing, for a controller that is not enabled, are left out.
+ *
+ * Return: length of the text in @buf.
+ */
+size_t cgroup_usage(const char *dir, char *buf, size_t size)
+  __attribute__((__nonnull__(1, 2)));
+
+/**
+ * cgroup_parallelism() - How many commands this session's limits let it run at once.
+ *
+ * The CPUs its cpu.max quota buys, rounded up, and the processes pids.max
+ * leaves room for, whichever is fewer.
+ *
+ * Return: at least 1, or -1 if the session has no cgroup or neither is limited.
+ */
+long cgroup_parallelism(void);
+
+/**
+ * cgroup_remove() - Remove a session's cgroup once the session is gone.
+ *
+ * @pid: the session process
+ *
+ * Kills what the session left running in it first and waits up to
+ * CGROUP_KILL_WAIT_MS for it to die. Async-signal-safe, the server calls
+ * it from its SIGCHLD handler. A cgroup that is still busy after that is
+ * removed by cgroup_sweep().
+ */
+void cgroup_remove(pid_t pid);
+
+/**
+ * cgroup_sweep() - Remove the cgroups of sessions that are gone.
+ *
+ * The server calls it after each connection it accepts, for cgroups
+ * cgroup_remove() could not remove yet. Not async-signal-safe.
+ */
+void cgroup_sweep(void);
+
+#endif /* __CGROUP_H */
@@ -28,13 +28,40 @@
 #include "../client_core.h"
 #include "../syscalls.h"
 #include "../filetransfer.h"
+#include "../clientmux.h"
+#include "../mystring.h"
+#include "../debug.h"
 
+#include <unistd.h>
+
+/*
+ * client [ip [port]]       interactive session
+ * client -M [ip [port]]    log in once and serve other clients as a master
+ * client -c "command"      run one command through the running master, exit
+ *                          with its status, 255 if there is no master
+ */
 void
 apprunner(int argc, char *argv[])
 {
   struct MyIO io;
+  int master = argc > 1 && mystrcmp(argv[1], "-M") == 0, status;
+
+  if (debug_init(mygetenv(DEBUG_ENV)) == -1) {
+    printerr_exit("bad " DEBUG_ENV ", expected level[:category,...]\n");
+  }
+  if (argc > 2 && mystrcmp(argv[1], "-c") == 0) {
+    status = mux_runcommand(argv[2]);
+    _exit(status == -1 ? 255 : status);
+  }
+  if (master) {
+    argc--;
+    argv++;
+  }
 
   initclient(argc, argv, &io);
+  if (master) {
+    mux_master(&io);
+  }
   runclient(&io);
   myclose(io.sockfd);
 }
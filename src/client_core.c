@@ -25,6 +25,7 @@
  *
  */
 #include <poll.h>
+#include <errno.h>
 #include <unistd.h> /* _exit */
 
 #include "client_core.h"
@@ -33,6 +34,13 @@
 #include "syscalls.h"
 #include "networktcp.h"
 #include "filetransfer.h"
+#include "upload.h"
+#include "download.h"
+
+/* private */
+static int __awaitlogin = 0; /* set when the login went out with the connect */
+#define __PROMPT_HOLD 32 /* longer than any prompt we look for */
+/* end private */
 
 void
 do_poll(int sockfd)
@@ -44,26 +52,50 @@ do_poll(int sockfd)
   fds[0].events = POLLIN;
 
  polltag:
-  pollval = poll(fds, 1, 0);
-  if (pollval == -1) {
+  pollval = poll(fds, 1, -1); /* sleep until there is something to read */
+  if (pollval == -1 && errno == EINTR) {
+    goto polltag;
+  } else if (pollval == -1) {
     myfprintf(sys_stderr, "poll() error");
     _exit(0);
-  } else if (pollval == 0) {
-    goto polltag; /* timer ran out should not happen since we have it at 0 */
   }
 }
 
+size_t
+build_login_preamble(char *buf, size_t bufsize)
+{
+  const char *user = mygetenv(USER_ENV);
+  const char *pass = mygetenv(PASS_ENV);
+
+  if (!user || !pass || mystrlen(user) + mystrlen(pass) + 3 > bufsize) {
+    return 0;
+  }
+
+  mystrcpy(buf, user);
+  mystrcat(buf, "\n");
+  mystrcat(buf, pass);
+  mystrcat(buf, "\n");
+
+  return mystrlen(buf);
+}
+
 void
 initclient(int argc, char *argv[], struct MyIO *io)
 {
-  io->sockfd = do_connect_server (
-                                  argc == 2 ? argv[1] : DEFAULT_IP,
-                                  argc == 2 ? argv[2] : DEFAULT_PORT
-                                  );
-
-  io->bufsize = MAX_DATA_SIZE;
-  mymemset(io->buf, 0, io->bufsize);
-  initiostruct(io->sockfd, sys_stdin, sys_stdout, io); /* TODO: REMOVE but FIX */
+  char login[2 * MAX_USER_NAME + 3];
+  size_t loginlen = build_login_preamble(login, sizeof login);
+  const char *ip = argc > 1 ? argv[1] : DEFAULT_IP;
+  const char *port = argc > 2 ? argv[2] : DEFAULT_PORT;
+
+  if (loginlen) {
+    io->sockfd = do_connect_server_login(ip, port, login, loginlen);
+    __awaitlogin = 1;
+  } else {
+    io->sockfd = do_connect_server(ip, port);
+  }
+
+  initiostruct(io->sockfd, sys_stdin, sys_stdout, io);
+  io_attach(io); /* the client keeps its buffer for the whole session */
 }
 
 int
@@ -74,24 +106,106 @@ do_connect_server(const char * const ip, const char * const port)
   return sckconnect(ai);
 }
 
+int
+do_connect_server_login(const char * const ip, const char * const port,
+                        const char * const login, size_t loginlen)
+{
+  struct addrinfo *ai;
+  mygetaddrinfo(port, ip, &ai);
+  return sckconnect_fastopen(ai, login, loginlen);
+}
+
+static int
+endswith(const char *s, size_t len, const char *suffix)
+{
+  size_t suffixlen = mystrlen(suffix);
+  return len >= suffixlen && mystrncmp(s + len - suffixlen, suffix, suffixlen) == 0;
+}
+
+int
+relay_until_prompt(int sockfd, int outfd, const char * const prompts[], int echoprompt)
+{
+  char buf[__PROMPT_HOLD + NETREADMAX];
+  size_t held = 0, nread, i;
+  int p;
+
+  for (;;) {
+    do_poll(sockfd);
+    if ((nread = mysckread(sockfd, buf + held, NETREADMAX)) == 0) {
+      return -1; /* server hung up */
+    }
+    held += nread;
+
+    for (p = 0; prompts[p]; p++) {
+      if (endswith(buf, held, prompts[p])) {
+        if (outfd != -1) {
+          writechars(outfd, buf, echoprompt ? held : held - mystrlen(prompts[p]));
+        }
+        return p;
+      }
+    }
+
+    /* hold back a tail that could be the start of a prompt split across reads */
+    if (held > __PROMPT_HOLD) {
+      if (outfd != -1) {
+        writechars(outfd, buf, held - __PROMPT_HOLD);
+      }
+      for (i = 0; i < __PROMPT_HOLD; i++) {
+        buf[i] = buf[held - __PROMPT_HOLD + i];
+      }
+      held = __PROMPT_HOLD;
+    }
+  }
+}
+
+int
+awaiting_login(void)
+{
+  return __awaitlogin;
+}
+
+int
+await_login(struct MyIO *io)
+{
+  static const char * const prompts[] = { SERVER_PROMPT, LOGIN_PROMPT, PASSWORD_PROMPT, NULL };
+  int answered = 2; /* username and password went out with the connect */
+  int prompt;
+
+  do {
+    prompt = relay_until_prompt(io->sockfd, io->writefd, prompts, 1);
+  } while (prompt > 0 && answered-- > 0);
+
+  __awaitlogin = 0;
+  return prompt;
+}
+
 void
 runclient(struct MyIO *io)
 {
   size_t nsent;
+  int status;
   void(*callbacks[NCALLBACK])(struct MyIO*) = {
     clienthandleget,
     clienthandleput,
     clienthandlehelp,
     clienthandleexit,
+    clienthandleuget,
   };
 
   do {
     mymemset(io->buf, 0, io->bufsize);
-    do_poll(io->sockfd);
-
-    readsocket_writefd(io->sockfd, io->buf, io->bufsize, io->writefd);
+    if (__awaitlogin) {
+      if (await_login(io) == -1) {
+        _exit(1);
+      }
+    } else {
+      do_poll(io->sockfd);
+      readsocket_writefd(io->sockfd, io->buf, io->bufsize, io->writefd);
+    }
     nsent = readfd_writesocket(io->sockfd, io->buf, io->bufsize, io->readfd, 0);
     io->buf[nsent-1] = '\0';
-    runfiletransfer(io, callbacks);
+    if (runfiletransfer(io, callbacks) != 0 && !upload_send(io, -1)) {
+      download_recv(io, -1, &status);
+    }
   } while (1);
 }
@@ -29,6 +29,11 @@
 
 #define DEFAULT_PORT "1234"
 #define DEFAULT_IP "127.0.0.1"
+#define USER_ENV "SHELLSERVE_USER" /* login sent up front, see build_login_preamble() */
+#define PASS_ENV "SHELLSERVE_PASS"
+#define SERVER_PROMPT "server> " /* must match the prompt in server_core.c */
+#define LOGIN_PROMPT "Username: "
+#define PASSWORD_PROMPT "Password: "
 
 #include "globals.h"
 #include "filetransfer.h"
@@ -61,6 +66,34 @@ struct ClientContext {
 int do_connect_server(const char * const ip, const char * const port)
   __attribute__((__nonnull__(1, 2)));
 
+/**
+ * do_connect_server_login - Connects and sends the login in the first packet.
+ * @ip: IP address to connect to.
+ * @port: Port number to connect to.
+ * @login: Username and password lines to send.
+ * @loginlen: Length of @login.
+ *
+ * Same as do_connect_server() but the login answers are sent with the
+ * connection request, in the SYN when TCP Fast Open is available.
+ * Returns the socket file descriptor.
+ */
+int do_connect_server_login(const char * const ip, const char * const port,
+                            const char * const login, size_t loginlen)
+  __attribute__((__nonnull__(1, 2, 3)));
+
+/**
+ * build_login_preamble - Build the login lines from the environment.
+ * @buf: Buffer for the "username\npassword\n" lines.
+ * @bufsize: Size of @buf.
+ *
+ * Non-interactive clients can set USER_ENV and PASS_ENV so the answers to
+ * the server's login prompts are sent before the prompts arrive.
+ *
+ * Return: length of the preamble, or 0 if the variables are not set.
+ */
+size_t build_login_preamble(char *buf, size_t bufsize)
+  __attribute__((__nonnull__(1)));
+
 /**
  * initclient - Initializes client with server connection and I/O buffer.
  * @argc: Argument count from main.
@@ -69,6 +102,7 @@ int do_connect_server(const char * const ip, const char * const port)
  *
  * Initializes a client connection to a server, either using the IP and port
  * provided as arguments, or defaults. Also initializes I/O buffers.
+ * If a login preamble is available it is sent with the connection request.
  */
 void initclient(int argc, char *argv[], struct MyIO *io)
   __attribute__((__nonnull__(2, 3)));
@@ -84,6 +118,45 @@ void initclient(int argc, char *argv[], struct MyIO *io)
 void runclient(struct MyIO *io)
   __attribute__((__nonnull__(1)));
 
+/**
+ * relay_until_prompt - Copy server output to a fd until a prompt shows up.
+ * @sockfd: Socket connected to the server.
+ * @outfd: Where the output goes, -1 to discard it.
+ * @prompts: NULL terminated list of prompts to stop at.
+ * @echoprompt: Also write the prompt itself to @outfd.
+ *
+ * The server has no end of output marker, its next prompt is the only sign
+ * that a reply is complete. A short tail is held back between reads so a
+ * prompt split over two reads is still recognized.
+ *
+ * Return: index of the prompt seen, or -1 if the server hung up.
+ */
+int relay_until_prompt(int sockfd, int outfd, const char * const prompts[], int echoprompt)
+  __attribute__((__nonnull__(3)));
+
+/**
+ * await_login - Print server output until the login has been answered.
+ * @io: Pointer to struct containing I/O buffer and socket info.
+ *
+ * After a login preamble the server answers prompts we will never see on
+ * stdin. Consume its output past the username and password prompts up to
+ * the command prompt (login worked) or the next prompt (it did not), so the
+ * normal loop starts in step.
+ *
+ * Return: index of the last prompt seen, 0 for the command prompt, or -1
+ * if the server hung up.
+ */
+int await_login(struct MyIO *io)
+  __attribute__((__nonnull__(1)));
+
+/**
+ * awaiting_login - Check whether a login preamble is still unanswered.
+ *
+ * Return: 1 if initclient() sent the login with the connection and
+ * await_login() has not run yet.
+ */
+int awaiting_login(void);
+
 /**
  * do_poll - Waits for incoming data on a socket using poll.
  * @sockfd: The file descriptor for the socket to poll.
@@ -0,0 +1,393 @@
+/**
+ * @file clientmux.c
+ * @brief Client Connection Multiplexing
+ *
+ * The master side accepts one request at a time on a SOCK_SEQPACKET Unix
+ * socket. Each request is a single message carrying the working directory and
+ * command line, with the requester's stdin, stdout and stderr attached as
+ * SCM_RIGHTS. The master points the session I/O at those fds, so output and
+ * file transfers go straight to the requester without being copied through it.
+ * The session is framed, so the command's stdout and stderr land on the
+ * requester's and its exit status is the reply.
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#define _GNU_SOURCE /* struct ucred */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <linux/limits.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "clientmux.h"
+#include "client_core.h"
+#include "networktcp.h"
+#include "filetransfer.h"
+#include "upload.h"
+#include "download.h"
+#include "frames.h"
+#include "memscan.h"
+#include "mystring.h"
+#include "syscalls.h"
+
+/* private */
+#define __MUX_MSGMAX (PATH_MAX + MAX_LINE_SIZE)
+/* end private */
+
+char *
+mux_socketpath(char *buf, size_t size)
+{
+  char uid[16];
+  const char *path = mygetenv(MUX_PATH_ENV), *rundir = mygetenv("XDG_RUNTIME_DIR");
+
+  if (path) {
+    mystrncpy(buf, path, size - 1);
+    return buf;
+  }
+
+  /* never straight in /tmp, where another user could bind the name first */
+  if (rundir && rundir[0] == '/') {
+    mysnprintf(buf, size, "%s/shellserve.sock", rundir);
+  } else {
+    mysnprintf(buf, size, "/tmp/shellserve-%s/control.sock", myitoa(getuid(), uid));
+  }
+  return buf;
+}
+
+int
+mux_socketdir(const char *path, int create)
+{
+  char dir[PATH_MAX], *slash;
+  struct stat st;
+
+  mystrncpy(dir, path, sizeof dir - 1);
+  if ((slash = (char *)mystrrchr(dir, '/')) == NULL || slash == dir) {
+    return -1;
+  }
+  *slash = '\0';
+  if (create && mkdir(dir, 0700) == -1 && errno != EEXIST) {
+    return -1;
+  }
+  /* lstat, a symlink planted in its place does not count */
+  if (lstat(dir, &st) == -1 || !S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & 077)) {
+    return -1;
+  }
+  return 0;
+}
+
+/* the default places must be ours alone, MUX_PATH_ENV is the user's choice */
+static int
+mux_checkdir(const char *path, int create)
+{
+  if (mygetenv(MUX_PATH_ENV) || mux_socketdir(path, create) == 0) {
+    return 0;
+  }
+  myfprintf(sys_stderr, "control socket %s is not in a private directory\n", path);
+  return -1;
+}
+
+static void
+mux_addr(struct sockaddr_un *addr)
+{
+  mymemset(addr, 0, sizeof *addr);
+  addr->sun_family = AF_UNIX;
+  mux_socketpath(addr->sun_path, sizeof addr->sun_path);
+}
+
+int
+mux_login(struct MyIO *io)
+{
+  static const char * const prompts[] = { SERVER_PROMPT, LOGIN_PROMPT, PASSWORD_PROMPT, NULL };
+  size_t nread;
+  int prompt;
+
+  prompt = awaiting_login() ? await_login(io) : relay_until_prompt(io->sockfd, io->writefd, prompts, 1);
+  while (prompt > 0) {
+    nread = myreadline(io->readfd, io->buf, io->bufsize-1);
+    io->buf[nread-1] = '\n';
+    mysckwrite(io->sockfd, io->buf, nread);
+    prompt = relay_until_prompt(io->sockfd, io->writefd, prompts, 1);
+  }
+
+  return prompt == 0 ? 0 : -1;
+}
+
+static int
+mux_listen(void)
+{
+  struct sockaddr_un addr;
+  int lfd, cfd;
+  mode_t oldmask;
+
+  mux_addr(&addr);
+  if (mux_checkdir(addr.sun_path, 1) == -1) {
+    _exit(1);
+  }
+  if ((lfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) == -1) {
+    printerr_exit("socket() error\n");
+  }
+
+  oldmask = umask(077); /* the socket hands out a logged in session */
+  if (bind(lfd, (struct sockaddr *)&addr, sizeof addr) == -1) {
+    /* a master that died leaves its socket behind, replace it if nobody answers */
+    if (errno != EADDRINUSE || (cfd = socket(AF_UNIX, SOCK_SEQPACKET, 0)) == -1) {
+      printerr_exit("bind() error\n");
+    }
+    if (connect(cfd, (struct sockaddr *)&addr, sizeof addr) == 0) {
+      printerr_exit("master: already running\n");
+    }
+    close(cfd);
+    unlink(addr.sun_path);
+    if (bind(lfd, (struct sockaddr *)&addr, sizeof addr) == -1) {
+      printerr_exit("bind() error\n");
+    }
+  }
+  umask(oldmask);
+
+  if (listen(lfd, BACKLOG) == -1) {
+    printerr_exit("listen() error\n");
+  }
+
+  return lfd;
+}
+
+static int
+mux_peer_is_us(int cfd)
+{
+  struct ucred cred;
+  socklen_t len = sizeof cred;
+
+  return getsockopt(cfd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == getuid();
+}
+
+/*
+ * receive "cwd\0command\0" and the requester's fds, return the fd count.
+ * @len gets the bytes received; fds past MUX_NFDS are closed, the master
+ * lives long and would run out of them.
+ */
+static int
+mux_recvrequest(int cfd, char *msg, size_t *len, int fds[MUX_NFDS])
+{
+  char cbuf[CMSG_SPACE(sizeof(int) * MUX_NFDS)];
+  struct iovec iov = { .iov_base = msg, .iov_len = __MUX_MSGMAX };
+  struct msghdr mh = {
+    .msg_iov = &iov, .msg_iovlen = 1,
+    .msg_control = cbuf, .msg_controllen = sizeof cbuf,
+  };
+  struct cmsghdr *cm;
+  ssize_t n;
+  int nfds = 0, fd;
+
+  mymemset(msg, 0, __MUX_MSGMAX + 1);
+  if ((n = recvmsg(cfd, &mh, MSG_CMSG_CLOEXEC)) <= 0) {
+    return -1;
+  }
+  *len = n;
+
+  for (cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm)) {
+    if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+      for (size_t i = 0; i < (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int); i++) {
+        mymemcpy(&fd, CMSG_DATA(cm) + i * sizeof(int), sizeof fd);
+        if (nfds < MUX_NFDS) {
+          fds[nfds++] = fd;
+        } else {
+          close(fd);
+        }
+      }
+    }
+  }
+
+  return nfds;
+}
+
+int
+mux_serve(struct MyIO *io, int cfd, void(*callbacks[NCALLBACK])(struct MyIO*))
+{
+  char msg[__MUX_MSGMAX + 1], *command;
+  const char *end;
+  int fds[MUX_NFDS] = { -1, -1, -1 }, status = 0, quit = 0, help;
+  size_t len, n;
+
+  if (!mux_peer_is_us(cfd) || mux_recvrequest(cfd, msg, &n, fds) != MUX_NFDS) {
+    goto out;
+  }
+
+  /* both strings must end inside what came, and the line must fit io->buf */
+  status = 2;
+  if ((end = mymemchr(msg, '\0', n)) == NULL
+      || (command = msg + (end - msg) + 1) == msg + n || mymemchr(command, '\0', msg + n - command) == NULL) {
+    fdputs(fds[2], "master: malformed request\n");
+    goto out;
+  }
+  if ((len = mystrlen(command)) >= MAX_LINE_SIZE) {
+    fdputs(fds[2], "master: command too long\n");
+    goto out;
+  }
+  status = 0;
+
+  if (chdir(msg) == -1) { /* transfers save relative to the requester */
+    fdputs(fds[2], "master: cannot use working directory\n");
+  }
+
+  io->readfd = fds[0];
+  io->writefd = fds[1];
+  mystrncpy(io->buf, command, io->bufsize - 2);
+  quit = mystrcmp(io->buf, "exit") == 0;
+  help = mystrcmp(io->buf, "help") == 0;
+
+  io->buf[len] = '\n';
+  mysckwrite(io->sockfd, io->buf, len + 1);
+  io->buf[len] = '\0';
+
+  if (quit) {
+    goto out;
+  }
+  if (!help && upload_send(io, fds[2])) {
+    status = frames_relay(io->sockfd, io->writefd, fds[2]);
+  } else if (!help && download_recv(io, fds[2], &status)) {
+    ;
+  } else if (runfiletransfer(io, callbacks) == 0 && !help) {
+    /* the transfer handlers stop short of the exit frame, drop what is left */
+    status = frames_relay(io->sockfd, -1, fds[2]);
+  } else {
+    status = frames_relay(io->sockfd, io->writefd, fds[2]);
+  }
+  quit = status == -1;
+
+ out:
+  (void)write(cfd, &status, sizeof status);
+  for (int i = 0; i < MUX_NFDS; i++) {
+    if (fds[i] != -1) {
+      io_forget(fds[i]); /* the next request's fds get the same numbers */
+      close(fds[i]);
+    }
+  }
+  close(cfd);
+  io->readfd = -1;
+  io->writefd = -1;
+
+  return quit;
+}
+
+void
+mux_master(struct MyIO *io)
+{
+  char path[PATH_MAX];
+  int lfd, cfd;
+  pid_t pid;
+
+  /* transfers in master mode must not exit the whole master */
+  void(*callbacks[NCALLBACK])(struct MyIO*) = {
+    clienthandleget,
+    clienthandleput,
+    clienthandlehelp,
+    clienthandlehelp,
+    clienthandleuget,
+  };
+
+  if (mux_login(io) == -1) {
+    printerr_exit("master: login failed\n");
+  }
+  /* requesters get stdout, stderr and the exit status apart */
+  fdputs(io->sockfd, "frames on\n");
+  if (frames_relay(io->sockfd, -1, sys_stderr) != 0) {
+    printerr_exit("master: server does not frame output\n");
+  }
+
+  lfd = mux_listen();
+  myfprintf(sys_stderr, "master: listening on %s\n", mux_socketpath(path, sizeof path));
+
+  if ((pid = myfork()) != 0) {
+    _exit(0); /* the requesters find us through the socket */
+  }
+  setsid();
+
+  while ((cfd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC)) != -1 || errno == EINTR) {
+    if (cfd != -1 && mux_serve(io, cfd, callbacks)) {
+      break;
+    }
+  }
+
+  unlink(path);
+  _exit(0);
+}
+
+int
+mux_request(int fd, const char *command, const int fds[MUX_NFDS])
+{
+  char msg[__MUX_MSGMAX], cbuf[CMSG_SPACE(sizeof(int) * MUX_NFDS)];
+  struct iovec iov = { .iov_base = msg };
+  struct msghdr mh = {
+    .msg_iov = &iov, .msg_iovlen = 1,
+    .msg_control = cbuf, .msg_controllen = sizeof cbuf,
+  };
+  struct cmsghdr *cm;
+  int status = -1;
+
+  /* our fds and the command go only to a master of our own */
+  if (!mux_peer_is_us(fd)) {
+    fdputs(sys_stderr, "client: the control socket is not our master's\n");
+    return -1;
+  }
+  if (getcwd(msg, PATH_MAX) == NULL || mystrlen(command) >= MAX_LINE_SIZE) {
+    return -1;
+  }
+  iov.iov_len = mystrlen(msg) + 1;
+  mystrcpy(msg + iov.iov_len, command);
+  iov.iov_len += mystrlen(command) + 1;
+
+  mymemset(cbuf, 0, sizeof cbuf);
+  cm = CMSG_FIRSTHDR(&mh);
+  cm->cmsg_level = SOL_SOCKET;
+  cm->cmsg_type = SCM_RIGHTS;
+  cm->cmsg_len = CMSG_LEN(sizeof(int) * MUX_NFDS);
+  for (int i = 0; i < MUX_NFDS; i++) {
+    ((int *)CMSG_DATA(cm))[i] = fds[i];
+  }
+
+  if (sendmsg(fd, &mh, 0) == -1 || read(fd, &status, sizeof status) != sizeof status) {
+    status = -1;
+  }
+  return status;
+}
+
+int
+mux_runcommand(const char *command)
+{
+  static const int stdfds[MUX_NFDS] = { 0, 1, 2 }; /* our stdin, stdout, stderr */
+  struct sockaddr_un addr;
+  int fd, status;
+
+  mux_addr(&addr);
+  if (mux_checkdir(addr.sun_path, 0) == -1) {
+    return -1;
+  }
+  if ((fd = socket(AF_UNIX, SOCK_SEQPACKET, 0)) == -1
+      || connect(fd, (struct sockaddr *)&addr, sizeof addr) == -1) {
+    return -1;
+  }
+
+  status = mux_request(fd, command, stdfds);
+  close(fd);
+  return status;
+}
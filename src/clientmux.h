@@ -0,0 +1,128 @@
+/**
+ * @file clientmux.h
+ * @brief Client Connection Multiplexing
+ *
+ * This file declares the master mode of the client. A master logs in once,
+ * keeps the session open and listens on a Unix socket. Later client
+ * invocations hand it their command, working directory and standard fds and
+ * the master runs the command over the shared session, so they skip the
+ * connect and login entirely.
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef __CLIENTMUX_H
+#define __CLIENTMUX_H
+
+#include "globals.h"
+#include "filetransfer.h"
+
+#define MUX_PATH_ENV "SHELLSERVE_CONTROL_PATH"
+#define MUX_NFDS 3 /* stdin, stdout and stderr of the requesting client */
+
+/**
+ * mux_socketpath() - Get the path of the master's control socket.
+ * @buf: Buffer for the path.
+ * @size: Size of @buf.
+ *
+ * MUX_PATH_ENV if set, otherwise shellserve.sock in $XDG_RUNTIME_DIR, or
+ * /tmp/shellserve-UID/control.sock without it. The default places must pass
+ * mux_socketdir().
+ *
+ * Return: @buf
+ */
+char *mux_socketpath(char *buf, size_t size)
+  __attribute__((__nonnull__(1)));
+
+/**
+ * mux_socketdir() - Check that a socket path is in a private directory.
+ * @path: Socket path.
+ * @create: Nonzero to create the directory, mode 0700, if it is missing.
+ *
+ * The directory must be a real directory, not a symlink, owned by us and
+ * closed to group and others, so no other user can bind the socket first
+ * or replace it.
+ *
+ * Return: 0 if it is, -1 if not.
+ */
+int mux_socketdir(const char *path, int create)
+  __attribute__((__nonnull__(1)));
+
+/**
+ * mux_login() - Log in interactively until the server prompt shows up.
+ * @io: Pointer to the MyIO structure of the session.
+ *
+ * Answers each login prompt the login preamble did not cover with a line
+ * from @io->readfd.
+ *
+ * Return: 0 once logged in, -1 if the server hung up.
+ */
+int mux_login(struct MyIO *io)
+  __attribute__((__nonnull__(1)));
+
+/**
+ * mux_master() - Run the master for an already connected session.
+ * @io: Pointer to the MyIO structure of the session.
+ *
+ * Logs in, binds the control socket, detaches from the terminal and serves
+ * requests one at a time until the server hangs up or a client sends "exit".
+ * Only processes of the same user may connect.
+ */
+void mux_master(struct MyIO *io)
+  __attribute__((__nonnull__(1), __noreturn__));
+
+/**
+ * mux_serve() - Serve one request of a requester, in the master.
+ * @io: Pointer to the MyIO structure of the session.
+ * @cfd: Connection of the requester, closed on return.
+ * @callbacks: Transfer handlers, as for runfiletransfer().
+ *
+ * Runs the command with the requester's fds and writes the exit status back
+ * to it. Requesters of other users are turned away.
+ *
+ * Return: 0 to keep serving, nonzero once the session is over.
+ */
+int mux_serve(struct MyIO *io, int cfd, void(*callbacks[NCALLBACK])(struct MyIO*))
+  __attribute__((__nonnull__(1, 3)));
+
+/**
+ * mux_request() - Send one request to a master and wait for its status.
+ * @fd: Connection to the master.
+ * @command: Command line to run.
+ * @fds: The stdin, stdout and stderr the command uses.
+ *
+ * Nothing is sent unless the master runs as our user.
+ *
+ * Return: the exit status of the command, or -1 if the master is not ours
+ *         or the session ended.
+ */
+int mux_request(int fd, const char *command, const int fds[MUX_NFDS])
+  __attribute__((__nonnull__(2, 3)));
+
+/**
+ * mux_runcommand() - Run one command through a running master.
+ * @command: Command line to run.
+ *
+ * Return: the exit status of the command, or -1 if no master is running or
+ *         the session ended.
+ */
+int mux_runcommand(const char *command)
+  __attribute__((__nonnull__(1)));
+
+#endif /* __CLIENTMUX_H */
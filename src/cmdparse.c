@@ -0,0 +1,380 @@
+/**
+ * @file cmdparse.c
+ * @brief Command Line Lexer and Parser
+ *
+ * The lexer runs once over the line and lays its tokens out back to back in
+ * the arena; the parser then walks that array. A word is unquoted by moving
+ * its bytes left over the quotes, so the write pointer never passes the read
+ * pointer and the word can be terminated in place. An operator right after a
+ * word ("ls>out") is decoded before its first byte is overwritten by the NUL.
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdint.h>
+
+#include "cmdparse.h"
+#include "mystring.h"
+
+enum tok {
+  TOK_END,
+  TOK_WORD,
+  TOK_PIPE,
+  TOK_AND,
+  TOK_OR,
+  TOK_SEMI,
+  TOK_AMP,
+  TOK_IN,
+  TOK_OUT,
+  TOK_APPEND,
+};
+
+struct token {
+  enum tok kind;
+  char *word;                                  /* TOK_WORD only */
+};
+
+struct parser {
+  struct token *tok;                           /* next token */
+  struct arena *arena;
+  const char *err;
+};
+
+static const char * const __near[] = {
+  [TOK_END]    = "syntax error near end of line",
+  [TOK_WORD]   = "syntax error",
+  [TOK_PIPE]   = "syntax error near `|'",
+  [TOK_AND]    = "syntax error near `&&'",
+  [TOK_OR]     = "syntax error near `||'",
+  [TOK_SEMI]   = "syntax error near `;'",
+  [TOK_AMP]    = "syntax error near `&'",
+  [TOK_IN]     = "syntax error near `<'",
+  [TOK_OUT]    = "syntax error near `>'",
+  [TOK_APPEND] = "syntax error near `>>'",
+};
+
+static const char __full[] = "command line too long";
+
+void
+arena_init(struct arena *arena, void *buf, size_t size)
+{
+  arena->base = buf;
+  arena->used = 0;
+  arena->size = size;
+}
+
+void *
+arena_alloc(struct arena *arena, size_t n)
+{
+  void *p;
+
+  n = (n + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+  if (n > arena->size - arena->used) {
+    return NULL;
+  }
+  p = arena->base + arena->used;
+  arena->used += n;
+  return p;
+}
+
+static inline int
+is_blank(char c)
+{
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static inline int
+is_operator(char c)
+{
+  return c == '|' || c == '&' || c == ';' || c == '<' || c == '>';
+}
+
+static inline int
+is_redirect(enum tok kind)
+{
+  return kind == TOK_IN || kind == TOK_OUT || kind == TOK_APPEND;
+}
+
+/* decode the operator at *p and step over it */
+static enum tok
+lex_operator(char **p)
+{
+  char *s = *p;
+
+  *p = s + 1 + (s[1] == s[0]);
+  switch (s[0]) {
+  case '|': return s[1] == '|' ? TOK_OR : TOK_PIPE;
+  case '&': return s[1] == '&' ? TOK_AND : TOK_AMP;
+  case '>': return s[1] == '>' ? TOK_APPEND : TOK_OUT;
+  case '<': *p = s + 1; return TOK_IN;
+  default:  *p = s + 1; return TOK_SEMI;
+  }
+}
+
+/* unquote the word at *p in place and leave *p on the byte that ended it */
+static char *
+lex_word(char **pp, const char **err)
+{
+  char *p = *pp, *w = p, quote = 0, c;
+
+  for (;; p++) {
+    c = *p;
+    if (c == '\0') {
+      if (quote) {
+        *err = "unterminated quote";
+        return NULL;
+      }
+      break;
+    }
+    if (quote == '\'') {
+      if (c == '\'') {
+        quote = 0;
+        continue;
+      }
+    } else if (quote == '"') {
+      if (c == '"') {
+        quote = 0;
+        continue;
+      }
+      if (c == '\\' && (p[1] == '"' || p[1] == '\\')) {
+        c = *++p;
+      }
+    } else {
+      if (is_blank(c) || is_operator(c)) {
+        break;
+      }
+      if (c == '\'' || c == '"') {
+        quote = c;
+        continue;
+      }
+      if (c == '\\' && p[1] != '\0') {
+        c = *++p;
+      }
+    }
+    *w++ = c;
+  }
+  *pp = p;
+  return w;
+}
+
+/* tokenize the whole line; the tokens are contiguous and end with TOK_END */
+static struct token *
+lex(char *p, struct arena *arena, const char **err)
+{
+  struct token *first = NULL, *t;
+  char *end;
+
+  for (;;) {
+    while (is_blank(*p)) {
+      p++;
+    }
+    if ((t = arena_alloc(arena, sizeof(*t))) == NULL) {
+      *err = __full;
+      return NULL;
+    }
+    if (first == NULL) {
+      first = t;
+    }
+    t->word = NULL;
+    if (*p == '\0') {
+      t->kind = TOK_END;
+      return first;
+    }
+    if (is_operator(*p)) {
+      t->kind = lex_operator(&p);
+      continue;
+    }
+
+    t->kind = TOK_WORD;
+    t->word = p;
+    if ((end = lex_word(&p, err)) == NULL) {
+      return NULL;
+    }
+    /* step over the delimiter first, the NUL may be written on top of it */
+    if (is_operator(*p)) {
+      if ((t = arena_alloc(arena, sizeof(*t))) == NULL) {
+        *err = __full;
+        return NULL;
+      }
+      t->word = NULL;
+      t->kind = lex_operator(&p);
+    } else if (*p != '\0') {
+      p++;
+    }
+    *end = '\0';
+  }
+}
+
+static int
+syntax_error(struct parser *ps, const struct token *t)
+{
+  ps->err = __near[t->kind];
+  return -1;
+}
+
+static void *
+parser_alloc(struct parser *ps, size_t n)
+{
+  void *p = arena_alloc(ps->arena, n);
+
+  if (p == NULL) {
+    ps->err = __full;
+  }
+  return p;
+}
+
+static struct cmd_simple *
+parse_command(struct parser *ps)
+{
+  struct cmd_simple *cmd;
+  struct token *t;
+  int n = 0;
+
+  /* size argv by counting the words up to the next operator */
+  for (t = ps->tok; t->kind == TOK_WORD || is_redirect(t->kind); t++) {
+    if (t->kind == TOK_WORD) {
+      n++;
+    } else if (t[1].kind != TOK_WORD) {
+      syntax_error(ps, t + 1);
+      return NULL;
+    } else {
+      t++;
+    }
+  }
+  if (n == 0) {
+    if (t != ps->tok) {
+      ps->err = "missing command";
+    } else {
+      syntax_error(ps, t);
+    }
+    return NULL;
+  }
+
+  if ((cmd = parser_alloc(ps, sizeof(*cmd))) == NULL
+      || (cmd->argv = parser_alloc(ps, (n + 1) * sizeof(char *))) == NULL) {
+    return NULL;
+  }
+  cmd->argc = n;
+  cmd->in = cmd->out = NULL;
+  cmd->append = 0;
+  cmd->next = NULL;
+
+  for (n = 0, t = ps->tok; t->kind == TOK_WORD || is_redirect(t->kind); t++) {
+    switch (t->kind) {
+    case TOK_WORD:
+      cmd->argv[n++] = t->word;
+      break;
+    case TOK_IN:
+      cmd->in = (++t)->word;
+      break;
+    default:
+      cmd->append = t->kind == TOK_APPEND;
+      cmd->out = (++t)->word;
+      break;
+    }
+  }
+  cmd->argv[n] = NULL;
+  ps->tok = t;
+  return cmd;
+}
+
+static struct cmd_pipeline *
+parse_pipeline(struct parser *ps, enum cmd_join join)
+{
+  struct cmd_pipeline *pl;
+  struct cmd_simple **tail;
+
+  if ((pl = parser_alloc(ps, sizeof(*pl))) == NULL) {
+    return NULL;
+  }
+  pl->join = join;
+  pl->background = 0;
+  pl->nstages = 0;
+  pl->next = NULL;
+
+  /* as in the shell, time is a keyword that times the whole pipeline */
+  pl->timed = ps->tok->kind == TOK_WORD && ps->tok[1].kind == TOK_WORD && mystrcmp(ps->tok->word, "time") == 0;
+  if (pl->timed) {
+    ps->tok++;
+  }
+
+  tail = &pl->first;
+  for (;;) {
+    if ((*tail = parse_command(ps)) == NULL) {
+      return NULL;
+    }
+    tail = &(*tail)->next;
+    pl->nstages++;
+    if (ps->tok->kind != TOK_PIPE) {
+      return pl;
+    }
+    ps->tok++;
+  }
+}
+
+/* parse an and-or list onto *tail and return where the next one links */
+static struct cmd_pipeline **
+parse_andor(struct parser *ps, struct cmd_pipeline **tail)
+{
+  enum cmd_join join = JOIN_ALWAYS;
+
+  for (;;) {
+    if ((*tail = parse_pipeline(ps, join)) == NULL) {
+      return NULL;
+    }
+    tail = &(*tail)->next;
+    if (ps->tok->kind == TOK_AND) {
+      join = JOIN_AND;
+    } else if (ps->tok->kind == TOK_OR) {
+      join = JOIN_OR;
+    } else {
+      return tail;
+    }
+    ps->tok++;
+  }
+}
+
+int
+cmd_parse(char *line, struct arena *arena, struct cmd_pipeline **list, const char **err)
+{
+  struct parser ps = { .arena = arena, .err = NULL };
+  struct cmd_pipeline **tail = list, **next;
+
+  *list = NULL;
+  if ((ps.tok = lex(line, arena, err)) == NULL) {
+    return -1;
+  }
+
+  while (ps.tok->kind != TOK_END) {
+    if ((next = parse_andor(&ps, tail)) == NULL) {
+      *err = ps.err;
+      return -1;
+    }
+    if (ps.tok->kind == TOK_AMP) {
+      for (struct cmd_pipeline *pl = *tail; pl; pl = pl->next) {
+        pl->background = 1;
+      }
+    }
+    if (ps.tok->kind == TOK_SEMI || ps.tok->kind == TOK_AMP) {
+      ps.tok++;
+    }
+    tail = next;
+  }
+  return 0;
+}
@@ -0,0 +1,128 @@
+/**
+ * @file cmdparse.h
+ * @brief Command Line Lexer and Parser
+ *
+ * Turns a command line into a list of pipelines joined by ; && || and &,
+ * each stage with its own redirections:
+ *
+ *   list     -> andor ((";" | "&") andor)* [";" | "&"]
+ *   andor    -> pipeline (("&&" | "||") pipeline)*
+ *   pipeline -> command ("|" command)*
+ *   command  -> (word | ("<" | ">" | ">>") word)+
+ *
+ * Words may be quoted with '...' or "..." and a backslash escapes the next
+ * character. The lexer makes one pass and unquotes and terminates words in
+ * place, so argv strings are slices of the line, not copies. Nodes come from
+ * a caller supplied arena and nothing is kept between calls.
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef __CMDPARSE_H
+#define __CMDPARSE_H
+
+#include <stddef.h>
+
+/**
+ * struct arena - Bump allocator over a caller owned buffer
+ * @base: the buffer
+ * @used: bytes handed out so far
+ * @size: size of @base
+ */
+struct arena {
+  char *base;
+  size_t used, size;
+};
+
+/**
+ * arena_init() - Hand out @size bytes of @buf, see arena_alloc().
+ */
+void arena_init(struct arena *arena, void *buf, size_t size)
+  __attribute__((__nonnull__(1, 2)));
+
+/**
+ * arena_alloc() - Allocate @n pointer aligned bytes, freed with the buffer.
+ *
+ * Return: the memory, or NULL if the arena is full.
+ */
+void *arena_alloc(struct arena *arena, size_t n)
+  __attribute__((__nonnull__(1)));
+
+/**
+ * enum cmd_join - When a pipeline runs, given the status of the one before
+ * @JOIN_ALWAYS: first in the list, or after ; or &
+ * @JOIN_AND: after &&, only if the previous one succeeded
+ * @JOIN_OR: after ||, only if the previous one failed
+ */
+enum cmd_join {
+  JOIN_ALWAYS,
+  JOIN_AND,
+  JOIN_OR,
+};
+
+/**
+ * struct cmd_simple - One stage of a pipeline
+ * @argv: NULL terminated arguments, slices of the parsed line
+ * @argc: number of arguments, at least 1
+ * @in: file for stdin (<), or NULL
+ * @out: file for stdout (> or >>), or NULL
+ * @append: @out was given with >>
+ * @next: next stage of the pipeline
+ */
+struct cmd_simple {
+  char **argv;
+  int argc;
+  char *in;
+  char *out;
+  int append;
+  struct cmd_simple *next;
+};
+
+/**
+ * struct cmd_pipeline - Stages connected by |
+ * @first: first stage
+ * @nstages: number of stages
+ * @join: how it depends on the previous pipeline
+ * @background: the and-or list it belongs to ended with &
+ * @timed: prefixed with the time keyword
+ * @next: next pipeline of the list
+ */
+struct cmd_pipeline {
+  struct cmd_simple *first;
+  int nstages;
+  enum cmd_join join;
+  int background;
+  int timed;
+  struct cmd_pipeline *next;
+};
+
+/**
+ * cmd_parse() - Parse a command line.
+ *
+ * @line: the line, modified in place and referenced by the result
+ * @arena: where the nodes are allocated
+ * @list: set to the first pipeline, NULL for an empty line
+ * @err: set to a message when parsing fails
+ *
+ * Return: 0 on success, -1 on a syntax error or a full arena.
+ */
+int cmd_parse(char *line, struct arena *arena, struct cmd_pipeline **list, const char **err)
+  __attribute__((__nonnull__(1, 2, 3, 4)));
+
+#endif /* __CMDPARSE_H */
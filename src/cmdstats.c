@@ -0,0 +1,198 @@
+/**
+ * @file cmdstats.c
+ * @brief Command Timing Histograms And Reports
+ *
+ * The histograms live in a shared mapping and every session adds to them
+ * with relaxed atomic increments, so a reader may see a pipeline in one
+ * histogram before the next.
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include "cmdstats.h"
+#include "mystring.h"
+#include "syscalls.h"
+#include "serverlog.h"
+
+struct cmdhist {
+  uint64_t count;                              /* pipelines recorded */
+  uint64_t slow;                               /* of which logged as slow */
+  uint64_t real[CMDSTATS_NBUCKETS];            /* pipeline wall time */
+  uint64_t spawn[CMDSTATS_NBUCKETS];           /* per stage */
+  uint64_t cpu[CMDSTATS_NBUCKETS];             /* per stage, user + sys */
+};
+
+static struct cmdhist *__h;
+static uint64_t __slow_ns;                     /* 0 logs nothing */
+
+/* bucket b counts values under 2^b us */
+static unsigned int
+__bucket(uint64_t us)
+{
+  unsigned int b = us ? 64 - __builtin_clzll(us) : 0;
+
+  return b < CMDSTATS_NBUCKETS ? b : CMDSTATS_NBUCKETS - 1;
+}
+
+static void
+__add(uint64_t *hist, uint64_t us)
+{
+  __atomic_add_fetch(&hist[__bucket(us)], 1, __ATOMIC_RELAXED);
+}
+
+/* the shell's 0m0.000s */
+static size_t
+__shelltime(char *buf, size_t size, const char *name, uint64_t us)
+{
+  return mysnprintf(buf, size, "%s\t%llum%llu.%03llus\n", name, (unsigned long long)(us / 60000000),
+                    (unsigned long long)(us / 1000000 % 60), (unsigned long long)(us / 1000 % 1000));
+}
+
+void
+cmdstats_init(void)
+{
+  const char *ms = mygetenv(CMDSTATS_SLOW_ENV);
+  struct cmdhist *h;
+
+  for (__slow_ns = 0; ms && *ms >= '0' && *ms <= '9'; ms++) {
+    __slow_ns = __slow_ns * 10 + (*ms - '0');
+  }
+  __slow_ns *= 1000000;
+
+  h = mmap(NULL, sizeof *h, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (h == MAP_FAILED) {
+    printerr_exit("mmap() error\n");
+  }
+  if (__h) {
+    munmap(__h, sizeof *__h);
+  }
+  __h = h;
+}
+
+uint64_t
+cmdstats_real_ns(const Pipeline *pipe, size_t npipes)
+{
+  uint64_t start = UINT64_MAX, end = 0;
+
+  for (size_t i = 0; i < npipes; i++) {
+    if (pipe[i].usage.started == 0) {
+      continue;
+    }
+    if (pipe[i].usage.started < start) {
+      start = pipe[i].usage.started;
+    }
+    if (pipe[i].usage.started + pipe[i].usage.wall_ns > end) {
+      end = pipe[i].usage.started + pipe[i].usage.wall_ns;
+    }
+  }
+  return end > start ? end - start : 0;
+}
+
+void
+cmdstats_record(int clientid, const Pipeline *pipe, size_t npipes)
+{
+  uint64_t real = cmdstats_real_ns(pipe, npipes);
+  char cmd[LOG_RECSIZE];
+
+  if (__slow_ns && real >= __slow_ns) {
+    describe_pipeline(cmd, sizeof cmd, pipe, npipes);
+    log_event(LOG_SLOW, clientid, (int)(real / 1000000), cmd);
+    if (__h) {
+      __atomic_add_fetch(&__h->slow, 1, __ATOMIC_RELAXED);
+    }
+  }
+  if (__h == NULL) {
+    return;
+  }
+
+  __atomic_add_fetch(&__h->count, 1, __ATOMIC_RELAXED);
+  __add(__h->real, real / 1000);
+  for (size_t i = 0; i < npipes; i++) {
+    if (pipe[i].usage.spawn_ns) { /* builtins do not spawn */
+      __add(__h->spawn, pipe[i].usage.spawn_ns / 1000);
+    }
+    __add(__h->cpu, pipe[i].usage.utime_us + pipe[i].usage.stime_us);
+  }
+}
+
+size_t
+cmdstats_report(char *buf, size_t size, const Pipeline *pipe, size_t npipes)
+{
+  uint64_t user = 0, sys = 0;
+  size_t len = 0;
+  char cmd[64];
+
+  for (size_t i = 0; i < npipes; i++) {
+    user += pipe[i].usage.utime_us;
+    sys += pipe[i].usage.stime_us;
+  }
+  len += __shelltime(buf + len, size - len, "real", cmdstats_real_ns(pipe, npipes) / 1000);
+  len += __shelltime(buf + len, size - len, "user", user);
+  len += __shelltime(buf + len, size - len, "sys", sys);
+  len += mysnprintf(buf + len, size - len, "%-5s %10s %10s %10s %10s %10s %6s %6s  %s\n", "stage",
+                    "spawn_us", "wall_us", "user_us", "sys_us", "maxrss_kb", "vcsw", "ivcsw", "command");
+
+  for (size_t i = 0; i < npipes && len < size; i++) {
+    const struct stage_usage *u = &pipe[i].usage;
+
+    describe_pipeline(cmd, sizeof cmd, &pipe[i], 1);
+    len += mysnprintf(buf + len, size - len, "%-5zu %10llu %10llu %10llu %10llu %10ld %6ld %6ld  %s\n", i,
+                      (unsigned long long)(u->spawn_ns / 1000), (unsigned long long)(u->wall_ns / 1000),
+                      (unsigned long long)u->utime_us, (unsigned long long)u->stime_us,
+                      u->maxrss_kb, u->nvcsw, u->nivcsw, cmd);
+  }
+  return len < size ? len : size - 1;
+}
+
+size_t
+cmdstats_histograms(char *buf, size_t size)
+{
+  struct cmdhist *h = __h;
+  size_t len;
+  char bound[24];
+
+  if (h == NULL) {
+    return 0;
+  }
+
+  len = mysnprintf(buf, size, "pipelines %llu, slow %llu\n%-10s %12s %12s %12s\n",
+                   (unsigned long long)__atomic_load_n(&h->count, __ATOMIC_RELAXED),
+                   (unsigned long long)__atomic_load_n(&h->slow, __ATOMIC_RELAXED),
+                   "lt_us", "real", "spawn", "cpu");
+  for (unsigned int b = 0; b < CMDSTATS_NBUCKETS && len < size; b++) {
+    uint64_t real = __atomic_load_n(&h->real[b], __ATOMIC_RELAXED);
+    uint64_t spawn = __atomic_load_n(&h->spawn[b], __ATOMIC_RELAXED);
+    uint64_t cpu = __atomic_load_n(&h->cpu[b], __ATOMIC_RELAXED);
+
+    if (real == 0 && spawn == 0 && cpu == 0) {
+      continue;
+    }
+    if (b == CMDSTATS_NBUCKETS - 1) {
+      mystrcpy(bound, "inf");
+    } else {
+      mysnprintf(bound, sizeof bound, "%llu", 1ull << b);
+    }
+    len += mysnprintf(buf + len, size - len, "%-10s %12llu %12llu %12llu\n", bound,
+                      (unsigned long long)real, (unsigned long long)spawn, (unsigned long long)cpu);
+  }
+  return len < size ? len : size - 1;
+}
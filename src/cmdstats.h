@@ -0,0 +1,94 @@
+/**
+ * @file cmdstats.h
+ * @brief Command Timing Histograms And Reports
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef __CMDSTATS_H
+#define __CMDSTATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pipeline.h"
+
+#define CMDSTATS_SLOW_ENV "SHELLSERVE_SLOW_MS" /* log pipelines at least this slow */
+#define CMDSTATS_NBUCKETS 28                   /* powers of two of a microsecond, the last one open */
+
+/**
+ * cmdstats_init() - Create the server-wide histograms.
+ *
+ * Called by the server before it forks sessions, which all add to them.
+ * Without it cmdstats_record() only logs slow pipelines.
+ */
+void cmdstats_init(void);
+
+/**
+ * cmdstats_real_ns() - Wall time of a pipeline that run_pipeline() ran.
+ *
+ * @pipe: the stages, see struct stage_usage
+ * @npipes: number of stages
+ *
+ * Return: from the first stage's start to the last stage's end.
+ */
+uint64_t cmdstats_real_ns(const Pipeline *pipe, size_t npipes)
+  __attribute__((__nonnull__(1)));
+
+/**
+ * cmdstats_record() - Add a pipeline to the histograms.
+ *
+ * @clientid: session id, for the log
+ * @pipe: the stages, see struct stage_usage
+ * @npipes: number of stages
+ *
+ * The pipeline's wall time goes into one histogram, each stage's spawn
+ * latency and CPU time into two more. A pipeline at least as slow as
+ * CMDSTATS_SLOW_ENV milliseconds is logged as LOG_SLOW.
+ */
+void cmdstats_record(int clientid, const Pipeline *pipe, size_t npipes)
+  __attribute__((__nonnull__(2)));
+
+/**
+ * cmdstats_report() - Format what the time keyword prints.
+ *
+ * @buf: receives the report
+ * @size: size of @buf
+ * @pipe: the stages, see struct stage_usage
+ * @npipes: number of stages
+ *
+ * real, user and sys as the shell prints them, then one line per stage.
+ *
+ * Return: length of the text in @buf.
+ */
+size_t cmdstats_report(char *buf, size_t size, const Pipeline *pipe, size_t npipes)
+  __attribute__((__nonnull__(1, 3)));
+
+/**
+ * cmdstats_histograms() - Format the server-wide histograms.
+ *
+ * @buf: receives one line per non-empty bucket
+ * @size: size of @buf
+ *
+ * Return: length of the text in @buf, 0 if cmdstats_init() was not called.
+ */
+size_t cmdstats_histograms(char *buf, size_t size)
+  __attribute__((__nonnull__(1)));
+
+#endif /* __CMDSTATS_H */
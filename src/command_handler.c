@@ -21,7 +21,6 @@
  * along with this program. If not, see <https://www.gnu.org/licenses/>.
  *
  */
-#include <stdio.h> /* for fflush */
 
 #include "globals.h"
 #include "mystring.h"
@@ -29,74 +28,410 @@
 #include "server_core.h"
 #include "command_handler.h"
 #include "pipeline.h"
+#include "bufpool.h"
+#include "debug.h"
+#include "cmdparse.h"
+#include "jobs.h"
+#include "frames.h"
+#include "resultcache.h"
+#include "cmdstats.h"
+#include "transcript.h"
+#include "upload.h"
+#include "download.h"
 
-char argv_alloc[MAX_NUM_ARGS][MAX_LINE_SIZE];
+#include <fcntl.h>
+#include <spawn.h>
+#include <unistd.h>
 
-int
-parse_commandline(char *argv[], char *command_line)
-{
-  char *line;
-  int i;
-  i = 0;
-  for (line = mystrtok(command_line, ' '); i < MAX_NUM_ARGS && line; line = mystrtok(NULL, ' '), i++) {
-    if (line[0] == '\0') {
-      --i;
-      continue; /* skip empty */
+static int __inscript; /* scripts do not nest */
+
+/* one line of an inline script, which may span the reads of the socket */
+static size_t
+script_getline(int fd, char *line, size_t size)
+{
+  size_t len = 0;
+  int c;
+
+  while ((c = mygetchar(fd)) != '\n') {
+    if (c != EOF && len < size - 1) { /* EOF only ends a chunk, the next read blocks */
+      line[len++] = (char)c;
+    }
+  }
+  if (len && line[len-1] == '\r') {
+    len--;
+  }
+  line[len] = '\0';
+  return len;
+}
+
+/* a script's text, in a pool buffer that is swapped for a bigger one as it grows */
+struct script {
+  char *body;
+  size_t size;
+  size_t used;
+  int fits;
+  int nlines;
+};
+
+static void
+script_init(struct script *s)
+{
+  s->body = bufpool_get();
+  s->size = BUFPOOL_BUFSIZE;
+  s->used = 0;
+  s->fits = 1;
+  s->nlines = 0;
+}
+
+static void
+script_free(struct script *s)
+{
+  if (s->size == BUFPOOL_BUFSIZE) {
+    bufpool_put(s->body);
+  } else {
+    myfree(s->body, s->size);
+  }
+}
+
+/* add n bytes, doubling the body up to SCRIPT_MAX; past that only fits is cleared */
+static void
+script_add(struct script *s, const char *p, size_t n)
+{
+  size_t size = s->size;
+  char *bigger;
+
+  if (!s->fits) {
+    return;
+  }
+  while (s->used + n > size && size < SCRIPT_MAX) {
+    size *= 2;
+  }
+  if (s->used + n > size) {
+    s->fits = 0;
+    return;
+  }
+  if (size != s->size) {
+    bigger = mymalloc(size);
+    mymemcpy(bigger, s->body, s->used);
+    script_free(s);
+    s->body = bigger;
+    s->size = size;
+  }
+  mymemcpy(s->body + s->used, p, n);
+  s->used += n;
+}
+
+/* the text as consecutive strings, one per line; -1 if it did not fit */
+static int
+script_lines(struct script *s)
+{
+  if (s->used && s->body[s->used-1] != '\n') {
+    script_add(s, "\n", 1);
+  }
+  if (!s->fits) {
+    return -1;
+  }
+  for (size_t i = 0; i < s->used; i++) {
+    if (s->body[i] == '\n') {
+      s->body[i] = '\0';
+      if (i && s->body[i-1] == '\r') {
+        s->body[i-1] = '\0';
+      }
+      s->nlines++;
     }
-    mymemset(argv_alloc[i], 0, MAX_LINE_SIZE);
-    mystrcpy(argv_alloc[i], line);
-    argv[i] = argv_alloc[i];
   }
+  return 0;
+}
+
+/*
+ * the lines the client sends after the command: FRAME_STDIN frames up to
+ * an empty one when framed, otherwise lines up to SCRIPT_END. Read to the
+ * end even when they do not fit, so none of them runs as a command.
+ */
+static int
+script_recv(int sockfd, struct script *s)
+{
+  char line[FRAME_MAXLEN]; /* a frame's payload, or a line */
+  struct framehdr hdr;
+  size_t len;
 
-  argv[i] = NULL;
+  for (;;) {
+    if (frames_enabled()) {
+      if (frame_recv_hdr(sockfd, &hdr) == -1 || hdr.type != FRAME_STDIN
+          || frame_read_body(sockfd, line, hdr.len) == -1) {
+        return -1;
+      }
+      if (hdr.len == 0) {
+        break;
+      }
+      transcript_write(line, hdr.len);
+      script_add(s, line, hdr.len);
+      continue;
+    }
+    fdputs(sockfd, SCRIPT_PROMPT);
+    len = script_getline(sockfd, line, MAX_LINE_SIZE);
+    transcript_puts(line);
+    transcript_write("\n", 1);
+    if (mystrcmp(line, SCRIPT_END) == 0) {
+      break;
+    }
+    line[len] = '\n';
+    script_add(s, line, len + 1);
+  }
+  return script_lines(s);
+}
+
+/* a server file; -1 if it cannot be read or does not fit */
+static int
+script_load(const char *path, struct script *s)
+{
+  char chunk[BUFPOOL_BUFSIZE];
+  ssize_t n;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+    return -1;
+  }
+  while (s->fits && (n = read(fd, chunk, sizeof chunk)) > 0) {
+    script_add(s, chunk, n);
+  }
+  close(fd);
+  return script_lines(s);
+}
+
+/* script [-e]: the index of the file operand, argc if none, -1 for a usage error */
+static int
+script_operand(int argc, char **argv)
+{
+  int i = 1;
+
+  while (i < argc && mystrcmp(argv[i], "-e") == 0) {
+    i++;
+  }
+  if (i + 1 < argc || (i < argc && argv[i][0] == '-')) {
+    return -1;
+  }
   return i;
 }
 
-void
+/* a pipeline that reads a script from the client */
+static int
+script_reads_client(const struct cmd_pipeline *pl)
+{
+  return pl->nstages == 1 && !pl->background && mystrcmp(pl->first->argv[0], "script") == 0
+         && script_operand(pl->first->argc, pl->first->argv) == pl->first->argc;
+}
+
+int
+script_inline(const struct cmd_pipeline *list)
+{
+  int n = 0;
+
+  for (const struct cmd_pipeline *pl = list; pl; pl = pl->next) {
+    n += script_reads_client(pl);
+  }
+  return n;
+}
+
+/* read and drop the script of a pipeline that is not run */
+static void
+script_skip(int sockfd)
+{
+  struct script s;
+
+  script_init(&s);
+  script_recv(sockfd, &s);
+  script_free(&s);
+}
+
+int
+runscript(ClientData * const client, int argc, char **argv)
+{
+  const char *path = NULL;
+  struct script s;
+  char *line, *next;
+  int errexit, i, status = 0, loaded;
+
+  if ((i = script_operand(argc, argv)) == -1) {
+    frame_printf(client->clientfd, FRAME_STDERR, 0, "usage: script [-e] [file]\n");
+    return 2;
+  }
+  errexit = i > 1;
+  path = i < argc ? argv[i] : NULL;
+  if (__inscript) {
+    frame_printf(client->clientfd, FRAME_STDERR, 0, "script: scripts do not nest\n");
+    return 2;
+  }
+
+  script_init(&s);
+  loaded = path ? script_load(path, &s) : script_recv(client->clientfd, &s);
+  if (loaded == -1) {
+    frame_printf(client->clientfd, FRAME_STDERR, 0, "script: %s: cannot read, or longer than %d bytes\n",
+                 path ? path : "stdin", SCRIPT_MAX - 1);
+    script_free(&s);
+    return 1;
+  }
+
+  __inscript = 1;
+  for (i = 1, line = s.body; i <= s.nlines; i++, line = next) {
+    next = line + mystrlen(line) + 1; /* before the parser cuts the line into words */
+    if (*line == '\0' || *line == '#') {
+      continue;
+    }
+    status = runcommand(client, line);
+    if (errexit && status != 0) {
+      frame_printf(client->clientfd, FRAME_STDERR, 0, "script: line %d: exit status %d\n", i, status);
+      break;
+    }
+  }
+  __inscript = 0;
+  script_free(&s);
+  return status;
+}
+
+int
 runcommand(ClientData * const client, char *readbuf)
 {
-  int npipes;
+  struct arena arena;
+  struct cmd_pipeline *list;
+  const char *err;
+  Pipeline *pipe;
+  int npipes, status = 0, upload;
+  char name[MAX_PATH_SIZE], *mem;
 
-  Pipeline pipe[MAX_NUM_ARGS];
+  /* the client takes such a line's file itself, unless a script runs it */
+  if (!__inscript && download_line(readbuf, name, sizeof name, NULL)) {
+    return download_send(client->clientfd, name);
+  }
+
+  mem = bufpool_get();
+  arena_init(&arena, mem, BUFPOOL_BUFSIZE);
+  if (cmd_parse(readbuf, &arena, &list, &err) == -1) {
+    frame_printf(client->clientfd, FRAME_STDERR, 0, "%s\n", err);
+    bufpool_put(mem);
+    return 2; /* the shell's status for a syntax error */
+  }
+  /* the client streams after such a line, unless a script runs it */
+  upload = !__inscript && upload_pipeline(list);
+  if (upload && list->background) {
+    upload_recv(client->clientfd, -1);
+    frame_printf(client->clientfd, FRAME_STDERR, 0, "%s: an upload cannot run in the background\n", UPLOAD_COMMAND);
+    bufpool_put(mem);
+    return 2;
+  }
+  /* a framed line is followed by one stream at most, see upload_send() */
+  if (frames_enabled() && !__inscript && script_inline(list) > !upload) {
+    if (upload) {
+      upload_recv(client->clientfd, -1);
+    }
+    frame_printf(client->clientfd, FRAME_STDERR, 0, "script: only one script or upload can follow a line\n");
+    bufpool_put(mem);
+    return 2;
+  }
+
+  for (struct cmd_pipeline *pl = list; pl; pl = pl->next) {
+    if ((pl->join == JOIN_AND && status != 0) || (pl->join == JOIN_OR && status == 0)) {
+      if (!__inscript && script_reads_client(pl)) {
+        script_skip(client->clientfd); /* its lines must not run as commands */
+      }
+      continue;
+    }
+    if (pl->nstages == 1 && !pl->background && mystrcmp(pl->first->argv[0], "script") == 0) {
+      status = runscript(client, pl->first->argc, pl->first->argv);
+      continue;
+    }
+    if ((pipe = arena_alloc(&arena, pl->nstages * sizeof(*pipe))) == NULL) {
+      if (upload && pl == list) {
+        upload_recv(client->clientfd, -1);
+      }
+      frame_printf(client->clientfd, FRAME_STDERR, 0, "command line too long\n");
+      status = 2;
+      break;
+    }
+    npipes = build_pipeline(pipe, pl, client->clientfd);
+    pipe[0].upload = upload && pl == list;
+    if (pl->background) {
+      status = jobs_start(pipe, npipes) ? 0 : 1;
+      continue;
+    }
+    /* a timed pipeline really runs */
+    if (!pl->timed && resultcache_serve(pipe, npipes, client->clientfd)) {
+      status = 0;
+      continue;
+    }
+    status = run_pipeline(pipe, npipes);
+    resultcache_store(status);
+    cmdstats_record(client->clientid, pipe, npipes);
+    if (pl->timed) {
+      char *report = bufpool_get();
+      frame_send(client->clientfd, FRAME_STDERR, 0, report, cmdstats_report(report, BUFPOOL_BUFSIZE, pipe, npipes));
+      bufpool_put(report);
+    }
+    debugf(PIPELINEDEBUG, DBG_INFO, "%s exited %d\n", pipe[0].argv[0], status);
+  }
+  bufpool_put(mem);
+  return status;
+}
+
+/* file actions only fail for lack of memory */
+static void
+check_action(int err)
+{
+  if (err != 0) {
+    printerr_exit("posix_spawn_file_actions error\n");
+  }
+}
 
-  init_pipelines(pipe, client->clientfd);
-  npipes = build_pipeline(pipe, client, readbuf);
-  run_pipeline(pipe, npipes);
+void
+dup2_not_first_command(posix_spawn_file_actions_t *fa, Pipeline *pipe, int i)
+{
+  debugf(PIPELINEDEBUG, DBG_TRACE, "stdin <- pipe[%d]\n", i - 1);
+  check_action(posix_spawn_file_actions_adddup2(fa, pipe[i-1].fd[READ_END], sys_stdin));
 }
 
 void
-dup2_not_first_command(Pipeline *pipe, int i)
+dup2_not_last_command(posix_spawn_file_actions_t *fa, Pipeline *pipe, int i)
 {
-  printf("in i != 0\n");
-  mydup2(pipe[i-1].fd[READ_END], sys_stdin);
+  debugf(PIPELINEDEBUG, DBG_TRACE, "stdout -> pipe[%d]\n", i);
+  check_action(posix_spawn_file_actions_adddup2(fa, pipe[i].fd[WRITE_END], sys_stdout));
 }
 
 void
-dup2_not_last_command(Pipeline *pipe, int i)
+dup2_last_command(posix_spawn_file_actions_t *fa, Pipeline *pipe, int i)
 {
-  printf("in i < npipes-1\n");
-  mydup2(pipe[i].fd[WRITE_END], sys_stdout);
+  debugf(PIPELINEDEBUG, DBG_TRACE, "stdout -> socket %d\n", pipe[i].sockfd);
+  check_action(posix_spawn_file_actions_adddup2(fa, pipe[i].sockfd, sys_stdout));
 }
 
 void
-dup2_last_command(Pipeline *pipe, int i)
+do_dup2_command(posix_spawn_file_actions_t *fa, Pipeline *pipe, size_t npipes, int i)
 {
-  printf("in i == npipes-1\n");
-  mydup2(pipe[i].sockfd, sys_stdout);
+  if (i != 0) dup2_not_first_command(fa, pipe, i);
+  if (i < npipes-1) dup2_not_last_command(fa, pipe, i);
+  else dup2_last_command(fa, pipe, i);
 }
 
 void
-do_dup2_command(Pipeline *pipe, size_t npipes, int i)
+dup2_redirect(posix_spawn_file_actions_t *fa, Pipeline *pipe)
 {
-  if (i != 0) dup2_not_first_command(pipe, i); 
-  if (i < npipes-1) dup2_not_last_command(pipe, i);
-  else dup2_last_command(pipe, i);
+  if (pipe->redir[READ_END] != -1) {
+    debugf(PIPELINEDEBUG, DBG_TRACE, "stdin <- %s\n", pipe->fin);
+    check_action(posix_spawn_file_actions_adddup2(fa, pipe->redir[READ_END], sys_stdin));
+  }
+  if (pipe->redir[WRITE_END] != -1) {
+    debugf(PIPELINEDEBUG, DBG_TRACE, "stdout -> %s\n", pipe->fout);
+    check_action(posix_spawn_file_actions_adddup2(fa, pipe->redir[WRITE_END], sys_stdout));
+  }
 }
 
 void
-dup2_and_close(Pipeline *pipe, size_t npipes, int i)
+dup2_and_close(posix_spawn_file_actions_t *fa, Pipeline *pipe, size_t npipes, int i)
 {
-  do_dup2_command(pipe, npipes, i);
-  close_pipes(pipe, npipes);
-  close(pipe[i].sockfd);
+  do_dup2_command(fa, pipe, npipes, i);
+  for (int j = 0; j < npipes; j++) {
+    check_action(posix_spawn_file_actions_addclose(fa, pipe[j].fd[READ_END]));
+    check_action(posix_spawn_file_actions_addclose(fa, pipe[j].fd[WRITE_END]));
+  }
+  check_action(posix_spawn_file_actions_addclose(fa, pipe[i].sockfd));
+  dup2_redirect(fa, &pipe[i]);
 }
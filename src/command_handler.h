@@ -24,26 +24,27 @@
 #ifndef __COMMAND_HANDLER_H
 #define __COMMAND_HANDLER_H
 
+#include <spawn.h>
+
 #include "globals.h"
 #include "server_core.h"
 
-/**
- * argv_alloc - Global 2D character array for command arguments
- *
- * This 2D array is used to store individual argument strings for commands.
- * Each row represents an argument, and each column represents a character in
- * that argument.
- */
-extern char argv_alloc[MAX_NUM_ARGS][MAX_LINE_SIZE];
+#define SCRIPT_END "."     /* ends a script sent after the command */
+#define SCRIPT_PROMPT "> " /* asks for the next line of it, unless framed */
+#define SCRIPT_MAX 0x100000 /* bytes of a script, it is held in memory */
+
+struct cmd_pipeline;
 
 /**
  * struct __Pipeline - Pipeline structure to manage command pipelines
  * @argv: Array to hold pointers to argument strings for the command
  * @fin: File name for input redirection, NULL if not applicable
  * @fout: File name for output redirection, NULL if not applicable
+ * @append: Output redirection appends (>>) rather than truncates (>)
  * @argc: Number of arguments in argv
  * @fd: Array of file descriptors (READ_END, WRITE_END) for the pipe
  * @sockfd: Socket file descriptor for client connection
+ * @pid: Process running the command, once started
  *
  * This structure encapsulates all information needed to manage a single
  * command in a pipeline. It includes the command arguments, file redirection
@@ -51,19 +52,6 @@ extern char argv_alloc[MAX_NUM_ARGS][MAX_LINE_SIZE];
  */
 typedef struct __Pipeline Pipeline;
 
-/**
- * parse_commandline - Parse a command line into an argv array
- * @argv: Array to hold pointers to argument strings
- * @command_line: Command line string to parse
- *
- * Parses a command line string into an array of argument strings.
- * Each token, separated by spaces, becomes an individual argument.
- *
- * Return: Number of arguments parsed.
- */
-int parse_commandline(char **argv, char *command_line)
-  __attribute__((__nonnull__(1, 2)));
-
 /**
  * execcmd - Execute a command using execve()
  * @argv: Array of command arguments
@@ -79,64 +67,123 @@ void execcmd(char *argv[])
  * @client: Client context containing client-specific data
  * @readbuf: Buffer containing the command to run
  *
- * Initializes pipelines, builds them, and then runs the command.
+ * Parses the line, then builds and runs each pipeline in turn, skipping
+ * those whose && or || condition fails. A lone script command runs
+ * runscript(). A line that starts with a streamed upload, see
+ * upload_pipeline(), feeds the upload to its first pipeline. A streamed
+ * download, see download_line(), only sends the file. A pipeline ending
+ * in & becomes a job, see jobs_start(). The parse tree and the pipeline tables live in an
+ * arena borrowed from the buffer pool for the duration.
+ * Syntax errors are reported to the client.
+ *
+ * Return: exit status of the last pipeline run, 2 for a syntax error
+ */
+int runcommand(ClientData * const client, char *readbuf);
+
+/**
+ * runscript - Run the lines of a script as one command
+ * @client: Client context containing client-specific data
+ * @argc: Number of arguments of the script command
+ * @argv: script [-e] [file]
+ *
+ * Runs each line of a file on the server, or of the lines the client sends
+ * after the command, through runcommand(). The client ends them with a
+ * SCRIPT_END line, or when the session is framed sends them as FRAME_STDIN
+ * frames up to an empty one, as for an upload. The output of all of them
+ * goes back as one response, with one exit status. Empty lines and lines
+ * starting with # are skipped. With -e the script stops at the first line
+ * that fails. A script is at most SCRIPT_MAX bytes, and may not run another
+ * script.
+ *
+ * Return: exit status of the last line run, 2 for a usage error
+ */
+int runscript(ClientData * const client, int argc, char **argv)
+  __attribute__((__nonnull__(1, 3)));
+
+/**
+ * script_inline - Count the scripts a command line reads from the client
+ * @list: the parsed command line, see cmd_parse()
+ *
+ * A lone "script" or "script -e" pipeline reads its lines from the client.
+ * A framed line may be followed by one such script, or by an upload; the
+ * mux master streams its stdin as the script's lines when this is 1.
+ *
+ * Return: number of such pipelines in @list
  */
-void runcommand(ClientData * const client, char *readbuf);
+int script_inline(const struct cmd_pipeline *list);
 
 /**
- * dup2_and_close - Redirects I/O and closes unneeded pipes
+ * dup2_redirect - Add the file redirections of a command
+ * @fa: File actions of the command's spawn
+ * @pipe: Pipeline structure of the command
+ *
+ * Puts the < and > / >> files of the command, which the session has
+ * opened into @pipe->redir, onto stdin and stdout, after the pipe
+ * redirections so the files take precedence.
+ */
+void dup2_redirect(posix_spawn_file_actions_t *fa, Pipeline *pipe)
+  __attribute__((__nonnull__(1, 2)));
+
+/**
+ * dup2_and_close - Describe the I/O plumbing of one pipeline command
+ * @fa: File actions of the command's spawn
  * @pipe: Pipeline structure array
  * @npipes: Number of pipes in the pipeline
  * @i: Index of the current command in the pipeline
  *
- * Redirects the I/O for a specific command in the pipeline and
- * closes all unnecessary file descriptors.
+ * Adds the dup2 actions that connect the command to its neighbours, the
+ * closes of every pipe and the socket, then its file redirections. The
+ * child runs them in order between clone and exec.
  */
-void dup2_and_close(Pipeline *pipe, size_t npipes, int i)
-  __attribute__((__nonnull__(1)));
+void dup2_and_close(posix_spawn_file_actions_t *fa, Pipeline *pipe, size_t npipes, int i)
+  __attribute__((__nonnull__(1, 2)));
 
 /**
  * do_dup2_command - Dup2 handling for a pipeline command
+ * @fa: File actions of the command's spawn
  * @pipe: Pipeline structure array
  * @npipes: Number of pipes in the pipeline
  * @i: Index of the current command in the pipeline
  *
- * Handles dup2() calls for file descriptor redirection for a
+ * Adds the dup2() actions for file descriptor redirection for a
  * specific command in the pipeline.
  */
-void do_dup2_command(Pipeline *pipe, size_t npipes, int i)
-  __attribute__((__nonnull__(1)));
+void do_dup2_command(posix_spawn_file_actions_t *fa, Pipeline *pipe, size_t npipes, int i)
+  __attribute__((__nonnull__(1, 2)));
 
 /**
  * dup2_last_command - Handle last command in a pipeline
+ * @fa: File actions of the command's spawn
  * @pipe: Pipeline structure array
  * @i: Index of the last command in the pipeline
  *
  * Redirects stdout to the socket for the last command in the pipeline.
  */
-void dup2_last_command(Pipeline *pipe, int i)
-  __attribute__((__nonnull__(1)));
+void dup2_last_command(posix_spawn_file_actions_t *fa, Pipeline *pipe, int i)
+  __attribute__((__nonnull__(1, 2)));
 
 /**
  * dup2_not_last_command - Handle non-last commands in a pipeline
+ * @fa: File actions of the command's spawn
  * @pipe: Pipeline structure array
  * @i: Index of the current non-last command in the pipeline
  *
  * Redirects stdout to the write end of the pipe for commands that
  * are not the last in the pipeline.
  */
-void dup2_not_last_command(Pipeline *pipe, int i)
-  __attribute__((__nonnull__(1)));
+void dup2_not_last_command(posix_spawn_file_actions_t *fa, Pipeline *pipe, int i)
+  __attribute__((__nonnull__(1, 2)));
 
 
 /**
  * dup2_not_first_command - Handle non-first commands in a pipeline
+ * @fa: File actions of the command's spawn
  * @pipe: Pipeline structure array
  * @i: Index of the current non-first command in the pipeline
  *
  * Redirects stdin from the read end of the previous pipe.
  */
-void dup2_not_first_command(Pipeline *pipe, int i)
-  __attribute__((__nonnull__(1)));
+void dup2_not_first_command(posix_spawn_file_actions_t *fa, Pipeline *pipe, int i)
+  __attribute__((__nonnull__(1, 2)));
 
 #endif // __COMMAND_HANDLER_H
@@ -0,0 +1,50 @@
+/**
+ * @file cpufeatures.c
+ * @brief Runtime CPU Feature Detection
+ *
+ * This file implements the cached CPUID query used by the SIMD dispatch code.
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "cpufeatures.h"
+
+unsigned int
+cpu_features(void)
+{
+  static int probed = 0;
+  static unsigned int features = 0;
+
+  if (probed) {
+    return features;
+  }
+
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2")) {
+    features |= CPU_SSE2;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    features |= CPU_AVX2;
+  }
+#endif
+
+  probed = 1;
+  return features;
+}
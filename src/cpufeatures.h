@@ -0,0 +1,51 @@
+/**
+ * @file cpufeatures.h
+ * @brief Runtime CPU Feature Detection
+ *
+ * This file declares the helpers used to pick the fastest implementation of a
+ * primitive for the machine we are running on. Detection happens once and the
+ * result is cached.
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef __CPUFEATURES_H
+#define __CPUFEATURES_H
+
+/**
+ * enum cpufeature - Instruction set extensions we dispatch on
+ * @CPU_SSE2: 128 bit integer SIMD, baseline on x86_64
+ * @CPU_AVX2: 256 bit integer SIMD
+ */
+enum cpufeature {
+  CPU_SSE2 = 1 << 0,
+  CPU_AVX2 = 1 << 1,
+};
+
+/**
+ * cpu_features() - Get the instruction set extensions of this CPU.
+ *
+ * The first call queries CPUID, later calls return the cached value.
+ * Always 0 on architectures other than x86.
+ *
+ * Return: bitmask of enum cpufeature values.
+ */
+unsigned int cpu_features(void);
+
+#endif /* __CPUFEATURES_H */
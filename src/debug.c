@@ -0,0 +1,95 @@
+/**
+ * @file debug.c
+ * @brief Runtime Threshold for debugf()
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include "debug.h"
+#include "memscan.h"
+
+#define DEBUG_ALLCATEGORIES ((1u << NDEBUGCATEGORIES) - 1)
+
+int g_debuglevel = DBG_WARN;
+unsigned int g_debugmask = DEBUG_ALLCATEGORIES;
+
+static const char *const __levelnames[] = {
+  [DBG_OFF] = "off",
+  [DBG_ERROR] = "error",
+  [DBG_WARN] = "warn",
+  [DBG_INFO] = "info",
+  [DBG_TRACE] = "trace",
+};
+
+static const char *const __categorynames[NDEBUGCATEGORIES] = {
+  [NONE] = "none",
+  [SYSCALLDEBUG] = "syscall",
+  [SIGNALDEBUG] = "signal",
+  [PIPELINEDEBUG] = "pipeline",
+};
+
+/* index of the @len byte word @s in @names, -1 if absent */
+static int
+__debug_lookup(const char *const names[], int n, const char *s, size_t len)
+{
+  for (int i = 0; i < n; i++) {
+    if (mystrlen(names[i]) == len && mystrncmp(names[i], s, len) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int
+debug_init(const char *spec)
+{
+  const char *end;
+  int level;
+  unsigned int mask = DEBUG_ALLCATEGORIES;
+
+  if (spec == NULL) {
+    return 0;
+  }
+
+  end = mystrchrnul(spec, ':');
+  level = __debug_lookup(__levelnames, DBG_TRACE + 1, spec, end - spec);
+  if (level == -1) {
+    return -1;
+  }
+
+  if (*end == ':') {
+    mask = 0;
+    for (spec = end + 1; ; spec = end + 1) {
+      int cat;
+
+      end = mystrchrnul(spec, ',');
+      if ((cat = __debug_lookup(__categorynames, NDEBUGCATEGORIES, spec, end - spec)) == -1) {
+        return -1;
+      }
+      mask |= 1u << cat;
+      if (*end == '\0') {
+        break;
+      }
+    }
+  }
+
+  g_debuglevel = level;
+  g_debugmask = mask;
+  return 0;
+}
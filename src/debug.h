@@ -0,0 +1,75 @@
+/**
+ * @file debug.h
+ * @brief Leveled, Category Aware Debug Tracing
+ *
+ * debugf() statements above DEBUG_LEVEL compile to nothing. Enabled ones cost
+ * a load and compare against the runtime threshold, which is set from the
+ * SHELLSERVE_DEBUG environment variable by debug_init().
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef __DEBUG_H
+#define __DEBUG_H
+
+#include "globals.h"
+#include "mystring.h"
+#include "syscalls.h"
+
+#define DEBUG_ENV "SHELLSERVE_DEBUG"
+
+extern int g_debuglevel;         /* runtime threshold, DBG_OFF..DBG_TRACE */
+extern unsigned int g_debugmask; /* bit per enum debug category */
+
+/**
+ * debug_enabled() - True if @cat traces at @level.
+ *
+ * Constant false when @level is above DEBUG_LEVEL, so the guarded code is
+ * dropped at compile time.
+ */
+#define debug_enabled(cat, level)                                       \
+  ((level) <= DEBUG_LEVEL && (level) <= g_debuglevel                    \
+   && (g_debugmask & (1u << (cat))) != 0)
+
+/**
+ * debugf() - Write a trace line to stderr, see myfprintf() for the format.
+ *
+ * @cat: enum debug category
+ * @level: enum debuglevel of the message
+ */
+#define debugf(cat, level, ...)                                         \
+  do {                                                                  \
+    if (debug_enabled(cat, level)) {                                    \
+      myfprintf(sys_stderr, __VA_ARGS__);                               \
+    }                                                                   \
+  } while (0)
+
+/**
+ * debug_init() - Set the runtime threshold and categories.
+ *
+ * @spec: "level[:category,...]", level is one of off, error, warn, info or
+ *        trace and categories are syscall, signal or pipeline. Without a
+ *        category list every category is enabled. NULL leaves the defaults
+ *        (warn, all categories).
+ *
+ * Return: 0 on success, -1 if @spec is malformed, nothing is changed then.
+ */
+int debug_init(const char *spec);
+
+#endif // __DEBUG_H
@@ -0,0 +1,296 @@
+/**
+ * @file download.c
+ * @brief Streamed Downloads Into A Local Command
+ *
+ * get big.log | grep ERROR greps on the client without a copy on its disk.
+ * The server answers the line with the file as frames, even when the
+ * session is not framed, so the client knows where the file ends. The
+ * client splices the payloads into the pipe of a local shell command.
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#define _GNU_SOURCE /* pipe2 */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "download.h"
+#include "frames.h"
+#include "mystring.h"
+#include "syscalls.h"
+#include "serverlog.h"
+
+#define __BLANK(c) ((c) == ' ' || (c) == '\t' || (c) == '\r' || (c) == '\n')
+#define __SHELLCHARS ";&<>()'\"`$\\*?[{~#" /* left to the shell, the line is not a download */
+
+int
+download_line(const char *line, char *name, size_t size, const char **local)
+{
+  const char *p = line, *start;
+  size_t len, cmdlen = sizeof DOWNLOAD_COMMAND - 1;
+
+  for ( ; __BLANK(*p); p++) {
+    ;
+  }
+  if (mystrncmp(p, DOWNLOAD_COMMAND, cmdlen) != 0 || !__BLANK(p[cmdlen])) {
+    return 0;
+  }
+  for (p += cmdlen; __BLANK(*p); p++) {
+    ;
+  }
+  for (start = p; *p && !__BLANK(*p) && *p != '|'; p++) {
+    if (mystrchr(__SHELLCHARS, *p)) {
+      return 0;
+    }
+  }
+  if ((len = p - start) == 0 || (name && len >= size)) {
+    return 0;
+  }
+  for ( ; __BLANK(*p); p++) {
+    ;
+  }
+
+  if (local) {
+    *local = NULL;
+  }
+  if (*p == '|') {
+    for (p++; __BLANK(*p); p++) {
+      ;
+    }
+    if (*p == '\0' || *p == '|' || *p == '&') { /* ||, |& and a dangling | are not ours */
+      return 0;
+    }
+    if (local) {
+      *local = p;
+    }
+  } else if (*p != '\0') {
+    return 0;
+  }
+
+  if (name) {
+    mymemcpy(name, start, len);
+    name[len] = '\0';
+  }
+  return 1;
+}
+
+static int
+__waitout(int sockfd)
+{
+  struct pollfd pfd = { sockfd, POLLOUT, 0 };
+
+  return poll(&pfd, 1, -1) == -1 && errno != EINTR ? -1 : 0;
+}
+
+/* all of it, the session may have left the socket non-blocking */
+static int
+__sendall(int sockfd, const void *buf, size_t len, int flags)
+{
+  const char *p = buf;
+  ssize_t w;
+
+  while (len) {
+    if ((w = send(sockfd, p, len, flags)) > 0) {
+      p += w;
+      len -= w;
+    } else if (w == 0 || (errno == EAGAIN && __waitout(sockfd) == -1) || (errno != EAGAIN && errno != EINTR)) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* a frame, whether or not the session is framed; only its header when buf is NULL */
+static int
+__frame(int sockfd, int type, const void *buf, size_t len, int flags)
+{
+  char frame[sizeof(struct framehdr) + FRAME_MAXLEN];
+  struct framehdr *hdr = (struct framehdr *)frame;
+
+  hdr->type = type;
+  hdr->pad = 0;
+  hdr->job = 0;
+  hdr->len = htonl(len);
+  if (buf == NULL) {
+    return __sendall(sockfd, frame, sizeof *hdr, flags);
+  }
+  mymemcpy(frame + sizeof *hdr, buf, len);
+  return __sendall(sockfd, frame, sizeof *hdr + len, flags);
+}
+
+/* the header goes out with the payload after it, the payload from the page cache */
+static int
+__sendfile(int sockfd, int fd, off_t size)
+{
+  char zero[FRAME_MAXLEN] = { 0 };
+  off_t off = 0;
+  size_t left;
+  ssize_t n;
+
+  while (off < size) {
+    left = size - off < FRAME_MAXLEN ? size - off : FRAME_MAXLEN;
+    if (__frame(sockfd, FRAME_STDOUT, NULL, left, MSG_MORE) == -1) {
+      return -1;
+    }
+    while (left) {
+      if ((n = sendfile(sockfd, fd, &off, left)) > 0) {
+        left -= n;
+      } else if (n == 0) {
+        /* the file shrank, fill the frame so the client stays in step */
+        __sendall(sockfd, zero, left, 0);
+        errno = EIO;
+        return -1;
+      } else if ((errno == EAGAIN && __waitout(sockfd) == -1) || (errno != EAGAIN && errno != EINTR)) {
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+/* pipes and devices, whose size is not known */
+static int
+__copy(int sockfd, int fd)
+{
+  char buf[FRAME_MAXLEN];
+  ssize_t n;
+
+  while ((n = read(fd, buf, sizeof buf)) != 0) {
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    if (__frame(sockfd, FRAME_STDOUT, buf, n, 0) == -1) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int
+download_send(int sockfd, const char *name)
+{
+  char msg[FRAME_MAXLEN];
+  struct stat st;
+  int fd, status = 0;
+  uint32_t s;
+
+  log_event(LOG_REQUEST, 0, 0, DOWNLOAD_COMMAND);
+  if ((fd = open(name, O_RDONLY | O_CLOEXEC)) == -1 || fstat(fd, &st) == -1
+      || (S_ISREG(st.st_mode) ? __sendfile(sockfd, fd, st.st_size) : __copy(sockfd, fd)) == -1) {
+    mysnprintf(msg, sizeof msg, "%s: %s: %s\n", DOWNLOAD_COMMAND, name, strerror(errno));
+    __frame(sockfd, FRAME_STDERR, msg, mystrlen(msg), 0);
+    status = 1;
+  }
+  if (fd != -1) {
+    close(fd);
+  }
+  if (!frames_enabled()) {
+    s = htonl(status);
+    __frame(sockfd, FRAME_EXIT, &s, sizeof s, 0);
+  }
+  return status;
+}
+
+/* sh -c cmd reading a pipe; its write end in *fd */
+static pid_t
+__consumer(const char *cmd, int outfd, int errfd, int *fd)
+{
+  int p[2];
+  pid_t pid;
+
+  if (pipe2(p, O_CLOEXEC) == -1) {
+    return -1;
+  }
+  if ((pid = myfork()) == 0) {
+    dup2(p[0], STDIN_FILENO);
+    dup2(outfd, STDOUT_FILENO);
+    dup2(errfd, STDERR_FILENO);
+    execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+    _exit(127);
+  }
+  close(p[0]);
+  *fd = p[1];
+  return pid;
+}
+
+int
+download_recv(struct MyIO *io, int errfd, int *status)
+{
+  struct sigaction ign = { .sa_handler = SIG_IGN }, old;
+  struct framehdr hdr;
+  const char *local;
+  int fd = io->writefd, r, wstatus;
+  pid_t pid = 0;
+
+  if (!download_line(io->buf, NULL, 0, &local)) {
+    return 0;
+  }
+  if (errfd == -1) {
+    errfd = sys_stderr;
+  }
+  if (local && (pid = __consumer(local, io->writefd, errfd, &fd)) == -1) {
+    myfprintf(errfd, "%s: cannot start %s: %s\n", DOWNLOAD_COMMAND, local, strerror(errno));
+    fd = -1; /* the download is dropped */
+  }
+
+  /* a consumer that quits early must not take the client with it */
+  sigaction(SIGPIPE, &ign, &old);
+  for (;;) {
+    if (frame_recv_hdr(io->sockfd, &hdr) == -1) {
+      r = -1;
+    } else if (hdr.type == FRAME_STDOUT && hdr.job == 0) {
+      r = frame_splice(io->sockfd, &fd, hdr.len);
+    } else {
+      r = frame_relay_body(io->sockfd, &hdr, io->writefd, errfd, status);
+    }
+    if (r != 0) {
+      break;
+    }
+  }
+  sigaction(SIGPIPE, &old, NULL);
+  if (r == -1) {
+    *status = -1;
+  }
+
+  if (pid > 0) {
+    if (fd != -1) {
+      close(fd);
+    }
+    while (waitpid(pid, &wstatus, 0) == -1 && errno == EINTR) {
+      ;
+    }
+    if (r == 1) {
+      *status = WIFSIGNALED(wstatus) ? 128 + WTERMSIG(wstatus) : WEXITSTATUS(wstatus);
+    }
+  }
+  return 1;
+}
@@ -0,0 +1,89 @@
+/**
+ * @file download.h
+ * @brief Streamed Downloads Into A Local Command
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef __DOWNLOAD_H
+#define __DOWNLOAD_H
+
+#include <stddef.h>
+
+#include "filetransfer.h"
+
+#define DOWNLOAD_COMMAND "get" /* get file [| local command] */
+
+/**
+ * download_line() - Whether a command line is a streamed download.
+ *
+ * @line: the line as typed
+ * @name: receives the file operand, may be NULL
+ * @size: size of @name
+ * @local: receives the local command after the |, NULL when there is none
+ *         and the file goes to stdout; may be NULL
+ *
+ * The line is DOWNLOAD_COMMAND, one file operand without quotes or shell
+ * characters, and optionally | and a command for the client's shell. It is
+ * looked at as text, the local command is not the server's to parse.
+ * Client and server both decide with this, so they agree on when the
+ * server streams the file instead of running the line.
+ *
+ * Return: 1 if it is, 0 if not
+ */
+int download_line(const char *line, char *name, size_t size, const char **local)
+  __attribute__((__nonnull__(1)));
+
+/**
+ * download_send() - Stream a file to the client, on the server.
+ *
+ * @sockfd: the client socket
+ * @name: the file, relative to the session's working directory
+ *
+ * The file goes out as FRAME_STDOUT frames whether or not the session is
+ * framed, a regular file with sendfile(2). Errors go out as FRAME_STDERR
+ * frames. An unframed session ends the stream with its own FRAME_EXIT
+ * frame, a framed one with the exit frame of the request.
+ *
+ * Return: 0, or 1 if the file could not be read
+ */
+int download_send(int sockfd, const char *name)
+  __attribute__((__nonnull__(2)));
+
+/**
+ * download_recv() - Take a streamed download into a local command or stdout.
+ *
+ * @io: the session; @io->buf holds the line just sent and @io->writefd is
+ *      stdout
+ * @errfd: where stderr goes, -1 for the client's
+ * @status: receives the local command's exit status, or the download's
+ *          when there is no local command; -1 if the server hung up
+ *
+ * The local command runs under /bin/sh with the download on its stdin.
+ * Payloads are spliced from the socket into its pipe, so a consumer that
+ * falls behind stops the reads and TCP pushes back on the server; nothing
+ * is written to disk. Once it stops reading the rest is dropped, so the
+ * session stays in step with the server.
+ *
+ * Return: 1 if the line was a streamed download, 0 if not and nothing was read
+ */
+int download_recv(struct MyIO *io, int errfd, int *status)
+  __attribute__((__nonnull__(1, 3)));
+
+#endif /* __DOWNLOAD_H */
@@ -23,6 +23,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 #include <linux/limits.h>
 
 #include "globals.h"
@@ -32,8 +33,12 @@
 #include "mystring.h"
 #include "syscalls.h"
 #include "client_core.h"
+#include "udptransfer.h"
+#include "bufpool.h"
+#include "serverlog.h"
+#include "frames.h"
 
-const char *const commandlist = "put\nget\ndel\nhelp\n";
+const char *const commandlist = "put\nget\nuget\ndel\nhelp\n";
 
 void
 initiostruct(int sockfd, int readfd, int writefd, struct MyIO *io)
@@ -41,14 +46,29 @@ initiostruct(int sockfd, int readfd, int writefd, struct MyIO *io)
   io->sockfd = sockfd;
   io->readfd = readfd;
   io->writefd = writefd;
+  io->buf = NULL;
   io->bufsize = MAX_DATA_SIZE;
-  mymemset(io->buf, 0, io->bufsize);
+}
+
+void
+io_attach(struct MyIO *io)
+{
+  if (io->buf == NULL) {
+    io->buf = bufpool_get();
+  }
+}
+
+void
+io_detach(struct MyIO *io)
+{
+  bufpool_put(io->buf);
+  io->buf = NULL;
 }
 
 int
 openfile_getfd_fromclient(struct MyIO *io, int flags, int mode)
 {
-  myfprintf(io->sockfd, "filename: ");
+  fdputs(io->sockfd, FILENAME_PROMPT);
   fflush(NULL);
   do_poll(io->sockfd);
   myreadline(io->sockfd, io->buf, io->bufsize-1);
@@ -74,7 +94,7 @@ serverhandleget(struct MyIO *io)
 {
   int oldfd = io->readfd;
 
-  myfprintf(io->writefd, "client:: get\n");
+  log_event(LOG_REQUEST, 0, 0, "get");
   io->readfd = openfile_getfd_fromclient(io, O_RDONLY, 0);
   sendfile_tosocket(io);
 
@@ -87,24 +107,49 @@ void
 serverhandleput(struct MyIO *io)
 {
   int oldfd = io->writefd;
-  myfprintf(io->writefd, "client:: put\n");
+  log_event(LOG_REQUEST, 0, 0, "put");
   io->writefd = openfile_getfd_fromclient(io, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
   readbytes_fromsocket(io, NETREADMAX-1);
   closewritefd_restoreoldfd(oldfd, io);
 }
 
+void
+serverhandleuget(struct MyIO *io)
+{
+  int oldfd = io->readfd, udpfd, port;
+  uint64_t token = udp_token();
+  struct stat st;
+
+  log_event(LOG_REQUEST, 0, 0, "uget");
+  io->readfd = openfile_getfd_fromclient(io, O_RDONLY, 0);
+  if (fstat(io->readfd, &st) == -1) {
+    printerr_exit("fstat() error\n");
+  }
+
+  udpfd = udp_listen(io->sockfd, &port);
+  myfprintf(io->sockfd, "udp %d %llu %llu\n", port, (unsigned long long)st.st_size, (unsigned long long)token);
+  if (udp_accept_hello(udpfd, io->sockfd, token) == 0) {
+    udp_sendfile(udpfd, io->readfd, NULL);
+  }
+  myclose(udpfd);
+
+  /* wait for send confirmation */
+  myreadline(io->sockfd, io->buf, io->bufsize-1);
+  closereadfd_restoreoldfd(oldfd, io);
+}
+
 void
 serverhandlehelp(struct MyIO *io)
 {
-  myfprintf(io->readfd, "client:: help\n");
-  mysckwrite(io->sockfd, commandlist, mystrlen(commandlist));
+  log_event(LOG_REQUEST, 0, 0, "help");
+  frame_send(io->sockfd, FRAME_STDOUT, 0, commandlist, mystrlen(commandlist));
 }
 
 void
 serverhandleexit(struct MyIO *io)
 {
-  myfprintf(io->writefd, "client:: exit\n");
-  _exit(0); /* TODO: Do this cleanly */
+  log_event(LOG_REQUEST, 0, 0, "exit");
+  myexit(0); /* TODO: Do this cleanly */
 }
 
 void
@@ -119,10 +164,10 @@ init_clienthandleget(char *savename, struct MyIO *io, size_t savenamelen)
 void
 read_prompt_clienthandle(struct MyIO *io)
 {
-  /* get the clienthandle prompt */
-  do_poll(io->sockfd);
-  myreadline(io->sockfd, io->buf, io->bufsize-1);
-  myfprintf(io->writefd, io->buf);
+  static const char * const prompts[] = { FILENAME_PROMPT, NULL };
+
+  /* get the clienthandle prompt, it may arrive split over several reads */
+  relay_until_prompt(io->sockfd, io->writefd, prompts, 1);
 }
 
 int
@@ -222,6 +267,44 @@ clienthandleget(struct MyIO *io)
   getfile_fromserver(savename, io, NETREADMAX-1);
 }
 
+void
+clienthandleuget(struct MyIO *io)
+{
+  char savename[NETREADMAX+1], *p;
+  int oldfd = io->writefd, udpfd, port = 0;
+  uint64_t size = 0, token = 0;
+  size_t nread;
+
+  init_clienthandleget(savename, io, NETREADMAX+1);
+  read_prompt_clienthandle(io);
+
+  nread = myreadline(io->readfd, io->buf, io->bufsize-1);
+  io->writefd = create_savefile_getfd(savename, io);
+  send_filename_toserver(io, nread);
+
+  /* "udp PORT SIZE TOKEN" */
+  do_poll(io->sockfd);
+  myreadline(io->sockfd, io->buf, io->bufsize-1);
+  for (p = io->buf + 4; *p >= '0' && *p <= '9'; p++) {
+    port = port * 10 + (*p - '0');
+  }
+  for (p++; *p >= '0' && *p <= '9'; p++) {
+    size = size * 10 + (*p - '0');
+  }
+  for (p++; *p >= '0' && *p <= '9'; p++) {
+    token = token * 10 + (*p - '0');
+  }
+
+  udpfd = udp_connect(io->sockfd, port);
+  if (udp_recvfile(udpfd, io->writefd, size, token) == -1) {
+    fdputs(sys_stderr, "uget: transfer timed out\n");
+  }
+  myclose(udpfd);
+
+  mysckwrite(io->sockfd, "\n", 1);
+  closewritefd_restoreoldfd(oldfd, io);
+}
+
 void
 clienthandleput(struct MyIO *io)
 {
@@ -254,6 +337,8 @@ runfiletransfer(struct MyIO *io, void(*ftpcallback[NCALLBACK])(struct MyIO*))
     ftpcallback[HELP](io);
   } else if((ran_custom_command_flag = mystrcmp(io->buf, "exit")) == 0) {
     ftpcallback[EXIT](io);
+  } else if((ran_custom_command_flag = mystrcmp(io->buf, "uget")) == 0) {
+    ftpcallback[UGET](io);
   }
 
   return ran_custom_command_flag;
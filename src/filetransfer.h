@@ -25,12 +25,15 @@
 
 #include "globals.h"
 
+#define FILENAME_PROMPT "filename: "
+
 /**
  * struct MyIO - Structure for encapsulating I/O operations
  * @sockfd:   Socket file descriptor for network operations
  * @readfd:   File descriptor for read operations
  * @writefd:  File descriptor for write operations
- * @buf:      Buffer for storing data temporarily
+ * @buf:      Buffer for storing data temporarily, borrowed from bufpool.c
+ *            with io_attach() and NULL while the session is idle
  * @bufsize:  Size of the buffer
  *
  * This structure is a collection of various I/O parameters required
@@ -38,7 +41,7 @@
  */
 struct MyIO {
   int sockfd, readfd, writefd;
-  char buf[MAX_DATA_SIZE];
+  char *buf;
   size_t bufsize;
 };
 
@@ -48,6 +51,7 @@ struct MyIO {
  * @PUT:    Command for putting files
  * @HELP:   Command for displaying help
  * @EXIT:   Command for exiting
+ * @UGET:   Command for getting files over the UDP data channel
  * @NCALLBACK: Sentinel value for the number of FTP commands
  *
  * This enumeration lists all FTP commands that can be handled by the system.
@@ -57,6 +61,7 @@ enum FTPCALLBACK {
   PUT,
   HELP,
   EXIT,
+  UGET,
   NCALLBACK,
 };
 
@@ -91,12 +96,28 @@ int runfiletransfer(struct MyIO *io, void(*ftpcallback[NCALLBACK])(struct MyIO*)
  * @writefd: File descriptor for writing
  * @io:      Pointer to the MyIO structure to initialize
  *
- * This function initializes the MyIO structure with the given parameters,
- * sets the buffer size to MAX_DATA_SIZE and clears the buffer.
+ * This function initializes the MyIO structure with the given parameters
+ * and sets the buffer size to MAX_DATA_SIZE. No buffer is attached.
  */
 void initiostruct(int sockfd, int readfd, int writefd, struct MyIO *io)
   __attribute__((__nonnull__(4)));
 
+/**
+ * io_attach() - Borrow a zeroed buffer for @io from the buffer pool
+ * @io: Pointer to the MyIO structure
+ *
+ * Does nothing if a buffer is already attached.
+ */
+void io_attach(struct MyIO *io)
+  __attribute__((__nonnull__(1)));
+
+/**
+ * io_detach() - Hand the buffer of @io back to the buffer pool
+ * @io: Pointer to the MyIO structure
+ */
+void io_detach(struct MyIO *io)
+  __attribute__((__nonnull__(1)));
+
 /**
  * openfile_getfd_fromclient() - Obtain file descriptor from client-side
  * @io: Pointer to the MyIO structure containing buffer information
@@ -138,6 +159,17 @@ void serverhandleget(struct MyIO *io)
 void serverhandleput(struct MyIO *io)
   __attribute__((__nonnull__(1)));
 
+/**
+ * serverhandleuget() - Handles UGET requests from the client
+ * @io: Pointer to the MyIO structure
+ *
+ * Like serverhandleget() but the data goes over a UDP channel. The port,
+ * file size and a random token are sent over the control connection as
+ * "udp PORT SIZE TOKEN". Only the client's HELLO with the token gets the file.
+ */
+void serverhandleuget(struct MyIO *io)
+  __attribute__((__nonnull__(1)));
+
 /**
  * serverhandlehelp() - Sends help text to the client
  * @io: Pointer to the MyIO structure
@@ -170,6 +202,9 @@ void clienthandleget(struct MyIO *io)
 void clienthandleput(struct MyIO *io)
   __attribute__((__nonnull__(1)));
 
+void clienthandleuget(struct MyIO *io)
+  __attribute__((__nonnull__(1)));
+
 void clienthandlehelp(struct MyIO *io)
   __attribute__((__nonnull__(1)));
 
@@ -0,0 +1,288 @@
+/**
+ * @file frames.c
+ * @brief Framed Command Output
+ *
+ * Each frame goes out with a single write, header and payload together, so
+ * frames from the session and from its relays never interleave mid-frame.
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#define _GNU_SOURCE /* splice */
+
+#include <arpa/inet.h> /* htonl */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#include "frames.h"
+#include "mystring.h"
+#include "syscalls.h"
+
+static int __framed = 0;
+
+void
+frames_enable(int on)
+{
+  __framed = on != 0;
+}
+
+int
+frames_enabled(void)
+{
+  return __framed;
+}
+
+static void
+__send(int fd, int type, int job, const void *buf, size_t len)
+{
+  char frame[sizeof(struct framehdr) + FRAME_MAXLEN];
+  struct framehdr *hdr = (struct framehdr *)frame;
+
+  hdr->type = type;
+  hdr->pad = 0;
+  hdr->job = htons(job);
+  hdr->len = htonl(len);
+  mymemcpy(frame + sizeof *hdr, buf, len);
+  mysckwrite(fd, frame, sizeof *hdr + len);
+}
+
+void
+frame_send(int fd, int type, int job, const void *buf, size_t len)
+{
+  const char *p = buf;
+  size_t n;
+
+  if (!__framed) {
+    if (len) {
+      mysckwrite(fd, buf, len);
+    }
+    return;
+  }
+  for (; len; p += n, len -= n) {
+    n = len < FRAME_MAXLEN ? len : FRAME_MAXLEN;
+    __send(fd, type, job, p, n);
+  }
+}
+
+void
+frame_printf(int fd, int type, int job, const char *fmt, ...)
+{
+  char buf[FRAME_MAXLEN];
+  va_list ap;
+  size_t n;
+
+  va_start(ap, fmt);
+  n = myvsnprintf(buf, sizeof buf, fmt, ap);
+  va_end(ap);
+  frame_send(fd, type, job, buf, n < sizeof buf ? n : sizeof buf - 1);
+}
+
+void
+frame_exit(int fd, int job, int status)
+{
+  uint32_t s = htonl(status);
+
+  if (__framed) {
+    __send(fd, FRAME_EXIT, job, &s, sizeof s);
+  }
+}
+
+/* wait for the socket, which the session may have left non-blocking */
+static int
+__wait(int fd)
+{
+  struct pollfd pfd = { fd, POLLIN, 0 };
+
+  return poll(&pfd, 1, -1) == -1 && errno != EINTR ? -1 : 0;
+}
+
+/* up to n bytes, read ahead ones first; 0 if the peer hung up */
+static ssize_t
+__read(int fd, void *buf, size_t n)
+{
+  ssize_t r;
+
+  if ((r = mybuffered(fd, buf, n)) > 0) {
+    return r;
+  }
+  while ((r = read(fd, buf, n)) == -1) {
+    if ((errno != EAGAIN && errno != EINTR) || __wait(fd) == -1) {
+      return -1;
+    }
+  }
+  return r;
+}
+
+/* exactly n bytes */
+static int
+__readn(int fd, void *buf, size_t n)
+{
+  char *p = buf;
+  ssize_t r;
+
+  for ( ; n; p += r, n -= r) {
+    if ((r = __read(fd, p, n)) <= 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* all of it, or -1 once the reader is gone */
+static int
+__writen(int fd, const char *p, size_t n)
+{
+  ssize_t w;
+
+  while (n) {
+    if ((w = write(fd, p, n)) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    p += w;
+    n -= w;
+  }
+  return 0;
+}
+
+int
+frame_recv_hdr(int sockfd, struct framehdr *hdr)
+{
+  if (__readn(sockfd, hdr, sizeof *hdr) == -1) {
+    return -1;
+  }
+  hdr->job = ntohs(hdr->job);
+  hdr->len = ntohl(hdr->len);
+  if (hdr->type < FRAME_STDOUT || hdr->type > FRAME_STDIN || hdr->len > FRAME_MAXLEN
+      || (hdr->type == FRAME_EXIT && hdr->len != sizeof(uint32_t))) {
+    return -1;
+  }
+  return 0;
+}
+
+int
+frame_read_body(int sockfd, void *buf, size_t len)
+{
+  return __readn(sockfd, buf, len);
+}
+
+int
+frame_recv(int sockfd, struct framehdr *hdr, char *buf)
+{
+  if (frame_recv_hdr(sockfd, hdr) == -1 || hdr->type == FRAME_STDIN) {
+    return -1;
+  }
+  return frame_read_body(sockfd, buf, hdr->len);
+}
+
+int
+frame_splice(int sockfd, int *fd, size_t len)
+{
+  char buf[FRAME_MAXLEN];
+  ssize_t n;
+
+  while (len) {
+    n = mybuffered(sockfd, buf, len < sizeof buf ? len : sizeof buf);
+    /* read ahead bytes are already in user space, the rest moves in the kernel */
+    if (n == 0 && *fd != -1) {
+      if ((n = splice(sockfd, NULL, *fd, NULL, len, SPLICE_F_MOVE)) > 0) {
+        len -= n;
+        continue;
+      }
+      if (n == 0 || (errno == EAGAIN && __wait(sockfd) == -1)) {
+        return -1;
+      }
+      if (errno == EPIPE) {
+        *fd = -1;
+      }
+      if (errno != EINVAL) { /* neither end a pipe, the bytes are copied */
+        continue;
+      }
+      n = 0;
+    }
+    if (n == 0 && (n = __read(sockfd, buf, len < sizeof buf ? len : sizeof buf)) <= 0) {
+      return -1;
+    }
+    if (*fd != -1 && __writen(*fd, buf, n) == -1) {
+      *fd = -1;
+    }
+    len -= n;
+  }
+  return 0;
+}
+
+int
+frame_relay_body(int sockfd, const struct framehdr *hdr, int outfd, int errfd, int *status)
+{
+  char buf[FRAME_MAXLEN];
+  uint32_t s;
+  int fd;
+
+  if (hdr->type == FRAME_STDIN || __readn(sockfd, buf, hdr->len) == -1) {
+    return -1;
+  }
+  if (hdr->type == FRAME_EXIT) {
+    mymemcpy(&s, buf, sizeof s);
+    s = ntohl(s);
+    if (hdr->job == 0) {
+      *status = (int)s;
+      return 1;
+    }
+    if (errfd != -1) {
+      if (s == 0) {
+        myfprintf(errfd, "[%d]  Done\n", hdr->job);
+      } else {
+        myfprintf(errfd, "[%d]  Exit %d\n", hdr->job, (int)s);
+      }
+    }
+    return 0;
+  }
+  fd = hdr->type == FRAME_STDOUT ? outfd : errfd;
+  if (fd != -1) {
+    writechars(fd, buf, hdr->len);
+  }
+  return 0;
+}
+
+int
+frame_relay_one(int sockfd, int outfd, int errfd, int *status)
+{
+  struct framehdr hdr;
+
+  if (frame_recv_hdr(sockfd, &hdr) == -1) {
+    return -1;
+  }
+  return frame_relay_body(sockfd, &hdr, outfd, errfd, status);
+}
+
+int
+frames_relay(int sockfd, int outfd, int errfd)
+{
+  int status, r;
+
+  while ((r = frame_relay_one(sockfd, outfd, errfd, &status)) == 0) {
+    ;
+  }
+  return r == 1 ? status : -1;
+}
@@ -0,0 +1,205 @@
+/**
+ * @file frames.h
+ * @brief Framed Command Output
+ *
+ * A session switched to frames with "frames on" sends what a command line
+ * prints as frames instead of a byte stream: stdout and stderr in separate
+ * frames as the output arrives, then an exit frame with the status, and no
+ * prompt. Every request line ends with exactly one exit frame for job 0, so
+ * a client can tell where the output stops without looking for the prompt.
+ * Background jobs send their output and their exit frame under their job
+ * number. File transfers keep their own protocol and then get an exit frame.
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef __FRAMES_H
+#define __FRAMES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "globals.h"
+
+#define FRAME_MAXLEN MAX_DATA_SIZE /* payload bytes, longer output is split */
+
+/**
+ * enum frametype - What a frame carries
+ * @FRAME_STDOUT: output of the command line, or of a streamed download,
+ *                see download.h
+ * @FRAME_STDERR: diagnostics, from any stage
+ * @FRAME_EXIT: the exit status as a 32 bit integer, ends the request or job
+ * @FRAME_STDIN: client to server, input of a streamed upload; an empty one
+ *               ends it, see upload.h
+ */
+enum frametype {
+  FRAME_STDOUT = 1,
+  FRAME_STDERR,
+  FRAME_EXIT,
+  FRAME_STDIN,
+};
+
+/**
+ * struct framehdr - Wire format of a frame header, integers in network order
+ * @type: enum frametype
+ * @pad: zero
+ * @job: 0 for the request line, otherwise the background job
+ * @len: payload bytes that follow, at most FRAME_MAXLEN
+ */
+struct framehdr {
+  uint8_t type;
+  uint8_t pad;
+  uint16_t job;
+  uint32_t len;
+} __attribute__((__packed__));
+
+/**
+ * frames_enable() - Switch this session's output to frames or back.
+ *
+ * @on: nonzero for frames
+ */
+void frames_enable(int on);
+
+/**
+ * frames_enabled() - True if this session's output is framed.
+ */
+int frames_enabled(void);
+
+/**
+ * frame_send() - Send output as frames, or as it is when not framed.
+ *
+ * @fd: the client socket, or where unframed output goes
+ * @type: FRAME_STDOUT or FRAME_STDERR
+ * @job: 0, or the background job the output is from
+ * @buf: the output
+ * @len: bytes in @buf
+ */
+void frame_send(int fd, int type, int job, const void *buf, size_t len);
+
+/**
+ * frame_printf() - frame_send() formatted output, see myfprintf().
+ */
+void frame_printf(int fd, int type, int job, const char *fmt, ...)
+  __attribute__((__nonnull__(4), __format__(__printf__, 4, 5)));
+
+/**
+ * frame_exit() - End a request or a job with its status, when framed.
+ *
+ * @fd: the client socket
+ * @job: 0 for the request line, otherwise the background job
+ * @status: exit status
+ */
+void frame_exit(int fd, int job, int status);
+
+/**
+ * frame_recv_hdr() - Read the header of one frame.
+ *
+ * @sockfd: the session socket
+ * @hdr: receives the header in host order
+ *
+ * Bytes myreadline() read ahead on @sockfd come first. The payload is left
+ * on the socket for frame_splice() or frame_relay_body().
+ *
+ * Return: 0, or -1 if the peer hung up or sent something that is not a frame
+ */
+int frame_recv_hdr(int sockfd, struct framehdr *hdr)
+  __attribute__((__nonnull__(2)));
+
+/**
+ * frame_read_body() - Read the payload of a frame into memory.
+ *
+ * @sockfd: the session socket, after frame_recv_hdr()
+ * @buf: receives the payload
+ * @len: payload bytes, from the header, at most FRAME_MAXLEN
+ *
+ * Return: 0, or -1 if the peer hung up
+ */
+int frame_read_body(int sockfd, void *buf, size_t len)
+  __attribute__((__nonnull__(2)));
+
+/**
+ * frame_recv() - Read one frame, on the client side.
+ *
+ * @sockfd: the session socket
+ * @hdr: receives the header in host order
+ * @buf: receives the payload, FRAME_MAXLEN bytes
+ *
+ * Return: 0, or -1 if the server hung up or sent something that is not a frame
+ */
+int frame_recv(int sockfd, struct framehdr *hdr, char *buf)
+  __attribute__((__nonnull__(2, 3)));
+
+/**
+ * frame_splice() - Move a payload from the socket to a descriptor.
+ *
+ * @sockfd: the session socket, after frame_recv_hdr()
+ * @fd: where the payload goes; set to -1 once its reader has gone, and
+ *      the rest of the payload is dropped
+ * @len: payload bytes, from the header
+ *
+ * When @fd is a pipe the bytes are spliced and never copied to user space,
+ * so a full pipe stops the reads and TCP pushes back on the sender.
+ * Otherwise they are copied.
+ *
+ * Return: 0, or -1 if the peer hung up
+ */
+int frame_splice(int sockfd, int *fd, size_t len)
+  __attribute__((__nonnull__(2)));
+
+/**
+ * frame_relay_body() - Copy the payload of a frame to its descriptor.
+ * @sockfd: the session socket, after frame_recv_hdr()
+ * @hdr: the header
+ * @outfd: where stdout goes, -1 to drop it
+ * @errfd: where stderr goes, -1 to drop it
+ * @status: receives the exit status when the frame ends the request
+ *
+ * Return: as frame_relay_one()
+ */
+int frame_relay_body(int sockfd, const struct framehdr *hdr, int outfd, int errfd, int *status)
+  __attribute__((__nonnull__(2, 5)));
+
+/**
+ * frame_relay_one() - Copy one frame to its descriptor.
+ * @sockfd: the session socket
+ * @outfd: where stdout goes, -1 to drop it
+ * @errfd: where stderr goes, -1 to drop it
+ * @status: receives the exit status when the frame ends the request
+ *
+ * Return: 1 if the frame ended the request, 0 for any other frame, -1 if the
+ *         server hung up
+ */
+int frame_relay_one(int sockfd, int outfd, int errfd, int *status)
+  __attribute__((__nonnull__(4)));
+
+/**
+ * frames_relay() - Copy frames to their descriptors until the request ends.
+ *
+ * @sockfd: the session socket
+ * @outfd: where stdout goes, -1 to drop it
+ * @errfd: where stderr goes, -1 to drop it
+ *
+ * Background jobs' output goes to the same places; their exit frames are
+ * reported on @errfd the way the shell reports finished jobs.
+ *
+ * Return: exit status of the request, -1 if the server hung up
+ */
+int frames_relay(int sockfd, int outfd, int errfd);
+
+#endif /* __FRAMES_H */
@@ -42,17 +42,36 @@
 
 /**
  * @enum debug
- * @brief Debugging level enumeration.
+ * @brief Debugging category enumeration.
  *
- * This enumeration defines the debugging levels that can be used throughout the application
- * to conditionally compile or execute code based on the current debugging level.
+ * This enumeration defines the debugging categories that can be used throughout the
+ * application to select which subsystems trace, see debug.h.
  */
 enum debug {
   NONE,
   SYSCALLDEBUG,
-  SIGNALDEBUG
+  SIGNALDEBUG,
+  PIPELINEDEBUG,
+  NDEBUGCATEGORIES
 };
 
+/**
+ * @enum debuglevel
+ * @brief Debugging verbosity, each level includes the ones before it.
+ */
+enum debuglevel {
+  DBG_OFF,
+  DBG_ERROR,
+  DBG_WARN,
+  DBG_INFO,
+  DBG_TRACE
+};
+
+/* highest level compiled in, anything above it is removed by the compiler */
+#ifndef DEBUG_LEVEL
+#define DEBUG_LEVEL DBG_WARN
+#endif
+
 extern char **g_envp;
 
 #endif // __GLOBAL_H
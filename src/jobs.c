@@ -0,0 +1,413 @@
+/**
+ * @file jobs.c
+ * @brief Background Jobs of a Session
+ *
+ * A small table of jobs, numbered from one above the highest one in use as
+ * the shell numbers them. The current job is the newest, the previous one
+ * the job before it. Stages are reaped with waitpid() on their own pids, so
+ * a foreground pipeline and the jobs never collect each other's children.
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h> /* strtol */
+#include <string.h> /* strsignal */
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "jobs.h"
+#include "frames.h"
+#include "bufpool.h"
+#include "mystring.h"
+#include "signals.h"
+#include "syscalls.h"
+#include "debug.h"
+
+static struct job __jobs[JOBS_MAX];
+static int __sigfd = -1;
+
+void
+jobs_init(void)
+{
+  sigset_t mask;
+
+  mysigemptyset(&mask);
+  mysigaddset(&mask, SIGCHLD);
+  mysigprocmask(SIG_BLOCK, &mask, NULL);
+  mysigaction(SIGCHLD, SIG_DFL);
+  if ((__sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) == -1) {
+    printerr_exit("signalfd() error\n");
+  }
+  myonexit(jobs_hangup); /* however the session ends */
+}
+
+/* the session keeps the read end, non-blocking for jobs_poll() */
+static void
+__output_pipe(int *rd, int *wr)
+{
+  int fd[FDLEN];
+
+  mypipe(fd);
+  fcntl(fd[READ_END], F_SETFD, FD_CLOEXEC);
+  fcntl(fd[WRITE_END], F_SETFD, FD_CLOEXEC);
+  fcntl(fd[READ_END], F_SETFL, O_NONBLOCK);
+  *rd = fd[READ_END];
+  *wr = fd[WRITE_END];
+}
+
+struct job *
+jobs_start(Pipeline *pipe, size_t npipes)
+{
+  struct job *j = NULL;
+  int id = 1, sockfd = pipe[npipes-1].sockfd, err = -1;
+
+  if (npipes > JOBS_MAXSTAGES) {
+    frame_printf(sockfd, FRAME_STDERR, 0, "too many commands in a pipeline to run in the background\n");
+    return NULL;
+  }
+  for (int i = 0; i < JOBS_MAX; i++) {
+    if (__jobs[i].id == 0) {
+      j = j ? j : &__jobs[i];
+    } else if (__jobs[i].id >= id) {
+      id = __jobs[i].id + 1;
+    }
+  }
+  if (j == NULL) {
+    frame_printf(sockfd, FRAME_STDERR, 0, "too many jobs\n");
+    return NULL;
+  }
+
+  describe_pipeline(j->cmd, sizeof j->cmd, pipe, npipes);
+  j->sockfd = sockfd;
+  j->out = j->err = -1;
+  if (frames_enabled()) {
+    /* frames cannot be written by the commands themselves */
+    __output_pipe(&j->out, &pipe[npipes-1].sockfd);
+    __output_pipe(&j->err, &err);
+  }
+  start_pipeline(pipe, npipes, err);
+  if (j->out != -1) {
+    myclose(pipe[npipes-1].sockfd);
+    myclose(err);
+    pipe[npipes-1].sockfd = sockfd;
+  }
+  j->id = id;
+  j->npids = npipes;
+  j->nlive = 0;
+  j->live = 0;
+  j->wstatus = pipe[npipes-1].pid == -1 ? pipe[npipes-1].nostart << 8 : 0;
+  for (size_t i = 0; i < npipes; i++) {
+    j->pids[i] = pipe[i].pid;
+    if (pipe[i].pid != -1) {
+      j->live |= 1u << i;
+      j->nlive++;
+    }
+  }
+  debugf(PIPELINEDEBUG, DBG_INFO, "job %d started, %d of %d stages\n", j->id, j->nlive, j->npids);
+  frame_printf(sockfd, FRAME_STDOUT, 0, "[%d] %d\n", j->id, (int)pipe[npipes-1].pid);
+  return j;
+}
+
+static void
+__reaped(struct job *j, int i, int wstatus)
+{
+  debugf(SIGNALDEBUG, DBG_TRACE, "job %d pid %d status 0x%x\n", j->id, j->pids[i], wstatus);
+  log_wstatus(wstatus);
+  if (i == j->npids - 1) {
+    j->wstatus = wstatus;
+  }
+  j->live &= ~(1u << i);
+  j->nlive--;
+}
+
+void
+jobs_reap(void)
+{
+  int wstatus;
+  pid_t pid;
+
+  for (int n = 0; n < JOBS_MAX; n++) {
+    struct job *j = &__jobs[n];
+
+    for (int i = 0; j->id && i < j->npids; i++) {
+      if (!(j->live & (1u << i)) || (pid = waitpid(j->pids[i], &wstatus, WNOHANG)) == 0) {
+        continue;
+      }
+      if (pid == -1) {
+        wstatus = 0; /* not ours any more, nothing to wait for */
+      }
+      __reaped(j, i, wstatus);
+    }
+  }
+}
+
+/* one read of a job's output, sent on as a frame of the job */
+static void
+__relay_some(struct job *j, int *fd, int type)
+{
+  char *buf = bufpool_get();
+  ssize_t n;
+
+  if ((n = read(*fd, buf, BUFPOOL_BUFSIZE)) > 0) {
+    frame_send(j->sockfd, type, j->id, buf, n);
+  } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+    myclose(*fd);
+    *fd = -1;
+  }
+  bufpool_put(buf);
+}
+
+void
+jobs_poll(int sockfd)
+{
+  struct pollfd fds[2 + 2 * JOBS_MAX];
+  struct signalfd_siginfo si;
+  struct job *j;
+  int n;
+
+  for (;;) {
+    fds[0] = (struct pollfd){ sockfd, POLLIN, 0 };
+    fds[1] = (struct pollfd){ __sigfd, POLLIN, 0 };
+    for (n = 0; n < JOBS_MAX; n++) {
+      fds[2 + 2*n] = (struct pollfd){ __jobs[n].id ? __jobs[n].out : -1, POLLIN, 0 };
+      fds[3 + 2*n] = (struct pollfd){ __jobs[n].id ? __jobs[n].err : -1, POLLIN, 0 };
+    }
+    if (poll(fds, 2 + 2 * JOBS_MAX, -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      myfprintf(sys_stderr, "poll() error");
+      myexit(0);
+    }
+    if (fds[1].revents & POLLIN) {
+      while (read(__sigfd, &si, sizeof si) == sizeof si) {
+        ; /* signals merge, one read can stand for several children */
+      }
+      jobs_reap();
+    }
+    for (n = 0; n < JOBS_MAX; n++) {
+      j = &__jobs[n];
+      if (fds[2 + 2*n].revents) {
+        __relay_some(j, &j->out, FRAME_STDOUT);
+      }
+      if (fds[3 + 2*n].revents) {
+        __relay_some(j, &j->err, FRAME_STDERR);
+      }
+    }
+    if (fds[0].revents) {
+      return;
+    }
+  }
+}
+
+struct job *
+jobs_next(const struct job *prev)
+{
+  struct job *next = NULL;
+  int after = prev ? prev->id : 0;
+
+  for (int n = 0; n < JOBS_MAX; n++) {
+    if (__jobs[n].id > after && (next == NULL || __jobs[n].id < next->id)) {
+      next = &__jobs[n];
+    }
+  }
+  return next;
+}
+
+/* the newest job for 0, the one before it for 1 */
+static struct job *
+__recent(int nth)
+{
+  struct job *first = NULL, *second = NULL;
+
+  for (struct job *j = jobs_next(NULL); j; j = jobs_next(j)) {
+    second = first;
+    first = j;
+  }
+  return nth ? second : first;
+}
+
+char
+jobs_mark(const struct job *j)
+{
+  return j == __recent(0) ? '+' : j == __recent(1) ? '-' : ' ';
+}
+
+struct job *
+jobs_find(const char *spec)
+{
+  long id;
+  char *end;
+
+  if (spec[0] != '%') {
+    id = strtol(spec, &end, 10);
+    for (int n = 0; *end == '\0' && id > 0 && n < JOBS_MAX; n++) {
+      for (int i = 0; __jobs[n].id && i < __jobs[n].npids; i++) {
+        if (__jobs[n].pids[i] == id) {
+          return &__jobs[n];
+        }
+      }
+    }
+    return NULL;
+  }
+  if (spec[1] == '\0' || ((spec[1] == '%' || spec[1] == '+') && spec[2] == '\0')) {
+    return __recent(0);
+  }
+  if (spec[1] == '-' && spec[2] == '\0') {
+    return __recent(1);
+  }
+  id = strtol(spec + 1, &end, 10);
+  for (int n = 0; *end == '\0' && id > 0 && n < JOBS_MAX; n++) {
+    if (__jobs[n].id == id) {
+      return &__jobs[n];
+    }
+  }
+  return NULL;
+}
+
+const char *
+jobs_state(const struct job *j, char *buf, size_t len)
+{
+  if (j->nlive) {
+    mysnprintf(buf, len, "Running");
+  } else if (WIFSIGNALED(j->wstatus)) {
+    mysnprintf(buf, len, "%s", strsignal(WTERMSIG(j->wstatus)));
+  } else if (WEXITSTATUS(j->wstatus)) {
+    mysnprintf(buf, len, "Exit %d", WEXITSTATUS(j->wstatus));
+  } else {
+    mysnprintf(buf, len, "Done");
+  }
+  return buf;
+}
+
+static int
+__status(const struct job *j)
+{
+  return WIFSIGNALED(j->wstatus) ? 128 + WTERMSIG(j->wstatus) : WEXITSTATUS(j->wstatus);
+}
+
+/* the rest of a framed job's output, until every writer has closed it */
+static void
+__relay_rest(struct job *j)
+{
+  if (j->out == -1 && j->err == -1) {
+    return;
+  }
+  if (j->out != -1) {
+    fcntl(j->out, F_SETFL, 0);
+  }
+  if (j->err != -1) {
+    fcntl(j->err, F_SETFL, 0);
+  }
+  relay_output(j->out, j->err, j->sockfd, j->id);
+  j->out = j->err = -1;
+}
+
+void
+jobs_forget(struct job *j)
+{
+  debugf(PIPELINEDEBUG, DBG_INFO, "job %d forgotten, %d stages live\n", j->id, j->nlive);
+  if (j->nlive == 0) {
+    __relay_rest(j);
+    frame_exit(j->sockfd, j->id, __status(j));
+  }
+  if (j->out != -1) {
+    myclose(j->out);
+  }
+  if (j->err != -1) {
+    myclose(j->err);
+  }
+  j->out = j->err = -1;
+  j->id = 0;
+}
+
+void
+jobs_notify(int fd)
+{
+  struct job *done[JOBS_MAX];
+  char state[32];
+  int ndone = 0;
+
+  jobs_reap();
+  for (struct job *j = jobs_next(NULL); j; j = jobs_next(j)) {
+    if (j->nlive == 0) {
+      if (!frames_enabled()) {
+        myfprintf(fd, "[%d]%c  %-24s%s\n", j->id, jobs_mark(j), jobs_state(j, state, sizeof state), j->cmd);
+      }
+      done[ndone++] = j;
+    }
+  }
+  while (ndone) {
+    jobs_forget(done[--ndone]);
+  }
+}
+
+int
+jobs_wait(struct job *j)
+{
+  int wstatus;
+  pid_t pid;
+
+  __relay_rest(j); /* the stages may be blocked on output nobody reads */
+  for (int i = 0; i < j->npids; i++) {
+    if (!(j->live & (1u << i))) {
+      continue;
+    }
+    while ((pid = waitpid(j->pids[i], &wstatus, 0)) == -1 && errno == EINTR) {
+      ;
+    }
+    __reaped(j, i, pid == -1 ? 0 : wstatus);
+  }
+  jobs_forget(j);
+
+  return __status(j);
+}
+
+int
+jobs_signal(const struct job *j, int sig)
+{
+  int sent = 0, err = ESRCH;
+
+  for (int i = 0; i < j->npids; i++) {
+    if (!(j->live & (1u << i))) {
+      continue;
+    }
+    if (kill(j->pids[i], sig) == 0) {
+      sent++;
+    } else {
+      err = errno;
+    }
+  }
+  errno = sent ? errno : err;
+  return sent ? 0 : -1;
+}
+
+void
+jobs_hangup(void)
+{
+  for (struct job *j = jobs_next(NULL); j; j = jobs_next(j)) {
+    jobs_signal(j, SIGHUP);
+    jobs_signal(j, SIGCONT); /* a stopped stage gets the SIGHUP once it runs */
+  }
+}
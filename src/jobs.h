@@ -0,0 +1,191 @@
+/**
+ * @file jobs.h
+ * @brief Background Jobs of a Session
+ *
+ * A command line ending in '&' starts its pipeline and returns to the prompt.
+ * The session keeps SIGCHLD blocked and reads it from a signalfd next to the
+ * client socket, reaping the stages of its jobs by pid as they exit, so no
+ * signal handler competes with run_pipeline() for its own children. Finished
+ * jobs are reported before the next prompt, as an interactive shell does.
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef __JOBS_H
+#define __JOBS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "pipeline.h"
+
+#define JOBS_MAX 16       /* jobs a session may have at once */
+#define JOBS_MAXSTAGES 16 /* stages of a background pipeline, at most 32 */
+#define JOBS_CMDLEN 128   /* command text kept for jobs, truncated */
+
+/**
+ * struct job - A background pipeline
+ * @id: the job number, %id; 0 for a free slot
+ * @npids: stages started
+ * @nlive: stages not reaped yet
+ * @live: bit i set while stage i is not reaped
+ * @pids: process of each stage, -1 if it did not start
+ * @wstatus: wait status of the last stage
+ * @sockfd: the client socket
+ * @out: read end of the last stage's stdout in a framed session, else -1
+ * @err: read end of the stages' stderr in a framed session, else -1
+ * @cmd: the command line, rebuilt from the stages
+ */
+struct job {
+  int id;
+  int npids;
+  int nlive;
+  uint32_t live;
+  pid_t pids[JOBS_MAXSTAGES];
+  int wstatus;
+  int sockfd;
+  int out;
+  int err;
+  char cmd[JOBS_CMDLEN];
+};
+
+/**
+ * jobs_init() - Take over SIGCHLD for the session.
+ *
+ * Blocks SIGCHLD and opens the signalfd jobs_poll() waits on, and has
+ * myexit() run jobs_hangup(). Called in the session after fork(); the
+ * server keeps sigchld_handler().
+ */
+void jobs_init(void);
+
+/**
+ * jobs_start() - Start a pipeline in the background.
+ *
+ * @pipe: the stages, from build_pipeline()
+ * @npipes: number of stages
+ *
+ * Prints "[id] pid" of the last stage to its socket, or why the job could
+ * not start. In a framed session the output comes back through pipes that
+ * jobs_poll() relays as frames of the job.
+ *
+ * Return: the job, or NULL if the table is full or the pipeline too long
+ */
+struct job *jobs_start(Pipeline *pipe, size_t npipes)
+  __attribute__((__nonnull__(1)));
+
+/**
+ * jobs_poll() - Wait for input on the client socket.
+ *
+ * @sockfd: the client socket
+ *
+ * Reaps job stages as their SIGCHLD arrives while the session is idle, and
+ * relays the output of jobs in a framed session.
+ */
+void jobs_poll(int sockfd);
+
+/**
+ * jobs_reap() - Collect the stages that have exited, without blocking.
+ */
+void jobs_reap(void);
+
+/**
+ * jobs_notify() - Report and forget the jobs that have finished.
+ *
+ * @fd: where to print "[id]+  Done  cmd" lines, which a framed session
+ *      gets as the jobs' exit frames instead
+ */
+void jobs_notify(int fd);
+
+/**
+ * jobs_find() - Look up a job operand of jobs, wait or kill.
+ *
+ * @spec: "%id", "%%" or "%+" for the current job, "%-" for the previous one,
+ *        or the pid of one of its stages
+ *
+ * Return: the job, or NULL if there is none
+ */
+struct job *jobs_find(const char *spec)
+  __attribute__((__nonnull__(1)));
+
+/**
+ * jobs_next() - Iterate over the jobs in order of their number.
+ *
+ * @prev: the job returned last time, NULL to start
+ *
+ * Return: the next job, NULL after the last one
+ */
+struct job *jobs_next(const struct job *prev);
+
+/**
+ * jobs_mark() - The marker the jobs listing shows for @j.
+ *
+ * Return: '+' for the current job, '-' for the previous one, otherwise ' '
+ */
+char jobs_mark(const struct job *j)
+  __attribute__((__nonnull__(1)));
+
+/**
+ * jobs_state() - Describe a job as the jobs listing does.
+ *
+ * @j: the job
+ * @buf: receives "Running", "Done", "Exit N" or the signal that killed it
+ * @len: size of @buf
+ *
+ * Return: @buf
+ */
+const char *jobs_state(const struct job *j, char *buf, size_t len)
+  __attribute__((__nonnull__(1, 2)));
+
+/**
+ * jobs_wait() - Block until every stage of a job has exited, and forget it.
+ *
+ * @j: the job
+ *
+ * Return: exit status of the last stage, 128 + signal if it was killed
+ */
+int jobs_wait(struct job *j)
+  __attribute__((__nonnull__(1)));
+
+/**
+ * jobs_forget() - Drop a job from the table, reaped or not.
+ *
+ * A finished job of a framed session sends the rest of its output and its
+ * exit frame first.
+ */
+void jobs_forget(struct job *j)
+  __attribute__((__nonnull__(1)));
+
+/**
+ * jobs_signal() - Send a signal to every live stage of a job.
+ *
+ * Return: 0, or -1 with errno set if no stage could be signalled
+ */
+int jobs_signal(const struct job *j, int sig)
+  __attribute__((__nonnull__(1)));
+
+/**
+ * jobs_hangup() - Send SIGHUP to every job, as the session ends.
+ *
+ * The stages hold the client socket open, so the client would not see the
+ * connection close until they exited by themselves.
+ */
+void jobs_hangup(void);
+
+#endif /* __JOBS_H */
@@ -0,0 +1,222 @@
+/**
+ * @file logdecode.c
+ * @brief Binary Server Log Decoder
+ *
+ * Renders a binary server log (SHELLSERVE_LOG_FORMAT=binary) as the text
+ * log with timestamps, or as one JSON object per line. Also prints session
+ * transcripts (SHELLSERVE_TRANSCRIPT_DIR) oldest byte first.
+ *
+ *   logdecode [-j] [file]     reads stdin when no file is given
+ *   logdecode -t file         prints a transcript
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../serverlog.h"
+#include "../transcript.h"
+
+#define WINDOW 0x10000 /* bytes of the log decoded at a time */
+
+/* strings by id, as defined so far by LOG_STRDEF records */
+static char strings[LOG_NINTERN + 1][LOG_RECSIZE + 1];
+static unsigned short strlens[LOG_NINTERN + 1];
+
+static void
+print_time(uint64_t ts)
+{
+  time_t sec = ts / 1000000000;
+  struct tm tm;
+  char buf[32];
+
+  gmtime_r(&sec, &tm);
+  strftime(buf, sizeof buf, "%Y-%m-%dT%H:%M:%S", &tm);
+  printf("%s.%06uZ", buf, (unsigned int)(ts % 1000000000 / 1000));
+}
+
+static void
+print_json_string(const char *s, size_t n)
+{
+  putchar('"');
+  for (size_t i = 0; i < n; i++) {
+    unsigned char c = s[i];
+    if (c == '"' || c == '\\') {
+      printf("\\%c", c);
+    } else if (c == '\n') {
+      printf("\\n");
+    } else if (c < 0x20) {
+      printf("\\u%04x", c);
+    } else {
+      putchar(c);
+    }
+  }
+  putchar('"');
+}
+
+static void
+print_text(const struct logrec *rec, const char *str, size_t len)
+{
+  char line[LOG_RECSIZE + 64], *p = line;
+  size_t n = log_render(rec, str, len, line, sizeof line);
+
+  n = n < sizeof line ? n : sizeof line - 1;
+  /* the line carries its own newline, a SIGINT record also starts with one */
+  if (n > 0 && *p == '\n') {
+    p++;
+    n--;
+  }
+  print_time(rec->ts);
+  putchar(' ');
+  fwrite(p, 1, n, stdout);
+}
+
+static void
+print_json(const struct logrec *rec, const char *str, size_t len)
+{
+  printf("{\"ts\":\"");
+  print_time(rec->ts);
+  printf("\",\"ts_ns\":%llu,\"event\":\"%s\",\"client\":%u,\"arg\":%d",
+         (unsigned long long)rec->ts, log_event_name(rec->event), rec->clientid, rec->arg);
+  if (str != NULL) {
+    printf(",\"str\":");
+    print_json_string(str, len);
+  }
+  printf("}\n");
+}
+
+static int
+print_transcript(const char *path)
+{
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  void *map;
+  char *out;
+  size_t n;
+
+  if (fd == -1 || fstat(fd, &st) == -1) {
+    perror(path);
+    return 1;
+  }
+  if ((size_t)st.st_size < TRANSCRIPT_HDRSIZE
+      || (map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+    fprintf(stderr, "logdecode: not a transcript\n");
+    return 1;
+  }
+  close(fd);
+
+  if (((struct transcript_hdr *)map)->size > st.st_size - TRANSCRIPT_HDRSIZE
+      || (out = malloc(st.st_size)) == NULL
+      || (n = transcript_copyout(map, out, st.st_size)) == 0) {
+    fprintf(stderr, "logdecode: not a transcript or empty\n");
+    return 1;
+  }
+  fwrite(out, 1, n, stdout);
+  free(out);
+  munmap(map, st.st_size);
+
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int json = argc > 1 && strcmp(argv[1], "-j") == 0;
+  const char *path = argc > 1 + json ? argv[1 + json] : NULL;
+  FILE *in = path ? fopen(path, "rb") : stdin;
+  const char *str, *payload;
+  static char log[WINDOW];
+  struct logrec rec;
+  size_t len, n, got, off, used;
+  uint64_t ts = 0;
+
+  if (argc > 2 && strcmp(argv[1], "-t") == 0) {
+    return print_transcript(argv[2]);
+  }
+  if (in == NULL) {
+    perror(path);
+    return 1;
+  }
+  n = fread(log, 1, sizeof log, in);
+  if (n < sizeof LOG_MAGIC - 1 || memcmp(log, LOG_MAGIC, sizeof LOG_MAGIC - 1) != 0) {
+    fprintf(stderr, "logdecode: not a binary server log\n");
+    return 1;
+  }
+
+  /* a record cut off at the end of the window is moved to the front and read again */
+  for (off = sizeof LOG_MAGIC - 1;; off += used) {
+    if ((used = log_decode(log + off, n - off, &ts, &rec, &payload)) == 0) {
+      if (n - off >= LOG_BIN_RECMAX) {
+        fprintf(stderr, "logdecode: corrupt record\n");
+        return 1;
+      }
+      memmove(log, log + off, n - off);
+      n -= off;
+      off = 0;
+      if ((got = fread(log + n, 1, sizeof log - n, in)) == 0) {
+        break;
+      }
+      n += got;
+      continue;
+    }
+
+    if (rec.event == LOG_STRDEF) {
+      if (rec.strid == 0) {
+        fprintf(stderr, "logdecode: bad string id %u\n", rec.strid);
+        return 1;
+      }
+      memcpy(strings[rec.strid], payload, rec.len);
+      strlens[rec.strid] = rec.len;
+      continue;
+    }
+
+    str = NULL;
+    len = 0;
+    if (rec.event == LOG_TEXT) {
+      str = payload;
+      len = rec.len;
+    } else if (rec.strid != 0) {
+      str = strings[rec.strid];
+      len = strlens[rec.strid];
+    }
+
+    if (json) {
+      print_json(&rec, str, len);
+    } else {
+      print_text(&rec, str, len);
+    }
+  }
+  if (ferror(in)) {
+    perror("logdecode");
+    return 1;
+  }
+  if (n > 0) {
+    fprintf(stderr, "logdecode: truncated record\n");
+    return 1;
+  }
+
+  return 0;
+}
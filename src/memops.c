@@ -0,0 +1,211 @@
+/**
+ * @file memops.c
+ * @brief Vectorized Memory Fill and Copy
+ *
+ * Byte, word, SSE2 and AVX2 kernels for mymemset() and mymemcpy(), and the
+ * dispatch that picks one of them at startup. Every variant handles any
+ * alignment and length; the wide ones finish their tail with the next
+ * narrower variant.
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdint.h>
+
+#include "memops.h"
+#include "mystring.h"
+#include "cpufeatures.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define __HAVE_X86_SIMD 1
+#endif
+
+/* private */
+typedef uint64_t __attribute__((__may_alias__, __aligned__(1))) __uword;
+
+static void *(*__memset_impl)(void *, int, size_t) = mymemset_scalar;
+static void *(*__memcpy_impl)(void *, const void *, size_t) = mymemcpy_scalar;
+/* end private */
+
+void *
+mymemset_scalar(void *s, int c, size_t n)
+{
+  char *tmp = s;
+
+  while(n--) {
+    *tmp++ = c;
+  }
+
+  return s;
+}
+
+void *
+mymemset_word(void *s, int c, size_t n)
+{
+  unsigned char *p = s;
+  const uint64_t fill = 0x0101010101010101ull * (unsigned char)c;
+
+  for ( ; n >= sizeof fill; p += sizeof fill, n -= sizeof fill) {
+    *(__uword *)p = fill;
+  }
+  mymemset_scalar(p, c, n);
+
+  return s;
+}
+
+void *
+mymemcpy_scalar(void *dest, const void *src, size_t n)
+{
+  char *d = dest;
+  const char *s = src;
+
+  while(n > 0) {
+    *d++ = *s++;
+    n--;
+  }
+
+  return dest;
+}
+
+void *
+mymemcpy_word(void *dest, const void *src, size_t n)
+{
+  unsigned char *d = dest;
+  const unsigned char *s = src;
+
+  for ( ; n >= sizeof(__uword); d += sizeof(__uword), s += sizeof(__uword), n -= sizeof(__uword)) {
+    *(__uword *)d = *(const __uword *)s;
+  }
+  mymemcpy_scalar(d, s, n);
+
+  return dest;
+}
+
+#ifdef __HAVE_X86_SIMD
+__attribute__((target("sse2"))) void *
+mymemset_sse2(void *s, int c, size_t n)
+{
+  unsigned char *p = s;
+  const __m128i fill = _mm_set1_epi8((char)c);
+
+  for ( ; n >= 16; p += 16, n -= 16) {
+    _mm_storeu_si128((__m128i *)p, fill);
+  }
+  mymemset_word(p, c, n);
+
+  return s;
+}
+
+__attribute__((target("avx2"))) void *
+mymemset_avx2(void *s, int c, size_t n)
+{
+  unsigned char *p = s;
+  const __m256i fill = _mm256_set1_epi8((char)c);
+
+  for ( ; n >= 32; p += 32, n -= 32) {
+    _mm256_storeu_si256((__m256i *)p, fill);
+  }
+  mymemset_sse2(p, c, n);
+
+  return s;
+}
+
+__attribute__((target("sse2"))) void *
+mymemcpy_sse2(void *dest, const void *src, size_t n)
+{
+  unsigned char *d = dest;
+  const unsigned char *s = src;
+
+  for ( ; n >= 16; d += 16, s += 16, n -= 16) {
+    _mm_storeu_si128((__m128i *)d, _mm_loadu_si128((const __m128i *)s));
+  }
+  mymemcpy_word(d, s, n);
+
+  return dest;
+}
+
+__attribute__((target("avx2"))) void *
+mymemcpy_avx2(void *dest, const void *src, size_t n)
+{
+  unsigned char *d = dest;
+  const unsigned char *s = src;
+
+  for ( ; n >= 32; d += 32, s += 32, n -= 32) {
+    _mm256_storeu_si256((__m256i *)d, _mm256_loadu_si256((const __m256i *)s));
+  }
+  mymemcpy_sse2(d, s, n);
+
+  return dest;
+}
+#else
+/* no SIMD on this architecture, the variants fall back to words */
+void *
+mymemset_sse2(void *s, int c, size_t n)
+{
+  return mymemset_word(s, c, n);
+}
+
+void *
+mymemset_avx2(void *s, int c, size_t n)
+{
+  return mymemset_word(s, c, n);
+}
+
+void *
+mymemcpy_sse2(void *dest, const void *src, size_t n)
+{
+  return mymemcpy_word(dest, src, n);
+}
+
+void *
+mymemcpy_avx2(void *dest, const void *src, size_t n)
+{
+  return mymemcpy_word(dest, src, n);
+}
+#endif /* __HAVE_X86_SIMD */
+
+__attribute__((constructor)) void
+memops_init(void)
+{
+  unsigned int features = cpu_features();
+
+  if (features & CPU_AVX2) {
+    __memset_impl = mymemset_avx2;
+    __memcpy_impl = mymemcpy_avx2;
+  } else if (features & CPU_SSE2) {
+    __memset_impl = mymemset_sse2;
+    __memcpy_impl = mymemcpy_sse2;
+  } else {
+    __memset_impl = mymemset_word;
+    __memcpy_impl = mymemcpy_word;
+  }
+}
+
+void *
+mymemset(void *s, int c, size_t n)
+{
+  return __memset_impl(s, c, n);
+}
+
+void *
+mymemcpy(void *dest, const void *src, size_t n)
+{
+  return __memcpy_impl(dest, src, n);
+}
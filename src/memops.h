@@ -0,0 +1,62 @@
+/**
+ * @file memops.h
+ * @brief Vectorized Memory Fill and Copy
+ *
+ * Byte, word, SSE2 and AVX2 variants of mymemset() and mymemcpy(), which are
+ * declared in mystring.h. The public entry points dispatch to the best one
+ * the CPU supports, the same way memscan.h does for the scanners.
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef __MEMOPS_H
+#define __MEMOPS_H
+
+#include "globals.h"
+
+/**
+ * memops_init() - Select the fill and copy kernels for this CPU.
+ *
+ * Runs once at startup before main(). Safe to call again.
+ */
+void memops_init(void);
+
+/*
+ * Individual variants, exported for the unit tests and benchmarks.
+ * The SIMD variants must only be called if cpu_features() reports them.
+ */
+void *mymemset_scalar(void *s, int c, size_t n)
+  __attribute__((__nonnull__(1)));
+void *mymemset_word(void *s, int c, size_t n)
+  __attribute__((__nonnull__(1)));
+void *mymemset_sse2(void *s, int c, size_t n)
+  __attribute__((__nonnull__(1)));
+void *mymemset_avx2(void *s, int c, size_t n)
+  __attribute__((__nonnull__(1)));
+
+void *mymemcpy_scalar(void *dest, const void *src, size_t n)
+  __attribute__((__nonnull__(1, 2)));
+void *mymemcpy_word(void *dest, const void *src, size_t n)
+  __attribute__((__nonnull__(1, 2)));
+void *mymemcpy_sse2(void *dest, const void *src, size_t n)
+  __attribute__((__nonnull__(1, 2)));
+void *mymemcpy_avx2(void *dest, const void *src, size_t n)
+  __attribute__((__nonnull__(1, 2)));
+
+#endif /* __MEMOPS_H */
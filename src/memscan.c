@@ -0,0 +1,368 @@
+/**
+ * @file memscan.c
+ * @brief Vectorized Byte Scanning
+ *
+ * Scalar, SSE2 and AVX2 kernels for finding a byte in a buffer or a delimiter
+ * in a string, and for comparing strings, and the dispatch that picks one of
+ * them at startup. The string kernels never read across a page boundary past
+ * the terminator: the scanners only issue aligned loads, and the comparisons
+ * step bytewise over a block that would cross into the next page.
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdint.h>
+
+#include "memscan.h"
+#include "mystring.h"
+#include "cpufeatures.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define __HAVE_X86_SIMD 1
+#endif
+
+/* private */
+#define __PAGE_SIZE 0x1000
+
+typedef uint64_t __attribute__((__may_alias__, __aligned__(1))) __uword;
+
+static const void *(*__memchr_impl)(const void *, int, size_t) = mymemchr_scalar;
+static char *(*__strchrnul_impl)(const char *, int) = mystrchrnul_scalar;
+static int (*__strcmp_impl)(const char *, const char *) = mystrcmp_scalar;
+
+/* true if an @n byte load at @p would touch the next page */
+static inline int
+__crosses_page(const char *p, size_t n)
+{
+  return ((uintptr_t)p & (__PAGE_SIZE - 1)) > __PAGE_SIZE - n;
+}
+
+/* compare up to @n bytes one at a time, *@done is set if the strings end or differ */
+static inline int
+__strcmp_bytes(const char **s1, const char **s2, size_t n, int *done)
+{
+  const unsigned char *a = (const unsigned char *)*s1, *b = (const unsigned char *)*s2;
+
+  for ( ; n > 0; n--, a++, b++) {
+    if (*a != *b || *a == '\0') {
+      *done = 1;
+      return *a - *b;
+    }
+  }
+  *s1 = (const char *)a;
+  *s2 = (const char *)b;
+  *done = 0;
+  return 0;
+}
+/* end private */
+
+const void *
+mymemchr_scalar(const void *s, int c, size_t n)
+{
+  const unsigned char *p = s;
+
+  while (n--) {
+    if (*p == (unsigned char)c) {
+      return p;
+    }
+    p++;
+  }
+
+  return NULL;
+}
+
+char *
+mystrchrnul_scalar(const char *s, int c)
+{
+  while (*s && *s != (char)c) {
+    s++;
+  }
+
+  return (char *)s;
+}
+
+int
+mystrcmp_scalar(const char *s1, const char *s2)
+{
+  const unsigned char *s = (const unsigned char *)s1, *t = (const unsigned char *)s2;
+
+  for ( ; *s == *t; s++, t++) {
+    if (*s == '\0') {
+      return 0;
+    }
+  }
+  return *s - *t;
+}
+
+int
+mystrcmp_word(const char *s1, const char *s2)
+{
+  const uint64_t ones = 0x0101010101010101ull, highs = 0x8080808080808080ull;
+  uint64_t a, b;
+  int diff, done;
+
+  for (;;) {
+    if (__crosses_page(s1, sizeof a) || __crosses_page(s2, sizeof a)) {
+      diff = __strcmp_bytes(&s1, &s2, sizeof a, &done);
+    } else {
+      a = *(const __uword *)s1;
+      b = *(const __uword *)s2;
+      /* unequal, or a has a zero byte */
+      if (a == b && ((a - ones) & ~a & highs) == 0) {
+        s1 += sizeof a;
+        s2 += sizeof a;
+        continue;
+      }
+      diff = __strcmp_bytes(&s1, &s2, sizeof a, &done);
+    }
+    if (done) {
+      return diff;
+    }
+  }
+}
+
+#ifdef __HAVE_X86_SIMD
+__attribute__((target("sse2"))) const void *
+mymemchr_sse2(const void *s, int c, size_t n)
+{
+  const unsigned char *p = s;
+  const __m128i needle = _mm_set1_epi8((char)c);
+  unsigned int mask;
+
+  for ( ; n >= 16; p += 16, n -= 16) {
+    mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), needle));
+    if (mask) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+
+  return mymemchr_scalar(p, c, n);
+}
+
+__attribute__((target("avx2"))) const void *
+mymemchr_avx2(const void *s, int c, size_t n)
+{
+  const unsigned char *p = s;
+  const __m256i needle = _mm256_set1_epi8((char)c);
+  unsigned int mask;
+
+  for ( ; n >= 32; p += 32, n -= 32) {
+    mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), needle));
+    if (mask) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+
+  return mymemchr_sse2(p, c, n);
+}
+
+__attribute__((target("sse2"))) char *
+mystrchrnul_sse2(const char *s, int c)
+{
+  /* round down to the block holding s, aligned loads never cross a page */
+  size_t off = (uintptr_t)s & 15;
+  const char *p = s - off;
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i needle = _mm_set1_epi8((char)c);
+  __m128i chunk;
+  unsigned int mask;
+
+  chunk = _mm_load_si128((const __m128i *)p);
+  mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, zero),
+                                        _mm_cmpeq_epi8(chunk, needle)));
+  mask >>= off; /* ignore the bytes before s */
+  if (mask) {
+    return (char *)s + __builtin_ctz(mask);
+  }
+
+  for (;;) {
+    p += 16;
+    chunk = _mm_load_si128((const __m128i *)p);
+    mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, zero),
+                                          _mm_cmpeq_epi8(chunk, needle)));
+    if (mask) {
+      return (char *)p + __builtin_ctz(mask);
+    }
+  }
+}
+
+__attribute__((target("avx2"))) char *
+mystrchrnul_avx2(const char *s, int c)
+{
+  size_t off = (uintptr_t)s & 31;
+  const char *p = s - off;
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i needle = _mm256_set1_epi8((char)c);
+  __m256i chunk;
+  unsigned int mask;
+
+  chunk = _mm256_load_si256((const __m256i *)p);
+  mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, zero),
+                                              _mm256_cmpeq_epi8(chunk, needle)));
+  mask >>= off;
+  if (mask) {
+    return (char *)s + __builtin_ctz(mask);
+  }
+
+  for (;;) {
+    p += 32;
+    chunk = _mm256_load_si256((const __m256i *)p);
+    mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, zero),
+                                                _mm256_cmpeq_epi8(chunk, needle)));
+    if (mask) {
+      return (char *)p + __builtin_ctz(mask);
+    }
+  }
+}
+
+__attribute__((target("sse2"))) int
+mystrcmp_sse2(const char *s1, const char *s2)
+{
+  const __m128i zero = _mm_setzero_si128();
+  __m128i a, b;
+  unsigned int mask;
+  int diff, done;
+
+  for (;;) {
+    if (__crosses_page(s1, 16) || __crosses_page(s2, 16)) {
+      diff = __strcmp_bytes(&s1, &s2, 16, &done);
+      if (done) {
+        return diff;
+      }
+      continue;
+    }
+    a = _mm_loadu_si128((const __m128i *)s1);
+    b = _mm_loadu_si128((const __m128i *)s2);
+    /* bytes that differ or end the string */
+    mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) & 0xffff;
+    mask |= _mm_movemask_epi8(_mm_cmpeq_epi8(a, zero));
+    if (mask) {
+      mask = __builtin_ctz(mask);
+      return (unsigned char)s1[mask] - (unsigned char)s2[mask];
+    }
+    s1 += 16;
+    s2 += 16;
+  }
+}
+
+__attribute__((target("avx2"))) int
+mystrcmp_avx2(const char *s1, const char *s2)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i a, b;
+  unsigned int mask;
+  int diff, done;
+
+  for (;;) {
+    if (__crosses_page(s1, 32) || __crosses_page(s2, 32)) {
+      diff = __strcmp_bytes(&s1, &s2, 32, &done);
+      if (done) {
+        return diff;
+      }
+      continue;
+    }
+    a = _mm256_loadu_si256((const __m256i *)s1);
+    b = _mm256_loadu_si256((const __m256i *)s2);
+    mask = ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b));
+    mask |= _mm256_movemask_epi8(_mm256_cmpeq_epi8(a, zero));
+    if (mask) {
+      mask = __builtin_ctz(mask);
+      return (unsigned char)s1[mask] - (unsigned char)s2[mask];
+    }
+    s1 += 32;
+    s2 += 32;
+  }
+}
+#else
+/* no SIMD on this architecture, the variants fall back to scalar */
+const void *
+mymemchr_sse2(const void *s, int c, size_t n)
+{
+  return mymemchr_scalar(s, c, n);
+}
+
+const void *
+mymemchr_avx2(const void *s, int c, size_t n)
+{
+  return mymemchr_scalar(s, c, n);
+}
+
+char *
+mystrchrnul_sse2(const char *s, int c)
+{
+  return mystrchrnul_scalar(s, c);
+}
+
+char *
+mystrchrnul_avx2(const char *s, int c)
+{
+  return mystrchrnul_scalar(s, c);
+}
+
+int
+mystrcmp_sse2(const char *s1, const char *s2)
+{
+  return mystrcmp_word(s1, s2);
+}
+
+int
+mystrcmp_avx2(const char *s1, const char *s2)
+{
+  return mystrcmp_word(s1, s2);
+}
+#endif /* __HAVE_X86_SIMD */
+
+__attribute__((constructor)) void
+memscan_init(void)
+{
+  unsigned int features = cpu_features();
+
+  if (features & CPU_AVX2) {
+    __memchr_impl = mymemchr_avx2;
+    __strchrnul_impl = mystrchrnul_avx2;
+    __strcmp_impl = mystrcmp_avx2;
+  } else if (features & CPU_SSE2) {
+    __memchr_impl = mymemchr_sse2;
+    __strchrnul_impl = mystrchrnul_sse2;
+    __strcmp_impl = mystrcmp_sse2;
+  } else {
+    __memchr_impl = mymemchr_scalar;
+    __strchrnul_impl = mystrchrnul_scalar;
+    __strcmp_impl = mystrcmp_word;
+  }
+}
+
+const void *
+mymemchr(const void *s, int c, size_t n)
+{
+  return __memchr_impl(s, c, n);
+}
+
+char *
+mystrchrnul(const char *s, int c)
+{
+  return __strchrnul_impl(s, c);
+}
+
+int
+mystrcmp(const char *s1, const char *s2)
+{
+  return __strcmp_impl(s1, s2);
+}
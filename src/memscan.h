@@ -0,0 +1,95 @@
+/**
+ * @file memscan.h
+ * @brief Vectorized Byte Scanning
+ *
+ * This file declares the kernels used to find the next newline or delimiter
+ * in a buffer, and to compare strings. Each kernel has a scalar, SSE2 and
+ * AVX2 variant; the public entry points dispatch to the best one the CPU
+ * supports. mystrcmp(), mystrlen() and mystrchr() are declared in mystring.h.
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef __MEMSCAN_H
+#define __MEMSCAN_H
+
+#include "globals.h"
+
+/**
+ * mymemchr() - Find the first occurrence of C in the first N bytes of S.
+ *
+ * @s: Pointer to the buffer to scan.
+ * @c: Byte to look for.
+ * @n: Number of bytes to scan.
+ *
+ * Return: pointer to the matching byte, or NULL if C is not in the buffer.
+ */
+const void *mymemchr(const void *s, int c, size_t n)
+  __attribute__((__nonnull__(1), __pure__));
+
+/**
+ * mystrchrnul() - Find the first occurrence of C or the terminating NUL in S.
+ *
+ * @s: Pointer to the string to scan.
+ * @c: Character to look for.
+ *
+ * Unlike mystrchr() this never returns NULL, which is what a tokenizer wants:
+ * the result is either the delimiter or the end of the string.
+ *
+ * Return: pointer to the first C in S, or to the NUL terminator.
+ */
+char *mystrchrnul(const char *s, int c)
+  __attribute__((__nonnull__(1), __pure__));
+
+/**
+ * memscan_init() - Select the scanning kernels for this CPU.
+ *
+ * Runs once at startup before main(). Safe to call again; it only re-reads
+ * the cached CPU features.
+ */
+void memscan_init(void);
+
+/*
+ * Individual variants, exported for the unit tests and benchmarks.
+ * The SIMD variants must only be called if cpu_features() reports them.
+ */
+const void *mymemchr_scalar(const void *s, int c, size_t n)
+  __attribute__((__nonnull__(1), __pure__));
+const void *mymemchr_sse2(const void *s, int c, size_t n)
+  __attribute__((__nonnull__(1), __pure__));
+const void *mymemchr_avx2(const void *s, int c, size_t n)
+  __attribute__((__nonnull__(1), __pure__));
+
+char *mystrchrnul_scalar(const char *s, int c)
+  __attribute__((__nonnull__(1), __pure__));
+char *mystrchrnul_sse2(const char *s, int c)
+  __attribute__((__nonnull__(1), __pure__));
+char *mystrchrnul_avx2(const char *s, int c)
+  __attribute__((__nonnull__(1), __pure__));
+
+int mystrcmp_scalar(const char *s1, const char *s2)
+  __attribute__((__nonnull__(1, 2), __pure__));
+int mystrcmp_word(const char *s1, const char *s2)
+  __attribute__((__nonnull__(1, 2), __pure__));
+int mystrcmp_sse2(const char *s1, const char *s2)
+  __attribute__((__nonnull__(1, 2), __pure__));
+int mystrcmp_avx2(const char *s1, const char *s2)
+  __attribute__((__nonnull__(1, 2), __pure__));
+
+#endif /* __MEMSCAN_H */
@@ -29,8 +29,11 @@
  */
 #include "globals.h"
 #include "mystring.h"
+#include "memscan.h"
 #include "syscalls.h"
+#include "bufpool.h"
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <unistd.h>
 
@@ -49,159 +52,519 @@
 #define __MAX_CMD_LEN MAX_LINE_SIZE
 /* end private */
 
+/*
+ * read buffers shared by mygetchar() and myreadline(), one per fd so a line
+ * left over from the socket is never handed out as input from stdin. The
+ * storage is borrowed from the buffer pool only while a chunk is unread.
+ * The table grows rather than drop a leftover; io_forget() frees a slot.
+ */
+#define __IO_NBUF 4
+struct __iobuf {
+  int fd;
+  int n;
+  char *bufp;
+  char *buf;
+};
+static struct __iobuf __io_fixed[__IO_NBUF] = { [0 ... __IO_NBUF-1] = { .fd = -1 } };
+static struct __iobuf *__io = __io_fixed;
+static size_t __io_nbuf = __IO_NBUF;
+
+static void
+__io_grow(void)
+{
+  struct __iobuf *io = mymalloc(2 * __io_nbuf * sizeof *io);
+
+  mymemcpy(io, __io, __io_nbuf * sizeof *io);
+  for (size_t i = __io_nbuf; i < 2 * __io_nbuf; i++) {
+    io[i] = (struct __iobuf){ .fd = -1 };
+  }
+  if (__io != __io_fixed) {
+    myfree(__io, __io_nbuf * sizeof *io);
+  }
+  __io = io;
+  __io_nbuf *= 2;
+}
+
+static struct __iobuf *
+__io_get(int fd)
+{
+  struct __iobuf *io, *empty = NULL;
+
+  for (io = __io; io < __io + __io_nbuf; io++) {
+    if (io->fd == fd) {
+      return io;
+    }
+    if (empty == NULL && io->n == 0) {
+      empty = io;
+    }
+  }
+
+  if (empty == NULL) { /* every slot holds unread input */
+    __io_grow();
+    empty = __io + __io_nbuf / 2;
+  }
+  empty->fd = fd;
+  empty->n = 0;
+  return empty;
+}
+
+static void
+__io_drained(struct __iobuf *io)
+{
+  io->n = 0;
+  bufpool_put(io->buf);
+  io->buf = NULL;
+}
+
+static void
+__io_fill(struct __iobuf *io)
+{
+  if (io->buf == NULL) {
+    io->buf = bufpool_get();
+  }
+  io->n = myread(io->fd, io->buf, __IO_GETCHAR_BUFSIZE);
+  /* ctrl-d */
+  if (io->n == 0) {
+    myexit(1);
+  }
+  io->bufp = io->buf;
+  ++io->n; /* one extra for the EOF marking the end of the chunk */
+}
+
 int
 mygetchar(int fd)
 {
-  static char buf[__IO_GETCHAR_BUFSIZE];
-  static char *bufp = buf;
-  static int n = 0;
+  struct __iobuf *io = __io_get(fd);
 
-  if (n == 0) {
-    n = myread(fd, buf, sizeof buf);
-    /* ctrl-d */
-    if (n == 0) {
-      _exit(1);
+  if (io->n == 0) {
+    __io_fill(io);
+  }
+  if (--io->n > 0) {
+    return (unsigned char)*io->bufp++;
+  }
+  __io_drained(io);
+  return EOF;
+}
+
+void
+io_forget(int fd)
+{
+  for (struct __iobuf *io = __io; io < __io + __io_nbuf; io++) {
+    if (io->fd == fd) {
+      if (io->n) {
+        __io_drained(io);
+      }
+      io->fd = -1;
+    }
+  }
+}
+
+size_t
+mypending(int fd)
+{
+  for (struct __iobuf *io = __io; io < __io + __io_nbuf; io++) {
+    if (io->fd == fd && io->n > 1) {
+      return (size_t)(io->n - 1);
     }
-    bufp = buf;
-    ++n;
   }
-  return (--n > 0) ? (unsigned char)*bufp++ : EOF;
+  return 0;
+}
+
+size_t
+mybuffered(int fd, void *buf, size_t n)
+{
+  struct __iobuf *io = __io_get(fd);
+  size_t take = io->n > 1 ? (size_t)(io->n - 1) : 0;
+
+  if (take > n) {
+    take = n;
+  }
+  if (buf) {
+    mymemcpy(buf, io->bufp, take);
+  }
+  io->bufp += take;
+  io->n -= take;
+  if (io->n == 1) {
+    __io_drained(io); /* drop the EOF marker */
+  }
+  return take;
 }
 
 size_t
 myreadline(int fd, char * const line, size_t read_max)
 {
-  size_t n_total;
-  char c = mygetchar(fd);
-  for (n_total = 0; n_total < read_max - 1 && c != EOF; n_total++) {
-    line[n_total] = c;
-    c = mygetchar(fd);
+  size_t n_total, i;
+  const char *nl;
+  struct __iobuf *io = __io_get(fd);
+
+  if (io->n <= 1) {
+    __io_fill(io);
+  }
+
+  /* take the rest of the chunk, or up to and including the first newline */
+  n_total = (size_t)(io->n - 1) < read_max - 1 ? (size_t)(io->n - 1) : read_max - 1;
+  if ((nl = mymemchr(io->bufp, '\n', n_total)) != NULL) {
+    n_total = nl - io->bufp + 1;
+  }
+
+  for (i = 0; i < n_total; i++) {
+    line[i] = io->bufp[i];
+  }
+  io->bufp += n_total;
+  io->n -= n_total;
+  if (io->n == 1) {
+    __io_drained(io); /* drop the EOF marker */
+  }
+
+  if (n_total > 0) {
+    line[n_total - 1] = '\0';
   }
-  line[n_total - 1] = '\0';
 
   return n_total;
 }
 
-void
-myfprintf(int fd, const char *strn, ...)
+/*
+ * formatting engine behind myfprintf() and mysnprintf(). Output is rendered
+ * into a buffer and only written out when the buffer fills, so a log line is
+ * a single write() instead of one per character.
+ */
+struct __fmtout {
+  char *buf;
+  size_t len, cap;
+  size_t total; /* length of the whole output, even past cap */
+  int fd;       /* flush here when full, -1 to truncate instead */
+};
+
+/* "00" to "99", two digits per division when converting to decimal */
+static const char __digitpairs[201] =
+  "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+  "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+static char *
+__utoa_dec(uint64_t num, char *end)
 {
-  va_list ap;
-  size_t len;
-  int d, c, curchar;
-  char buf[__IO_GETCHAR_BUFSIZE];
-  char *s;
-  va_start(ap, strn);
-  while (*strn) {
-    curchar = *strn++;
-    if (curchar != '%') {
-      mywrite(fd, &curchar, 1);
-    } else {
-      switch (*strn) {
-        /* string */
-      case 's':
-        s = va_arg(ap, char *);
-        len = mystrlen(s);
-        writechars(fd, s, len);
-        strn++;
-        break;
-        /* int */
-      case 'd':
-        d = va_arg(ap, int);
-        s = myitoa(d, buf);
-        len = mystrlen(s);
-        mywrite(fd, s, len);
-        strn++;
-        break;
-        /* char */
-      case 'c':
-        c = (char)va_arg(ap, int);
-        mywrite(fd, &c, 1);
-        strn++;
-        break;
+  unsigned int r;
+
+  while (num >= 100) {
+    r = (unsigned int)(num % 100) * 2;
+    num /= 100;
+    *--end = __digitpairs[r + 1];
+    *--end = __digitpairs[r];
+  }
+  if (num >= 10) {
+    r = (unsigned int)num * 2;
+    *--end = __digitpairs[r + 1];
+    *--end = __digitpairs[r];
+  } else {
+    *--end = '0' + (char)num;
+  }
+
+  return end;
+}
+
+static char *
+__utoa_hex(uint64_t num, char *end, const char *digits)
+{
+  do {
+    *--end = digits[num & 0xf];
+    num >>= 4;
+  } while (num);
+
+  return end;
+}
+
+static void
+__fmt_flush(struct __fmtout *out)
+{
+  if (out->fd != -1 && out->len > 0) {
+    writechars(out->fd, out->buf, out->len);
+    out->len = 0;
+  }
+}
+
+static void
+__fmt_put(struct __fmtout *out, const char *s, size_t n)
+{
+  size_t room;
+
+  out->total += n;
+  while (n > 0) {
+    if (out->len == out->cap) {
+      if (out->fd == -1) {
+        return; /* truncated */
       }
+      __fmt_flush(out);
     }
+    room = out->cap - out->len;
+    room = n < room ? n : room;
+    mymemcpy(out->buf + out->len, s, room);
+    out->len += room;
+    s += room;
+    n -= room;
   }
-  va_end(ap);
 }
 
-char
-*myitoa(int num, char *str)
+static void
+__fmt_pad(struct __fmtout *out, char c, int n)
 {
-  int start, end, i, rem, is_negative, tmp;
+  static const char zeroes[] = "0000000000000000";
+  static const char spaces[] = "                ";
+  const char *fill = c == '0' ? zeroes : spaces;
 
-  is_negative = i = 0;
-  if (num == 0) {
-    str[i++] = '0';
-    str[i] = '\0';
-    return str;
+  for (; n > 16; n -= 16) {
+    __fmt_put(out, fill, 16);
+  }
+  if (n > 0) {
+    __fmt_put(out, fill, n);
   }
+}
 
-  if (num < 0) {
-    is_negative = 1;
-    num = -num;
+/* emit [sign|prefix][zeroes]digits with the field width applied */
+static void
+__fmt_number(struct __fmtout *out, const char *prefix, const char *digits, int ndigits,
+             int width, int prec, int left, int zero)
+{
+  int nprefix = mystrlen(prefix), nzero = prec > ndigits ? prec - ndigits : 0;
+  int npad = width - nprefix - nzero - ndigits;
+
+  if (prec == 0 && ndigits == 1 && digits[0] == '0') {
+    ndigits = 0; /* "%.0d" of 0 prints nothing */
+    npad++;
+  }
+  if (zero && !left && prec < 0 && npad > 0) {
+    nzero += npad;
+    npad = 0;
   }
 
-  while (num != 0) {
-    rem = num % 10;
-    str[i++] = (rem > 9) ? (rem - 10) + 'a' : rem + '0';
-    num /= 10;
+  if (!left) {
+    __fmt_pad(out, ' ', npad);
+  }
+  __fmt_put(out, prefix, nprefix);
+  __fmt_pad(out, '0', nzero);
+  __fmt_put(out, digits, ndigits);
+  if (left) {
+    __fmt_pad(out, ' ', npad);
   }
+}
+
+static void
+__fmt_string(struct __fmtout *out, const char *s, int width, int prec, int left)
+{
+  int n = 0;
 
-  if (is_negative) {
-    str[i++] = '-';
+  if (s == NULL) {
+    s = "(null)";
+  }
+  while ((prec < 0 || n < prec) && s[n]) {
+    n++;
   }
-  str[i] = '\0';
 
-  start = 0;
-  end = i - 1;
-  while (start < end) {
-    tmp = *(str + start);
-    *(str + start) = *(str + end);
-    *(str + end) = tmp;
-    start++;
-    end--;
+  if (!left) {
+    __fmt_pad(out, ' ', width - n);
+  }
+  __fmt_put(out, s, n);
+  if (left) {
+    __fmt_pad(out, ' ', width - n);
   }
+}
 
-  return str;
+static void
+__fmt_run(struct __fmtout *out, const char *fmt, va_list ap)
+{
+  char digits[24], *end = digits + sizeof digits, *p;
+  const char *lit;
+  int width, prec, left, zero, lng, shrt, neg;
+  uint64_t u;
+  int64_t d;
+  char c;
+
+  while (*fmt) {
+    /* copy the literal run up to the next conversion in one go */
+    lit = fmt;
+    while (*fmt && *fmt != '%') {
+      fmt++;
+    }
+    __fmt_put(out, lit, fmt - lit);
+    if (*fmt == '\0') {
+      break;
+    }
+    lit = fmt++;
+
+    left = zero = lng = shrt = 0;
+    width = 0;
+    prec = -1;
+    for (;; fmt++) {
+      if (*fmt == '-') {
+        left = 1;
+      } else if (*fmt == '0') {
+        zero = 1;
+      } else {
+        break;
+      }
+    }
+    if (*fmt == '*') {
+      if ((width = va_arg(ap, int)) < 0) {
+        left = 1;
+        width = -width;
+      }
+      fmt++;
+    }
+    while (*fmt >= '0' && *fmt <= '9') {
+      width = width * 10 + (*fmt++ - '0');
+    }
+    if (*fmt == '.') {
+      fmt++;
+      prec = 0;
+      if (*fmt == '*') {
+        prec = va_arg(ap, int);
+        fmt++;
+      }
+      while (*fmt >= '0' && *fmt <= '9') {
+        prec = prec * 10 + (*fmt++ - '0');
+      }
+    }
+    for (;; fmt++) {
+      if (*fmt == 'l' || *fmt == 'z') {
+        lng++;
+      } else if (*fmt == 'h') {
+        shrt++;
+      } else {
+        break;
+      }
+    }
+
+    switch (*fmt) {
+    case 'd':
+    case 'i':
+      d = lng ? (lng > 1 ? va_arg(ap, long long) : va_arg(ap, long)) : va_arg(ap, int);
+      d = shrt ? (shrt > 1 ? (signed char)d : (short)d) : d;
+      neg = d < 0;
+      p = __utoa_dec(neg ? -(uint64_t)d : (uint64_t)d, end);
+      __fmt_number(out, neg ? "-" : "", p, end - p, width, prec, left, zero);
+      break;
+    case 'u':
+    case 'x':
+    case 'X':
+      u = lng ? (lng > 1 ? va_arg(ap, unsigned long long) : va_arg(ap, unsigned long))
+              : va_arg(ap, unsigned int);
+      u = shrt ? (shrt > 1 ? (unsigned char)u : (unsigned short)u) : u;
+      if (*fmt == 'u') {
+        p = __utoa_dec(u, end);
+      } else {
+        p = __utoa_hex(u, end, *fmt == 'x' ? "0123456789abcdef" : "0123456789ABCDEF");
+      }
+      __fmt_number(out, "", p, end - p, width, prec, left, zero);
+      break;
+    case 'p':
+      u = (uintptr_t)va_arg(ap, void *);
+      if (u == 0) {
+        __fmt_string(out, "(nil)", width, -1, left);
+        break;
+      }
+      p = __utoa_hex(u, end, "0123456789abcdef");
+      __fmt_number(out, "0x", p, end - p, width, prec, left, zero);
+      break;
+    case 's':
+      __fmt_string(out, va_arg(ap, const char *), width, prec, left);
+      break;
+    case 'c':
+      c = (char)va_arg(ap, int);
+      if (!left) {
+        __fmt_pad(out, ' ', width - 1);
+      }
+      __fmt_put(out, &c, 1);
+      if (left) {
+        __fmt_pad(out, ' ', width - 1);
+      }
+      break;
+    case '%':
+      __fmt_put(out, "%", 1);
+      break;
+    default: /* not a conversion we know, print it as is */
+      __fmt_put(out, lit, fmt - lit + (*fmt != '\0'));
+      if (*fmt == '\0') {
+        return;
+      }
+      break;
+    }
+    fmt++;
+  }
 }
 
 void
-writechars(int fd, void *buf, size_t n)
+myvfprintf(int fd, const char *fmt, va_list ap)
 {
-  size_t n_left = n, n_write;
-  char *bufp = buf;
+  char buf[__IO_GETCHAR_BUFSIZE];
+  struct __fmtout out = { buf, 0, sizeof buf, 0, fd };
 
-  while (n_left > 0) {
-    n_write = mywrite(fd, bufp, n_left);
-    n_left -= n_write;
-    bufp += n_write;
-  }
+  __fmt_run(&out, fmt, ap);
+  __fmt_flush(&out);
+}
+
+void
+myfprintf(int fd, const char *fmt, ...)
+{
+  va_list ap;
+
+  va_start(ap, fmt);
+  myvfprintf(fd, fmt, ap);
+  va_end(ap);
 }
 
-void*
-mymemset(void *s, int c, size_t n)
+size_t
+myvsnprintf(char *str, size_t size, const char *fmt, va_list ap)
 {
-  char *tmp = s;
+  struct __fmtout out = { str, 0, size ? size - 1 : 0, 0, -1 };
 
-  while(n--) {
-    *tmp++ = c;
+  __fmt_run(&out, fmt, ap);
+  if (size) {
+    str[out.len] = '\0';
   }
 
-  return s;
+  return out.total;
 }
 
-void*
-mymemcpy(void *dest, const void *src, size_t n)
+size_t
+mysnprintf(char *str, size_t size, const char *fmt, ...)
 {
-  char *d = dest;
-  const char *s = src;
+  va_list ap;
+  size_t n;
 
-  while(n > 0 && *s) {
-    *d++ = *s++;
-    n--;
+  va_start(ap, fmt);
+  n = myvsnprintf(str, size, fmt, ap);
+  va_end(ap);
+
+  return n;
+}
+
+char
+*myitoa(int num, char *str)
+{
+  char digits[16], *end = digits + sizeof digits, *p;
+  uint64_t u = num < 0 ? -(uint64_t)num : (uint64_t)num;
+
+  p = __utoa_dec(u, end);
+  if (num < 0) {
+    *--p = '-';
   }
+  mymemcpy(str, p, end - p);
+  str[end - p] = '\0';
 
-  return dest;
+  return str;
+}
+
+void
+writechars(int fd, void *buf, size_t n)
+{
+  size_t n_left = n, n_write;
+  char *bufp = buf;
+
+  while (n_left > 0) {
+    n_write = mywrite(fd, bufp, n_left);
+    n_left -= n_write;
+    bufp += n_write;
+  }
 }
 
 char*
@@ -258,23 +621,7 @@ mystrncpy(char *dst, const char * const src, size_t n)
 size_t
 mystrlen(const char *s)
 {
-  const char *sp = s;
-
-  while(*sp++) {;}
-
-  return (sp - s - 1);
-}
-
-int
-mystrcmp(const char *s1, const char *s2)
-{
-  const char *s = s1, *t = s2;
-  for ( ; *s == *t; s++, t++) {
-    if (*s == '\0') {
-      return 0;
-    }
-  }
-  return *s - *t;
+  return mystrchrnul(s, '\0') - s;
 }
 
 int
@@ -294,16 +641,9 @@ mystrncmp(const char *s1, const char *s2, size_t n)
 const char*
 mystrchr(const char *s, int c)
 {
-  const char *sp = s;
-
-  while(*sp) {
-    if(*sp == c) {
-      return sp;
-    }
-    sp++;
-  }
+  const char *sp = mystrchrnul(s, c);
 
-  return NULL;
+  return *sp != '\0' ? sp : NULL;
 }
 
 const char*
@@ -341,24 +681,24 @@ fdgetline(int fd)
   static char buf[__MAX_CMD_LEN];
   static char *bufptr = buf;
   static int n = 0;
-  char *ptr = bufptr;
+  char *ptr, *nl;
 
   if (n == 0) {
     n = myread(fd, buf, __MAX_CMD_LEN);
     bufptr = buf;
   }
+  ptr = bufptr;
 
-  while (n > 0) {
-    if (*bufptr == '\n') {
-      *bufptr = '\0';
-      bufptr++;
-      n--;
-      return ptr;
-    }
-    bufptr++;
-    n--;
+  if (n > 0 && (nl = (char *)mymemchr(bufptr, '\n', n)) != NULL) {
+    *nl = '\0';
+    n -= nl - bufptr + 1;
+    bufptr = nl + 1;
+    return ptr;
   }
 
+  bufptr += n;
+  n = 0;
+
   return NULL;
 }
 
@@ -459,10 +799,7 @@ mystrtok(char *str, char delim)
   next_token = remove_whitespace(next_token);
 
   start_token = next_token;
-
-  while (*next_token != '\0' && *next_token != delim) {
-    next_token++;
-  }
+  next_token = mystrchrnul(next_token, delim);
 
   if (*next_token != '\0') {
     *next_token = '\0';
@@ -32,6 +32,7 @@
 #define __MYSTRING_H
 
 #include "globals.h"
+#include <stdarg.h>
 
 /*  (from <stdio.h>) The value returned by fgetc and similar functions to indicate the
     end of the file.  */
@@ -45,6 +46,8 @@
  * @s: Pointer to the destination object.
  * @c: Value to be set.
  * @n: Number of bytes to be set.
+ *
+ * Dispatches to the widest variant in memops.c the CPU supports.
  */
 void *mymemset(void *s, int c, size_t n)
   __attribute__((__nonnull__(1)));
@@ -54,7 +57,9 @@ void *mymemset(void *s, int c, size_t n)
  *
  * @dest: Pointer to the destination object.
  * @src: Pointer to the source object.
- * @n: Number of bytes to be copied.
+ * @n: Number of bytes to be copied, NUL bytes included.
+ *
+ * Dispatches to the widest variant in memops.c the CPU supports.
  */
 void *mymemcpy(void *dest, const void *src, size_t n)
   __attribute__((__nonnull__(1, 2)));
@@ -119,6 +124,8 @@ char *mystrncpy(char *dst, const char * const src, size_t n)
  *
  * @s1: Pointer to the first string.
  * @s2: Pointer to the second string.
+ *
+ * Bytes compare as unsigned char. Dispatches to a variant in memscan.c.
  */
 int mystrcmp(const char *s1, const char *s2)
   __attribute__((__nonnull__ (1, 2), __pure__));
@@ -151,6 +158,16 @@ const char *mystrchr(const char *s, int c)
 const char *mystrrchr(const char *s, int c)
   __attribute__((__nonnull__ (1), __pure__));
 
+/**
+ * io_forget() - Drop what mygetchar() and myreadline() read ahead on a fd.
+ *
+ * @fd: File descriptor, about to be closed.
+ *
+ * A later fd with the same number starts with nothing buffered.
+ * myclose() calls it.
+ */
+void io_forget(int fd);
+
 /**
  * myputs() - Writes a string to stdout.
  *
@@ -191,7 +208,7 @@ void writechars(int fd, void *buf, size_t n)
 /**
  * myitoa() - converts an integer to a string
  * @num: The integer to convert
- * @str: string to store the integer in
+ * @str: string to store the integer in, at least 12 bytes
  */
 char *myitoa(int num, char *str)
   __attribute__((__nonnull__(2)));
@@ -200,10 +217,48 @@ char *myitoa(int num, char *str)
  * myfprintf() - will write a variable args string to fd.
  *
  * @fd: the fd to write to
- * @strn: the formatted string to write supports %c chars %d integers %s strings
+ * @fmt: printf style format, supports %d %i %u %x %X %p %s %c and %%, the
+ *       hh, h, l, ll and z length modifiers, the '-' and '0' flags, and
+ *       width and precision (either may be '*')
+ *
+ * The output is rendered into a stack buffer and written with a single
+ * write() unless it is longer than the buffer.
+ */
+void myfprintf(int fd, const char *fmt, ...)
+  __attribute__((__nonnull__(2), __format__(__printf__, 2, 3)));
+
+/**
+ * myvfprintf() - myfprintf() taking a va_list.
+ *
+ * @fd: the fd to write to
+ * @fmt: format, see myfprintf()
+ * @ap: the arguments
  */
-void myfprintf(int fd, const char *strn, ...)
-  __attribute__((__nonnull__(2)));
+void myvfprintf(int fd, const char *fmt, va_list ap)
+  __attribute__((__nonnull__(2), __format__(__printf__, 2, 0)));
+
+/**
+ * mysnprintf() - Format into a buffer, see myfprintf() for the format.
+ *
+ * @str: the buffer, always NUL terminated if @size is not 0
+ * @size: size of @str
+ * @fmt: format, see myfprintf()
+ *
+ * Return: length of the full output, which was truncated if >= @size.
+ */
+size_t mysnprintf(char *str, size_t size, const char *fmt, ...)
+  __attribute__((__nonnull__(3), __format__(__printf__, 3, 4)));
+
+/**
+ * myvsnprintf() - mysnprintf() taking a va_list.
+ *
+ * @str: the buffer, always NUL terminated if @size is not 0
+ * @size: size of @str
+ * @fmt: format, see myfprintf()
+ * @ap: the arguments
+ */
+size_t myvsnprintf(char *str, size_t size, const char *fmt, va_list ap)
+  __attribute__((__nonnull__(3), __format__(__printf__, 3, 0)));
 
 /**
  * mygetchar() - Reads a character from a file descriptor.
@@ -212,6 +267,26 @@ void myfprintf(int fd, const char *strn, ...)
  */
 int mygetchar(int fd);
 
+/**
+ * mybuffered() - Take bytes that mygetchar() and myreadline() read ahead.
+ *
+ * @fd: File descriptor.
+ * @buf: Receives them, NULL to drop them.
+ * @n: At most this many.
+ *
+ * Return: bytes taken, 0 when nothing is buffered for @fd.
+ */
+size_t mybuffered(int fd, void *buf, size_t n);
+
+/**
+ * mypending() - Count the bytes read ahead on a fd, without taking them.
+ *
+ * @fd: File descriptor.
+ *
+ * When it is not 0 the next myreadline() on @fd returns without reading.
+ */
+size_t mypending(int fd);
+
 /**
  * myputs() - Writes a string to stdout.
  *
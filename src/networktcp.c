@@ -28,8 +28,11 @@
  */
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <unistd.h>
+#include <errno.h>
 
 #include "syscalls.h"
 #include "networktcp.h"
@@ -124,6 +127,74 @@ sckconnect(struct addrinfo *ai)
   return sockfd;
 }
 
+int
+tcpfastopen_enabled(void)
+{
+  const char *val = mygetenv(TFO_ENV);
+  return val == NULL || mystrcmp(val, "0") != 0;
+}
+
+void
+settcpfastopen(int sck)
+{
+  int qlen = TFO_QLEN;
+
+  if (!tcpfastopen_enabled()) {
+    return;
+  }
+  if (setsockopt(sck, IPPROTO_TCP, TCP_FASTOPEN, &qlen, sizeof qlen) == -1) {
+    fdputs(sys_stderr, "server: TCP Fast Open unavailable\n");
+  }
+}
+
+int
+sckconnect_fastopen(struct addrinfo *ai, const void *data, size_t len)
+{
+  int sockfd;
+  ssize_t nsent = 0;
+  struct addrinfo *p;
+
+  if (!tcpfastopen_enabled()) {
+    sockfd = sckconnect(ai);
+    mysckwrite(sockfd, data, len);
+    return sockfd;
+  }
+
+  for (p = ai; p != NULL; p = p->ai_next) {
+    if ((sockfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1) {
+      continue;
+    }
+
+    nsent = sendto(sockfd, data, len, MSG_FASTOPEN, p->ai_addr, p->ai_addrlen);
+    if (nsent == -1 && (errno == EOPNOTSUPP || errno == ENOPROTOOPT)) {
+      /* client side TFO is off in the kernel, do it the slow way */
+      nsent = 0;
+      if (connect(sockfd, p->ai_addr, p->ai_addrlen) == -1) {
+        close(sockfd);
+        continue;
+      }
+    } else if (nsent == -1) {
+      close(sockfd);
+      continue;
+    }
+
+    break;
+  }
+
+  if (p == NULL) {
+    exitfreeaddr("connection failure", ai);
+  }
+
+  if (nsent < len) {
+    mysckwrite(sockfd, (const char *)data + nsent, len - nsent);
+  }
+
+  fdputs(sys_stderr, "client: connected\n");
+  freeaddrinfo(ai);
+
+  return sockfd;
+}
+
 int
 bindscklisten(struct addrinfo *ai)
 {
@@ -136,6 +207,8 @@ bindscklisten(struct addrinfo *ai)
     if(mybind(bsck, ai) == 0) break;
   }
 
+  settcpfastopen(bsck);
+
   if (mylisten(bsck, BACKLOG) == -1) {
     close(bsck);
     exitfreeaddr("listen error", ai);
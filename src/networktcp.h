@@ -33,6 +33,8 @@
 
 #define NETREADMAX MAX_DATA_SIZE
 #define BACKLOG 0x10
+#define TFO_QLEN 0x10 /* pending TCP Fast Open requests on the listen socket */
+#define TFO_ENV "SHELLSERVE_TFO" /* set to 0 to disable TCP Fast Open */
 
 #include <netdb.h>
 
@@ -108,6 +110,41 @@ int initservergetsock(const char *const port)
 int sckconnect(struct addrinfo *ai)
   __attribute__((__nonnull__(1)));
 
+/**
+ * sckconnect_fastopen() - Connects and sends the first payload in the SYN.
+ *
+ * @ai: Pointer to address info structure.
+ * @data: First bytes to send to the peer.
+ * @len: Length of @data.
+ *
+ * Uses TCP Fast Open when it is enabled so @data rides in the SYN and the
+ * peer can act on it one round trip earlier. Without a cookie the kernel
+ * falls back to a normal handshake on its own; if TFO is disabled or not
+ * supported this does a plain connect() followed by a write.
+ *
+ * Return: Socket descriptor of the connection.
+ */
+int sckconnect_fastopen(struct addrinfo *ai, const void *data, size_t len)
+  __attribute__((__nonnull__(1, 2)));
+
+/**
+ * tcpfastopen_enabled() - Check whether TCP Fast Open should be used.
+ *
+ * TFO is on unless the TFO_ENV environment variable is set to "0".
+ *
+ * Return: 1 if enabled, 0 otherwise.
+ */
+int tcpfastopen_enabled(void);
+
+/**
+ * settcpfastopen() - Enable TCP Fast Open on a listening socket.
+ *
+ * @sck: Socket descriptor, before listen() is called.
+ *
+ * Failure is not fatal, the socket keeps working as a normal listener.
+ */
+void settcpfastopen(int sck);
+
 /**
  * myaccept() - Wrapper for accept with custom handling.
  *
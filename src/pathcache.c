@@ -0,0 +1,273 @@
+/**
+ * @file pathcache.c
+ * @brief Hashed Command Path Cache
+ *
+ * Open addressing over a fixed table. Sessions insert concurrently, so each
+ * slot carries a sequence number used as a seqlock: a writer makes it odd
+ * while it fills the slot, and a reader that sees it odd or changed treats
+ * the lookup as a miss and resolves the slow way. Entries are stamped with
+ * the generation they were resolved in; bumping the generation empties the
+ * table without touching it.
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pathcache.h"
+#include "mystring.h"
+#include "memscan.h"
+#include "syscalls.h"
+#include "debug.h"
+
+struct pathslot {
+  uint32_t seq;                                /* odd while being written */
+  uint32_t gen;                                /* generation it was resolved in */
+  uint64_t hash;
+  uint32_t dir;                                /* index into dirs[] */
+  char name[PATHCACHE_NAMELEN];
+};
+
+struct pathtable {
+  uint32_t gen;                                /* 0 is never current */
+  uint32_t ndirs;
+  uint64_t checked;                            /* CLOCK_MONOTONIC of the last mtime check */
+  int64_t mtime[PATHCACHE_MAXDIRS];            /* ns */
+  char dirs[PATHCACHE_MAXDIRS][PATHCACHE_DIRLEN];
+  struct pathslot slots[PATHCACHE_NSLOTS];
+};
+
+static struct pathtable *__pt;
+
+static uint64_t
+__hash(const char *s)
+{
+  uint64_t h = 0xcbf29ce484222325ull;          /* FNV-1a */
+
+  while (*s) {
+    h = (h ^ (unsigned char)*s++) * 0x100000001b3ull;
+  }
+  return h;
+}
+
+static uint64_t
+__now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);  /* vDSO, not a syscall */
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int64_t
+__dir_mtime(const char *dir)
+{
+  struct stat st;
+
+  if (stat(dir, &st) == -1) {
+    return -1;
+  }
+  return (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+/* dir/name into out, -1 if it does not fit */
+static int
+__join(char *out, size_t outlen, const char *dir, const char *name)
+{
+  size_t dlen = mystrlen(dir), nlen = mystrlen(name);
+
+  if (dlen + 1 + nlen + 1 > outlen) {
+    return -1;
+  }
+  mymemcpy(out, dir, dlen);
+  out[dlen] = '/';
+  mymemcpy(out + dlen + 1, name, nlen + 1);
+  return 0;
+}
+
+static int
+__executable(const char *path)
+{
+  struct stat st;
+
+  return stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, X_OK) == 0;
+}
+
+/* one session per interval stats the directories; a change empties the cache */
+static void
+__recheck(struct pathtable *pt)
+{
+  uint64_t now = __now_ns(), last = __atomic_load_n(&pt->checked, __ATOMIC_RELAXED);
+  int changed = 0;
+  int64_t m;
+
+  if (now - last < PATHCACHE_RECHECK_NS
+      || !__atomic_compare_exchange_n(&pt->checked, &last, now, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    return;
+  }
+  for (uint32_t i = 0; i < pt->ndirs; i++) {
+    if ((m = __dir_mtime(pt->dirs[i])) != pt->mtime[i]) {
+      pt->mtime[i] = m;
+      changed = 1;
+    }
+  }
+  if (changed) {
+    debugf(SYSCALLDEBUG, DBG_INFO, "pathcache: PATH changed\n");
+    pathcache_invalidate();
+  }
+}
+
+/* cached directory index of name, -1 on a miss */
+static int
+__lookup(struct pathtable *pt, const char *name, uint64_t hash, uint32_t gen)
+{
+  for (uint32_t i = 0; i < PATHCACHE_PROBE; i++) {
+    struct pathslot *s = &pt->slots[(hash + i) & (PATHCACHE_NSLOTS - 1)];
+    uint32_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+    int hit;
+    uint32_t dir;
+
+    if (seq & 1) {
+      continue;
+    }
+    /* bounded, a torn name may have lost its NUL */
+    hit = s->gen == gen && s->hash == hash && mystrncmp(s->name, name, PATHCACHE_NAMELEN) == 0;
+    dir = s->dir;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq) {
+      continue;
+    }
+    if (hit) {
+      return dir < pt->ndirs ? (int)dir : -1;
+    }
+  }
+  return -1;
+}
+
+/* best effort: a slot another session is writing is left alone */
+static void
+__insert(struct pathtable *pt, const char *name, uint64_t hash, uint32_t gen, uint32_t dir)
+{
+  struct pathslot *s = &pt->slots[hash & (PATHCACHE_NSLOTS - 1)];
+  uint32_t seq;
+
+  for (uint32_t i = 0; i < PATHCACHE_PROBE; i++) {
+    struct pathslot *t = &pt->slots[(hash + i) & (PATHCACHE_NSLOTS - 1)];
+    if (t->gen != gen) { /* free or stale */
+      s = t;
+      break;
+    }
+  }
+
+  seq = __atomic_load_n(&s->seq, __ATOMIC_RELAXED);
+  if ((seq & 1)
+      || !__atomic_compare_exchange_n(&s->seq, &seq, seq + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+    return;
+  }
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  s->gen = gen;
+  s->hash = hash;
+  s->dir = dir;
+  mystrcpy(s->name, name);
+  __atomic_store_n(&s->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void
+pathcache_init(const char *path)
+{
+  struct pathtable *pt;
+  const char *p, *end;
+  size_t len;
+
+  pt = mmap(NULL, sizeof *pt, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (pt == MAP_FAILED) {
+    printerr_exit("mmap() error\n");
+  }
+
+  for (p = path ? path : PATHCACHE_DEFAULT_PATH; *p && pt->ndirs < PATHCACHE_MAXDIRS; p = *end ? end + 1 : end) {
+    end = mystrchrnul(p, ':');
+    len = end - p;
+    if (len == 0 || len >= PATHCACHE_DIRLEN) { /* "" means ".", not for a server */
+      continue;
+    }
+    mymemcpy(pt->dirs[pt->ndirs], p, len);
+    pt->dirs[pt->ndirs][len] = '\0';
+    pt->mtime[pt->ndirs] = __dir_mtime(pt->dirs[pt->ndirs]);
+    pt->ndirs++;
+  }
+  pt->gen = 1;
+  pt->checked = __now_ns();
+
+  if (__pt) {
+    munmap(__pt, sizeof *__pt);
+  }
+  __pt = pt;
+}
+
+void
+pathcache_invalidate(void)
+{
+  if (__pt && __atomic_add_fetch(&__pt->gen, 1, __ATOMIC_RELEASE) == 0) {
+    __atomic_add_fetch(&__pt->gen, 1, __ATOMIC_RELEASE); /* wrapped, 0 would match empty slots */
+  }
+}
+
+int
+pathcache_resolve(const char *name, char *out, size_t outlen)
+{
+  struct pathtable *pt;
+  uint64_t hash;
+  uint32_t gen;
+  int dir;
+
+  if (mystrchr(name, '/')) {
+    if (mystrlen(name) >= outlen) {
+      return -1;
+    }
+    mystrcpy(out, name);
+    return 0;
+  }
+  if (__pt == NULL) {
+    pathcache_init(mygetenv("PATH"));
+  }
+  pt = __pt;
+
+  __recheck(pt);
+  gen = __atomic_load_n(&pt->gen, __ATOMIC_ACQUIRE);
+  hash = __hash(name);
+  if (mystrlen(name) < PATHCACHE_NAMELEN
+      && (dir = __lookup(pt, name, hash, gen)) != -1
+      && __join(out, outlen, pt->dirs[dir], name) == 0) {
+    return 0;
+  }
+
+  for (uint32_t i = 0; i < pt->ndirs; i++) {
+    if (__join(out, outlen, pt->dirs[i], name) == 0 && __executable(out)) {
+      if (mystrlen(name) < PATHCACHE_NAMELEN && *name) {
+        __insert(pt, name, hash, gen, i);
+      }
+      return 0;
+    }
+  }
+  return -1;
+}
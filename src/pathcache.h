@@ -0,0 +1,70 @@
+/**
+ * @file pathcache.h
+ * @brief Hashed Command Path Cache
+ *
+ * Resolves a command name against PATH and remembers the answer in a hash
+ * table in a MAP_SHARED mapping, like the shell's hash builtin but shared by
+ * every session forked after pathcache_init(). A hit costs one hash lookup;
+ * the PATH directories are stat()ed at most once per PATHCACHE_RECHECK_NS
+ * across all sessions, and a change to any of their mtimes empties the cache.
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef __PATHCACHE_H
+#define __PATHCACHE_H
+
+#include <stddef.h>
+
+#define PATHCACHE_NSLOTS 1024              /* entries, a power of two */
+#define PATHCACHE_PROBE 8                  /* slots searched from the home slot */
+#define PATHCACHE_NAMELEN 64               /* longer names are not cached */
+#define PATHCACHE_MAXDIRS 32               /* PATH entries past this are ignored */
+#define PATHCACHE_DIRLEN 256               /* longer PATH entries are ignored */
+#define PATHCACHE_RECHECK_NS 1000000000ull /* how stale a directory mtime may be */
+#define PATHCACHE_DEFAULT_PATH "/usr/local/bin:/usr/bin:/bin"
+
+/**
+ * pathcache_init() - Create the shared cache for the directories in @path.
+ *
+ * @path: colon separated directories, NULL for PATHCACHE_DEFAULT_PATH
+ *
+ * Called by the server before it forks sessions. pathcache_resolve() calls
+ * it with $PATH when nothing did.
+ */
+void pathcache_init(const char *path);
+
+/**
+ * pathcache_resolve() - Find the executable a command name runs.
+ *
+ * @name: argv[0]; a name containing '/' is returned as is
+ * @out: receives the absolute path
+ * @outlen: size of @out
+ *
+ * Return: 0 on success, -1 if no PATH directory has an executable @name.
+ */
+int pathcache_resolve(const char *name, char *out, size_t outlen)
+  __attribute__((__nonnull__(1, 2)));
+
+/**
+ * pathcache_invalidate() - Forget every cached path, for all sessions.
+ */
+void pathcache_invalidate(void);
+
+#endif /* __PATHCACHE_H */
@@ -1,55 +1,52 @@
 #include "pipeline.h"
 #include "command_handler.h"
 #include "syscalls.h"
+#include "debug.h"
+#include "bufpool.h"
+#include "transcript.h"
+#include "resultcache.h"
+#include "builtins.h"
+#include "frames.h"
+#include "upload.h"
 
-#include <stdio.h> /* for fflush */
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <string.h> /* strerror */
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
 
-int
-parse_pipeline(Pipeline *pipe, int argc, char *argv[])
-{
-  int command_count = 0;
-  int argument_count = 0;
-
-  for (size_t i = 0; i < argc; i++) {
-    if (mystrcmp(argv[i], "|") == 0) {
-      pipe[command_count].argv[argument_count] = NULL;
-      argument_count = 0;
-      ++command_count;
-      continue;
-    }
-
-    pipe[command_count].argv[argument_count++] = argv[i];
-    pipe[command_count].argc = argument_count;
-  }
-
-  pipe[command_count].argv[argument_count] = NULL;
-
-  return command_count + 1;
-}
 
 void
 init_pipeline(Pipeline *pipe, int fd)
 {
+  pipe->argv = NULL;
   pipe->argc = 0;
 
   pipe->fin = NULL;
   pipe->fout = NULL;
-
-  for (int i = 0; i < MAX_NUM_ARGS; i++) {
-    pipe->argv[i] = NULL;
-  }
+  pipe->append = 0;
 
   for (int i = 0; i < FDLEN; i++) {
     pipe->fd[i] = -1;
+    pipe->redir[i] = -1;
   }
 
   pipe->sockfd = fd;
+  pipe->pid = -1;
+  pipe->nostart = 127; /* the shell's status for a command that could not run */
+  pipe->upload = 0;
+  mymemset(&pipe->usage, 0, sizeof pipe->usage);
 }
 
 void
-init_pipelines(Pipeline pipes[MAX_NUM_ARGS], int fd)
+init_pipelines(Pipeline *pipes, size_t npipes, int fd)
 {
-  for (int i = 0; i < MAX_NUM_ARGS; i++) {
+  for (int i = 0; i < npipes; i++) {
     init_pipeline(&pipes[i], fd);
   }
 }
@@ -59,10 +56,8 @@ init_pipesfd(Pipeline *pipe, size_t npipes)
 {
   for (int i = 0; i < npipes; i++) {
     mypipe(pipe[i].fd);
-    printf("pipe[%d].fd[0] = %d\n", i, pipe[i].fd[0]);
-    printf("pipe[%d].fd[0] = %d\n", i, pipe[i].fd[1]);
+    debugf(PIPELINEDEBUG, DBG_TRACE, "pipe[%d].fd = %d %d\n", i, pipe[i].fd[0], pipe[i].fd[1]);
   }
-  fflush(NULL);
 }
 
 void
@@ -75,37 +70,389 @@ close_pipes(Pipeline *pipe, size_t npipes)
 }
 
 void
+relay_output(int out, int err, int sockfd, int job)
+{
+  struct pollfd fds[2] = { { out, POLLIN, 0 }, { err, POLLIN, 0 } };
+  char *buf = bufpool_get();
+  ssize_t n;
+
+  while (fds[0].fd != -1 || fds[1].fd != -1) {
+    if (poll(fds, 2, -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      printerr_exit("poll() error\n");
+    }
+    for (int i = 0; i < 2; i++) {
+      if (fds[i].revents == 0) {
+        continue;
+      }
+      if ((n = read(fds[i].fd, buf, BUFPOOL_BUFSIZE)) == -1) {
+        if (errno == EINTR) {
+          continue;
+        }
+        printerr_exit("read() error\n");
+      }
+      if (n == 0) {
+        myclose(fds[i].fd);
+        fds[i].fd = -1; /* poll() skips it */
+        continue;
+      }
+      if (i == 0 && job == 0) {
+        transcript_write(buf, n);
+        resultcache_capture(buf, n);
+      }
+      frame_send(sockfd, i == 0 ? FRAME_STDOUT : FRAME_STDERR, job, buf, n);
+    }
+  }
+  bufpool_put(buf);
+}
+
+static uint64_t
+__now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t
+__tv_us(struct timeval tv)
+{
+  return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* wait for a stage and keep what it cost */
+static int
+__reap(Pipeline *p)
+{
+  struct rusage ru;
+  int wstatus;
+
+  mywait4(p->pid, &wstatus, 0, &ru);
+  p->usage.wall_ns = __now_ns() - p->usage.started;
+  p->usage.utime_us = __tv_us(ru.ru_utime);
+  p->usage.stime_us = __tv_us(ru.ru_stime);
+  p->usage.maxrss_kb = ru.ru_maxrss;
+  p->usage.nvcsw = ru.ru_nvcsw;
+  p->usage.nivcsw = ru.ru_nivcsw;
+  return wstatus;
+}
+
+/* a builtin runs in the session, it cost what the session used meanwhile */
+static void
+__self_usage(Pipeline *p, const struct rusage *before)
+{
+  struct rusage ru;
+
+  getrusage(RUSAGE_SELF, &ru);
+  p->usage.wall_ns = __now_ns() - p->usage.started;
+  p->usage.utime_us = __tv_us(ru.ru_utime) - __tv_us(before->ru_utime);
+  p->usage.stime_us = __tv_us(ru.ru_stime) - __tv_us(before->ru_stime);
+  p->usage.maxrss_kb = ru.ru_maxrss;
+  p->usage.nvcsw = ru.ru_nvcsw - before->ru_nvcsw;
+  p->usage.nivcsw = ru.ru_nivcsw - before->ru_nivcsw;
+}
+
+/* the last stage, in the session; file redirections replace in and out */
+static int
+run_last_builtin(const struct builtin *b, const struct builtin_args *args, Pipeline *last, int in, int errin)
+{
+  int out = last->sockfd, err = sys_stderr, flags = 0, status;
+  struct rusage ru;
+
+  if (transcript_enabled() || resultcache_capturing()) {
+    flags |= BUILTIN_TEE;
+  }
+  if (frames_enabled()) {
+    err = last->sockfd;
+    flags |= BUILTIN_FRAMED;
+  }
+  if (last->fin) {
+    if (in != -1) {
+      myclose(in);
+    }
+    if ((in = open(last->fin, O_RDONLY | O_CLOEXEC)) == -1) {
+      frame_printf(err, FRAME_STDERR, 0, "%s: %s: %s\n", last->argv[0], last->fin, strerror(errno));
+      return 1;
+    }
+  }
+  if (last->fout) {
+    out = open(last->fout, O_WRONLY | O_CREAT | O_CLOEXEC | (last->append ? O_APPEND : O_TRUNC), 0644);
+    if (out == -1) {
+      frame_printf(err, FRAME_STDERR, 0, "%s: %s: %s\n", last->argv[0], last->fout, strerror(errno));
+      if (in != -1) {
+        myclose(in);
+      }
+      return 1;
+    }
+    flags &= ~(BUILTIN_TEE | BUILTIN_FRAMED);
+  }
+
+  debugf(PIPELINEDEBUG, DBG_TRACE, "builtin %s\n", last->argv[0]);
+  getrusage(RUSAGE_SELF, &ru);
+  last->usage.started = __now_ns();
+  status = builtin_run(b, last->argc, last->argv, args, in, out, err, errin, flags);
+  __self_usage(last, &ru);
+
+  if (in != -1) {
+    myclose(in);
+  }
+  if (out != last->sockfd) {
+    myclose(out);
+  }
+  return status;
+}
+
+/* the put of a streamed upload, a child holding only the socket and its stdout pipe */
+static pid_t
+spawn_upload(Pipeline *pipe, size_t npipes, int err)
+{
+  pid_t pid = myfork();
+
+  if (pid != 0) {
+    mybuffered(pipe[0].sockfd, NULL, BUFPOOL_BUFSIZE); /* the child has the upload's first bytes */
+    return pid;
+  }
+  mysigaction(SIGPIPE, SIG_IGN); /* a next stage that stops reading is not an error */
+  for (size_t j = 0; j < npipes; j++) {
+    if (j) {
+      myclose(pipe[j].fd[WRITE_END]);
+    }
+    myclose(pipe[j].fd[READ_END]);
+  }
+  if (pipe[npipes-1].sockfd != pipe[0].sockfd) {
+    myclose(pipe[npipes-1].sockfd); /* the session's relay pipe */
+  }
+  if (err != -1) {
+    myclose(err);
+  }
+  _exit(upload_recv(pipe[0].sockfd, pipe[0].fd[WRITE_END]));
+}
+
+/* why a stage did not start, to where its stderr would have gone, or else to the client */
+static void
+__nostart(const Pipeline *pipe, size_t npipes, int err, const char *what, const char *why)
+{
+  char msg[PATH_MAX + 64];
+  size_t n = mysnprintf(msg, sizeof msg, "%s: %s\n", what, why);
+
+  n = n < sizeof msg ? n : sizeof msg - 1;
+  if (err != -1) {
+    mywrite(err, msg, n);
+  } else {
+    frame_send(pipe[npipes-1].sockfd, FRAME_STDERR, 0, msg, n);
+  }
+}
+
+static void
+__close_redirects(Pipeline *p)
+{
+  for (int k = 0; k < FDLEN; k++) {
+    if (p->redir[k] != -1) {
+      myclose(p->redir[k]);
+      p->redir[k] = -1;
+    }
+  }
+}
+
+/* the stage's < and > files, opened here so one that cannot be is reported and the stage not started */
+static int
+__open_redirects(Pipeline *pipe, size_t npipes, int err, Pipeline *p)
+{
+  if (p->fin && (p->redir[READ_END] = open(p->fin, O_RDONLY | O_CLOEXEC)) == -1) {
+    __nostart(pipe, npipes, err, p->fin, strerror(errno));
+    return -1;
+  }
+  if (p->fout && (p->redir[WRITE_END] = open(p->fout, O_WRONLY | O_CREAT | O_CLOEXEC
+                                             | (p->append ? O_APPEND : O_TRUNC), 0644)) == -1) {
+    __nostart(pipe, npipes, err, p->fout, strerror(errno));
+    __close_redirects(p);
+    return -1;
+  }
+  return 0;
+}
+
+/* start stages [0, nspawn), stderr to err unless -1, with the caller's signal mask, less the SIGCHLD the session holds */
+static void
+spawn_stages(Pipeline *pipe, size_t npipes, size_t nspawn, int err, int background)
+{
+  sigset_t mask;
+  posix_spawnattr_t attr;
+  posix_spawn_file_actions_t fa;
+  int e;
+
+  mysigprocmask(SIG_SETMASK, NULL, &mask);
+  sigdelset(&mask, SIGCHLD);
+  if (posix_spawnattr_init(&attr) != 0
+      || posix_spawnattr_setsigmask(&attr, &mask) != 0
+      || posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK) != 0) {
+    printerr_exit("posix_spawnattr error\n");
+  }
+
+  for (int i = 0; i < nspawn; i++) {
+    if (builtin_session(pipe[i].argv[0])) {
+      struct builtin_args args;
+
+      pipe[i].nostart = 2;
+      __nostart(pipe, npipes, err, pipe[i].argv[0], builtin_find(pipe[i].argc, pipe[i].argv, &args)
+                ? "runs only as the last command of a foreground pipeline" : "unsupported option");
+      continue;
+    }
+    if (!pipe[i].upload && __open_redirects(pipe, npipes, err, &pipe[i]) == -1) {
+      pipe[i].nostart = 1;
+      continue;
+    }
+    if (posix_spawn_file_actions_init(&fa) != 0) {
+      printerr_exit("posix_spawn_file_actions error\n");
+    }
+    if (err != -1 && posix_spawn_file_actions_adddup2(&fa, err, sys_stderr) != 0) {
+      printerr_exit("posix_spawn_file_actions error\n");
+    }
+    dup2_and_close(&fa, pipe, npipes, i);
+    /* a job must not read the server's stdin behind the session's back */
+    if (background && i == 0 && pipe[0].fin == NULL
+        && posix_spawn_file_actions_addopen(&fa, sys_stdin, "/dev/null", O_RDONLY, 0) != 0) {
+      printerr_exit("posix_spawn_file_actions error\n");
+    }
+    pipe[i].usage.started = __now_ns();
+    if (pipe[i].upload) {
+      pipe[i].pid = spawn_upload(pipe, npipes, err);
+    } else if ((e = myposix_spawn(&pipe[i].pid, pipe[i].argv[0], &fa, &attr, &pipe[i].argv[0], g_envp)) != 0) {
+      pipe[i].pid = -1;
+      pipe[i].nostart = e == ENOENT ? 127 : 126;
+      __nostart(pipe, npipes, err, pipe[i].argv[0], e == ENOENT ? "command not found" : strerror(e));
+    }
+    pipe[i].usage.spawn_ns = __now_ns() - pipe[i].usage.started;
+    posix_spawn_file_actions_destroy(&fa);
+    __close_redirects(&pipe[i]);
+  }
+  posix_spawnattr_destroy(&attr);
+}
+
+static size_t
+__append(char *buf, size_t size, size_t at, const char *s)
+{
+  while (*s && at < size - 1) {
+    buf[at++] = *s++;
+  }
+  buf[at] = '\0';
+  return at;
+}
+
+size_t
+describe_pipeline(char *buf, size_t size, const Pipeline *pipe, size_t npipes)
+{
+  size_t at = 0;
+
+  buf[0] = '\0';
+  for (size_t i = 0; i < npipes; i++) {
+    if (i) {
+      at = __append(buf, size, at, " | ");
+    }
+    for (int k = 0; k < pipe[i].argc; k++) {
+      at = __append(buf, size, at, k ? " " : "");
+      at = __append(buf, size, at, pipe[i].argv[k]);
+    }
+    if (pipe[i].fin) {
+      at = __append(buf, size, at, " < ");
+      at = __append(buf, size, at, pipe[i].fin);
+    }
+    if (pipe[i].fout) {
+      at = __append(buf, size, at, pipe[i].append ? " >> " : " > ");
+      at = __append(buf, size, at, pipe[i].fout);
+    }
+  }
+  return at;
+}
+
+/* a pipe for the session to read, neither end survives exec unless dup2()ed */
+static void
+session_pipe(int fd[FDLEN])
+{
+  mypipe(fd);
+  fcntl(fd[READ_END], F_SETFD, FD_CLOEXEC);
+  fcntl(fd[WRITE_END], F_SETFD, FD_CLOEXEC);
+}
+
+int
 run_pipeline(Pipeline *pipe, size_t npipes)
 {
-  pid_t pid;
+  int out[FDLEN] = { -1, -1 }, err[FDLEN] = { -1, -1 }, sockfd = npipes ? pipe[npipes-1].sockfd : -1;
+  int wstatus = 0, status = 0, in = -1;
+  size_t nspawn = npipes;
+  const struct builtin *builtin = NULL;
+  struct builtin_args args;
+
+  /* a builtin for the last stage runs here, its input is the pipe before it */
+  if (npipes && (builtin = builtin_find(pipe[npipes-1].argc, pipe[npipes-1].argv, &args)) != NULL) {
+    nspawn--;
+  }
 
   init_pipesfd(pipe, npipes);
+  if (npipes && builtin == NULL && (transcript_enabled() || frames_enabled() || resultcache_capturing())) {
+    /* only the last command keeps out[] past exec, as its stdout */
+    session_pipe(out);
+    pipe[npipes-1].sockfd = out[WRITE_END];
+  }
+  if (nspawn && frames_enabled()) {
+    session_pipe(err);
+  }
 
-  for (int i = 0; i < npipes; i++) {
-    pid = myfork();
-    if (pid == 0) { /* child client */
-      dup2_and_close(pipe, npipes, i);
-      myexecve(pipe[i].argv[0], &pipe[i].argv[0], g_envp);
-    }
-    /* parent */
+  spawn_stages(pipe, npipes, nspawn, err[WRITE_END], 0);
+  if (builtin && npipes > 1) {
+    in = fcntl(pipe[npipes-2].fd[READ_END], F_DUPFD_CLOEXEC, 0);
   }
   close_pipes(pipe, npipes); /* close all pipes in parent */
 
-  /* [TODO] use SIG's so we can have bg procs */
-  for (int i = 0; i < npipes; i++) {
-    mywait(NULL);
+  if (err[WRITE_END] != -1) {
+    myclose(err[WRITE_END]);
+  }
+  if (out[WRITE_END] != -1) {
+    myclose(out[WRITE_END]);
+  }
+  if (builtin) {
+    /* stages before it write their stderr to err[] while it runs, it relays that as it waits */
+    status = run_last_builtin(builtin, &args, &pipe[npipes-1], in, err[READ_END]);
+  }
+  relay_output(out[READ_END], err[READ_END], sockfd, 0);
+
+  for (int i = 0; i < nspawn; i++) {
+    if (pipe[i].pid != -1) {
+      wstatus = __reap(&pipe[i]);
+    } else {
+      wstatus = pipe[i].nostart << 8;
+    }
+  }
+
+  if (builtin) {
+    return status;
   }
+  return WIFSIGNALED(wstatus) ? 128 + WTERMSIG(wstatus) : WEXITSTATUS(wstatus);
+}
+
+void
+start_pipeline(Pipeline *pipe, size_t npipes, int err)
+{
+  init_pipesfd(pipe, npipes);
+  spawn_stages(pipe, npipes, npipes, err, 1);
+  close_pipes(pipe, npipes);
 }
 
 int
-build_pipeline(Pipeline *pipe, ClientData * const client, char * const readbuf)
+build_pipeline(Pipeline *pipe, const struct cmd_pipeline *pl, int fd)
 {
-  int argc, npipes;
-  char *argv[MAX_LINE_SIZE];
+  int npipes = 0;
 
-  argc = parse_commandline(argv, readbuf);
-  npipes = parse_pipeline(pipe, argc, argv);
+  init_pipelines(pipe, pl->nstages, fd);
+  for (const struct cmd_simple *cmd = pl->first; cmd; cmd = cmd->next, npipes++) {
+    pipe[npipes].argv = cmd->argv;
+    pipe[npipes].argc = cmd->argc;
+    pipe[npipes].fin = cmd->in;
+    pipe[npipes].fout = cmd->out;
+    pipe[npipes].append = cmd->append;
+  }
 
   return npipes;
 }
-
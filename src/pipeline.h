@@ -3,9 +3,11 @@
 
 #define __need_size_t
 #include <stddef.h> /* for size_t */
+#include <stdint.h>
 
 #include "globals.h"
 #include "server_core.h"
+#include "cmdparse.h"
 
 /**
  * enum pipefd - Enum for indexing pipe file descriptors
@@ -23,25 +25,62 @@ enum pipefd {
   FDLEN
 };
 
+/**
+ * struct stage_usage - What one stage of a pipeline cost
+ * @started: CLOCK_MONOTONIC ns when it was started
+ * @spawn_ns: Time posix_spawn() took, 0 for a builtin
+ * @wall_ns: From the start until it was reaped
+ * @utime_us: User CPU time
+ * @stime_us: System CPU time
+ * @maxrss_kb: Peak resident set size
+ * @nvcsw: Voluntary context switches
+ * @nivcsw: Involuntary context switches
+ *
+ * A builtin's numbers are those of the session while it ran, its
+ * @maxrss_kb is the session's.
+ */
+struct stage_usage {
+  uint64_t started;
+  uint64_t spawn_ns;
+  uint64_t wall_ns;
+  uint64_t utime_us;
+  uint64_t stime_us;
+  long maxrss_kb;
+  long nvcsw;
+  long nivcsw;
+};
+
 /**
  * struct __Pipeline - Structure for holding pipeline command and I/O info
- * @argv: Array of pointers to argument strings
- * @fin: Pointer to input file name string
- * @fout: Pointer to output file name string
+ * @argv: NULL terminated argument strings
+ * @fin: Pointer to input file name string, or NULL
+ * @fout: Pointer to output file name string, or NULL
+ * @append: Open @fout for appending instead of truncating it
  * @argc: Count of arguments in argv
  * @fd: Array of pipe file descriptors
  * @sockfd: Socket file descriptor
+ * @pid: Process running the command, once started
+ * @nostart: Exit status of a command that could not start, when @pid is -1
+ * @redir: The @fin and @fout files, opened by the session before the spawn
+ * @upload: The command is the put of a streamed upload, see upload_recv()
+ * @usage: What the command cost, filled in by run_pipeline()
  *
  * This structure holds all the relevant information for a command pipeline,
  * including the command arguments, any file I/O redirections, and file descriptors.
  */
 typedef struct __Pipeline {
-  char *argv[MAX_NUM_ARGS];
+  char **argv;
   char *fin;
   char *fout;
+  int append;
   int argc;
   int fd[FDLEN];
   int sockfd;
+  pid_t pid;
+  int nostart;
+  int redir[FDLEN];
+  int upload;
+  struct stage_usage usage;
 } Pipeline;
 
 /**
@@ -65,53 +104,94 @@ void close_pipes(Pipeline *pipe, size_t npipes);
 void init_pipesfd(Pipeline *pipe, size_t npipes);
 
 /**
- * build_pipeline - Constructs a pipeline from client data
- * @pipe: Pointer to the array of Pipeline structures
- * @client: Pointer to ClientData structure containing client information
- * @readbuf: Pointer to buffer containing the command to parse
+ * build_pipeline - Fill a Pipeline array from a parsed pipeline
+ * @pipe: Pointer to the array of Pipeline structures, one per stage
+ * @pl: The parsed pipeline, see cmd_parse()
+ * @fd: File descriptor the last command writes to
  *
- * Return: Number of pipelines created
+ * Return: Number of pipelines filled
  */
-int build_pipeline(Pipeline *pipe, ClientData * const client, char * const readbuf)
+int build_pipeline(Pipeline *pipe, const struct cmd_pipeline *pl, int fd)
   __attribute__((__nonnull__(1, 2)));
 
 /**
- * parse_pipeline - Parses command-line arguments to populate a Pipeline array
+ * run_pipeline - Execute the commands in the pipelines
  * @pipe: Pointer to the array of Pipeline structures
- * @argc: Count of arguments passed
- * @argv: Pointer to array of argument strings
+ * @npipes: Number of pipelines
+ *
+ * Iterates over each Pipeline in the array, starting the commands with
+ * posix_spawn() and file actions for their plumbing, and waits for all of them.
+ * A last command that builtin_find() knows runs in the session instead,
+ * reading the pipe before it and writing to the socket. When the session is
+ * framed, the last command's stdout and every stage's stderr come back
+ * through pipes and go out as frames, see relay_output(). Only the pids of
+ * this pipeline are waited for, background jobs are left to jobs_reap().
+ * Each stage's usage is recorded as it is reaped, see struct stage_usage.
+ * A first stage marked @upload is a child of the session that copies the
+ * client's upload into the pipe after it.
  *
- * Return: Number of commands parsed, +1
+ * Return: exit status of the last command, 128 + signal if it was killed,
+ *         127 if it could not be started
  */
-int parse_pipeline(Pipeline *pipe, int argc, char *argv[])
-  __attribute__((__nonnull__(1, 3)));
+int run_pipeline(Pipeline *pipe, size_t npipes);
 
 /**
- * run_pipeline - Execute the commands in the pipelines
+ * start_pipeline - Start the commands in the pipelines without waiting
  * @pipe: Pointer to the array of Pipeline structures
  * @npipes: Number of pipelines
+ * @err: Where every stage's stderr goes, -1 to leave it alone
  *
- * Iterates over each Pipeline in the array, forking and executing the commands.
+ * Every stage is spawned, builtins included, and the first reads /dev/null
+ * unless it redirects its input. The last one writes to its sockfd directly,
+ * so a background job's output is not in the transcript. Stages that could
+ * not start have pid -1.
  */
-void run_pipeline(Pipeline *pipe, size_t npipes);
+void start_pipeline(Pipeline *pipe, size_t npipes, int err);
+
+/**
+ * relay_output - Send what the commands print to the client until they close
+ * @out: Read end of the last command's stdout, or -1
+ * @err: Read end of the stages' stderr, or -1
+ * @sockfd: Client socket
+ * @job: 0 for the command line, otherwise the background job
+ *
+ * Output goes out as frames when the session is framed, see frame_send(),
+ * and the command line's stdout is also copied to the transcript and to a
+ * result cache capture, see resultcache_capture(). Both descriptors are
+ * closed.
+ */
+void relay_output(int out, int err, int sockfd, int job);
+
+/**
+ * describe_pipeline - The command line again, close enough to what was typed
+ * @buf: Receives the text, truncated to fit
+ * @size: Size of @buf, not 0
+ * @pipe: Pointer to the array of Pipeline structures
+ * @npipes: Number of pipelines
+ *
+ * Return: Length of the text in @buf
+ */
+size_t describe_pipeline(char *buf, size_t size, const Pipeline *pipe, size_t npipes)
+  __attribute__((__nonnull__(1, 3)));
 
 /**
  * init_pipeline - Initialize a single Pipeline structure
  * @pipe: Pointer to the Pipeline structure to initialize
  * @fd: File descriptor to associate with the Pipeline's sockfd
  *
- * Initialize the argv pointers to NULL, and file descriptors to -1.
+ * Clear argv and the redirections, and set the file descriptors to -1.
  */
 void init_pipeline(Pipeline *pipe, int fd);
 
 /**
  * init_pipelines - Initialize an array of Pipeline structures
  * @pipes: Array of Pipeline structures to initialize
+ * @npipes: Number of entries in @pipes
  * @fd: File descriptor to associate with each Pipeline's sockfd
  *
  * Iterates over each Pipeline structure in the array and initializes it.
  */
-void init_pipelines(Pipeline pipes[MAX_NUM_ARGS], int fd);
+void init_pipelines(Pipeline *pipes, size_t npipes, int fd);
 
 #endif /* __PIPELINE_H */
 
@@ -0,0 +1,406 @@
+/**
+ * @file resultcache.c
+ * @brief Shared Result Cache For Read-Only Commands
+ *
+ * A fixed table of slots in a shared mapping, each holding one command
+ * line's output. The key is the cwd and the parsed argv, so quoting and
+ * spacing do not matter; the stat of the cwd and of every operand is kept
+ * next to the output and must still match when it is served. Slots are
+ * seqlocked as in pathcache.c: the writer makes the sequence odd while it
+ * fills a slot and a reader copies the output out before checking that the
+ * sequence did not move. A store replaces the entry for the same key, an
+ * empty or expired slot, or the one served least recently.
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "resultcache.h"
+#include "mystring.h"
+#include "syscalls.h"
+#include "frames.h"
+#include "transcript.h"
+#include "debug.h"
+
+struct resultpath {
+  uint64_t dev;
+  uint64_t ino;                                /* 0 if it did not exist */
+  int64_t size;
+  int64_t mtime;                               /* ns */
+};
+
+struct resultslot {
+  uint32_t seq;                                /* odd while being written */
+  uint32_t gen;                                /* generation it was stored in */
+  uint64_t hash;
+  uint64_t stored;                             /* CLOCK_MONOTONIC */
+  uint64_t used;                               /* last served, for eviction */
+  uint32_t keylen;
+  uint32_t npaths;
+  uint32_t len;
+  struct resultpath paths[RESULTCACHE_MAXPATHS];
+  char key[RESULTCACHE_KEYLEN];
+  char data[RESULTCACHE_SLOTSIZE];
+};
+
+struct resulttable {
+  uint32_t gen;                                /* 0 is never current */
+  uint64_t ttl;                                /* ns */
+  struct resultslot slots[RESULTCACHE_NSLOTS];
+};
+
+/* the command line being looked up, and its output while it runs */
+struct resultkey {
+  int armed;                                   /* capturing for resultcache_store() */
+  int overflow;
+  uint64_t hash;
+  uint32_t keylen;
+  uint32_t npaths;
+  uint32_t len;
+  struct resultpath paths[RESULTCACHE_MAXPATHS];
+  char key[RESULTCACHE_KEYLEN];
+};
+
+/*
+ * commands whose output depends on nothing but what the stat of their
+ * operands and of the cwd shows. A directory's mtime moves when an entry
+ * is added, removed or renamed, not when one is written to or chmod()ed,
+ * so ls only qualifies while it prints nothing but names.
+ */
+static const struct {
+  const char *name;
+  int operands;                                /* reads stdin without one */
+  const char *opts;                            /* the options allowed, NULL for any */
+} __readonly[] = {
+  { "cat",       1, NULL },
+  { "head",      1, NULL },
+  { "ls",        0, "1ACUadmrx" },
+  { "md5sum",    1, NULL },
+  { "sha256sum", 1, NULL },
+  { "tail",      1, NULL },
+  { "wc",        1, NULL },
+};
+
+static struct resulttable *__rt;
+static struct resultkey __k;
+static char __out[RESULTCACHE_SLOTSIZE];       /* a hit copied out, or a miss captured */
+
+static uint64_t
+__hash(const char *s, size_t n)
+{
+  uint64_t h = 0xcbf29ce484222325ull;          /* FNV-1a */
+
+  while (n--) {
+    h = (h ^ (unsigned char)*s++) * 0x100000001b3ull;
+  }
+  return h;
+}
+
+static uint64_t
+__now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* a path that does not exist is recorded too, creating it changes the entry */
+static void
+__stat(const char *path, struct resultpath *rp)
+{
+  struct stat st;
+
+  mymemset(rp, 0, sizeof *rp);
+  if (stat(path, &st) == 0) {
+    rp->dev = st.st_dev;
+    rp->ino = st.st_ino;
+    rp->size = st.st_size;
+    rp->mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+  }
+}
+
+/* every letter of an option is one opts allows, long options never are */
+static int
+__optsallowed(const char *arg, const char *opts)
+{
+  if (arg[1] == '-') {
+    return 0;
+  }
+  for (arg++; *arg; arg++) {
+    if (mystrchr(opts, *arg) == NULL) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* a following tail never finishes, stdin is not an operand we can stat */
+static int
+__cacheable(const Pipeline *p, int first)
+{
+  const char *opts;
+  int operands = 0, i, n;
+
+  for (n = 0; n < sizeof __readonly / sizeof *__readonly; n++) {
+    if (mystrcmp(__readonly[n].name, p->argv[0]) == 0) {
+      break;
+    }
+  }
+  if (n == sizeof __readonly / sizeof *__readonly || p->fin || p->fout) {
+    return 0;
+  }
+  opts = __readonly[n].opts;
+  for (i = 1; i < p->argc; i++) {
+    if (mystrcmp(p->argv[i], "-") == 0) {
+      return 0;
+    }
+    if (p->argv[i][0] != '-') {
+      operands++;
+    } else if (opts && !__optsallowed(p->argv[i], opts)) {
+      return 0;
+    } else if (mystrcmp(p->argv[0], "tail") == 0
+               && (mystrncmp(p->argv[i], "--f", 3) == 0 || mystrncmp(p->argv[i], "--r", 3) == 0
+                   || (p->argv[i][1] != '-' && (mystrchr(p->argv[i], 'f') || mystrchr(p->argv[i], 'F'))))) {
+      return 0;
+    }
+  }
+  return !(first && __readonly[n].operands && operands == 0);
+}
+
+/* cwd, then per stage argc and the NUL terminated arguments; -1 if not cacheable */
+static int
+__makekey(const Pipeline *pipe, size_t npipes, struct resultkey *k)
+{
+  size_t len, n;
+
+  if (npipes == 0 || mygetcwd(k->key, RESULTCACHE_KEYLEN) == NULL) {
+    return -1;
+  }
+  len = mystrlen(k->key) + 1;
+  k->npaths = 0;
+  __stat(k->key, &k->paths[k->npaths++]);
+
+  for (size_t i = 0; i < npipes; i++) {
+    if (pipe[i].argc > 255 || len + 1 > RESULTCACHE_KEYLEN || !__cacheable(&pipe[i], i == 0)) {
+      return -1;
+    }
+    k->key[len++] = (char)pipe[i].argc;
+    for (int j = 0; j < pipe[i].argc; j++) {
+      if (len + (n = mystrlen(pipe[i].argv[j]) + 1) > RESULTCACHE_KEYLEN) {
+        return -1;
+      }
+      mymemcpy(k->key + len, pipe[i].argv[j], n);
+      len += n;
+      if (j == 0 || pipe[i].argv[j][0] == '-') {
+        continue;
+      }
+      if (k->npaths == RESULTCACHE_MAXPATHS) {
+        return -1;
+      }
+      __stat(pipe[i].argv[j], &k->paths[k->npaths++]);
+    }
+  }
+  k->keylen = len;
+  k->hash = __hash(k->key, len);
+  return 0;
+}
+
+/* same key and the same files; fields read without the seqlock, checked after */
+static int
+__matches(const struct resultslot *s, const struct resultkey *k)
+{
+  return s->hash == k->hash && s->keylen == k->keylen && s->npaths == k->npaths
+         && memcmp(s->key, k->key, k->keylen) == 0
+         && memcmp(s->paths, k->paths, k->npaths * sizeof *k->paths) == 0;
+}
+
+/* length of the output copied into __out, -1 on a miss */
+static int
+__lookup(struct resulttable *rt, const struct resultkey *k, uint32_t gen, uint64_t now)
+{
+  for (uint32_t i = 0; i < RESULTCACHE_NSLOTS; i++) {
+    struct resultslot *s = &rt->slots[i];
+    uint32_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE), len;
+    int hit;
+
+    if ((seq & 1) || s->gen != gen || s->hash != k->hash) {
+      continue;
+    }
+    hit = now - s->stored <= rt->ttl && __matches(s, k);
+    len = s->len;
+    if (hit && len <= RESULTCACHE_SLOTSIZE) {
+      mymemcpy(__out, s->data, len);
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq || !hit || len > RESULTCACHE_SLOTSIZE) {
+      continue;
+    }
+    __atomic_store_n(&s->used, now, __ATOMIC_RELAXED);
+    return len;
+  }
+  return -1;
+}
+
+/* the entry for the same key, else an empty or expired slot, else the least recently served */
+static struct resultslot *
+__victim(struct resulttable *rt, const struct resultkey *k, uint32_t gen, uint64_t now)
+{
+  struct resultslot *lru = &rt->slots[0], *free = NULL;
+
+  for (uint32_t i = 0; i < RESULTCACHE_NSLOTS; i++) {
+    struct resultslot *s = &rt->slots[i];
+
+    if (s->gen == gen && __matches(s, k)) {
+      return s;
+    }
+    if (free == NULL && (s->gen != gen || now - s->stored > rt->ttl)) {
+      free = s;
+    }
+    if (__atomic_load_n(&s->used, __ATOMIC_RELAXED) < __atomic_load_n(&lru->used, __ATOMIC_RELAXED)) {
+      lru = s;
+    }
+  }
+  return free ? free : lru;
+}
+
+void
+resultcache_init(const char *ttl)
+{
+  struct resulttable *rt;
+  uint64_t ms = 0;
+
+  for ( ; ttl && *ttl >= '0' && *ttl <= '9'; ttl++) {
+    ms = ms * 10 + (*ttl - '0');
+  }
+  if (ms == 0) {
+    return;
+  }
+
+  /* untouched slots cost no memory */
+  rt = mmap(NULL, sizeof *rt, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (rt == MAP_FAILED) {
+    printerr_exit("mmap() error\n");
+  }
+  rt->gen = 1;
+  rt->ttl = ms * 1000000;
+
+  if (__rt) {
+    munmap(__rt, sizeof *__rt);
+  }
+  __rt = rt;
+}
+
+int
+resultcache_serve(const Pipeline *pipe, size_t npipes, int sockfd)
+{
+  struct resulttable *rt = __rt;
+  uint64_t now;
+  int len;
+
+  __k.armed = 0;
+  if (rt == NULL || __makekey(pipe, npipes, &__k) == -1) {
+    return 0;
+  }
+
+  now = __now_ns();
+  if ((len = __lookup(rt, &__k, __atomic_load_n(&rt->gen, __ATOMIC_ACQUIRE), now)) != -1) {
+    debugf(PIPELINEDEBUG, DBG_INFO, "resultcache: %s served %d bytes\n", pipe[0].argv[0], len);
+    transcript_write(__out, len);
+    frame_send(sockfd, FRAME_STDOUT, 0, __out, len);
+    return 1;
+  }
+
+  __k.armed = 1;
+  __k.overflow = 0;
+  __k.len = 0;
+  return 0;
+}
+
+int
+resultcache_capturing(void)
+{
+  return __k.armed;
+}
+
+void
+resultcache_capture(const void *buf, size_t n)
+{
+  if (!__k.armed || __k.overflow) {
+    return;
+  }
+  if (n > RESULTCACHE_SLOTSIZE - __k.len) {
+    __k.overflow = 1;
+    return;
+  }
+  mymemcpy(__out + __k.len, buf, n);
+  __k.len += n;
+}
+
+/* best effort: a slot another session is writing is left alone */
+void
+resultcache_store(int status)
+{
+  struct resulttable *rt = __rt;
+  struct resultslot *s;
+  uint64_t now;
+  uint32_t gen, seq;
+
+  if (!__k.armed) {
+    return;
+  }
+  __k.armed = 0;
+  if (rt == NULL || status != 0 || __k.overflow) {
+    return;
+  }
+
+  now = __now_ns();
+  gen = __atomic_load_n(&rt->gen, __ATOMIC_ACQUIRE);
+  s = __victim(rt, &__k, gen, now);
+  seq = __atomic_load_n(&s->seq, __ATOMIC_RELAXED);
+  if ((seq & 1)
+      || !__atomic_compare_exchange_n(&s->seq, &seq, seq + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+    return;
+  }
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  s->gen = gen;
+  s->hash = __k.hash;
+  s->stored = now;
+  s->used = now;
+  s->keylen = __k.keylen;
+  s->npaths = __k.npaths;
+  s->len = __k.len;
+  mymemcpy(s->paths, __k.paths, __k.npaths * sizeof *__k.paths);
+  mymemcpy(s->key, __k.key, __k.keylen);
+  mymemcpy(s->data, __out, __k.len);
+  __atomic_store_n(&s->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void
+resultcache_invalidate(void)
+{
+  if (__rt && __atomic_add_fetch(&__rt->gen, 1, __ATOMIC_RELEASE) == 0) {
+    __atomic_add_fetch(&__rt->gen, 1, __ATOMIC_RELEASE); /* wrapped, 0 would match empty slots */
+  }
+}
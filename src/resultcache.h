@@ -0,0 +1,92 @@
+/**
+ * @file resultcache.h
+ * @brief Shared Result Cache For Read-Only Commands
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef __RESULTCACHE_H
+#define __RESULTCACHE_H
+
+#include <stddef.h>
+
+#include "pipeline.h"
+
+#define RESULTCACHE_ENV "SHELLSERVE_RESULT_CACHE" /* TTL in ms, unset or 0 disables */
+#define RESULTCACHE_NSLOTS 64                     /* entries, evicted least recently used */
+#define RESULTCACHE_SLOTSIZE (64 << 10)           /* larger outputs are not cached */
+#define RESULTCACHE_KEYLEN 1024                   /* longer command lines are not cached */
+#define RESULTCACHE_MAXPATHS 8                    /* the cwd and the operands, more are not cached */
+
+/**
+ * resultcache_init() - Create the shared cache, if enabled.
+ *
+ * @ttl: milliseconds an entry may be served, NULL or "0" leaves it disabled
+ *
+ * Called by the server before it forks sessions, which all share it.
+ */
+void resultcache_init(const char *ttl);
+
+/**
+ * resultcache_serve() - Send a command line's output from the cache.
+ *
+ * @pipe: the pipeline about to run, see build_pipeline()
+ * @npipes: number of stages
+ * @sockfd: client socket
+ *
+ * Only pipelines of known read-only commands without redirections are
+ * looked up. An entry is served while it is younger than the TTL and the
+ * cwd and every operand still have the inode, size and mtime they had when
+ * it ran. On a miss the output of the run that follows is captured, see
+ * resultcache_capture(), and resultcache_store() keeps it.
+ *
+ * Return: 1 if the output was sent and the command must not run, else 0.
+ */
+int resultcache_serve(const Pipeline *pipe, size_t npipes, int sockfd)
+  __attribute__((__nonnull__(1)));
+
+/**
+ * resultcache_capturing() - True while a miss is being captured.
+ */
+int resultcache_capturing(void);
+
+/**
+ * resultcache_capture() - Append command output to the capture, if any.
+ *
+ * @buf: stdout bytes, as sent to the client
+ * @n: number of bytes
+ */
+void resultcache_capture(const void *buf, size_t n);
+
+/**
+ * resultcache_store() - Finish a capture started by resultcache_serve().
+ *
+ * @status: exit status of the run, only successful runs are kept
+ *
+ * Output that overflowed RESULTCACHE_SLOTSIZE is dropped. stderr is never
+ * captured, so a command that warns and succeeds is served without it.
+ */
+void resultcache_store(int status);
+
+/**
+ * resultcache_invalidate() - Forget every cached result, for all sessions.
+ */
+void resultcache_invalidate(void);
+
+#endif /* __RESULTCACHE_H */
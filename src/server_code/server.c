@@ -27,12 +27,16 @@
 #include "../server_core.h"
 #include "../signals.h"
 #include "../clientlogin.h"
+#include "../debug.h"
 
 void
 apprunner(void)
 {
   ServerData server;
 
+  if (debug_init(mygetenv(DEBUG_ENV)) == -1) {
+    printerr_exit("bad " DEBUG_ENV ", expected level[:category,...]\n");
+  }
   load_credentials("credentials.txt");
   install_handlers();
   initserver(&server);
@@ -44,6 +44,15 @@
 #include "command_handler.h"
 #include "pipeline.h"
 #include "filetransfer.h"
+#include "bufpool.h"
+#include "serverlog.h"
+#include "transcript.h"
+#include "pathcache.h"
+#include "jobs.h"
+#include "frames.h"
+#include "resultcache.h"
+#include "cgroup.h"
+#include "cmdstats.h"
 
 const char *const greeting = "Welcome to MyFTP Server!\n";
 const char *const port = "1234";
@@ -54,10 +63,16 @@ initserver(ServerData * const server)
 {
   server->port     = port;
   server->greeting = greeting;
+  server->outfd    = sys_stdout; /* for logging */
+  log_init(server->outfd);     /* before the socket, the writer has no use for it */
+  transcript_init();
+  pathcache_init(mygetenv("PATH")); /* shared by the sessions forked later */
+  resultcache_init(mygetenv(RESULTCACHE_ENV));
+  cgroup_init(); /* the listener stays in its own cgroup */
+  cmdstats_init();
   server->bindfd   = initservergetsock(server->port);
   server->runflag  = 1;
-  server->outfd    = sys_stdout; /* for logging */
-  mymemset(server->readbuf, 0, NETREADMAX);
+  server->readbuf  = NULL;
 }
 
 pid_t
@@ -68,7 +83,7 @@ acceptandforkclient(ClientData * const client, const ServerData * const server)
   client->clientfd = myaccept(server->bindfd);
   client->clientid = clientid;
 
-  myfprintf(server->outfd, "::client %d connected\n", client->clientid);
+  log_event(LOG_CONNECT, client->clientid, 0, NULL);
 
   return myfork();
 }
@@ -76,8 +91,9 @@ acceptandforkclient(ClientData * const client, const ServerData * const server)
 void closeclientfd(ClientData * const client, const ServerData * const server)
 {
   close(client->clientfd);
-  myfprintf(server->outfd, "::client %d disconnected\n", client->clientid);
-  _exit(1);
+  transcript_close();
+  log_event(LOG_DISCONNECT, client->clientid, 0, NULL);
+  myexit(1); /* jobs_hangup() */
 }
 
 char * const
@@ -86,9 +102,21 @@ send_recv_log_io(const char * const send_data,
                  ServerData * const server)
 {
   fdputs(server->io->sockfd, send_data);
-  mymemset(server->io->buf, 0, server->io->bufsize-1);
+  transcript_puts(send_data);
+
+  /*
+   * stay bufferless while the client is idle, reaping jobs that finish.
+   * A line that came in with the last one is already here, poll() would
+   * not wake up for it.
+   */
+  if (mypending(server->io->sockfd) == 0) {
+    jobs_poll(server->io->sockfd);
+  }
+  io_attach(server->io);
   myreadline(server->io->sockfd, server->io->buf, server->io->bufsize-1);
-  myfprintf(server->io->writefd, "::client %d sent %s\n", client->clientid, server->io->buf);
+  log_event(LOG_SENT, client->clientid, 0, server->io->buf);
+  transcript_puts(server->io->buf);
+  transcript_write("\n", 1);
 
   return server->io->buf;
 }
@@ -101,7 +129,7 @@ send_recv_log(const char * const send_data,
   fdputs(client->clientfd, send_data);
   mymemset(server->readbuf, 0, NETREADMAX-1);
   myreadline(client->clientfd, server->readbuf, NETREADMAX-1);
-  myfprintf(server->outfd, "::client %d sent %s\n", client->clientid, server->readbuf);
+  log_event(LOG_SENT, client->clientid, 0, server->readbuf);
 
   return server->readbuf;
 }
@@ -136,7 +164,7 @@ attempt_login(ClientData * const client, ServerData * const server)
 
   userindex = verifyuser(username, password);
   if (userindex == -1) {
-    myfprintf(server->outfd, "::client %d failed password attempt\n", client->clientid);
+    log_event(LOG_LOGIN_FAILED, client->clientid, 0, NULL);
   }
 
   return userindex;
@@ -145,6 +173,7 @@ attempt_login(ClientData * const client, ServerData * const server)
 void
 do_login(ClientData * const client, ServerData * const server)
 {
+  server->readbuf = bufpool_get();
   send_greeting(client, server);
   client->userindex = -1;
   for (int nlogin = 0; nlogin < MAX_LOGIN_ATTEMPTS && client->userindex == -1; nlogin++) {
@@ -152,6 +181,8 @@ do_login(ClientData * const client, ServerData * const server)
   }
 
   send_login_result(client, client->userindex);
+  bufpool_put(server->readbuf);
+  server->readbuf = NULL;
 
   server->runflag = client->userindex != -1;
 }
@@ -160,6 +191,7 @@ void
 handleclient(ClientData * const client, ServerData * const server)
 {
   struct MyIO io;
+  int status;
 
   initiostruct(client->clientfd, sys_stdout, sys_stdout, &io);
   server->io = &io;
@@ -170,14 +202,20 @@ handleclient(ClientData * const client, ServerData * const server)
     serverhandleput,
     serverhandlehelp,
     serverhandleexit,
+    serverhandleuget,
   };
 
   while(server->runflag) {
     fflush(NULL);
-    send_recv_log_io(prompt, client, server);
+    jobs_notify(client->clientfd);
+    /* a framed client knows the line is done from its exit frame */
+    send_recv_log_io(frames_enabled() ? "" : prompt, client, server);
+    status = 0;
     if (runfiletransfer(server->io, callbacks)) {
-      runcommand(client, server->io->buf);
+      status = runcommand(client, server->io->buf);
     }
+    frame_exit(client->clientfd, 0, status);
+    io_detach(server->io);
   }
 }
 
@@ -186,16 +224,23 @@ runserver(ServerData * const server)
 {
   ClientData client;
 
-  myfprintf(server->outfd, "::server up\n");
+  log_event(LOG_SERVER_UP, 0, 0, NULL);
   while (server->runflag) {
     if (acceptandforkclient(&client, server) == 0) { /* we are in a child process */
       myclose(server->bindfd); /* we dont need this in the child */
+      jobs_init(); /* the session waits for its own children */
+      transcript_open(client.clientid);
       do_login(&client, server);
+      if (server->runflag) {
+        cgroup_enter(); /* after login, which runs with the listener's share */
+      }
       handleclient(&client, server);
       closeclientfd(&client, server);
     }
     myclose(client.clientfd); /* close client socket in parent don't need it */
+    cgroup_sweep(); /* sessions whose cgroup was still busy when they were reaped */
   }
-  myfprintf(server->outfd, "::server down\n");
+  log_event(LOG_SERVER_DOWN, 0, 0, NULL);
+  log_close();
 }
 
@@ -56,7 +56,8 @@ struct MyIO;
  * List of supported commands as a string.
  *
  * @var ServerData::readbuf
- * Buffer used for reading data from the client. Sized to NETREADMAX + 1 to account for null-terminator.
+ * Buffer used for reading login replies from the client. Borrowed from the
+ * buffer pool for the duration of do_login() and NULL otherwise.
  *
  * @var ServerData::runflag
  * A flag to control whether the server continues running.
@@ -70,7 +71,7 @@ typedef struct _ServerData {
   const char *port;
   const char *greeting;
   const char *commandlist;
-  char readbuf[NETREADMAX+1];
+  char *readbuf;
   int runflag;
   int outfd;
 }ServerData;
@@ -0,0 +1,613 @@
+/**
+ * @file serverlog.c
+ * @brief Asynchronous Server Log
+ *
+ * A bounded multi-producer ring in a MAP_SHARED mapping inherited by every
+ * forked session, drained by a single writer process which renders the
+ * records as text or encodes them as binary records with interned strings.
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "serverlog.h"
+#include "mystring.h"
+#include "syscalls.h"
+
+static struct logring *__log;
+static pid_t __logwriter;
+static pid_t __logpid; /* ours, kept current across fork() for __log_publish() */
+
+/* seq of a slot a producer is copying into, with the producer's pid */
+#define __LOG_COPYING (1ULL << 63)
+
+/* writer side: the batch being gathered and the binary log's string table */
+struct __logout {
+  int fd;
+  int binary;
+  uint64_t ts; /* of the last binary record, the next one's is a delta */
+  size_t n;
+  char batch[LOG_BATCH];
+};
+
+struct __intern {
+  uint32_t hash, id, off;
+  uint16_t len;
+};
+
+#define __INTERN_SLOTS (2 * LOG_NINTERN)
+#define __INTERN_ARENA (LOG_NINTERN * 64)
+
+static struct __intern __interned[__INTERN_SLOTS];
+static char __internarena[__INTERN_ARENA];
+static uint32_t __ninterned, __internused;
+
+static const char * const __eventnames[LOG_NEVENTS] = {
+  [LOG_STRDEF]          = "strdef",
+  [LOG_TEXT]            = "text",
+  [LOG_SERVER_UP]       = "server_up",
+  [LOG_SERVER_DOWN]     = "server_down",
+  [LOG_CONNECT]         = "connect",
+  [LOG_DISCONNECT]      = "disconnect",
+  [LOG_SENT]            = "sent",
+  [LOG_LOGIN_FAILED]    = "login_failed",
+  [LOG_REQUEST]         = "request",
+  [LOG_CHILD_EXITED]    = "child_exited",
+  [LOG_CHILD_KILLED]    = "child_killed",
+  [LOG_CHILD_STOPPED]   = "child_stopped",
+  [LOG_CHILD_CONTINUED] = "child_continued",
+  [LOG_SIGINT]          = "sigint",
+  [LOG_DROPPED]         = "dropped",
+  [LOG_SLOW]            = "slow",
+};
+
+const char *
+log_event_name(unsigned int event)
+{
+  return event < LOG_NEVENTS ? __eventnames[event] : "unknown";
+}
+
+size_t
+log_render(const struct logrec *rec, const char *str, size_t slen, char *buf, size_t size)
+{
+  int id = rec->clientid, arg = rec->arg, len = (int)slen;
+
+  if (str == NULL) {
+    str = "";
+    len = 0;
+  }
+
+  switch (rec->event) {
+  case LOG_TEXT:            return mysnprintf(buf, size, "%.*s", len, str);
+  case LOG_SERVER_UP:       return mysnprintf(buf, size, "::server up\n");
+  case LOG_SERVER_DOWN:     return mysnprintf(buf, size, "::server down\n");
+  case LOG_CONNECT:         return mysnprintf(buf, size, "::client %d connected\n", id);
+  case LOG_DISCONNECT:      return mysnprintf(buf, size, "::client %d disconnected\n", id);
+  case LOG_SENT:            return mysnprintf(buf, size, "::client %d sent %.*s\n", id, len, str);
+  case LOG_LOGIN_FAILED:    return mysnprintf(buf, size, "::client %d failed password attempt\n", id);
+  case LOG_REQUEST:         return mysnprintf(buf, size, "client:: %.*s\n", len, str);
+  case LOG_CHILD_EXITED:    return mysnprintf(buf, size, "exited, status=%d\n", arg);
+  case LOG_CHILD_KILLED:    return mysnprintf(buf, size, "killed by signal %d\n", arg);
+  case LOG_CHILD_STOPPED:   return mysnprintf(buf, size, "stopped by signal %d\n", arg);
+  case LOG_CHILD_CONTINUED: return mysnprintf(buf, size, "continued\n");
+  case LOG_SIGINT:          return mysnprintf(buf, size, "\nCaught SIGINT\n");
+  case LOG_DROPPED:         return mysnprintf(buf, size, "::log dropped %d records\n", arg);
+  case LOG_SLOW:            return mysnprintf(buf, size, "::client %d slow %dms %.*s\n", id, arg, len, str);
+  default:                  return mysnprintf(buf, size, "%s", "");
+  }
+}
+
+static uint64_t
+__log_now_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t
+__log_timestamp(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts); /* vDSO, not a syscall */
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+__log_sleep_us(long us)
+{
+  struct timespec ts = { us / 1000000, (us % 1000000) * 1000 };
+
+  nanosleep(&ts, NULL);
+}
+
+static void
+__out_flush(struct __logout *out)
+{
+  if (out->n > 0) {
+    writechars(out->fd, out->batch, out->n);
+    out->n = 0;
+  }
+}
+
+static void
+__out_put(struct __logout *out, const void *p, size_t n)
+{
+  if (out->n + n > LOG_BATCH) {
+    __out_flush(out);
+  }
+  mymemcpy(out->batch + out->n, p, n);
+  out->n += n;
+}
+
+static unsigned char *
+__log_putvarint(unsigned char *p, uint64_t v)
+{
+  for (; v >= 0x80; v >>= 7) {
+    *p++ = (unsigned char)v | 0x80;
+  }
+  *p++ = (unsigned char)v;
+  return p;
+}
+
+/* NULL if the varint does not end before end */
+static const unsigned char *
+__log_getvarint(const unsigned char *p, const unsigned char *end, uint64_t *v)
+{
+  *v = 0;
+  for (int shift = 0; p < end && shift < 64; shift += 7) {
+    *v |= (uint64_t)(*p & 0x7f) << shift;
+    if ((*p++ & 0x80) == 0) {
+      return p;
+    }
+  }
+  return NULL;
+}
+
+/* small negative numbers stay small as varints */
+static uint64_t
+__log_zigzag(int64_t v)
+{
+  return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t
+__log_unzigzag(uint64_t v)
+{
+  return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static int
+__log_haspayload(unsigned int event)
+{
+  return event == LOG_STRDEF || event == LOG_TEXT;
+}
+
+/* one binary record, see struct logrec for the encoding */
+static void
+__log_putbinary(struct __logout *out, const struct logrec *rec, const char *str)
+{
+  unsigned char enc[40], *p = enc;
+  unsigned int head = rec->event;
+
+  head |= rec->clientid ? LOG_BIN_CLIENT : 0;
+  head |= rec->arg ? LOG_BIN_ARG : 0;
+  head |= rec->strid ? LOG_BIN_STRID : 0;
+  *p++ = head;
+  p = __log_putvarint(p, __log_zigzag((int64_t)(rec->ts - out->ts)));
+  out->ts = rec->ts;
+  if (rec->clientid) {
+    p = __log_putvarint(p, rec->clientid);
+  }
+  if (rec->arg) {
+    p = __log_putvarint(p, __log_zigzag(rec->arg));
+  }
+  if (rec->strid) {
+    p = __log_putvarint(p, rec->strid);
+  }
+  if (__log_haspayload(rec->event)) {
+    p = __log_putvarint(p, rec->len);
+  }
+  __out_put(out, enc, p - enc);
+  if (__log_haspayload(rec->event)) {
+    __out_put(out, str, rec->len);
+  }
+}
+
+size_t
+log_decode(const void *buf, size_t n, uint64_t *ts, struct logrec *rec, const char **payload)
+{
+  const unsigned char *p = buf, *end = p + n;
+  uint64_t v;
+  unsigned int head;
+
+  if (n == 0) {
+    return 0;
+  }
+  head = *p++;
+  *rec = (struct logrec){ .event = head & LOG_BIN_EVENT };
+  *payload = NULL;
+  if (rec->event >= LOG_NEVENTS || (p = __log_getvarint(p, end, &v)) == NULL) {
+    return 0;
+  }
+  rec->ts = *ts + (uint64_t)__log_unzigzag(v);
+  if (head & LOG_BIN_CLIENT) {
+    if ((p = __log_getvarint(p, end, &v)) == NULL || v > UINT32_MAX) {
+      return 0;
+    }
+    rec->clientid = v;
+  }
+  if (head & LOG_BIN_ARG) {
+    if ((p = __log_getvarint(p, end, &v)) == NULL) {
+      return 0;
+    }
+    rec->arg = (int32_t)__log_unzigzag(v);
+  }
+  if (head & LOG_BIN_STRID) {
+    if ((p = __log_getvarint(p, end, &v)) == NULL || v == 0 || v > LOG_NINTERN) {
+      return 0;
+    }
+    rec->strid = v;
+  }
+  if (__log_haspayload(rec->event)) {
+    if ((p = __log_getvarint(p, end, &v)) == NULL || v > LOG_RECSIZE || v > (uint64_t)(end - p)) {
+      return 0;
+    }
+    rec->len = v;
+    *payload = (const char *)p;
+    p += v;
+  }
+  *ts = rec->ts; /* only now, a cut off record is decoded again once it is whole */
+  return p - (const unsigned char *)buf;
+}
+
+static uint32_t
+__log_hash(const char *s, size_t n)
+{
+  uint32_t h = 2166136261u; /* FNV-1a */
+
+  while (n--) {
+    h = (h ^ (unsigned char)*s++) * 16777619u;
+  }
+  return h;
+}
+
+/* id of the string, defining it in the output the first time it is seen */
+static uint32_t
+__log_intern(struct __logout *out, uint64_t ts, const char *s, size_t n)
+{
+  uint32_t h = __log_hash(s, n), i;
+  struct __intern *e;
+  struct logrec def = { .ts = ts, .event = LOG_STRDEF, .len = n };
+
+  for (i = h & (__INTERN_SLOTS - 1);; i = (i + 1) & (__INTERN_SLOTS - 1)) {
+    e = &__interned[i];
+    if (e->id == 0) {
+      break;
+    }
+    if (e->hash == h && e->len == n && mystrncmp(__internarena + e->off, s, n) == 0) {
+      return e->id;
+    }
+  }
+
+  if (__ninterned == LOG_NINTERN || __internused + n > __INTERN_ARENA) {
+    /* start over, ids get redefined from 1 */
+    mymemset(__interned, 0, sizeof __interned);
+    __ninterned = __internused = 0;
+    return __log_intern(out, ts, s, n);
+  }
+
+  e->hash = h;
+  e->id = ++__ninterned;
+  e->off = __internused;
+  e->len = n;
+  mymemcpy(__internarena + e->off, s, n);
+  __internused += n;
+
+  def.strid = e->id;
+  __log_putbinary(out, &def, s);
+
+  return e->id;
+}
+
+static void
+__log_encode(struct __logout *out, struct logrec *rec, const char *str)
+{
+  char line[LOG_RECSIZE + 64];
+  size_t n;
+
+  if (!out->binary) {
+    n = log_render(rec, str, rec->len, line, sizeof line);
+    __out_put(out, line, n < sizeof line ? n : sizeof line - 1);
+  } else if (rec->event == LOG_TEXT) {
+    __log_putbinary(out, rec, str);
+  } else {
+    if (rec->len > 0) {
+      rec->strid = __log_intern(out, rec->ts, str, rec->len);
+      rec->len = 0;
+    }
+    __log_putbinary(out, rec, NULL);
+  }
+}
+
+/*
+ * whether to give up on the unfilled slot at pos; a producer that died
+ * there would stall us forever. A slot nobody has started copying into is
+ * taken back from its producer, which then drops the record. One being
+ * copied into is only given up once its producer is gone, a late copy
+ * would tear the record of the slot's next owner.
+ */
+static int
+__log_skip(struct logslot *slot, uint64_t pos, uint64_t seq, uint64_t *stalled_since)
+{
+  if (pos == __atomic_load_n(&__log->head, __ATOMIC_RELAXED)) {
+    *stalled_since = 0;
+    return 0; /* empty */
+  }
+  if (*stalled_since == 0) {
+    *stalled_since = __log_now_us();
+    return 0;
+  }
+  if (__log_now_us() - *stalled_since < LOG_STALL_US) {
+    return 0;
+  }
+  if (seq & __LOG_COPYING) {
+    if (kill((pid_t)(seq & ~__LOG_COPYING), 0) == 0 || errno != ESRCH) {
+      return 0;
+    }
+  } else if (!__atomic_compare_exchange_n(&slot->seq, &seq, pos + LOG_NSLOTS, 0,
+                                          __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+    return 0; /* the producer got there first */
+  }
+  __atomic_add_fetch(&__log->dropped, 1, __ATOMIC_RELAXED);
+  return 1;
+}
+
+/* encode every finished record from the tail on, return the number taken */
+static size_t
+__log_gather(struct __logout *out, uint64_t *stalled_since)
+{
+  struct logring *r = __log;
+  struct logslot *slot;
+  uint64_t pos = r->tail, seq;
+  size_t n = 0;
+
+  for (;;) {
+    slot = &r->slots[pos & (LOG_NSLOTS - 1)];
+    seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if (seq == pos + 1) {
+      __log_encode(out, &slot->rec, slot->str);
+      n++;
+    } else if (!__log_skip(slot, pos, seq, stalled_since)) {
+      break;
+    }
+    *stalled_since = 0;
+    __atomic_store_n(&slot->seq, pos + LOG_NSLOTS, __ATOMIC_RELEASE);
+    __atomic_store_n(&r->tail, ++pos, __ATOMIC_RELEASE);
+  }
+
+  return n;
+}
+
+static void __attribute__((__noreturn__))
+__log_writer(int outfd, int binary, pid_t parent)
+{
+  static struct __logout out;
+  struct logrec drop = { .event = LOG_DROPPED };
+  uint64_t stalled_since = 0, dropped;
+  int done = 0;
+
+  /* a ^C to the server must not lose what is still queued */
+  mysigaction(SIGINT, SIG_IGN);
+
+  out.fd = outfd;
+  out.binary = binary;
+  if (binary) {
+    __out_put(&out, LOG_MAGIC, sizeof LOG_MAGIC - 1);
+  }
+
+  while (!done) {
+    done = __atomic_load_n(&__log->stop, __ATOMIC_ACQUIRE) || getppid() != parent;
+    while (__log_gather(&out, &stalled_since) > 0) {
+      ;
+    }
+    if ((dropped = __atomic_exchange_n(&__log->dropped, 0, __ATOMIC_RELAXED)) > 0) {
+      drop.ts = __log_timestamp();
+      drop.arg = dropped > INT32_MAX ? INT32_MAX : (int32_t)dropped;
+      __log_encode(&out, &drop, NULL);
+    }
+    __out_flush(&out);
+    if (!done) {
+      __log_sleep_us(LOG_IDLE_US);
+    }
+  }
+
+  _exit(0);
+}
+
+static void
+__log_forked(void)
+{
+  __logpid = getpid();
+}
+
+void
+log_init(int outfd)
+{
+  pid_t parent = getpid();
+  const char *format = getenv(LOG_FORMAT_ENV);
+  int binary = format != NULL && mystrcmp(format, "binary") == 0;
+
+  __log = mmap(NULL, sizeof *__log, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (__log == MAP_FAILED) {
+    printerr_exit("mmap() error\n");
+  }
+  for (uint64_t i = 0; i < LOG_NSLOTS; i++) {
+    __log->slots[i].seq = i;
+  }
+  __logpid = parent;
+  pthread_atfork(NULL, NULL, __log_forked);
+
+  if ((__logwriter = myfork()) == 0) {
+    __log_writer(outfd, binary, parent);
+  }
+}
+
+/* claim the next slot, NULL if the ring is full */
+static struct logslot *
+__log_claim(uint64_t *pos)
+{
+  struct logring *r = __log;
+  struct logslot *slot;
+  uint64_t seq;
+
+  *pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+  for (;;) {
+    slot = &r->slots[*pos & (LOG_NSLOTS - 1)];
+    seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if (seq == *pos) {
+      if (__atomic_compare_exchange_n(&r->head, pos, *pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        return slot;
+      }
+    } else if ((int64_t)(seq - *pos) < 0) {
+      __atomic_add_fetch(&r->dropped, 1, __ATOMIC_RELAXED);
+      return NULL;
+    } else {
+      *pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+/*
+ * copy a record built on the stack into the claimed slot. The slot is
+ * marked as being copied into first; if the writer already gave up on it
+ * the record is dropped without touching the slot, which may have a new
+ * owner by now.
+ */
+static void
+__log_publish(struct logslot *slot, uint64_t pos, const struct logslot *rec)
+{
+  if (!__atomic_compare_exchange_n(&slot->seq, &pos, __LOG_COPYING | (uint64_t)__logpid, 0,
+                                   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+    return;
+  }
+  slot->rec = rec->rec;
+  mymemcpy(slot->str, rec->str, rec->rec.len);
+  __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+void
+log_event(enum logevent event, int clientid, int arg, const char *str)
+{
+  struct logslot *slot, local;
+  uint64_t pos;
+  size_t n = 0;
+  char line[LOG_RECSIZE + 64];
+
+  local.rec.ts = __log_timestamp();
+  local.rec.clientid = clientid;
+  local.rec.arg = arg;
+  local.rec.event = event;
+  local.rec.strid = 0;
+  for (; str && str[n] && n < LOG_RECSIZE; n++) {
+    local.str[n] = str[n];
+  }
+  local.rec.len = n;
+
+  if (__log == NULL) {
+    n = log_render(&local.rec, local.str, n, line, sizeof line);
+    writechars(sys_stdout, line, n < sizeof line ? n : sizeof line - 1);
+    return;
+  }
+  if ((slot = __log_claim(&pos)) != NULL) {
+    __log_publish(slot, pos, &local);
+  }
+}
+
+void
+log_printf(const char *fmt, ...)
+{
+  struct logslot *slot, local;
+  uint64_t pos;
+  va_list ap;
+  size_t n;
+
+  va_start(ap, fmt);
+  if (__log == NULL) {
+    myvfprintf(sys_stdout, fmt, ap);
+    va_end(ap);
+    return;
+  }
+
+  n = myvsnprintf(local.str, LOG_RECSIZE, fmt, ap);
+  va_end(ap);
+  if (n >= LOG_RECSIZE) {
+    n = LOG_RECSIZE - 1;
+    local.str[n - 1] = '\n'; /* keep truncated records on their own line */
+  }
+  local.rec.ts = __log_timestamp();
+  local.rec.clientid = 0;
+  local.rec.arg = 0;
+  local.rec.event = LOG_TEXT;
+  local.rec.strid = 0;
+  local.rec.len = n;
+
+  if ((slot = __log_claim(&pos)) != NULL) {
+    __log_publish(slot, pos, &local);
+  }
+}
+
+void
+log_flush(void)
+{
+  uint64_t head;
+
+  if (__log == NULL) {
+    return;
+  }
+  head = __atomic_load_n(&__log->head, __ATOMIC_ACQUIRE);
+  while ((int64_t)(__atomic_load_n(&__log->tail, __ATOMIC_ACQUIRE) - head) < 0
+         && kill(__logwriter, 0) == 0) {
+    __log_sleep_us(LOG_IDLE_US / 2);
+  }
+}
+
+void
+log_close(void)
+{
+  if (__log == NULL) {
+    return;
+  }
+  log_flush();
+  __atomic_store_n(&__log->stop, 1, __ATOMIC_RELEASE);
+  waitpid(__logwriter, NULL, 0);
+  munmap(__log, sizeof *__log);
+  __log = NULL;
+}
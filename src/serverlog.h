@@ -0,0 +1,228 @@
+/**
+ * @file serverlog.h
+ * @brief Asynchronous Server Log
+ *
+ * Session processes append log records to a lock-free ring in shared memory
+ * and go on with the request; a writer process drains the ring and writes
+ * the records out in batches, as text or as compact binary records. Logging
+ * an event costs a few stores and atomic operations, never a syscall.
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef __SERVERLOG_H
+#define __SERVERLOG_H
+
+#include <stdint.h>
+
+#include "globals.h"
+
+#define LOG_NSLOTS 1024           /* records in the ring, a power of two */
+#define LOG_RECSIZE 216           /* longer strings are truncated */
+#define LOG_BATCH 0x10000         /* bytes the writer gathers per write() */
+#define LOG_IDLE_US 2000          /* writer sleep when the ring is empty */
+#define LOG_STALL_US 1000000      /* a claimed slot left unfilled this long is skipped */
+#define LOG_FORMAT_ENV "SHELLSERVE_LOG_FORMAT" /* "binary" for the binary log */
+#define LOG_MAGIC "SSLOG02\n"     /* first 8 bytes of a binary log */
+#define LOG_NINTERN 4096          /* string ids before the table starts over */
+#define LOG_BIN_RECMAX (1 + 5 * 10 + LOG_RECSIZE) /* longest binary record */
+
+/**
+ * enum logevent - What a log record says
+ * @LOG_STRDEF: binary log only, defines string @strid as the payload
+ * @LOG_TEXT: free form text in the payload, see log_printf()
+ * @LOG_SERVER_UP: "::server up"
+ * @LOG_SERVER_DOWN: "::server down"
+ * @LOG_CONNECT: "::client ID connected"
+ * @LOG_DISCONNECT: "::client ID disconnected"
+ * @LOG_SENT: "::client ID sent STR", a line the client sent
+ * @LOG_LOGIN_FAILED: "::client ID failed password attempt"
+ * @LOG_REQUEST: "client:: STR", a transfer command being served
+ * @LOG_CHILD_EXITED: "exited, status=ARG"
+ * @LOG_CHILD_KILLED: "killed by signal ARG"
+ * @LOG_CHILD_STOPPED: "stopped by signal ARG"
+ * @LOG_CHILD_CONTINUED: "continued"
+ * @LOG_SIGINT: "Caught SIGINT"
+ * @LOG_DROPPED: "::log dropped ARG records"
+ * @LOG_SLOW: "::client ID slow ARGms STR", a pipeline over the threshold
+ * @LOG_NEVENTS: number of events
+ */
+enum logevent {
+  LOG_STRDEF,
+  LOG_TEXT,
+  LOG_SERVER_UP,
+  LOG_SERVER_DOWN,
+  LOG_CONNECT,
+  LOG_DISCONNECT,
+  LOG_SENT,
+  LOG_LOGIN_FAILED,
+  LOG_REQUEST,
+  LOG_CHILD_EXITED,
+  LOG_CHILD_KILLED,
+  LOG_CHILD_STOPPED,
+  LOG_CHILD_CONTINUED,
+  LOG_SIGINT,
+  LOG_DROPPED,
+  LOG_SLOW,
+  LOG_NEVENTS,
+};
+
+/* first byte of a binary record: the event and which fields follow */
+#define LOG_BIN_EVENT  0x1f
+#define LOG_BIN_CLIENT 0x20
+#define LOG_BIN_ARG    0x40
+#define LOG_BIN_STRID  0x80
+
+/**
+ * struct logrec - A log record
+ * @ts: nanoseconds since the epoch
+ * @clientid: client the event is about, 0 for the server
+ * @arg: event argument, e.g. an exit status
+ * @event: enum logevent
+ * @len: payload bytes (LOG_STRDEF, LOG_TEXT)
+ * @strid: interned string of the event, 0 for none
+ *
+ * The binary log is LOG_MAGIC followed by records of a few bytes each. A
+ * record is one byte holding @event and the LOG_BIN_* flags of the fields
+ * that are not 0, then LEB128 varints: @ts as the zigzag encoded change
+ * from the previous record, @clientid, @arg zigzag encoded, @strid, and
+ * for LOG_STRDEF and LOG_TEXT @len followed by the payload. A string is
+ * defined once by a LOG_STRDEF record and referred to by id after that;
+ * ids are reused once LOG_NINTERN strings have been defined.
+ */
+struct logrec {
+  uint64_t ts;
+  uint32_t clientid;
+  int32_t arg;
+  uint16_t event;
+  uint16_t len;
+  uint32_t strid;
+} __attribute__((__packed__));
+
+/**
+ * struct logslot - One record in the ring
+ * @seq: position the slot is ready for, see log_event()
+ * @rec: the record, @rec.len is the length of @str
+ * @str: the event's string or text, not NUL terminated
+ */
+struct logslot {
+  uint64_t seq;
+  struct logrec rec;
+  char str[LOG_RECSIZE];
+} __attribute__((__aligned__(64)));
+
+/**
+ * struct logring - Shared header and slots
+ * @head: next position a producer will claim
+ * @tail: next position the writer will read
+ * @dropped: records lost because the ring was full
+ * @stop: set by log_close() to ask the writer to drain and exit
+ * @slots: the records
+ *
+ * A slot at position pos is free to fill when its seq equals pos and holds
+ * a record when seq equals pos + 1; the writer sets it to pos + LOG_NSLOTS
+ * once the record is written out. While a producer copies its record in,
+ * seq holds the producer's pid with the top bit set.
+ */
+struct logring {
+  uint64_t head __attribute__((__aligned__(64)));
+  uint64_t tail __attribute__((__aligned__(64)));
+  uint64_t dropped;
+  int stop;
+  struct logslot slots[LOG_NSLOTS];
+};
+
+/**
+ * log_init() - Map the ring and start the writer process.
+ * @outfd: where the writer puts the records
+ *
+ * Call before forking sessions so they share the ring. The writer renders
+ * text lines unless LOG_FORMAT_ENV is "binary". Until this is called the
+ * log functions write text straight to stdout.
+ */
+void log_init(int outfd);
+
+/**
+ * log_event() - Append an event to the log.
+ * @event: enum logevent
+ * @clientid: client the event is about, 0 for the server
+ * @arg: event argument
+ * @str: the event's string, or NULL
+ *
+ * Only fills in a record, the writer does the formatting. Never blocks: if
+ * the ring is full the record is counted as dropped and the writer reports
+ * the count. Safe to call from a signal handler.
+ */
+void log_event(enum logevent event, int clientid, int arg, const char *str);
+
+/**
+ * log_printf() - Append a formatted LOG_TEXT record to the log.
+ * @fmt: format, see myfprintf()
+ *
+ * Formats on the caller's side, prefer log_event() on hot paths.
+ */
+void log_printf(const char *fmt, ...)
+  __attribute__((__nonnull__(1), __format__(__printf__, 1, 2)));
+
+/**
+ * log_flush() - Wait until the writer has written every record so far.
+ */
+void log_flush(void);
+
+/**
+ * log_close() - Flush the log and stop the writer.
+ *
+ * Later log calls write straight to stdout again.
+ */
+void log_close(void);
+
+/**
+ * log_render() - Render a record as the text log line.
+ * @rec: the record
+ * @str: its string, may be NULL
+ * @slen: length of @str
+ * @buf: where the line goes
+ * @size: size of @buf
+ *
+ * Return: length of the line, see mysnprintf().
+ */
+size_t log_render(const struct logrec *rec, const char *str, size_t slen, char *buf, size_t size)
+  __attribute__((__nonnull__(1, 4)));
+
+/**
+ * log_decode() - Decode one binary log record.
+ * @buf: the records following LOG_MAGIC
+ * @n: bytes in @buf
+ * @ts: timestamp of the previous record, 0 before the first; updated
+ *      only when a whole record is decoded
+ * @rec: the record
+ * @payload: set to the payload in @buf, NULL when the record has none
+ *
+ * Return: bytes the record takes up, 0 if it is cut off or corrupt.
+ */
+size_t log_decode(const void *buf, size_t n, uint64_t *ts, struct logrec *rec, const char **payload)
+  __attribute__((__nonnull__(1, 3, 4, 5)));
+
+/**
+ * log_event_name() - Short name of an event, e.g. "connect".
+ * @event: enum logevent
+ */
+const char *log_event_name(unsigned int event);
+
+#endif /* __SERVERLOG_H */
@@ -26,12 +26,29 @@
 #include "signal.h"
 #include "syscalls.h"
 #include "globals.h"
+#include "serverlog.h"
+#include "debug.h"
+#include "cgroup.h"
 
 #include <stdio.h>
 #include <errno.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+void
+log_wstatus(int wstatus)
+{
+  if (WIFEXITED(wstatus)) {
+    log_event(LOG_CHILD_EXITED, 0, WEXITSTATUS(wstatus), NULL);
+  } else if (WIFSIGNALED(wstatus)) {
+    log_event(LOG_CHILD_KILLED, 0, WTERMSIG(wstatus), NULL);
+  } else if (WIFSTOPPED(wstatus)) {
+    log_event(LOG_CHILD_STOPPED, 0, WSTOPSIG(wstatus), NULL);
+  } else if (WIFCONTINUED(wstatus)) {
+    log_event(LOG_CHILD_CONTINUED, 0, 0, NULL);
+  }
+}
+
 void
 sigchld_handler(int sig)
 {
@@ -44,14 +61,10 @@ sigchld_handler(int sig)
   while((pid = waitpid(-1, &wstatus, WNOHANG | WUNTRACED)) > 0) {
     /* block all signals */
     mysigprocmask(SIG_BLOCK, &mask_all, &old);
-    if (WIFEXITED(wstatus)) {
-      myfprintf(sys_stdout, "exited, status=%d\n", WEXITSTATUS(wstatus));
-    } else if (WIFSIGNALED(wstatus)) {
-      myfprintf(sys_stdout, "killed by signal %d\n", WTERMSIG(wstatus));
-    } else if (WIFSTOPPED(wstatus)) {
-      myfprintf(sys_stdout, "stopped by signal %d\n", WSTOPSIG(wstatus));
-    } else if (WIFCONTINUED(wstatus)) {
-      myfprintf(sys_stdout, "continued\n");
+    debugf(SIGNALDEBUG, DBG_TRACE, "SIGCHLD pid %d status 0x%x\n", pid, wstatus);
+    log_wstatus(wstatus);
+    if (WIFEXITED(wstatus) || WIFSIGNALED(wstatus)) {
+      cgroup_remove(pid); /* the server's children are sessions */
     }
     mysigprocmask(SIG_SETMASK, &old, NULL);
   }
@@ -62,7 +75,7 @@ sigchld_handler(int sig)
 void
 sigint_handler(int sig)
 {
-  myfprintf(sys_stdout, "\nCaught SIGINT\n");
+  log_event(LOG_SIGINT, 0, 0, NULL);
   _exit(0);
 }
 
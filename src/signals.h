@@ -26,11 +26,19 @@
 #ifndef __SIGNALS_H
 #define __SIGNALS_H
 
+/**
+ * log_wstatus() - Logs a child's change of state.
+ *
+ * @wstatus: The status from waitpid().
+ */
+void log_wstatus(int wstatus);
+
 /**
  * sigchld_handler() - Handles SIGCHLD signal.
  *
  * This function is triggered when a SIGCHLD signal is received, indicating a child process
  * has changed state. It reaps all terminated child processes and logs their exit statuses.
+ * Sessions replace it with jobs_init(), they wait for their own children by pid.
  *
  * @sig: The signal number (not used).
  */
@@ -26,6 +26,7 @@
  *
  */
 #define _POSIX_C_SOURCE 200809L /* for signal.h DO NOT MOVE */
+#define _DEFAULT_SOURCE /* for wait4 */
 
 #include <linux/limits.h>
 #include <sys/types.h>
@@ -36,10 +37,35 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <signal.h>
+#include <spawn.h>
 #include <unistd.h>
 
 #include "syscalls.h"
 #include "mystring.h"
+#include "debug.h"
+#include "pathcache.h"
+
+static void (*__onexit)(void);
+static pid_t __onexitpid;
+
+void
+myonexit(void (*fn)(void))
+{
+  __onexit = fn;
+  __onexitpid = getpid();
+}
+
+void
+myexit(int status)
+{
+  void (*fn)(void) = __onexit;
+
+  __onexit = NULL; /* a wrapper failing in the cleanup exits for good */
+  if (fn != NULL && getpid() == __onexitpid) {
+    fn();
+  }
+  _exit(status);
+}
 
 void
 syserrorexit(const char * const err, int sck, int errnum)
@@ -48,7 +74,7 @@ syserrorexit(const char * const err, int sck, int errnum)
   if(sck != -1) {
     close(sck);
   }
-  _exit(errnum);
+  myexit(errnum);
 }
 
 /* start wrappers for unit testing */
@@ -181,14 +207,35 @@ myexecve(const char *pathname, char *const argv[], char *const envp[])
 {
   char command[PATH_MAX];
 
-  mystrcpy(command, "/usr/bin/");
-  mystrcat(command, pathname);
+  if (pathcache_resolve(pathname, command, sizeof command) == -1) {
+    printerr_exit("execve error()\n");
+  }
+  debugf(SYSCALLDEBUG, DBG_TRACE, "execve %s\n", command);
 
   if (execve(command, argv, envp) == -1) {
     printerr_exit("execve error()\n");
   }
 }
 
+int
+myposix_spawn(pid_t *pid, const char *pathname, const posix_spawn_file_actions_t *fa,
+              const posix_spawnattr_t *attr, char *const argv[], char *const envp[])
+{
+  char command[PATH_MAX];
+  int err;
+
+  if (pathcache_resolve(pathname, command, sizeof command) == -1) {
+    debugf(SYSCALLDEBUG, DBG_WARN, "posix_spawn %s: command not found\n", pathname);
+    return ENOENT;
+  }
+  debugf(SYSCALLDEBUG, DBG_TRACE, "posix_spawn %s\n", command);
+
+  if ((err = posix_spawn(pid, command, fa, attr, argv, envp)) != 0) {
+    debugf(SYSCALLDEBUG, DBG_WARN, "posix_spawn %s error %d\n", command, err);
+  }
+  return err;
+}
+
 pid_t
 mywait(int *wstatus)
 {
@@ -210,6 +257,17 @@ mywaitpid(pid_t pid, int *wstatus, int options)
   return rpid;
 }
 
+pid_t
+mywait4(pid_t pid, int *wstatus, int options, struct rusage *rusage)
+{
+  pid_t rpid;
+
+  if ((rpid = wait4(pid, wstatus, options, rusage)) < 0) {
+    printerr_exit("wait4() error\n");
+  }
+  return rpid;
+}
+
 ssize_t
 myread(int fd, void *buf, size_t nbytes)
 {
@@ -235,6 +293,7 @@ mydup2(int oldfd, int newfd)
 {
   /** @fd: the new fd */
   int fd = dup2(oldfd, newfd);
+  debugf(SYSCALLDEBUG, DBG_TRACE, "dup2(%d, %d) = %d\n", oldfd, newfd, fd);
   if (fd == -1) {
     printerr_exit("dup2() error\n");
   }
@@ -253,6 +312,7 @@ mypipe(int *pipefd)
 void
 myclose(int fd)
 {
+  io_forget(fd);
   if (close(fd) == -1) {
     printerr_exit("close() error\n");
   }
@@ -29,7 +29,9 @@
 #define __SYSCALLS_H
 
 #include <signal.h>
+#include <spawn.h>
 #include <errno.h>
+#include <sys/resource.h>
 
 #include "globals.h"
 #include "mystring.h"
@@ -52,7 +54,7 @@
 #define printerr_exit(msg)                      \
   do {                                          \
     fdputs(sys_stderr, msg);                    \
-    _exit(1);                                   \
+    myexit(1);                                  \
   } while(0);
 
 /* wrappers for unit testing */
@@ -345,6 +347,16 @@ ssize_t myread(int fd, void *buf, size_t nbytes)
  */
 pid_t mywaitpid(pid_t pid, int *wstatus, int options);
 
+/**
+ * mywait4() - man wait4(2), mywaitpid() that also reports what the child used.
+ * @pid: the pid of the child to wait for, as for mywaitpid().
+ * @wstatus: the status of the child.
+ * @options: as for mywaitpid().
+ * @rusage: receives the child's CPU time, peak RSS and context switches.
+ */
+pid_t mywait4(pid_t pid, int *wstatus, int options, struct rusage *rusage)
+  __attribute__((__nonnull__(4)));
+
 /**
  * mywait() - man, wait(2) Wait for a child to die. When one does,
  *          put its status in *STAT_LOC and return its process ID.
@@ -361,12 +373,32 @@ pid_t mywait(int *wstatus);
  *            executing PATH with arguments ARGV and
  *            environment ENVP. ARGV and ENVP are terminated
  *            by NULL pointers.
- * @pathname: absolute path with command
+ * @pathname: command name, resolved through pathcache_resolve()
  * @argv: command and arguments for the command
  * @envp: environment variables
  */
 void myexecve(const char *pathname, char *const argv[], char *const envp[]);
 
+/**
+ * myposix_spawn() - man posix_spawn(3) Start PATH with ARGV and ENVP in a
+ *                 new process set up by the file actions @fa and @attr.
+ * @pid: set to the new process ID
+ * @pathname: command name, looked up like myexecve()
+ * @fa: dup2/open/close actions run in the child before exec, may be NULL
+ * @attr: signal mask and other attributes, may be NULL
+ * @argv: command and arguments for the command
+ * @envp: environment variables
+ *
+ * glibc starts the child with clone(CLONE_VM|CLONE_VFORK), so no page tables
+ * are copied however large the caller is. Unlike the other wrappers a failure
+ * does not exit, as it is usually a bad command name or redirection.
+ *
+ * Return: 0 on success, otherwise the error number
+ */
+int myposix_spawn(pid_t *pid, const char *pathname, const posix_spawn_file_actions_t *fa,
+                  const posix_spawnattr_t *attr, char *const argv[], char *const envp[])
+  __attribute__((__nonnull__(1, 2, 5)));
+
 /**
  * myfork() - man fork(2) Clone the calling process, creating an exact copy.
  *
@@ -376,5 +408,23 @@ void myexecve(const char *pathname, char *const argv[], char *const envp[]);
 pid_t myfork(void)
   __attribute__((__warn_unused_result__));
 
+/**
+ * myonexit() - Run @fn when this process leaves through myexit().
+ * @fn: cleanup, e.g. jobs_hangup(); NULL for none
+ *
+ * Only the process that set @fn runs it, not children forked after.
+ */
+void myonexit(void (*fn)(void));
+
+/**
+ * myexit() - _exit(2) after the cleanup set by myonexit().
+ * @status: exit status
+ *
+ * The error exits of the wrappers and the end of the client's input leave
+ * through here, so a session that ends any way still hangs up its jobs.
+ */
+void myexit(int status)
+  __attribute__((__noreturn__));
+
 #endif // __SYSCALLS_H
 
@@ -22,14 +22,44 @@
  */
 #include <check.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdlib.h>
 #include <string.h>
+#include <stdio.h>
+#include <time.h>
 
 #include "../client_core.h"
 #include "../syscalls.h"
 #include "../server_core.h"
 #include "../filetransfer.h"
+#include "../memscan.h"
+#include "../memops.h"
+#include "../cpufeatures.h"
+#include "../udptransfer.h"
+#include "../bufpool.h"
+#include "../serverlog.h"
+#include "../debug.h"
+#include "../transcript.h"
+#include "../cmdparse.h"
+#include "../pathcache.h"
+#include "../builtins.h"
+#include "../pipeline.h"
+#include "../jobs.h"
+#include "../frames.h"
+#include "../resultcache.h"
+#include "../cgroup.h"
+#include "../cmdstats.h"
+#include "../command_handler.h"
+#include "../upload.h"
+#include "../download.h"
+#include "../clientmux.h"
 
 #ifndef READ_END
 #define READ_END 0
@@ -119,6 +149,1781 @@ START_TEST(test_mymalloc_and_myfree_success)
 }
 END_TEST
 
+START_TEST(test_bufpool_get_and_put)
+{
+  int inuse = bufpool_inuse();
+  char *a = bufpool_get();
+  char *b = bufpool_get();
+
+  ck_assert(a != b);
+  ck_assert_int_eq(bufpool_inuse(), inuse + 2);
+  ck_assert_int_eq((uintptr_t)a % BUFPOOL_BUFSIZE, 0);
+
+  memset(a, 0x41, BUFPOOL_BUFSIZE);
+  bufpool_put(a);
+  bufpool_put(b);
+  ck_assert_int_eq(bufpool_inuse(), inuse);
+
+  /* a returned page comes back zeroed */
+  a = bufpool_get();
+  for (size_t i = 0; i < BUFPOOL_BUFSIZE; i++) {
+    ck_assert_int_eq(a[i], 0);
+  }
+  bufpool_put(a);
+}
+END_TEST
+
+START_TEST(test_mymemchr_variants)
+{
+  const void *(*variants[])(const void *, int, size_t) = {
+    mymemchr_scalar, mymemchr_sse2, mymemchr_avx2, mymemchr,
+  };
+  unsigned int needs[] = { 0, CPU_SSE2, CPU_AVX2, 0 };
+  char buf[200];
+
+  for (size_t v = 0; v < sizeof variants / sizeof variants[0]; v++) {
+    if ((cpu_features() & needs[v]) != needs[v]) {
+      continue;
+    }
+    for (size_t len = 0; len < 100; len++) {
+      for (size_t pos = 0; pos <= len; pos++) {
+        memset(buf, 'x', sizeof buf);
+        buf[pos] = '\n';
+        ck_assert_ptr_eq(variants[v](buf + 1, '\n', len), memchr(buf + 1, '\n', len));
+      }
+    }
+  }
+}
+END_TEST
+
+START_TEST(test_mystrchrnul_variants)
+{
+  char *(*variants[])(const char *, int) = {
+    mystrchrnul_scalar, mystrchrnul_sse2, mystrchrnul_avx2, mystrchrnul,
+  };
+  unsigned int needs[] = { 0, CPU_SSE2, CPU_AVX2, 0 };
+  char buf[200];
+
+  for (size_t v = 0; v < sizeof variants / sizeof variants[0]; v++) {
+    if ((cpu_features() & needs[v]) != needs[v]) {
+      continue;
+    }
+    for (size_t start = 0; start < 40; start++) {
+      for (size_t end = start; end < 120; end++) {
+        memset(buf, 'x', sizeof buf);
+        buf[end] = '\0';
+        ck_assert_ptr_eq(variants[v](buf + start, ' '), buf + end);
+        if (end > start) {
+          buf[end - 1] = ' ';
+          ck_assert_ptr_eq(variants[v](buf + start, ' '), buf + end - 1);
+        }
+      }
+    }
+  }
+}
+END_TEST
+
+START_TEST(test_mymemset_mymemcpy_variants)
+{
+  void *(*sets[])(void *, int, size_t) = {
+    mymemset_scalar, mymemset_word, mymemset_sse2, mymemset_avx2, mymemset,
+  };
+  void *(*cpys[])(void *, const void *, size_t) = {
+    mymemcpy_scalar, mymemcpy_word, mymemcpy_sse2, mymemcpy_avx2, mymemcpy,
+  };
+  unsigned int needs[] = { 0, 0, CPU_SSE2, CPU_AVX2, 0 };
+  unsigned char src[200], got[200], want[200];
+
+  for (size_t i = 0; i < sizeof src; i++) {
+    src[i] = i * 7; /* includes NUL bytes */
+  }
+  for (size_t v = 0; v < sizeof sets / sizeof sets[0]; v++) {
+    if ((cpu_features() & needs[v]) != needs[v]) {
+      continue;
+    }
+    for (size_t off = 0; off < 8; off++) {
+      for (size_t len = 0; len < 150; len++) {
+        memset(got, 0xee, sizeof got);
+        memset(want, 0xee, sizeof want);
+        memset(want + off, 0x5a, len);
+        ck_assert_ptr_eq(sets[v](got + off, 0x5a, len), got + off);
+        ck_assert_mem_eq(got, want, sizeof got);
+
+        memcpy(want + off, src + 3, len);
+        ck_assert_ptr_eq(cpys[v](got + off, src + 3, len), got + off);
+        ck_assert_mem_eq(got, want, sizeof got);
+      }
+    }
+  }
+}
+END_TEST
+
+START_TEST(test_mystrcmp_variants)
+{
+  int (*variants[])(const char *, const char *) = {
+    mystrcmp_scalar, mystrcmp_word, mystrcmp_sse2, mystrcmp_avx2, mystrcmp,
+  };
+  unsigned int needs[] = { 0, 0, CPU_SSE2, CPU_AVX2, 0 };
+  char a[200], b[200], *page;
+  size_t pagesz = sysconf(_SC_PAGESIZE);
+
+  /* a string that ends on the last byte before an unmapped page */
+  page = mmap(NULL, 2 * pagesz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  ck_assert(page != MAP_FAILED);
+  ck_assert(mprotect(page + pagesz, pagesz, PROT_NONE) == 0);
+
+  for (size_t v = 0; v < sizeof variants / sizeof variants[0]; v++) {
+    if ((cpu_features() & needs[v]) != needs[v]) {
+      continue;
+    }
+    for (size_t off = 0; off < 8; off++) {
+      for (size_t len = 0; len < 120; len++) {
+        memset(a, 'x', sizeof a);
+        memset(b, 'x', sizeof b);
+        a[off + len] = '\0';
+        b[len] = '\0';
+        ck_assert_int_eq(variants[v](a + off, b), 0);
+
+        if (len > 0) {
+          b[len - 1] = 'y';
+          ck_assert_int_lt(variants[v](a + off, b), 0);
+          ck_assert_int_gt(variants[v](b, a + off), 0);
+          b[len - 1] = (char)0xf0; /* compares above ASCII */
+          ck_assert_int_lt(variants[v](a + off, b), 0);
+          b[len - 1] = 'x';
+        }
+        b[len] = 'x';
+        b[len + 1] = '\0';
+        ck_assert_int_lt(variants[v](a + off, b), 0); /* a is a prefix of b */
+      }
+    }
+    for (size_t len = 0; len < 100; len++) {
+      char *end = page + pagesz - 1 - len;
+      memset(end, 'z', len);
+      end[len] = '\0';
+      memset(a, 'z', len);
+      a[len] = '\0';
+      ck_assert_int_eq(variants[v](end, a), 0);
+      ck_assert_int_eq(variants[v](a, end), 0);
+    }
+  }
+  munmap(page, 2 * pagesz);
+}
+END_TEST
+
+START_TEST(test_mystrlen_mystrchr)
+{
+  char buf[200];
+
+  for (size_t start = 0; start < 40; start++) {
+    for (size_t end = start; end < 120; end++) {
+      memset(buf, 'x', sizeof buf);
+      buf[end] = '\0';
+      ck_assert_uint_eq(mystrlen(buf + start), end - start);
+      ck_assert_ptr_eq(mystrchr(buf + start, ' '), NULL);
+      ck_assert_ptr_eq(mystrchr(buf + start, '\0'), NULL);
+      if (end > start) {
+        buf[end - 1] = ' ';
+        ck_assert_ptr_eq(mystrchr(buf + start, ' '), buf + end - 1);
+      }
+    }
+  }
+}
+END_TEST
+
+/* compare mysnprintf() against the libc formatting of the same arguments */
+#define ck_assert_format(fmt, ...)                                              \
+  do {                                                                          \
+    char want[128], got[128];                                                   \
+    int wantlen = snprintf(want, sizeof want, fmt, __VA_ARGS__);                \
+    ck_assert_int_eq(mysnprintf(got, sizeof got, fmt, __VA_ARGS__), wantlen);   \
+    ck_assert_str_eq(got, want);                                                \
+  } while (0)
+
+START_TEST(test_cmd_parse_grammar)
+{
+  char line[] = "ls -l 'a b'|wc -l>out && echo \"x \\\"y\\\"\" || ca\\ t<in>>log; time sleep 1 &";
+  char mem[1024] __attribute__((aligned(16)));
+  struct cmd_pipeline *pl;
+  struct cmd_simple *cmd;
+  struct arena arena;
+  const char *err = NULL;
+
+  arena_init(&arena, mem, sizeof mem);
+  ck_assert_int_eq(cmd_parse(line, &arena, &pl, &err), 0);
+
+  /* ls -l 'a b' | wc -l > out */
+  ck_assert_int_eq(pl->join, JOIN_ALWAYS);
+  ck_assert_int_eq(pl->nstages, 2);
+  cmd = pl->first;
+  ck_assert_int_eq(cmd->argc, 3);
+  ck_assert_str_eq(cmd->argv[0], "ls");
+  ck_assert_str_eq(cmd->argv[1], "-l");
+  ck_assert_str_eq(cmd->argv[2], "a b");
+  ck_assert_ptr_eq(cmd->argv[3], NULL);
+  cmd = cmd->next;
+  ck_assert_int_eq(cmd->argc, 2);
+  ck_assert_str_eq(cmd->argv[1], "-l");
+  ck_assert_str_eq(cmd->out, "out");
+  ck_assert_int_eq(cmd->append, 0);
+  ck_assert_ptr_eq(cmd->next, NULL);
+
+  /* && echo "x \"y\"" */
+  pl = pl->next;
+  ck_assert_int_eq(pl->join, JOIN_AND);
+  ck_assert_str_eq(pl->first->argv[1], "x \"y\"");
+
+  /* || ca\ t <in >>log */
+  pl = pl->next;
+  ck_assert_int_eq(pl->join, JOIN_OR);
+  cmd = pl->first;
+  ck_assert_int_eq(cmd->argc, 1);
+  ck_assert_str_eq(cmd->argv[0], "ca t");
+  ck_assert_str_eq(cmd->in, "in");
+  ck_assert_str_eq(cmd->out, "log");
+  ck_assert_int_eq(cmd->append, 1);
+  ck_assert_int_eq(pl->background, 0);
+  ck_assert_int_eq(pl->timed, 0);
+
+  /* ; time sleep 1 & */
+  pl = pl->next;
+  ck_assert_int_eq(pl->join, JOIN_ALWAYS);
+  ck_assert_int_eq(pl->background, 1);
+  ck_assert_int_eq(pl->timed, 1);
+  ck_assert_int_eq(pl->first->argc, 2);
+  ck_assert_str_eq(pl->first->argv[0], "sleep");
+  ck_assert_str_eq(pl->first->argv[1], "1");
+  ck_assert_ptr_eq(pl->next, NULL);
+
+  /* words are slices of the line, not copies */
+  ck_assert(pl->first->argv[0] > line && pl->first->argv[0] < line + sizeof line);
+
+  /* alone it is a command name */
+  char timeonly[] = "time";
+  ck_assert_int_eq(cmd_parse(timeonly, &arena, &pl, &err), 0);
+  ck_assert_int_eq(pl->timed, 0);
+  ck_assert_str_eq(pl->first->argv[0], "time");
+
+  char empty[] = "  \t ";
+  ck_assert_int_eq(cmd_parse(empty, &arena, &pl, &err), 0);
+  ck_assert_ptr_eq(pl, NULL);
+}
+END_TEST
+
+START_TEST(test_cmd_parse_errors)
+{
+  static const char * const bad[][2] = {
+    { "| ls",        "syntax error near `|'" },
+    { "ls |",        "syntax error near end of line" },
+    { "ls && ; ls",  "syntax error near `;'" },
+    { "ls >",        "syntax error near end of line" },
+    { "ls > | wc",   "syntax error near `|'" },
+    { "> out",       "missing command" },
+    { "echo 'abc",   "unterminated quote" },
+    { "echo \"abc'", "unterminated quote" },
+  };
+  char mem[1024] __attribute__((aligned(16))), line[64];
+  struct cmd_pipeline *pl;
+  struct arena arena;
+  const char *err;
+
+  for (size_t i = 0; i < sizeof bad / sizeof bad[0]; i++) {
+    strcpy(line, bad[i][0]);
+    arena_init(&arena, mem, sizeof mem);
+    err = NULL;
+    ck_assert_int_eq(cmd_parse(line, &arena, &pl, &err), -1);
+    ck_assert_str_eq(err, bad[i][1]);
+  }
+
+  /* running out of arena is an error, not an overflow */
+  strcpy(line, "a b c d e f g h i j k l m n o p q r s t u v w x y z");
+  arena_init(&arena, mem, 128);
+  ck_assert_int_eq(cmd_parse(line, &arena, &pl, &err), -1);
+  ck_assert_str_eq(err, "command line too long");
+  ck_assert_int_le(arena.used, 128);
+}
+END_TEST
+
+START_TEST(test_mysnprintf_matches_snprintf)
+{
+  char small[8];
+
+  ck_assert_format("::client %d connected\n", 42);
+  ck_assert_format("%d %d %d", 0, -1, -2147483647 - 1);
+  ck_assert_format("%i|%5d|%-5d|%05d|%.3d|%8.3d", 7, 7, -7, -7, 7, -7);
+  ck_assert_format("%u %lu %llu %zu", 4000000000u, 1ul << 40, ~0ull, (size_t)12345);
+  ck_assert_format("%ld %lld", -1234567890123l, -9223372036854775807ll - 1);
+  ck_assert_format("%x %X %08x %x", 0xdeadbeef, 0xabcu, 0x1f, 0);
+  ck_assert_format("%hhu %hd", 300, 70000);
+  ck_assert_format("%p %p", (void *)0x1000, (void *)&small);
+  ck_assert_format("[%s] [%10s] [%-10s] [%.2s] [%*s]", "abc", "abc", "abc", "abc", 6, "x");
+  ck_assert_format("%c%c%5c%-3c|", 'a', 'b', 'c', 'd');
+  ck_assert_format("100%% %.0d|", 0);
+
+  /* truncation still reports the full length */
+  ck_assert_int_eq(mysnprintf(small, sizeof small, "%s", "0123456789"), 10);
+  ck_assert_str_eq(small, "0123456");
+}
+END_TEST
+
+START_TEST(test_myfprintf_single_write)
+{
+  int sv[2];
+  char rec[128];
+
+  /* each write() on a seqpacket socket is its own record */
+  ck_assert(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) != -1);
+  myfprintf(sv[0], "::client %d sent %s\n", 3, "ls -l");
+  ck_assert_int_eq(read(sv[1], rec, sizeof rec), 22);
+  rec[22] = '\0';
+  ck_assert_str_eq(rec, "::client 3 sent ls -l\n");
+
+  close(sv[0]);
+  close(sv[1]);
+}
+END_TEST
+
+START_TEST(test_myreadline_splits_lines)
+{
+  int pipefd[2];
+  char line[64];
+  char *data = "get\nfile.txt\n";
+
+  ck_assert(pipe(pipefd) != -1);
+  ck_assert(write(pipefd[WRITE_END], data, strlen(data)) != -1);
+
+  ck_assert_int_eq(myreadline(pipefd[READ_END], line, sizeof line), 4);
+  ck_assert_str_eq(line, "get");
+  ck_assert_int_eq(myreadline(pipefd[READ_END], line, sizeof line), 9);
+  ck_assert_str_eq(line, "file.txt");
+
+  ck_assert(close(pipefd[READ_END]) != -1);
+  ck_assert(close(pipefd[WRITE_END]) != -1);
+}
+END_TEST
+
+START_TEST(test_myreadline_keeps_leftovers_per_fd)
+{
+  int fds[8][2], p[2], old;
+  char line[64], data[16];
+
+  /* more fds with a line left over than the table starts with */
+  for (int i = 0; i < 8; i++) {
+    ck_assert(pipe(fds[i]) != -1);
+    snprintf(data, sizeof data, "a%d\nb%d\n", i, i);
+    ck_assert(write(fds[i][WRITE_END], data, strlen(data)) != -1);
+    ck_assert_int_eq(myreadline(fds[i][READ_END], line, sizeof line), 3);
+  }
+  for (int i = 0; i < 8; i++) {
+    snprintf(data, sizeof data, "b%d", i);
+    ck_assert_int_eq(myreadline(fds[i][READ_END], line, sizeof line), 3);
+    ck_assert_str_eq(line, data);
+    myclose(fds[i][READ_END]);
+    myclose(fds[i][WRITE_END]);
+  }
+
+  /* a closed fd's leftover does not turn up on the next fd with its number */
+  ck_assert(pipe(p) != -1);
+  ck_assert(write(p[WRITE_END], "x\ny\n", 4) != -1);
+  ck_assert_int_eq(myreadline(p[READ_END], line, sizeof line), 2);
+  old = p[READ_END];
+  myclose(p[READ_END]);
+  myclose(p[WRITE_END]);
+  ck_assert(pipe(p) != -1);
+  ck_assert_int_eq(p[READ_END], old);
+  ck_assert(write(p[WRITE_END], "z\n", 2) != -1);
+  ck_assert_int_eq(myreadline(p[READ_END], line, sizeof line), 2);
+  ck_assert_str_eq(line, "z");
+  myclose(p[READ_END]);
+  myclose(p[WRITE_END]);
+}
+END_TEST
+
+/* two UDP sockets on loopback connected to each other */
+static void
+udp_loopback_pair(int fds[2])
+{
+  struct sockaddr_in addr[2];
+  socklen_t len = sizeof addr[0];
+
+  for (int i = 0; i < 2; i++) {
+    fds[i] = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&addr[i], 0, sizeof addr[i]);
+    addr[i].sin_family = AF_INET;
+    addr[i].sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(fds[i], (struct sockaddr *)&addr[i], sizeof addr[i]);
+    getsockname(fds[i], (struct sockaddr *)&addr[i], &len);
+  }
+  connect(fds[0], (struct sockaddr *)&addr[1], sizeof addr[1]);
+  connect(fds[1], (struct sockaddr *)&addr[0], sizeof addr[0]);
+}
+
+static void
+udp_transfer_with_loss(size_t size, unsigned int permille)
+{
+  char srcname[] = "/tmp/udpsrcXXXXXX", dstname[] = "/tmp/udpdstXXXXXX";
+  int src = mkstemp(srcname), dst = mkstemp(dstname);
+  int fds[2], wstatus;
+  char *data = malloc(size + 1), *back = malloc(size + 1);
+  pid_t pid;
+
+  for (size_t i = 0; i < size; i++) {
+    data[i] = (i * 7 + i / 1400) & 0xff;
+  }
+  ck_assert(write(src, data, size) == (ssize_t)size);
+
+  udp_loopback_pair(fds);
+  udp_set_loss(permille);
+
+  if ((pid = fork()) == 0) {
+    _exit(udp_sendfile(fds[0], src, NULL) == (int64_t)size ? 0 : 1);
+  }
+  ck_assert_int_eq(udp_recvfile(fds[1], dst, size, 0), size);
+  ck_assert(waitpid(pid, &wstatus, 0) == pid);
+  ck_assert(WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0);
+
+  ck_assert(pread(dst, back, size, 0) == (ssize_t)size);
+  ck_assert(memcmp(data, back, size) == 0);
+
+  udp_set_loss(0);
+  close(fds[0]);
+  close(fds[1]);
+  unlink(srcname);
+  unlink(dstname);
+  free(data);
+  free(back);
+}
+
+START_TEST(test_serverlog_collects_sessions)
+{
+  enum { NSESSIONS = 4, NLINES = 200 };
+  int pipefd[2], next[NSESSIONS] = { 0 }, id, line, nrecords = 0;
+  static char out[NSESSIONS * NLINES * 32];
+  char *p, *end;
+  ssize_t n, total = 0;
+
+  ck_assert(pipe(pipefd) != -1);
+  log_init(pipefd[WRITE_END]);
+
+  for (int i = 0; i < NSESSIONS; i++) {
+    if (fork() == 0) {
+      for (int j = 0; j < NLINES; j++) {
+        log_printf("::client %d sent %d\n", i, j);
+      }
+      _exit(0);
+    }
+  }
+  for (int i = 0; i < NSESSIONS; i++) {
+    wait(NULL);
+  }
+  log_close();
+  close(pipefd[WRITE_END]);
+
+  while ((n = read(pipefd[READ_END], out + total, sizeof out - 1 - total)) > 0) {
+    total += n;
+  }
+  out[total] = '\0';
+  close(pipefd[READ_END]);
+
+  /* every record arrives whole and each session's records stay in order */
+  for (p = out; (end = strchr(p, '\n')) != NULL; p = end + 1) {
+    ck_assert_int_eq(sscanf(p, "::client %d sent %d", &id, &line), 2);
+    ck_assert_int_eq(line, next[id]++);
+    nrecords++;
+  }
+  ck_assert_int_eq(nrecords, NSESSIONS * NLINES);
+}
+END_TEST
+
+START_TEST(test_serverlog_binary_interns_strings)
+{
+  int pipefd[2];
+  static char out[4096];
+  const char *payload;
+  struct logrec rec;
+  ssize_t n, total = 0;
+  size_t off, used;
+  int ndefs = 0, nsent = 0;
+  uint32_t strid = 0;
+  uint64_t ts = 0, lastts = 0;
+
+  ck_assert(pipe(pipefd) != -1);
+  setenv(LOG_FORMAT_ENV, "binary", 1);
+  log_init(pipefd[WRITE_END]);
+  unsetenv(LOG_FORMAT_ENV);
+
+  for (int i = 0; i < 3; i++) {
+    log_event(LOG_SENT, 7, 0, "ls -l");
+  }
+  log_event(LOG_CHILD_EXITED, 0, -2, NULL);
+  log_close();
+  close(pipefd[WRITE_END]);
+
+  while ((n = read(pipefd[READ_END], out + total, sizeof out - total)) > 0) {
+    total += n;
+  }
+  close(pipefd[READ_END]);
+
+  ck_assert(total > (ssize_t)sizeof LOG_MAGIC - 1);
+  ck_assert(memcmp(out, LOG_MAGIC, sizeof LOG_MAGIC - 1) == 0);
+
+  /* the command is defined once and every record refers to it */
+  for (off = sizeof LOG_MAGIC - 1; off < (size_t)total; off += used) {
+    ck_assert((used = log_decode(out + off, total - off, &ts, &rec, &payload)) > 0);
+    ck_assert(ts >= lastts);
+    lastts = ts;
+    if (rec.event == LOG_STRDEF) {
+      ck_assert_int_eq(rec.len, 5);
+      ck_assert(memcmp(payload, "ls -l", 5) == 0);
+      strid = rec.strid;
+      ndefs++;
+    } else if (rec.event == LOG_SENT) {
+      ck_assert_ptr_null(payload);
+      ck_assert_int_eq(rec.clientid, 7);
+      ck_assert_int_eq(rec.strid, strid);
+      nsent++;
+    } else {
+      ck_assert_int_eq(rec.event, LOG_CHILD_EXITED);
+      ck_assert_int_eq(rec.arg, -2);
+    }
+  }
+  ck_assert_int_eq(off, total);
+  ck_assert_int_eq(ndefs, 1);
+  ck_assert_int_eq(nsent, 3);
+  /* the first timestamp is absolute, after that a record takes a few bytes */
+  ck_assert_int_le(total, sizeof LOG_MAGIC - 1 + 2 * 16 + 5 + 3 * 8);
+
+  /* a record cut short is not decoded and leaves the timestamp alone */
+  ts = 0;
+  ck_assert_uint_eq(log_decode(out + sizeof LOG_MAGIC - 1, 1, &ts, &rec, &payload), 0);
+  used = log_decode(out + sizeof LOG_MAGIC - 1, total, &ts, &rec, &payload);
+  ts = 0;
+  ck_assert_uint_eq(log_decode(out + sizeof LOG_MAGIC - 1, used - 1, &ts, &rec, &payload), 0);
+  ck_assert_uint_eq(ts, 0);
+}
+END_TEST
+
+START_TEST(test_debug_levels_and_categories)
+{
+  int pipefd[2], saved;
+  char out[256];
+  ssize_t n;
+
+  ck_assert_int_eq(debug_init("bogus"), -1);
+  ck_assert_int_eq(debug_init("info:pipeline,nosuch"), -1);
+  ck_assert_int_eq(debug_init("info:pipeline,signal"), 0);
+  ck_assert_int_eq(g_debuglevel, DBG_INFO);
+  ck_assert_uint_eq(g_debugmask, (1u << PIPELINEDEBUG) | (1u << SIGNALDEBUG));
+
+  ck_assert(pipe(pipefd) != -1);
+  saved = dup(sys_stderr);
+  dup2(pipefd[WRITE_END], sys_stderr);
+  debugf(PIPELINEDEBUG, DBG_WARN, "kept %d\n", 1);
+  debugf(PIPELINEDEBUG, DBG_INFO, "above compiled level %d\n", 2); /* DEBUG_LEVEL is warn */
+  debugf(SYSCALLDEBUG, DBG_WARN, "category off %d\n", 3);
+  debugf(SIGNALDEBUG, DBG_ERROR, "kept %d\n", 4);
+  dup2(saved, sys_stderr);
+  close(saved);
+  close(pipefd[WRITE_END]);
+
+  n = read(pipefd[READ_END], out, sizeof out - 1);
+  close(pipefd[READ_END]);
+  ck_assert(n > 0);
+  out[n] = '\0';
+  ck_assert_str_eq(out, "kept 1\nkept 4\n");
+
+  ck_assert_int_eq(debug_init("warn"), 0);
+  ck_assert_uint_eq(g_debugmask, (1u << NDEBUGCATEGORIES) - 1);
+}
+END_TEST
+
+START_TEST(test_transcript_ring_keeps_newest)
+{
+  char dir[] = "/tmp/transcriptXXXXXX", path[MAX_PATH_SIZE], line[32];
+  static char out[2 << 20];
+  struct transcript_hdr *hdr;
+  struct stat st;
+  size_t n, len, total = 0;
+  int fd, i, next, nlines;
+  char *p;
+
+  ck_assert(mkdtemp(dir) != NULL);
+  setenv(TRANSCRIPT_DIR_ENV, dir, 1);
+  transcript_init();
+  transcript_open(9);
+  unsetenv(TRANSCRIPT_DIR_ENV);
+  ck_assert(transcript_enabled());
+
+  /* write past the 1 MB ring so it wraps */
+  for (i = 0; total < (3 << 19); i++) {
+    len = mysnprintf(line, sizeof line, "line %d\n", i);
+    transcript_write(line, len);
+    total += len;
+  }
+  nlines = i;
+  transcript_close();
+
+  mysnprintf(path, sizeof path, "%s/session-%d-9.tr", dir, getpid());
+  ck_assert((fd = open(path, O_RDONLY)) != -1);
+  ck_assert(fstat(fd, &st) == 0);
+  ck_assert_int_eq(st.st_size, TRANSCRIPT_HDRSIZE + (1 << 20));
+  hdr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ck_assert(hdr != MAP_FAILED);
+  close(fd);
+  ck_assert_uint_eq(hdr->head, total);
+
+  n = transcript_copyout(hdr, out, sizeof out);
+  ck_assert_uint_eq(n, 1 << 20);
+  out[n] = '\0';
+
+  /* skip the partial oldest line, the rest runs in order up to the last */
+  p = strchr(out, '\n') + 1;
+  ck_assert_int_eq(sscanf(p, "line %d", &next), 1);
+  for ( ; *p != '\0'; p = strchr(p, '\n') + 1) {
+    ck_assert_int_eq(sscanf(p, "line %d", &i), 1);
+    ck_assert_int_eq(i, next++);
+  }
+  ck_assert_int_eq(next, nlines);
+
+  munmap(hdr, st.st_size);
+  unlink(path);
+  rmdir(dir);
+}
+END_TEST
+
+START_TEST(test_pathcache_resolve_and_invalidate)
+{
+  char base[] = "/tmp/pathcacheXXXXXX", a[64], b[64], path[160], fa[80], fb[80], out[256];
+  int fd;
+
+  ck_assert_ptr_nonnull(mkdtemp(base));
+  snprintf(a, sizeof a, "%s/a", base);
+  snprintf(b, sizeof b, "%s/b", base);
+  snprintf(fa, sizeof fa, "%s/foo", a);
+  snprintf(fb, sizeof fb, "%s/foo", b);
+  snprintf(path, sizeof path, "%s::%s", a, b);
+  ck_assert_int_eq(mkdir(a, 0755), 0);
+  ck_assert_int_eq(mkdir(b, 0755), 0);
+
+  /* only executable regular files count */
+  ck_assert_int_ge(fd = open(fa, O_CREAT | O_WRONLY, 0644), 0);
+  close(fd);
+  ck_assert_int_ge(fd = open(fb, O_CREAT | O_WRONLY, 0755), 0);
+  close(fd);
+
+  pathcache_init(path);
+  ck_assert_int_eq(pathcache_resolve("foo", out, sizeof out), 0);
+  ck_assert_str_eq(out, fb);
+  ck_assert_int_eq(pathcache_resolve("nosuchcommand", out, sizeof out), -1);
+  ck_assert_int_eq(pathcache_resolve("./foo", out, sizeof out), 0);
+  ck_assert_str_eq(out, "./foo");
+
+  /* the answer is cached until the cache is told otherwise */
+  ck_assert_int_eq(chmod(fa, 0755), 0);
+  ck_assert_int_eq(pathcache_resolve("foo", out, sizeof out), 0);
+  ck_assert_str_eq(out, fb);
+  pathcache_invalidate();
+  ck_assert_int_eq(pathcache_resolve("foo", out, sizeof out), 0);
+  ck_assert_str_eq(out, fa);
+
+  unlink(fa);
+  unlink(fb);
+  pathcache_invalidate();
+  ck_assert_int_eq(pathcache_resolve("foo", out, sizeof out), -1);
+
+  rmdir(a);
+  rmdir(b);
+  rmdir(base);
+  pathcache_init(NULL);
+}
+END_TEST
+
+/* run argv as a builtin with stdin from in, its output into out; -1 if it is not one */
+static int
+run_builtin(char **argv, int in, char *out, size_t outlen)
+{
+  struct builtin_args args;
+  const struct builtin *b;
+  int argc = 0, fd[2], status;
+  ssize_t n;
+
+  while (argv[argc]) {
+    argc++;
+  }
+  if ((b = builtin_find(argc, argv, &args)) == NULL || pipe(fd) == -1) {
+    return -1;
+  }
+  status = builtin_run(b, argc, argv, &args, in, fd[1], sys_stderr, -1, 0);
+  close(fd[1]);
+  n = read(fd[0], out, outlen - 1);
+  out[n < 0 ? 0 : n] = '\0';
+  close(fd[0]);
+  return status;
+}
+
+START_TEST(test_builtins_match_programs)
+{
+  char dir[] = "/tmp/builtinsXXXXXX", f1[64], f2[64], sub[64], out[512], expect[256];
+  char *argv[8];
+  struct builtin_args args;
+  int fd[2];
+
+  ck_assert_ptr_nonnull(mkdtemp(dir));
+  snprintf(f1, sizeof f1, "%s/b", dir);
+  snprintf(f2, sizeof f2, "%s/a", dir);
+  snprintf(sub, sizeof sub, "%s/c", dir);
+  ck_assert_int_ge(fd[0] = open(f1, O_CREAT | O_WRONLY, 0644), 0);
+  ck_assert_int_eq(write(fd[0], "one two\nthree\nfour", 18), 18);
+  close(fd[0]);
+  ck_assert_int_ge(fd[0] = open(f2, O_CREAT | O_WRONLY, 0644), 0);
+  close(fd[0]);
+  ck_assert_int_eq(mkdir(sub, 0755), 0);
+
+  ck_assert_int_eq(run_builtin((char *[]){ "echo", "-n", "a", "b", NULL }, -1, out, sizeof out), 0);
+  ck_assert_str_eq(out, "a b");
+  ck_assert_int_eq(run_builtin((char *[]){ "cat", f1, NULL }, -1, out, sizeof out), 0);
+  ck_assert_str_eq(out, "one two\nthree\nfour");
+  ck_assert_int_eq(run_builtin((char *[]){ "head", "-n", "1", f1, NULL }, -1, out, sizeof out), 0);
+  ck_assert_str_eq(out, "one two\n");
+  ck_assert_int_eq(run_builtin((char *[]){ "tail", "-2", f1, NULL }, -1, out, sizeof out), 0);
+  ck_assert_str_eq(out, "three\nfour");
+  ck_assert_int_eq(run_builtin((char *[]){ "ls", dir, NULL }, -1, out, sizeof out), 0);
+  ck_assert_str_eq(out, "a\nb\nc\n");
+  ck_assert_int_eq(run_builtin((char *[]){ "cat", "/nonexistent", NULL }, -1, out, sizeof out), 1);
+
+  /* column widths follow the total size, one column of one input is bare */
+  ck_assert_int_eq(run_builtin((char *[]){ "wc", f1, f2, NULL }, -1, out, sizeof out), 0);
+  snprintf(expect, sizeof expect, " 2  4 18 %s\n 0  0  0 %s\n 2  4 18 total\n", f1, f2);
+  ck_assert_str_eq(out, expect);
+
+  /* stdin from a pipe, as the last stage of a pipeline */
+  ck_assert_int_eq(pipe(fd), 0);
+  ck_assert_int_eq(write(fd[1], "x\ny\n", 4), 4);
+  close(fd[1]);
+  ck_assert_int_eq(run_builtin((char *[]){ "wc", "-l", NULL }, fd[0], out, sizeof out), 0);
+  ck_assert_str_eq(out, "2\n");
+  close(fd[0]);
+
+  /* options they do not have go to the real program */
+  argv[0] = "ls"; argv[1] = "-l"; argv[2] = NULL;
+  ck_assert_ptr_null(builtin_find(2, argv, &args));
+  argv[0] = "tail"; argv[1] = "-n"; argv[2] = "+2"; argv[3] = NULL;
+  ck_assert_ptr_null(builtin_find(3, argv, &args));
+  argv[0] = "echo"; argv[1] = "-e"; argv[2] = NULL;
+  ck_assert_ptr_null(builtin_find(2, argv, &args));
+  argv[0] = "/bin/cat"; argv[1] = NULL;
+  ck_assert_ptr_null(builtin_find(1, argv, &args));
+
+  unlink(f1);
+  unlink(f2);
+  rmdir(sub);
+  rmdir(dir);
+}
+END_TEST
+
+START_TEST(test_jobs_background_wait_kill)
+{
+  char *false_argv[] = { "false", NULL }, *true_argv[] = { "true", NULL };
+  char *sleep_argv[] = { "sleep", "10", NULL }, out[256], state[32];
+  Pipeline stages[2];
+  struct job *j1, *j2;
+  siginfo_t si;
+  int fd[2], status, null = open("/dev/null", O_WRONLY);
+  pid_t pid;
+
+  ck_assert_int_ge(null, 0);
+  jobs_init();
+  init_pipelines(stages, 1, null);
+  stages[0].argv = false_argv;
+  stages[0].argc = 1;
+  ck_assert_ptr_nonnull(j1 = jobs_start(stages, 1));
+  init_pipelines(stages, 2, null);
+  stages[0].argv = true_argv;
+  stages[0].argc = 1;
+  stages[1].argv = sleep_argv;
+  stages[1].argc = 2;
+  ck_assert_ptr_nonnull(j2 = jobs_start(stages, 2));
+  ck_assert_int_eq(j2->id, 2);
+  ck_assert_str_eq(j2->cmd, "true | sleep 10");
+  ck_assert_ptr_eq(jobs_find("%%"), j2);
+  ck_assert_ptr_eq(jobs_find("%-"), j1);
+  ck_assert_ptr_null(jobs_find("%3"));
+
+  /* the status is that of the last stage */
+  ck_assert_int_eq(jobs_wait(j1), 1);
+  ck_assert_ptr_null(jobs_find("%1"));
+  ck_assert_str_eq(jobs_state(j2, state, sizeof state), "Running");
+  ck_assert_int_eq(run_builtin((char *[]){ "jobs", NULL }, -1, out, sizeof out), 0);
+  ck_assert_str_eq(out, "[2]+  Running                 true | sleep 10 &\n");
+  ck_assert_int_eq(run_builtin((char *[]){ "kill", "-KILL", "%2", NULL }, -1, out, sizeof out), 0);
+  ck_assert_int_eq(jobs_wait(j2), 128 + SIGKILL);
+  ck_assert_ptr_null(jobs_next(NULL));
+
+  /* a finished job is reported once, before the prompt */
+  init_pipelines(stages, 1, null);
+  stages[0].argv = true_argv;
+  stages[0].argc = 1;
+  ck_assert_ptr_nonnull(j1 = jobs_start(stages, 1));
+  ck_assert_int_eq(j1->id, 1);
+  ck_assert_int_eq(waitid(P_PID, j1->pids[0], &si, WEXITED | WNOWAIT), 0);
+  ck_assert_int_eq(pipe(fd), 0);
+  jobs_notify(fd[1]);
+  jobs_notify(fd[1]);
+  out[read(fd[0], out, sizeof out - 1)] = '\0';
+  ck_assert_str_eq(out, "[1]+  Done                    true\n");
+  ck_assert_int_eq(run_builtin((char *[]){ "wait", "%1", NULL }, -1, out, sizeof out), 127);
+  close(fd[0]);
+  close(fd[1]);
+
+  /* a session that reads the end of its input hangs up its jobs */
+  ck_assert_int_eq(pipe(fd), 0);
+  if ((pid = fork()) == 0) {
+    int eof[2];
+
+    jobs_init();
+    init_pipelines(stages, 1, fd[1]);
+    stages[0].argv = sleep_argv;
+    stages[0].argc = 2;
+    jobs_start(stages, 1);
+    close(fd[1]);
+    ck_assert_int_eq(pipe(eof), 0);
+    close(eof[1]);
+    mygetchar(eof[0]);
+    _exit(0);
+  }
+  close(fd[1]);
+  ck_assert_int_eq(waitpid(pid, &status, 0), pid);
+  ck_assert_int_eq(WEXITSTATUS(status), 1);
+  /* past the "[1] pid" line, the job held the pipe until it was hung up */
+  do {
+    ck_assert_int_eq(poll(&(struct pollfd){ fd[0], POLLIN, 0 }, 1, 3000), 1);
+  } while (read(fd[0], out, sizeof out) > 0);
+
+  close(fd[0]);
+  close(null);
+}
+END_TEST
+
+START_TEST(test_frames_split_streams_and_status)
+{
+  static char big[FRAME_MAXLEN + 100];
+  char buf[FRAME_MAXLEN], out[16], err[64];
+  struct framehdr hdr;
+  int sv[2], o[2], e[2];
+
+  ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+  ck_assert_int_eq(pipe(o), 0);
+  ck_assert_int_eq(pipe(e), 0);
+
+  /* unframed output goes out as it is and has no exit frame */
+  frame_send(sv[0], FRAME_STDOUT, 0, "raw", 3);
+  frame_exit(sv[0], 0, 1);
+  ck_assert_int_eq(read(sv[1], buf, sizeof buf), 3);
+
+  frames_enable(1);
+  mymemset(big, 'x', sizeof big);
+  frame_send(sv[0], FRAME_STDOUT, 0, big, sizeof big);
+  ck_assert_int_eq(frame_recv(sv[1], &hdr, buf), 0);
+  ck_assert_int_eq(hdr.type, FRAME_STDOUT);
+  ck_assert_int_eq(hdr.len, FRAME_MAXLEN);
+  ck_assert_int_eq(frame_recv(sv[1], &hdr, buf), 0);
+  ck_assert_int_eq(hdr.len, 100);
+
+  /* a job's exit is reported on stderr and does not end the request */
+  frame_printf(sv[0], FRAME_STDOUT, 0, "%s\n", "out");
+  frame_printf(sv[0], FRAME_STDERR, 0, "err\n");
+  frame_exit(sv[0], 2, 0);
+  frame_exit(sv[0], 0, 3);
+  frames_enable(0);
+  ck_assert_int_eq(frames_relay(sv[1], o[1], e[1]), 3);
+  close(o[1]);
+  close(e[1]);
+  out[read(o[0], out, sizeof out - 1)] = '\0';
+  err[read(e[0], err, sizeof err - 1)] = '\0';
+  ck_assert_str_eq(out, "out\n");
+  ck_assert_str_eq(err, "err\n[2]  Done\n");
+
+  close(sv[0]);
+  ck_assert_int_eq(frames_relay(sv[1], -1, -1), -1);
+  close(sv[1]);
+  close(o[0]);
+  close(e[0]);
+}
+END_TEST
+
+/* one command line through the cache as runcommand() runs it, its output read back from sv[1] */
+static void
+cached_command(char **argv, int sv[2], int *served, char *out, size_t size)
+{
+  Pipeline stage;
+  ssize_t n;
+
+  init_pipelines(&stage, 1, sv[0]);
+  stage.argv = argv;
+  for (stage.argc = 0; argv[stage.argc]; stage.argc++)
+    ;
+  if ((*served = resultcache_serve(&stage, 1, sv[0])) == 0) {
+    resultcache_store(run_pipeline(&stage, 1));
+  }
+  n = read(sv[1], out, size - 1);
+  ck_assert_int_ge(n, 0);
+  out[n] = '\0';
+}
+
+START_TEST(test_resultcache_hit_and_invalidate)
+{
+  char path[] = "/tmp/resultcacheXXXXXX", dir[] = "/tmp/resultdirXXXXXX", entry[64], out[256], first[256];
+  char *cat_argv[] = { "cat", path, NULL }, *sum_argv[] = { "md5sum", path, NULL };
+  char *ls_argv[] = { "ls", "-1a", dir, NULL };
+  char *uncached[][4] = { { "ls", "-l", dir, NULL }, { "ls", "-1s", dir, NULL }, { "ls", "--color", dir, NULL },
+                          { "du", dir, NULL }, { "df", dir, NULL }, { "stat", dir, NULL } };
+  struct timespec later[2] = { { 0, UTIME_OMIT }, { 2000000000, 0 } };
+  Pipeline stage;
+  int sv[2], fd, served;
+
+  ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+  ck_assert((fd = mkstemp(path)) != -1);
+  ck_assert_int_eq(write(fd, "v1\n", 3), 3);
+  resultcache_init("60000");
+
+  cached_command(cat_argv, sv, &served, out, sizeof out);
+  ck_assert_int_eq(served, 0);
+  ck_assert_str_eq(out, "v1\n");
+  cached_command(cat_argv, sv, &served, out, sizeof out);
+  ck_assert_int_eq(served, 1);
+  ck_assert_str_eq(out, "v1\n");
+
+  /* same size and inode, only the mtime tells */
+  ck_assert_int_eq(pwrite(fd, "v2\n", 3, 0), 3);
+  ck_assert_int_eq(futimens(fd, later), 0);
+  cached_command(cat_argv, sv, &served, out, sizeof out);
+  ck_assert_int_eq(served, 0);
+  ck_assert_str_eq(out, "v2\n");
+
+  /* a program's stdout is captured from the pipe it writes */
+  cached_command(sum_argv, sv, &served, first, sizeof first);
+  ck_assert_int_eq(served, 0);
+  cached_command(sum_argv, sv, &served, out, sizeof out);
+  ck_assert_int_eq(served, 1);
+  ck_assert_str_eq(out, first);
+  resultcache_invalidate();
+  cached_command(sum_argv, sv, &served, out, sizeof out);
+  ck_assert_int_eq(served, 0);
+
+  /* failures are not kept, and stdin is not an operand */
+  unlink(path);
+  init_pipelines(&stage, 1, sv[0]);
+  stage.argv = cat_argv;
+  stage.argc = 2;
+  ck_assert_int_eq(resultcache_serve(&stage, 1, sv[0]), 0);
+  resultcache_store(1);
+  ck_assert_int_eq(resultcache_serve(&stage, 1, sv[0]), 0);
+  resultcache_store(1);
+  stage.argv = (char *[]){ "cat", NULL };
+  stage.argc = 1;
+  ck_assert_int_eq(resultcache_serve(&stage, 1, sv[0]), 0);
+  ck_assert(!resultcache_capturing());
+
+  /* ls only while it prints names, which the directory's mtime covers */
+  ck_assert_ptr_nonnull(mkdtemp(dir));
+  cached_command(ls_argv, sv, &served, out, sizeof out);
+  ck_assert_int_eq(served, 0);
+  ck_assert_str_eq(out, ".\n..\n");
+  snprintf(entry, sizeof entry, "%s/a", dir);
+  ck_assert(close(open(entry, O_CREAT | O_WRONLY, 0644)) == 0);
+  ck_assert_int_eq(utimensat(AT_FDCWD, dir, later, 0), 0);
+  cached_command(ls_argv, sv, &served, out, sizeof out);
+  ck_assert_int_eq(served, 0);
+  ck_assert_str_eq(out, ".\n..\na\n");
+  cached_command(ls_argv, sv, &served, out, sizeof out);
+  ck_assert_int_eq(served, 1);
+  for (size_t i = 0; i < sizeof uncached / sizeof uncached[0]; i++) {
+    stage.argv = uncached[i];
+    for (stage.argc = 0; uncached[i][stage.argc]; stage.argc++)
+      ;
+    ck_assert_int_eq(resultcache_serve(&stage, 1, sv[0]), 0);
+    ck_assert(!resultcache_capturing());
+  }
+  unlink(entry);
+  rmdir(dir);
+
+  close(fd);
+  close(sv[0]);
+  close(sv[1]);
+}
+END_TEST
+
+START_TEST(test_cgroup_usage_and_fallback)
+{
+  char dir[] = "/tmp/cgroupXXXXXX", path[MAX_PATH_SIZE], out[256];
+  const char *files[][2] = {
+    { "cpu.stat", "usage_usec 1500\nuser_usec 1000\nsystem_usec 500\nnr_periods 0\n" },
+    { "memory.current", "4096\n" },
+    { "io.stat", "8:0 rbytes=100 wbytes=200 rios=1 wios=2\n8:16 rbytes=1 wbytes=2 rios=1 wios=1\n" },
+  };
+  int fd;
+
+  /* not a cgroup2 mount: sessions run unconfined */
+  ck_assert_ptr_nonnull(mkdtemp(dir));
+  setenv(CGROUP_ENV, dir, 1);
+  ck_assert_int_eq(cgroup_init(), -1);
+  unsetenv(CGROUP_ENV);
+  ck_assert_int_eq(cgroup_enter(), -1);
+  ck_assert_ptr_null(cgroup_dir());
+  ck_assert_int_eq(run_builtin((char *[]){ "usage", NULL }, -1, out, sizeof out), 1);
+  cgroup_remove(getpid());
+  cgroup_sweep();
+
+  /* memory.peak is missing, as before Linux 5.19 */
+  for (size_t i = 0; i < sizeof files / sizeof files[0]; i++) {
+    snprintf(path, sizeof path, "%s/%s", dir, files[i][0]);
+    ck_assert((fd = open(path, O_WRONLY | O_CREAT, 0644)) != -1);
+    ck_assert_int_eq(write(fd, files[i][1], strlen(files[i][1])), strlen(files[i][1]));
+    close(fd);
+  }
+  ck_assert_uint_eq(cgroup_usage(dir, out, sizeof out), strlen(out));
+  ck_assert_str_eq(out,
+                   "cpu.usage_usec   1500\n"
+                   "cpu.user_usec    1000\n"
+                   "cpu.system_usec  500\n"
+                   "memory.current   4096\n"
+                   "io.rbytes        101\n"
+                   "io.wbytes        202\n");
+
+  for (size_t i = 0; i < sizeof files / sizeof files[0]; i++) {
+    snprintf(path, sizeof path, "%s/%s", dir, files[i][0]);
+    unlink(path);
+  }
+  rmdir(dir);
+}
+END_TEST
+
+START_TEST(test_builtin_relays_earlier_stderr)
+{
+  char *noisy_argv[] = { "sh", "-c", "head -c 200000 /dev/zero >&2; echo x; echo y", NULL };
+  char *wc_argv[] = { "wc", "-l", NULL }, out[64];
+  char opath[] = "/tmp/bstdoutXXXXXX", epath[] = "/tmp/bstderrXXXXXX";
+  Pipeline stages[2];
+  struct stat st;
+  int sv[2], o, e, status;
+  pid_t pid;
+
+  /* more stderr than a pipe holds from a stage feeding a builtin */
+  ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+  ck_assert((o = mkstemp(opath)) != -1);
+  ck_assert((e = mkstemp(epath)) != -1);
+  if ((pid = fork()) == 0) {
+    alarm(10);
+    frames_enable(1);
+    init_pipelines(stages, 2, sv[0]);
+    stages[0].argv = noisy_argv;
+    stages[0].argc = 3;
+    stages[1].argv = wc_argv;
+    stages[1].argc = 2;
+    status = run_pipeline(stages, 2);
+    frame_exit(sv[0], 0, status);
+    _exit(0);
+  }
+  close(sv[0]);
+  ck_assert_int_eq(frames_relay(sv[1], o, e), 0);
+  ck_assert_int_eq(waitpid(pid, &status, 0), pid);
+  ck_assert(WIFEXITED(status));
+
+  ck_assert_int_eq(fstat(e, &st), 0);
+  ck_assert_int_eq(st.st_size, 200000);
+  out[pread(o, out, sizeof out - 1, 0)] = '\0';
+  ck_assert_str_eq(out, "2\n");
+  close(sv[1]);
+  close(o);
+  close(e);
+  unlink(opath);
+  unlink(epath);
+}
+END_TEST
+
+START_TEST(test_spawn_failures_reach_client)
+{
+  char *missing_argv[] = { "no-such-command-here", NULL };
+  char *sort_argv[] = { "sort", NULL }, *jobs_argv[] = { "jobs", NULL }, *jobsx_argv[] = { "jobs", "-x", NULL };
+  char *wc_argv[] = { "wc", "-l", NULL }, err[512];
+  char opath[] = "/tmp/sstdoutXXXXXX", epath[] = "/tmp/sstderrXXXXXX";
+  Pipeline stage, stages[2];
+  int sv[2], o, e, status;
+  pid_t pid;
+
+  /* not found is 127, a redirection that cannot be opened is 1, both say why */
+  ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+  ck_assert((o = mkstemp(opath)) != -1);
+  ck_assert((e = mkstemp(epath)) != -1);
+  if ((pid = fork()) == 0) {
+    alarm(10);
+    frames_enable(1);
+    init_pipelines(&stage, 1, sv[0]);
+    stage.argv = missing_argv;
+    stage.argc = 1;
+    frame_exit(sv[0], 0, run_pipeline(&stage, 1));
+    init_pipelines(&stage, 1, sv[0]);
+    stage.argv = sort_argv;
+    stage.argc = 1;
+    stage.fin = "/nonexistent/in";
+    frame_exit(sv[0], 0, run_pipeline(&stage, 1));
+    /* a session builtin has no program to fall back to */
+    init_pipelines(&stage, 1, sv[0]);
+    stage.argv = jobsx_argv;
+    stage.argc = 2;
+    frame_exit(sv[0], 0, run_pipeline(&stage, 1));
+    init_pipelines(stages, 2, sv[0]);
+    stages[0].argv = jobs_argv;
+    stages[0].argc = 1;
+    stages[1].argv = wc_argv;
+    stages[1].argc = 2;
+    frame_exit(sv[0], 0, run_pipeline(stages, 2));
+    _exit(0);
+  }
+  close(sv[0]);
+  ck_assert_int_eq(frames_relay(sv[1], o, e), 127);
+  ck_assert_int_eq(frames_relay(sv[1], o, e), 1);
+  ck_assert_int_eq(frames_relay(sv[1], o, e), 2);
+  ck_assert_int_eq(frames_relay(sv[1], o, e), 0);
+  ck_assert_int_eq(waitpid(pid, &status, 0), pid);
+  ck_assert(WIFEXITED(status));
+
+  err[pread(e, err, sizeof err - 1, 0)] = '\0';
+  ck_assert_str_eq(err, "no-such-command-here: command not found\n"
+                        "/nonexistent/in: No such file or directory\n"
+                        "jobs: unsupported option\n"
+                        "jobs: runs only as the last command of a foreground pipeline\n");
+  close(sv[1]);
+  close(o);
+  close(e);
+  unlink(opath);
+  unlink(epath);
+}
+END_TEST
+
+START_TEST(test_cmdstats_stage_usage)
+{
+  char *busy_argv[] = { "sh", "-c", "i=0; while [ $i -lt 20000 ]; do i=$((i+1)); done; sleep 0.05", NULL };
+  char *wc_argv[] = { "wc", "-l", NULL }, buf[1024];
+  Pipeline stages[2];
+  int null = open("/dev/null", O_WRONLY);
+
+  ck_assert_int_ge(null, 0);
+  cmdstats_init();
+  init_pipelines(stages, 2, null);
+  stages[0].argv = busy_argv;
+  stages[0].argc = 3;
+  stages[1].argv = wc_argv;
+  stages[1].argc = 2;
+  ck_assert_int_eq(run_pipeline(stages, 2), 0);
+
+  /* a program from wait4(), the builtin from the session */
+  ck_assert_uint_gt(stages[0].usage.spawn_ns, 0);
+  ck_assert_uint_ge(stages[0].usage.wall_ns, 50000000);
+  ck_assert_uint_gt(stages[0].usage.utime_us + stages[0].usage.stime_us, 0);
+  ck_assert_int_gt(stages[0].usage.maxrss_kb, 0);
+  ck_assert_uint_eq(stages[1].usage.spawn_ns, 0);
+  ck_assert_uint_gt(stages[1].usage.wall_ns, 0);
+  ck_assert_uint_ge(cmdstats_real_ns(stages, 2), stages[0].usage.wall_ns);
+
+  cmdstats_record(1, stages, 2);
+  cmdstats_histograms(buf, sizeof buf);
+  ck_assert_int_eq(strncmp(buf, "pipelines 1, slow 0\n", 20), 0);
+  cmdstats_report(buf, sizeof buf, stages, 2);
+  ck_assert_int_eq(strncmp(buf, "real\t0m0.", 9), 0);
+  ck_assert_ptr_nonnull(strstr(buf, "  wc -l\n"));
+  close(null);
+}
+END_TEST
+
+START_TEST(test_send_recv_log_io_takes_buffered_lines)
+{
+  struct MyIO io = { .bufsize = NETREADMAX };
+  ServerData server = { .io = &io };
+  ClientData client = { .clientid = 1 };
+  char prompt[16];
+  int sv[2];
+
+  /* two lines in one write, the second must not wait for more input */
+  ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+  io.sockfd = sv[0];
+  ck_assert_int_eq(write(sv[1], "echo one\necho two\n", 18), 18);
+  alarm(5);
+  ck_assert_str_eq(send_recv_log_io("$ ", &client, &server), "echo one");
+  ck_assert_uint_eq(mypending(sv[0]), 9);
+  ck_assert_str_eq(send_recv_log_io("$ ", &client, &server), "echo two");
+  alarm(0);
+  ck_assert_uint_eq(mypending(sv[0]), 0);
+  ck_assert_int_eq(read(sv[1], prompt, sizeof prompt), 4);
+  io_detach(&io);
+  myclose(sv[0]);
+  close(sv[1]);
+}
+END_TEST
+
+START_TEST(test_script_file_and_inline)
+{
+  static char big[8192];
+  char path[] = "/tmp/scriptXXXXXX", line[64], out[256];
+  const char *text = "echo one\n# comment\n\nfalse\necho two\r\n";
+  ClientData client = { .clientid = 1 };
+  struct framehdr hdr;
+  int sv[2], fd;
+  ssize_t n, total;
+
+  ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+  ck_assert((fd = mkstemp(path)) != -1);
+  ck_assert_int_eq(write(fd, text, strlen(text)), strlen(text));
+  close(fd);
+  client.clientfd = sv[0];
+
+  /* the status is that of the last line, unless -e stops at a failure */
+  snprintf(line, sizeof line, "script %s", path);
+  ck_assert_int_eq(runcommand(&client, line), 0);
+  out[read(sv[1], out, sizeof out - 1)] = '\0';
+  ck_assert_str_eq(out, "one\ntwo\n");
+  snprintf(line, sizeof line, "script -e %s && echo no", path);
+  ck_assert_int_eq(runcommand(&client, line), 1);
+  out[read(sv[1], out, sizeof out - 1)] = '\0';
+  ck_assert_str_eq(out, "one\nscript: line 4: exit status 1\n");
+
+  /* inline, the lines may arrive in any number of reads */
+  ck_assert_int_eq(write(sv[1], "echo a\nscr", 10), 10);
+  ck_assert_int_eq(write(sv[1], "ipt\necho b\n.\n", 13), 13);
+  ck_assert_int_eq(runcommand(&client, (char []){ "script" }), 0);
+  n = read(sv[1], out, sizeof out - 1);
+  out[n] = '\0';
+  ck_assert_str_eq(out, "> > > > a\nscript: scripts do not nest\nb\n");
+
+  ck_assert_int_eq(runcommand(&client, (char []){ "script -e a b" }), 2);
+  out[read(sv[1], out, sizeof out - 1)] = '\0';
+  ck_assert_str_eq(out, "usage: script [-e] [file]\n");
+
+  /* longer than a pool buffer */
+  memset(big, 'x', 5000);
+  for (int i = 0; i < 50; i++) {
+    memcpy(big + 100 * i, "true ", 5);
+    big[100 * i + 99] = '\n';
+  }
+  ck_assert_int_eq(write(sv[1], big, 5000), 5000);
+  ck_assert_int_eq(write(sv[1], "echo done\n.\n", 12), 12);
+  ck_assert_int_eq(runcommand(&client, (char []){ "script -e" }), 0);
+  for (total = 0; (n = recv(sv[1], big + total, sizeof big - 1 - total, MSG_DONTWAIT)) > 0; total += n) {
+    ;
+  }
+  big[total] = '\0';
+  ck_assert_int_eq(total, 52 * 2 + 5);
+  ck_assert_str_eq(big + total - 5, "done\n");
+
+  /* framed, the lines come as stdin frames, a skipped script's are dropped */
+  frames_enable(1);
+  hdr = (struct framehdr){ .type = FRAME_STDIN, .len = htonl(7) };
+  for (int i = 0; i < 2; i++) {
+    ck_assert_int_eq(write(sv[1], &hdr, sizeof hdr), sizeof hdr);
+    ck_assert_int_eq(write(sv[1], i ? "echo g\n" : "echo f\n", 7), 7);
+    ck_assert_int_eq(write(sv[1], &(struct framehdr){ .type = FRAME_STDIN }, sizeof hdr), sizeof hdr);
+  }
+  ck_assert_int_eq(runcommand(&client, (char []){ "script" }), 0);
+  ck_assert_int_eq(runcommand(&client, (char []){ "true || script" }), 0);
+  ck_assert_int_eq(runcommand(&client, (char []){ "script; script" }), 2);
+  frames_enable(0);
+  ck_assert_int_eq(frame_recv(sv[1], &hdr, big), 0);
+  ck_assert_int_eq(hdr.type, FRAME_STDOUT);
+  ck_assert_int_eq(hdr.len, 2);
+  ck_assert(memcmp(big, "f\n", 2) == 0);
+  ck_assert_int_eq(frame_recv(sv[1], &hdr, big), 0);
+  ck_assert_int_eq(hdr.type, FRAME_STDERR);
+  ck_assert_uint_eq(mypending(sv[0]), 0);
+  ck_assert_int_eq(recv(sv[1], big, 1, MSG_DONTWAIT), -1);
+  unlink(path);
+  close(sv[0]);
+  close(sv[1]);
+}
+END_TEST
+
+START_TEST(test_parallel_order_and_limit)
+{
+  char *sleepy[] = { "parallel", "-k", "-j", "3", "sh", "-c", "sleep $0; echo $0", ":::", "0.3", "0.1", "0.2", NULL };
+  char out[256];
+  struct builtin_args args;
+  struct timespec t0, t1;
+  int fd[2];
+
+  /* -k prints in the order of the operands, otherwise as they finish */
+  ck_assert_int_eq(run_builtin(sleepy, -1, out, sizeof out), 0);
+  ck_assert_str_eq(out, "0.3\n0.1\n0.2\n");
+  ck_assert_int_eq(run_builtin((char *[]){ "parallel", "-j3", "sh", "-c", "sleep $0; echo $0", ":::",
+                                           "0.3", "0.1", "0.2", NULL }, -1, out, sizeof out), 0);
+  ck_assert_str_eq(out, "0.1\n0.2\n0.3\n");
+
+  /* four at once take as long as one, one at a time four times as long */
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  ck_assert_int_eq(run_builtin((char *[]){ "parallel", "-j", "4", "sleep", ":::", "0.2", "0.2", "0.2", "0.2", NULL },
+                               -1, out, sizeof out), 0);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  ck_assert_int_lt((t1.tv_sec - t0.tv_sec) * 1000 + (t1.tv_nsec - t0.tv_nsec) / 1000000, 600);
+  ck_assert_int_eq(run_builtin((char *[]){ "parallel", "-j", "1", "sleep", ":::", "0.2", "0.2", NULL },
+                               -1, out, sizeof out), 0);
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  ck_assert_int_ge((t0.tv_sec - t1.tv_sec) * 1000 + (t0.tv_nsec - t1.tv_nsec) / 1000000, 400);
+
+  /* operands from stdin, command lines of their own, failures counted */
+  ck_assert_int_eq(pipe(fd), 0);
+  ck_assert_int_eq(write(fd[1], "echo a | tr a b\n\nfalse\nfalse\n", 29), 29);
+  close(fd[1]);
+  ck_assert_int_eq(run_builtin((char *[]){ "parallel", "-k", NULL }, fd[0], out, sizeof out), 2);
+  ck_assert_str_eq(out, "b\n");
+  close(fd[0]);
+  ck_assert_int_eq(run_builtin((char *[]){ "parallel", "-k", "echo", "<{}>", "{}", ":::", "x", NULL },
+                               -1, out, sizeof out), 0);
+  ck_assert_str_eq(out, "<{}> x\n");
+  ck_assert_ptr_null(builtin_find(3, (char *[]){ "parallel", "-x", "true", NULL }, &args));
+}
+END_TEST
+
+/* an upload frame as upload_send() builds it */
+static size_t
+upload_frame(char *buf, const char *data, size_t len)
+{
+  struct framehdr hdr = { FRAME_STDIN, 0, 0, htonl(len) };
+
+  memcpy(buf, &hdr, sizeof hdr);
+  memcpy(buf + sizeof hdr, data, len);
+  return sizeof hdr + len;
+}
+
+START_TEST(test_upload_into_pipe)
+{
+  static const char *lines[] = { "put - | wc -l", "put big.log | gzip -d | tar x", "put | cat && ls", NULL };
+  static const char *not[] = { "put", "put a b | wc", "ls | put -", "cat x; put - | wc", NULL };
+  char buf[256], line[64], mem[1024], out[64];
+  struct cmd_pipeline *list;
+  struct arena arena;
+  const char *err;
+  size_t len;
+  int sv[2], fd[2];
+
+  for (int k = 0; k < 2; k++) {
+    for (const char **l = k ? not : lines; *l; l++) {
+      strcpy(line, *l);
+      arena_init(&arena, mem, sizeof mem);
+      ck_assert_int_eq(cmd_parse(line, &arena, &list, &err), 0);
+      ck_assert_int_eq(upload_pipeline(list), !k);
+    }
+  }
+
+  /* the command line and the start of the upload arrive in one read */
+  ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+  ck_assert_int_eq(pipe(fd), 0);
+  len = 0;
+  memcpy(buf, "put - | cat\n", 12);
+  len += 12;
+  len += upload_frame(buf + len, "hello ", 6);
+  ck_assert_int_eq(write(sv[1], buf, len), len);
+  len = upload_frame(buf, "world\n", 6);
+  len += upload_frame(buf + len, "", 0);
+  memcpy(buf + len, "echo next\n", 10);
+  ck_assert_int_eq(write(sv[1], buf, len + 10), len + 10);
+
+  ck_assert_uint_eq(myreadline(sv[0], line, sizeof line), 12);
+  ck_assert_str_eq(line, "put - | cat");
+  ck_assert_int_eq(upload_recv(sv[0], fd[1]), 0);
+  close(fd[1]);
+  out[read(fd[0], out, sizeof out - 1)] = '\0';
+  ck_assert_str_eq(out, "hello world\n");
+  ck_assert_uint_eq(myreadline(sv[0], line, sizeof line), 10);
+  ck_assert_str_eq(line, "echo next");
+
+  /* once the reader is gone the rest is dropped up to the end */
+  close(fd[0]);
+  ck_assert_int_eq(pipe(fd), 0);
+  close(fd[0]);
+  signal(SIGPIPE, SIG_IGN);
+  len = upload_frame(buf, "lost", 4);
+  len += upload_frame(buf + len, "", 0);
+  ck_assert_int_eq(write(sv[1], buf, len), len);
+  ck_assert_int_eq(upload_recv(sv[0], fd[1]), 0);
+  close(fd[1]);
+
+  /* anything else, or a hangup, ends it early */
+  ck_assert_int_eq(write(sv[1], "echo hello\n", 11), 11);
+  ck_assert_int_eq(upload_recv(sv[0], -1), 1);
+  close(sv[1]);
+  ck_assert_int_eq(upload_recv(sv[0], -1), 1);
+  close(sv[0]);
+}
+END_TEST
+
+/* a datagram socket on addr that sends one HELLO to port */
+static int
+udp_hello_from(const char *addr, int port, uint64_t token)
+{
+  struct sockaddr_in sin = { .sin_family = AF_INET };
+  struct udppkt pkt;
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+  inet_pton(AF_INET, addr, &sin.sin_addr);
+  ck_assert_int_eq(bind(fd, (struct sockaddr *)&sin, sizeof sin), 0);
+  sin.sin_port = htons(port);
+  inet_pton(AF_INET, "127.0.0.1", &sin.sin_addr);
+  memset(&pkt, 0, sizeof pkt);
+  pkt.type = UDP_HELLO;
+  pkt.sack = htobe64(token);
+  ck_assert_int_eq(sendto(fd, &pkt, UDP_HDRLEN, 0, (struct sockaddr *)&sin, sizeof sin), UDP_HDRLEN);
+  return fd;
+}
+
+START_TEST(test_udp_hello_needs_token_and_peer)
+{
+  struct sockaddr_in sin = { .sin_family = AF_INET }, peer, good;
+  socklen_t len = sizeof sin;
+  int lfd, cfd, ctrl, udpfd, port, fds[3];
+  uint64_t token = udp_token();
+
+  /* the control connection, from 127.0.0.1 */
+  sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  lfd = socket(AF_INET, SOCK_STREAM, 0);
+  ck_assert_int_eq(bind(lfd, (struct sockaddr *)&sin, sizeof sin), 0);
+  ck_assert_int_eq(listen(lfd, 1), 0);
+  getsockname(lfd, (struct sockaddr *)&sin, &len);
+  cfd = socket(AF_INET, SOCK_STREAM, 0);
+  ck_assert_int_eq(connect(cfd, (struct sockaddr *)&sin, sizeof sin), 0);
+  ctrl = accept(lfd, NULL, NULL);
+
+  udpfd = udp_listen(ctrl, &port);
+  ck_assert(udp_token() != token);
+  fds[0] = udp_hello_from("127.0.0.2", port, token);     /* not the client's address */
+  fds[1] = udp_hello_from("127.0.0.1", port, token + 1); /* the wrong token */
+  fds[2] = udp_hello_from("127.0.0.1", port, token);
+  ck_assert_int_eq(udp_accept_hello(udpfd, ctrl, token), 0);
+
+  len = sizeof peer;
+  getpeername(udpfd, (struct sockaddr *)&peer, &len);
+  len = sizeof good;
+  getsockname(fds[2], (struct sockaddr *)&good, &len);
+  ck_assert_int_eq(peer.sin_port, good.sin_port);
+
+  for (int i = 0; i < 3; i++) {
+    close(fds[i]);
+  }
+  close(udpfd);
+  close(ctrl);
+  close(cfd);
+  close(lfd);
+}
+END_TEST
+
+/* hand mux_serve() a raw request with nfds fds, return the status it answers */
+static int
+mux_raw_request(struct MyIO *io, const char *msg, size_t len, const int *fds, int nfds)
+{
+  void(*callbacks[NCALLBACK])(struct MyIO*) = { NULL };
+  char cbuf[CMSG_SPACE(sizeof(int) * 4)];
+  struct iovec iov = { .iov_base = (void *)msg, .iov_len = len };
+  struct msghdr mh = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = cbuf,
+                       .msg_controllen = CMSG_SPACE(sizeof(int) * nfds) };
+  struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+  int req[2], status = -1;
+
+  ck_assert_int_eq(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, req), 0);
+  cm->cmsg_level = SOL_SOCKET;
+  cm->cmsg_type = SCM_RIGHTS;
+  cm->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+  memcpy(CMSG_DATA(cm), fds, sizeof(int) * nfds);
+  ck_assert_int_eq(sendmsg(req[1], &mh, 0), len);
+  ck_assert_int_eq(mux_serve(io, req[0], callbacks), 0);
+  ck_assert_int_eq(read(req[1], &status, sizeof status), sizeof status);
+  close(req[1]);
+  return status;
+}
+
+START_TEST(test_mux_request_relay_and_status)
+{
+  static const char frames[] = {
+    FRAME_STDOUT, 0, 0, 0, 0, 0, 0, 3, 'h', 'i', '\n',
+    FRAME_EXIT, 0, 0, 0, 0, 0, 0, 4, 0, 0, 0, 3,
+  };
+  void(*callbacks[NCALLBACK])(struct MyIO*) = {
+    clienthandlehelp, clienthandlehelp, clienthandlehelp, clienthandlehelp, clienthandlehelp,
+  };
+  char dir[] = "/tmp/ut_muxXXXXXX", path[64], link[32], out[64];
+  int req[2], sess[2], o[2], fds[MUX_NFDS], wstatus;
+  struct MyIO io;
+  pid_t pid;
+
+  /* the socket's directory must be private */
+  ck_assert_ptr_nonnull(mkdtemp(dir));
+  snprintf(path, sizeof path, "%s/control.sock", dir);
+  ck_assert_int_eq(mux_socketdir(path, 0), 0);
+  chmod(dir, 0755);
+  ck_assert_int_eq(mux_socketdir(path, 0), -1);
+  chmod(dir, 0700);
+  snprintf(link, sizeof link, "%s.link", dir);
+  ck_assert_int_eq(symlink(dir, link), 0);
+  snprintf(path, sizeof path, "%s/control.sock", link);
+  ck_assert_int_eq(mux_socketdir(path, 0), -1);
+  unlink(link);
+  rmdir(dir);
+
+  /* the session already holds the server's answer */
+  ck_assert_int_eq(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, req), 0);
+  ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sess), 0);
+  ck_assert_int_eq(pipe(o), 0);
+  ck_assert_int_eq(write(sess[1], frames, sizeof frames), sizeof frames);
+
+  if ((pid = fork()) == 0) {
+    fds[0] = open("/dev/null", O_RDONLY);
+    fds[1] = o[1];
+    fds[2] = o[1];
+    _exit(mux_request(req[1], "echo hi", fds));
+  }
+  close(req[1]);
+  close(o[1]);
+
+  initiostruct(sess[0], -1, -1, &io);
+  io_attach(&io);
+  ck_assert_int_eq(mux_serve(&io, req[0], callbacks), 0);
+  io_detach(&io);
+
+  ck_assert(waitpid(pid, &wstatus, 0) == pid);
+  ck_assert(WIFEXITED(wstatus));
+  ck_assert_int_eq(WEXITSTATUS(wstatus), 3);
+  out[read(o[0], out, sizeof out - 1)] = '\0';
+  ck_assert_str_eq(out, "hi\n");
+  out[read(sess[1], out, sizeof out - 1)] = '\0';
+  ck_assert_str_eq(out, "echo hi\n");
+
+  /* a request that does not fit or does not end goes no further, extra fds are closed */
+  {
+    static char big[8192];
+    char err[128];
+    int e[2], extra[2], raw[4];
+
+    ck_assert_int_eq(pipe(e), 0);
+    ck_assert_int_eq(pipe(extra), 0);
+    raw[0] = raw[1] = raw[2] = e[1];
+    raw[3] = extra[1];
+    memset(big, 'x', sizeof big);
+    big[0] = '/';
+    big[1] = '\0';
+    big[5000] = '\0';
+    ck_assert_int_eq(mux_raw_request(&io, big, 5001, raw, 4), 2);
+    ck_assert_int_eq(mux_raw_request(&io, "/\0echo", 6, raw, 3), 2);
+    ck_assert_int_eq(mux_raw_request(&io, "/tmp", 4, raw, 3), 2);
+    close(e[1]);
+    err[read(e[0], err, sizeof err - 1)] = '\0';
+    ck_assert_str_eq(err, "master: command too long\nmaster: malformed request\nmaster: malformed request\n");
+    close(extra[1]);
+    ck_assert_int_eq(read(extra[0], out, 1), 0);
+    close(e[0]);
+    close(extra[0]);
+  }
+
+  close(o[0]);
+  close(sess[0]);
+  close(sess[1]);
+}
+END_TEST
+
+START_TEST(test_upload_output_larger_than_input)
+{
+  enum { INSIZE = 1024 * 1024, GROWTH = 8 };
+  char path[] = "/tmp/ut_upload.XXXXXX", line[128], buf[FRAME_MAXLEN], *data;
+  char opath[] = "/tmp/ut_uploadout.XXXXXX";
+  struct framehdr hdr;
+  struct MyIO io;
+  struct stat st;
+  int sv[2], tmp, o, status;
+  ssize_t n;
+  pid_t pid;
+
+  ck_assert_int_ne(tmp = mkstemp(path), -1);
+  data = calloc(1, INSIZE);
+  ck_assert_int_eq(write(tmp, data, INSIZE), INSIZE);
+  close(tmp);
+  free(data);
+
+  /* a session that writes all of a chunk's output before it reads the next */
+  ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+  if ((pid = fork()) == 0) {
+    close(sv[1]);
+    frames_enable(1);
+    while (frame_recv_hdr(sv[0], &hdr) == 0 && hdr.len > 0) {
+      for (size_t got = 0; got < hdr.len; got += n) {
+        if ((n = read(sv[0], buf + got, hdr.len - got)) <= 0) {
+          _exit(1);
+        }
+      }
+      for (int i = 0; i < GROWTH; i++) {
+        frame_send(sv[0], FRAME_STDOUT, 0, buf, hdr.len);
+      }
+    }
+    frame_exit(sv[0], 0, 0);
+    _exit(0);
+  }
+  close(sv[0]);
+
+  alarm(20);
+  ck_assert_int_ne(o = mkstemp(opath), -1);
+  initiostruct(sv[1], -1, o, &io);
+  io.buf = line;
+  mysnprintf(line, sizeof line, "put %s | gzip -d", path);
+  ck_assert_int_eq(upload_send(&io, sys_stderr), 1);
+  ck_assert_int_eq(frames_relay(sv[1], o, sys_stderr), 0);
+  alarm(0);
+  ck_assert_int_eq(waitpid(pid, &status, 0), pid);
+  ck_assert_int_eq(fstat(o, &st), 0);
+  ck_assert_int_eq(st.st_size, (off_t)INSIZE * GROWTH);
+
+  close(o);
+  close(sv[1]);
+  unlink(opath);
+  unlink(path);
+}
+END_TEST
+
+START_TEST(test_download_into_command)
+{
+  static const char *not[] = { "get", "get a b", "get a || b", "get a |", "get 'a b'", "get a > b",
+                               "getx y", "get a; ls", "get *.log | wc", NULL };
+  char path[] = "/tmp/ut_download.XXXXXX", name[64], line[128], out[128], *data;
+  const char *local;
+  struct MyIO io;
+  int sv[2], fd[2], efd[2], tmp, status;
+  size_t size = 1 << 20;
+  pid_t pid;
+
+  ck_assert_int_eq(download_line("get big.log | grep ERROR", name, sizeof name, &local), 1);
+  ck_assert_str_eq(name, "big.log");
+  ck_assert_str_eq(local, "grep ERROR");
+  ck_assert_int_eq(download_line("  get\tsub/a.txt ", name, sizeof name, &local), 1);
+  ck_assert_str_eq(name, "sub/a.txt");
+  ck_assert_ptr_null(local);
+  ck_assert_int_eq(download_line("get x|wc -l", NULL, 0, NULL), 1);
+  ck_assert_int_eq(download_line("get xy", name, 2, NULL), 0); /* does not fit */
+  for (const char **l = not; *l; l++) {
+    ck_assert_int_eq(download_line(*l, name, sizeof name, &local), 0);
+  }
+
+  /* more than the socket and the pipe hold, so the consumer pushes back */
+  ck_assert_int_ne(tmp = mkstemp(path), -1);
+  data = malloc(size);
+  for (size_t i = 0; i < size; i++) {
+    data[i] = 'a' + i % 26;
+  }
+  ck_assert_int_eq(write(tmp, data, size), size);
+  close(tmp);
+  free(data);
+
+  ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+  if ((pid = fork()) == 0) {
+    close(sv[1]);
+    frames_enable(0);
+    download_send(sv[0], path);
+    write(sv[0], "next\n", 5);
+    download_send(sv[0], path);
+    download_send(sv[0], "/nonexistent");
+    _exit(0);
+  }
+  close(sv[0]);
+  ck_assert_int_eq(pipe(fd), 0);
+  ck_assert_int_eq(pipe(efd), 0);
+  initiostruct(sv[1], -1, fd[1], &io);
+  io.buf = line;
+
+  strcpy(line, "echo not a download");
+  ck_assert_int_eq(download_recv(&io, efd[1], &status), 0);
+
+  mysnprintf(line, sizeof line, "get %s | (sleep 0.2; wc -c)", path);
+  ck_assert_int_eq(download_recv(&io, efd[1], &status), 1);
+  ck_assert_int_eq(status, 0);
+  out[read(fd[0], out, sizeof out - 1)] = '\0';
+  ck_assert_int_eq(atoi(out), size);
+  ck_assert_int_eq(read(sv[1], out, 5), 5); /* the session is still in step */
+  ck_assert_int_eq(memcmp(out, "next\n", 5), 0);
+
+  /* a consumer that stops reading early drops the rest */
+  mysnprintf(line, sizeof line, "get %s | head -c 10", path);
+  ck_assert_int_eq(download_recv(&io, efd[1], &status), 1);
+  ck_assert_int_eq(status, 0);
+  out[read(fd[0], out, sizeof out - 1)] = '\0';
+  ck_assert_str_eq(out, "abcdefghij");
+
+  strcpy(line, "get /nonexistent");
+  ck_assert_int_eq(download_recv(&io, efd[1], &status), 1);
+  ck_assert_int_eq(status, 1);
+  out[read(efd[0], out, sizeof out - 1)] = '\0';
+  ck_assert_str_eq(out, "get: /nonexistent: No such file or directory\n");
+
+  /* a hangup */
+  ck_assert_int_eq(download_recv(&io, efd[1], &status), 1);
+  ck_assert_int_eq(status, -1);
+
+  waitpid(pid, NULL, 0);
+  close(sv[1]);
+  close(fd[0]);
+  close(fd[1]);
+  close(efd[0]);
+  close(efd[1]);
+  unlink(path);
+}
+END_TEST
+
+START_TEST(test_udp_transfer_loopback)
+{
+  udp_transfer_with_loss(1 << 20, 0);
+  udp_transfer_with_loss(UDP_PAYLOAD * 3, 0); /* exact multiple of a packet */
+  udp_transfer_with_loss(0, 0);
+}
+END_TEST
+
+START_TEST(test_udp_transfer_with_loss)
+{
+  udp_transfer_with_loss(1 << 20, 100); /* 10% of data and acks dropped */
+}
+END_TEST
+
+Suite *
+transfer_suite(void)
+{
+  Suite *s = suite_create("Transfer Test Suite");
+
+  TCase *tc_core = tcase_create("Core");
+  tcase_add_test(tc_core, test_udp_transfer_loopback);
+  tcase_add_test(tc_core, test_udp_transfer_with_loss);
+  tcase_add_test(tc_core, test_udp_hello_needs_token_and_peer);
+  tcase_add_test(tc_core, test_upload_into_pipe);
+  tcase_add_test(tc_core, test_mux_request_relay_and_status);
+  tcase_add_test(tc_core, test_upload_output_larger_than_input);
+  tcase_add_test(tc_core, test_download_into_command);
+  tcase_set_timeout(tc_core, 30);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
+
+Suite *
+string_suite(void)
+{
+  Suite *s = suite_create("String Test Suite");
+
+  TCase *tc_core = tcase_create("Core");
+  tcase_add_test(tc_core, test_mymemchr_variants);
+  tcase_add_test(tc_core, test_mystrchrnul_variants);
+  tcase_add_test(tc_core, test_mymemset_mymemcpy_variants);
+  tcase_add_test(tc_core, test_mystrcmp_variants);
+  tcase_add_test(tc_core, test_mystrlen_mystrchr);
+  tcase_add_test(tc_core, test_myreadline_splits_lines);
+  tcase_add_test(tc_core, test_myreadline_keeps_leftovers_per_fd);
+  tcase_add_test(tc_core, test_cmd_parse_grammar);
+  tcase_add_test(tc_core, test_cmd_parse_errors);
+  tcase_add_test(tc_core, test_mysnprintf_matches_snprintf);
+  tcase_add_test(tc_core, test_myfprintf_single_write);
+  suite_add_tcase(s, tc_core);
+
+  return s;
+}
+
 Suite *
 system_suite(void)
 {
@@ -129,6 +1934,23 @@ system_suite(void)
   tcase_add_test(tc_core, test_mysckread_large_buffer);
   tcase_add_test(tc_core, test_mysckwrite_success);
   tcase_add_test(tc_core, test_mymalloc_and_myfree_success);
+  tcase_add_test(tc_core, test_bufpool_get_and_put);
+  tcase_add_test(tc_core, test_serverlog_collects_sessions);
+  tcase_add_test(tc_core, test_serverlog_binary_interns_strings);
+  tcase_add_test(tc_core, test_debug_levels_and_categories);
+  tcase_add_test(tc_core, test_transcript_ring_keeps_newest);
+  tcase_add_test(tc_core, test_pathcache_resolve_and_invalidate);
+  tcase_add_test(tc_core, test_builtins_match_programs);
+  tcase_add_test(tc_core, test_jobs_background_wait_kill);
+  tcase_add_test(tc_core, test_parallel_order_and_limit);
+  tcase_add_test(tc_core, test_frames_split_streams_and_status);
+  tcase_add_test(tc_core, test_resultcache_hit_and_invalidate);
+  tcase_add_test(tc_core, test_cgroup_usage_and_fallback);
+  tcase_add_test(tc_core, test_builtin_relays_earlier_stderr);
+  tcase_add_test(tc_core, test_spawn_failures_reach_client);
+  tcase_add_test(tc_core, test_cmdstats_stage_usage);
+  tcase_add_test(tc_core, test_send_recv_log_io_takes_buffered_lines);
+  tcase_add_test(tc_core, test_script_file_and_inline);
   suite_add_tcase(s, tc_core);
 
   return s;
@@ -147,6 +1969,9 @@ main(void)
   Suite *s = system_suite();
   SRunner *sr = srunner_create(s);
 
+  srunner_add_suite(sr, string_suite());
+  srunner_add_suite(sr, transfer_suite());
+
   srunner_set_log(sr, "test.log");
   srunner_set_tap(sr, "/dev/stdout");
 
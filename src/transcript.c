@@ -0,0 +1,165 @@
+/**
+ * @file transcript.c
+ * @brief Per-Session Transcript Ring Files
+ *
+ * Each session owns its mapping, so appends need no locking. The bytes are
+ * copied in first and @head published after them.
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#define _POSIX_C_SOURCE 200809L /* posix_fallocate */
+
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "transcript.h"
+#include "mystring.h"
+#include "syscalls.h"
+
+static const char *__dir;                      /* NULL when disabled */
+static uint64_t __size = 1 << 20;              /* ring bytes per session */
+static struct transcript_hdr *__ts;            /* this session's mapping */
+
+void
+transcript_init(void)
+{
+  const char *mb = mygetenv(TRANSCRIPT_MB_ENV);
+  uint64_t n = 0;
+
+  __dir = mygetenv(TRANSCRIPT_DIR_ENV);
+  if (__dir == NULL) {
+    return;
+  }
+  if (myaccess(__dir, W_OK | X_OK) == -1) {
+    printerr_exit(TRANSCRIPT_DIR_ENV " is not a writable directory\n");
+  }
+
+  for ( ; mb && *mb >= '0' && *mb <= '9'; mb++) {
+    n = n * 10 + (*mb - '0');
+  }
+  if (n) {
+    __size = n << 20;
+  }
+}
+
+void
+transcript_open(int clientid)
+{
+  char path[MAX_PATH_SIZE];
+  int fd;
+  void *map;
+
+  if (__dir == NULL) {
+    return;
+  }
+
+  mysnprintf(path, sizeof path, "%s/session-%d-%d.tr", __dir, getpid(), clientid);
+  fd = myopen(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  /* reserve the blocks now so writeback cannot fail for lack of space */
+  if (posix_fallocate(fd, 0, TRANSCRIPT_HDRSIZE + __size) != 0) {
+    printerr_exit("posix_fallocate() error\n");
+  }
+  map = mmap(NULL, TRANSCRIPT_HDRSIZE + __size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    printerr_exit("mmap() error\n");
+  }
+  myclose(fd);
+
+  __ts = map;
+  mymemcpy(__ts->magic, TRANSCRIPT_MAGIC, sizeof __ts->magic);
+  __ts->size = __size;
+  __ts->head = 0;
+  __ts->pid = getpid();
+  __ts->clientid = clientid;
+}
+
+int
+transcript_enabled(void)
+{
+  return __ts != NULL;
+}
+
+void
+transcript_write(const void *buf, size_t n)
+{
+  const char *src = buf;
+  char *ring;
+  uint64_t head, off;
+  size_t first;
+
+  if (__ts == NULL) {
+    return;
+  }
+
+  ring = (char *)__ts + TRANSCRIPT_HDRSIZE;
+  head = __ts->head;
+  if (n > __ts->size) {
+    head += n - __ts->size;
+    src += n - __ts->size;
+    n = __ts->size;
+  }
+
+  off = head % __ts->size;
+  first = n < __ts->size - off ? n : __ts->size - off;
+  mymemcpy(ring + off, src, first);
+  mymemcpy(ring, src + first, n - first);
+
+  __atomic_store_n(&__ts->head, head + n, __ATOMIC_RELEASE);
+}
+
+void
+transcript_puts(const char *s)
+{
+  transcript_write(s, mystrlen(s));
+}
+
+void
+transcript_close(void)
+{
+  if (__ts == NULL) {
+    return;
+  }
+  munmap(__ts, TRANSCRIPT_HDRSIZE + __ts->size);
+  __ts = NULL;
+}
+
+size_t
+transcript_copyout(const struct transcript_hdr *hdr, char *out, size_t size)
+{
+  const char *ring = (const char *)hdr + TRANSCRIPT_HDRSIZE;
+  uint64_t head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+  uint64_t n = head < hdr->size ? head : hdr->size;
+  uint64_t off, first;
+
+  if (mystrncmp(hdr->magic, TRANSCRIPT_MAGIC, sizeof hdr->magic) != 0) {
+    return 0;
+  }
+  if (n > size) {
+    n = size; /* keep the newest bytes */
+  }
+
+  off = (head - n) % hdr->size;
+  first = n < hdr->size - off ? n : hdr->size - off;
+  mymemcpy(out, ring + off, first);
+  mymemcpy(out + first, ring, n - first);
+
+  return n;
+}
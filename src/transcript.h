@@ -0,0 +1,109 @@
+/**
+ * @file transcript.h
+ * @brief Per-Session Transcript Ring Files
+ *
+ * With SHELLSERVE_TRANSCRIPT_DIR set every session records what it sent and
+ * received into DIR/session-PID-ID.tr, a preallocated file mapped MAP_SHARED.
+ * Appending is a memcpy into the mapping and the kernel writes it back, so a
+ * crashed session still leaves its most recent bytes on disk.
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef __TRANSCRIPT_H
+#define __TRANSCRIPT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRANSCRIPT_DIR_ENV "SHELLSERVE_TRANSCRIPT_DIR"
+#define TRANSCRIPT_MB_ENV "SHELLSERVE_TRANSCRIPT_MB" /* ring size, default 1 */
+#define TRANSCRIPT_MAGIC "SSTRN01\n"
+#define TRANSCRIPT_HDRSIZE 0x1000 /* the ring starts one page in */
+
+/**
+ * struct transcript_hdr - First page of a transcript file
+ * @magic: TRANSCRIPT_MAGIC
+ * @size: ring bytes following the header page
+ * @head: bytes ever appended, the ring holds the last min(@head, @size)
+ * @pid: session process
+ * @clientid: session id, as in the server log
+ *
+ * @head is stored after the bytes it covers, so a reader never sees bytes
+ * that were not written yet.
+ */
+struct transcript_hdr {
+  char magic[8];
+  uint64_t size;
+  uint64_t head;
+  int32_t pid;
+  int32_t clientid;
+};
+
+/**
+ * transcript_init() - Read the transcript settings, in the server process.
+ *
+ * Exits if TRANSCRIPT_DIR_ENV names a directory that is not writable.
+ */
+void transcript_init(void);
+
+/**
+ * transcript_open() - Create this session's transcript, if enabled.
+ *
+ * @clientid: session id
+ */
+void transcript_open(int clientid);
+
+/**
+ * transcript_enabled() - True if this session records a transcript.
+ */
+int transcript_enabled(void);
+
+/**
+ * transcript_write() - Append @n bytes of @buf, a no-op when disabled.
+ *
+ * @buf: bytes to append
+ * @n: number of bytes, only the last ring size bytes are kept
+ */
+void transcript_write(const void *buf, size_t n);
+
+/**
+ * transcript_puts() - Append a NUL terminated string, see transcript_write().
+ *
+ * @s: string to append
+ */
+void transcript_puts(const char *s);
+
+/**
+ * transcript_close() - Unmap this session's transcript, it stays on disk.
+ */
+void transcript_close(void);
+
+/**
+ * transcript_copyout() - Copy a transcript ring out in order.
+ *
+ * @hdr: a mapped transcript file, header first
+ * @out: receives the recorded bytes, oldest first
+ * @size: bytes available at @out
+ *
+ * Return: number of bytes copied, 0 if @hdr is not a transcript.
+ */
+size_t transcript_copyout(const struct transcript_hdr *hdr, char *out, size_t size);
+
+#endif // __TRANSCRIPT_H
@@ -0,0 +1,514 @@
+/**
+ * @file udptransfer.c
+ * @brief Datagram Bulk Transfer Channel
+ *
+ * Sender and receiver for the UDP data channel. The sender keeps one state
+ * byte per packet and the receiver one received flag per packet, so a
+ * transfer costs about 6 bytes of bookkeeping per 1400 bytes of data.
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#define _GNU_SOURCE /* ppoll */
+
+#include <sys/random.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <endian.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "udptransfer.h"
+#include "syscalls.h"
+#include "mystring.h"
+
+/* private */
+enum { __PKT_UNSENT, __PKT_INFLIGHT, __PKT_LOST, __PKT_ACKED };
+
+static unsigned int __loss_permille = 0;
+static uint32_t __loss_state = 0x9e3779b9;
+/* end private */
+
+static uint32_t
+now_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)(ts.tv_sec * 1000000ull + ts.tv_nsec / 1000);
+}
+
+void
+udp_set_loss(unsigned int permille)
+{
+  __loss_permille = permille;
+  __loss_state ^= (uint32_t)getpid();
+}
+
+__attribute__((constructor)) static void
+udp_loss_from_env(void)
+{
+  const char *val = mygetenv(UDP_LOSS_ENV);
+  unsigned int permille = 0;
+
+  for ( ; val && *val >= '0' && *val <= '9'; val++) {
+    permille = permille * 10 + (*val - '0');
+  }
+  if (permille) {
+    udp_set_loss(permille);
+  }
+}
+
+static void
+udp_send(int udpfd, struct udppkt *pkt, size_t len)
+{
+  if (__loss_permille) {
+    /* xorshift32, good enough to pick packets to drop */
+    __loss_state ^= __loss_state << 13;
+    __loss_state ^= __loss_state >> 17;
+    __loss_state ^= __loss_state << 5;
+    if (__loss_state % 1000 < __loss_permille) {
+      return;
+    }
+  }
+  /* best effort, a refused or dropped datagram is just a lost packet */
+  (void)send(udpfd, pkt, len, 0);
+}
+
+/* wait up to timeout_us for a datagram, return its length or 0 */
+static ssize_t
+udp_recv(int udpfd, struct udppkt *pkt, uint32_t timeout_us)
+{
+  struct pollfd pfd = { .fd = udpfd, .events = POLLIN };
+  struct timespec ts = { timeout_us / 1000000, (timeout_us % 1000000) * 1000 };
+  ssize_t n;
+
+  if (ppoll(&pfd, 1, &ts, NULL) <= 0) {
+    return 0;
+  }
+  n = recv(udpfd, pkt, sizeof *pkt, 0);
+  return n < (ssize_t)UDP_HDRLEN ? 0 : n;
+}
+
+static void
+send_ack(int udpfd, const uint8_t *rcvd, uint32_t npkts, uint32_t cumack, uint32_t ts, int type)
+{
+  struct udppkt ack;
+  uint64_t sack = 0;
+
+  for (uint32_t i = 0; i < UDP_SACK_BITS && cumack + 1 + i < npkts; i++) {
+    if (rcvd[cumack + 1 + i]) {
+      sack |= 1ull << i;
+    }
+  }
+
+  mymemset(&ack, 0, UDP_HDRLEN);
+  ack.type = type;
+  ack.seq = htonl(cumack);
+  ack.ts = ts; /* echoed untouched */
+  ack.sack = htobe64(sack);
+  udp_send(udpfd, &ack, UDP_HDRLEN);
+}
+
+int64_t
+udp_recvfile(int udpfd, int filefd, uint64_t size, uint64_t token)
+{
+  struct udppkt pkt, hello;
+  uint32_t npkts = (size + UDP_PAYLOAD - 1) / UDP_PAYLOAD;
+  uint32_t cumack = 0, seq, idle = 0;
+  uint8_t *rcvd = mymalloc(npkts + 1);
+  int gotany = 0;
+  int64_t ret = -1;
+  ssize_t n;
+
+  mymemset(&hello, 0, UDP_HDRLEN);
+  hello.type = UDP_HELLO;
+  hello.sack = htobe64(token);
+  udp_send(udpfd, &hello, UDP_HDRLEN);
+
+  while (idle < UDP_IDLE_TIMEOUT_US) {
+    if ((n = udp_recv(udpfd, &pkt, UDP_HELLO_US)) == 0) {
+      idle += UDP_HELLO_US;
+      if (!gotany) {
+        udp_send(udpfd, &hello, UDP_HDRLEN);
+      }
+      continue;
+    }
+    gotany = 1;
+    idle = 0;
+    seq = ntohl(pkt.seq);
+
+    if (pkt.type == UDP_DATA && seq < npkts && !rcvd[seq]
+        && ntohs(pkt.len) <= n - UDP_HDRLEN) {
+      if (pwrite(filefd, pkt.payload, ntohs(pkt.len), (off_t)seq * UDP_PAYLOAD) == -1) {
+        printerr_exit("pwrite() error\n");
+      }
+      rcvd[seq] = 1;
+      while (cumack < npkts && rcvd[cumack]) {
+        cumack++;
+      }
+      send_ack(udpfd, rcvd, npkts, cumack, pkt.ts, UDP_ACK);
+    } else if (pkt.type == UDP_DATA) { /* duplicate, the ack must have been lost */
+      send_ack(udpfd, rcvd, npkts, cumack, pkt.ts, UDP_ACK);
+    } else if (pkt.type == UDP_FIN) {
+      send_ack(udpfd, rcvd, npkts, cumack, pkt.ts, cumack == npkts ? UDP_FINACK : UDP_ACK);
+      if (cumack == npkts) {
+        ret = size;
+        break;
+      }
+    }
+  }
+
+  myfree(rcvd, npkts + 1);
+  return ret;
+}
+
+struct sender {
+  uint8_t *state;     /* __PKT_* per packet */
+  uint32_t *sent;     /* last send time per packet */
+  uint32_t npkts;
+  uint32_t next;      /* first packet never sent */
+  uint32_t cumack;    /* every packet below this is acked */
+  uint32_t highack;   /* highest packet acked so far, +1 */
+  uint32_t inflight;
+  uint32_t nlost;     /* packets marked lost, waiting to be resent */
+  uint32_t cwnd, ssthresh, cwndfrac;
+  uint32_t srtt, rttvar, rto;
+  uint32_t lastcut;   /* time of the last window reduction */
+  uint32_t lastscan;  /* time of the last loss scan */
+};
+
+static void
+sender_rtt(struct sender *s, uint32_t sample)
+{
+  if (s->srtt == 0) {
+    s->srtt = sample;
+    s->rttvar = sample / 2;
+  } else {
+    uint32_t err = sample > s->srtt ? sample - s->srtt : s->srtt - sample;
+    s->rttvar = (3 * s->rttvar + err) / 4;
+    s->srtt = (7 * s->srtt + sample) / 8;
+  }
+  s->rto = s->srtt + 4 * s->rttvar;
+  s->rto = s->rto < UDP_MIN_RTO_US ? UDP_MIN_RTO_US : s->rto;
+  s->rto = s->rto > UDP_MAX_RTO_US ? UDP_MAX_RTO_US : s->rto;
+}
+
+static void
+sender_acked(struct sender *s, uint32_t seq)
+{
+  if (s->state[seq] == __PKT_ACKED) {
+    return;
+  }
+  if (s->state[seq] == __PKT_INFLIGHT) {
+    s->inflight--;
+  } else if (s->state[seq] == __PKT_LOST) {
+    s->nlost--; /* spurious, it was only late */
+  }
+  s->state[seq] = __PKT_ACKED;
+  if (seq + 1 > s->highack) {
+    s->highack = seq + 1;
+  }
+
+  /* slow start, then one packet per window */
+  if (s->cwnd < s->ssthresh) {
+    s->cwnd++;
+  } else if (++s->cwndfrac >= s->cwnd) {
+    s->cwnd++;
+    s->cwndfrac = 0;
+  }
+  if (s->cwnd > UDP_MAX_CWND) {
+    s->cwnd = UDP_MAX_CWND;
+  }
+}
+
+static void
+sender_ack(struct sender *s, const struct udppkt *ack, uint32_t now)
+{
+  uint32_t cumack = ntohl(ack->seq);
+  uint64_t sack = be64toh(ack->sack);
+
+  if (cumack > s->npkts) {
+    return;
+  }
+  sender_rtt(s, now - ack->ts);
+
+  for (uint32_t seq = s->cumack; seq < cumack; seq++) {
+    sender_acked(s, seq);
+  }
+  for (uint32_t i = 0; i < UDP_SACK_BITS && cumack + 1 + i < s->npkts; i++) {
+    if (sack & (1ull << i)) {
+      sender_acked(s, cumack + 1 + i);
+    }
+  }
+  while (s->cumack < s->npkts && s->state[s->cumack] == __PKT_ACKED) {
+    s->cumack++;
+  }
+}
+
+static void
+sender_detect_loss(struct sender *s, uint32_t now)
+{
+  int lost = 0;
+
+  /* the scan walks the whole window, keep it off the per-ack path */
+  if (now - s->lastscan < (s->srtt / 4 > 1000 ? s->srtt / 4 : 1000)) {
+    return;
+  }
+  s->lastscan = now;
+
+  for (uint32_t seq = s->cumack; seq < s->next; seq++) {
+    if (s->state[seq] != __PKT_INFLIGHT) {
+      continue;
+    }
+    /* later packets got through and this one had time to, or it timed out */
+    if ((seq + UDP_DUPTHRESH < s->highack && now - s->sent[seq] > s->srtt + s->srtt / 4)
+        || now - s->sent[seq] > s->rto) {
+      s->state[seq] = __PKT_LOST;
+      s->inflight--;
+      s->nlost++;
+      lost = 1;
+    }
+  }
+
+  /* multiplicative decrease, at most once per round trip */
+  if (lost && now - s->lastcut > s->srtt) {
+    s->ssthresh = s->cwnd / 2 < 2 ? 2 : s->cwnd / 2;
+    s->cwnd = s->ssthresh;
+    s->cwndfrac = 0;
+    s->lastcut = now;
+  }
+}
+
+/* next packet to put on the wire: lost ones first, then new ones */
+static int64_t
+sender_pick(struct sender *s)
+{
+  for (uint32_t seq = s->cumack; s->nlost && seq < s->next; seq++) {
+    if (s->state[seq] == __PKT_LOST) {
+      return seq;
+    }
+  }
+  return s->next < s->npkts ? (int64_t)s->next : -1;
+}
+
+static void
+sender_send(struct sender *s, int udpfd, int filefd, uint32_t seq, uint32_t now, struct udpstats *stats)
+{
+  struct udppkt pkt;
+  ssize_t n = pread(filefd, pkt.payload, UDP_PAYLOAD, (off_t)seq * UDP_PAYLOAD);
+
+  if (n < 0) {
+    printerr_exit("pread() error\n");
+  }
+
+  pkt.type = UDP_DATA;
+  pkt.pad = 0;
+  pkt.len = htons(n);
+  pkt.seq = htonl(seq);
+  pkt.ts = now;
+  pkt.pad2 = 0;
+  pkt.sack = 0;
+  udp_send(udpfd, &pkt, UDP_HDRLEN + n);
+
+  if (stats) {
+    stats->sent++;
+    stats->retransmits += s->state[seq] == __PKT_LOST;
+  }
+  if (s->state[seq] == __PKT_LOST) {
+    s->nlost--;
+  }
+  if (seq == s->next) {
+    s->next++;
+  }
+  s->state[seq] = __PKT_INFLIGHT;
+  s->sent[seq] = now;
+  s->inflight++;
+}
+
+static int
+sender_fin(struct sender *s, int udpfd)
+{
+  struct udppkt pkt;
+
+  for (int tries = 0; tries < UDP_FIN_TRIES; tries++) {
+    mymemset(&pkt, 0, UDP_HDRLEN);
+    pkt.type = UDP_FIN;
+    pkt.seq = htonl(s->npkts);
+    pkt.ts = now_us();
+    udp_send(udpfd, &pkt, UDP_HDRLEN);
+
+    while (udp_recv(udpfd, &pkt, s->rto) > 0) {
+      if (pkt.type == UDP_FINACK) {
+        return 0;
+      }
+    }
+  }
+
+  return -1; /* every data packet was acked, only the goodbye got lost */
+}
+
+int64_t
+udp_sendfile(int udpfd, int filefd, struct udpstats *stats)
+{
+  struct sender s;
+  struct stat st;
+  struct udppkt ack;
+  uint32_t now, lastack, nextsend, wait;
+  size_t statesize;
+  int64_t seq, ret = -1;
+
+  if (fstat(filefd, &st) == -1) {
+    printerr_exit("fstat() error\n");
+  }
+
+  mymemset(&s, 0, sizeof s);
+  s.npkts = (st.st_size + UDP_PAYLOAD - 1) / UDP_PAYLOAD;
+  s.cwnd = UDP_INIT_CWND;
+  s.ssthresh = UDP_MAX_CWND;
+  s.rto = UDP_MAX_RTO_US / 4;
+  statesize = (size_t)s.npkts * (sizeof *s.state + sizeof *s.sent) + sizeof *s.sent;
+  s.sent = mymalloc(statesize);
+  s.state = (uint8_t *)(s.sent + s.npkts + 1);
+
+  now = lastack = nextsend = now_us();
+  while (s.cumack < s.npkts) {
+    sender_detect_loss(&s, now);
+
+    /* send as much as the window allows, spaced srtt/cwnd apart */
+    while (s.inflight < s.cwnd && (int32_t)(now - nextsend) >= 0 && (seq = sender_pick(&s)) >= 0) {
+      sender_send(&s, udpfd, filefd, seq, now, stats);
+      nextsend += s.srtt / s.cwnd;
+      if ((int32_t)(now - nextsend) > (int32_t)s.srtt) {
+        nextsend = now; /* do not bank credit while idle */
+      }
+    }
+
+    wait = (int32_t)(nextsend - now) > 0 && s.inflight < s.cwnd ? nextsend - now : s.rto / 4;
+    if (udp_recv(udpfd, &ack, wait ? wait : 1) > 0 && ack.type == UDP_ACK) {
+      sender_ack(&s, &ack, now_us());
+      lastack = now_us();
+    }
+
+    now = now_us();
+    if (now - lastack > UDP_IDLE_TIMEOUT_US) {
+      goto out;
+    }
+  }
+
+  sender_fin(&s, udpfd);
+  ret = st.st_size;
+
+ out:
+  if (stats) {
+    stats->srtt_us = s.srtt;
+    stats->cwnd = s.cwnd;
+  }
+  myfree(s.sent, statesize);
+  return ret;
+}
+
+int
+udp_listen(int ctrlfd, int *port)
+{
+  struct sockaddr_in addr;
+  socklen_t addrlen = sizeof addr;
+  int udpfd;
+
+  if (getsockname(ctrlfd, (struct sockaddr *)&addr, &addrlen) == -1) {
+    printerr_exit("getsockname() error\n");
+  }
+  if ((udpfd = socket(AF_INET, SOCK_DGRAM, 0)) == -1) {
+    printerr_exit("socket() error\n");
+  }
+
+  addr.sin_port = 0; /* any free port */
+  if (bind(udpfd, (struct sockaddr *)&addr, sizeof addr) == -1) {
+    printerr_exit("bind() error\n");
+  }
+
+  addrlen = sizeof addr;
+  getsockname(udpfd, (struct sockaddr *)&addr, &addrlen);
+  *port = ntohs(addr.sin_port);
+
+  return udpfd;
+}
+
+uint64_t
+udp_token(void)
+{
+  uint64_t token;
+
+  if (getrandom(&token, sizeof token, 0) != sizeof token) {
+    printerr_exit("getrandom() error\n");
+  }
+  return token;
+}
+
+int
+udp_accept_hello(int udpfd, int ctrlfd, uint64_t token)
+{
+  struct pollfd pfd = { .fd = udpfd, .events = POLLIN };
+  struct sockaddr_in peer, ctrl;
+  socklen_t peerlen, ctrllen = sizeof ctrl;
+  uint32_t deadline = now_us() + UDP_IDLE_TIMEOUT_US, left;
+  struct udppkt pkt;
+
+  if (getpeername(ctrlfd, (struct sockaddr *)&ctrl, &ctrllen) == -1) {
+    return -1;
+  }
+  while ((int32_t)(left = deadline - now_us()) > 0) {
+    if (poll(&pfd, 1, left / 1000 + 1) <= 0) {
+      continue;
+    }
+    peerlen = sizeof peer;
+    /* only the logged in client knows the token, and it sends from the control peer */
+    if (recvfrom(udpfd, &pkt, sizeof pkt, 0, (struct sockaddr *)&peer, &peerlen) >= (ssize_t)UDP_HDRLEN
+        && pkt.type == UDP_HELLO && be64toh(pkt.sack) == token
+        && peer.sin_family == AF_INET && peer.sin_addr.s_addr == ctrl.sin_addr.s_addr) {
+      return connect(udpfd, (struct sockaddr *)&peer, peerlen);
+    }
+  }
+  return -1;
+}
+
+int
+udp_connect(int ctrlfd, int port)
+{
+  struct sockaddr_in addr;
+  socklen_t addrlen = sizeof addr;
+  int udpfd;
+
+  if (getpeername(ctrlfd, (struct sockaddr *)&addr, &addrlen) == -1) {
+    printerr_exit("getpeername() error\n");
+  }
+  if ((udpfd = socket(AF_INET, SOCK_DGRAM, 0)) == -1) {
+    printerr_exit("socket() error\n");
+  }
+
+  addr.sin_port = htons(port);
+  if (connect(udpfd, (struct sockaddr *)&addr, sizeof addr) == -1) {
+    printerr_exit("connect() error\n");
+  }
+
+  return udpfd;
+}
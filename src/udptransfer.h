@@ -0,0 +1,175 @@
+/**
+ * @file udptransfer.h
+ * @brief Datagram Bulk Transfer Channel
+ *
+ * This file declares the optional UDP data channel used by "uget". The
+ * control connection negotiates a port, then the file is sent as numbered
+ * datagrams. The receiver answers with cumulative plus selective
+ * acknowledgements, and the sender paces its packets and runs a simple AIMD
+ * congestion window.
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef __UDPTRANSFER_H
+#define __UDPTRANSFER_H
+
+#include <stdint.h>
+
+#include "globals.h"
+
+#define UDP_PAYLOAD 1400          /* data bytes per datagram, fits a 1500 MTU */
+#define UDP_SACK_BITS 64          /* packets after the cumulative ack in an ACK */
+#define UDP_DUPTHRESH 3           /* later packets acked before we call one lost */
+#define UDP_INIT_CWND 16          /* packets */
+#define UDP_MAX_CWND 4096
+#define UDP_MIN_RTO_US 5000
+#define UDP_MAX_RTO_US 1000000
+#define UDP_HELLO_US 100000       /* receiver resends HELLO until data shows up */
+#define UDP_IDLE_TIMEOUT_US 5000000
+#define UDP_FIN_TRIES 10
+#define UDP_LOSS_ENV "SHELLSERVE_UDP_LOSS" /* drop rate in per mille, for testing */
+
+/**
+ * enum udptype - Datagram types on the data channel
+ * @UDP_HELLO: receiver to sender, tells the sender where to send; carries
+ *             the transfer's token in @sack
+ * @UDP_DATA: one chunk of the file
+ * @UDP_ACK: cumulative ack plus a selective ack bitmap
+ * @UDP_FIN: sender is done, seq holds the packet count
+ * @UDP_FINACK: receiver has everything
+ */
+enum udptype {
+  UDP_HELLO,
+  UDP_DATA,
+  UDP_ACK,
+  UDP_FIN,
+  UDP_FINACK,
+};
+
+/**
+ * struct udppkt - Wire format of a datagram, integers in network order
+ * @type: enum udptype
+ * @len: payload bytes (DATA)
+ * @seq: packet number (DATA, FIN) or next expected packet (ACK)
+ * @ts: sender timestamp in microseconds (DATA), echoed back (ACK)
+ * @sack: bit i set means packet seq+1+i was received (ACK), the token (HELLO)
+ * @payload: file data (DATA)
+ */
+struct udppkt {
+  uint8_t type;
+  uint8_t pad;
+  uint16_t len;
+  uint32_t seq;
+  uint32_t ts;
+  uint32_t pad2;
+  uint64_t sack;
+  char payload[UDP_PAYLOAD];
+} __attribute__((__packed__));
+
+#define UDP_HDRLEN (sizeof(struct udppkt) - UDP_PAYLOAD)
+
+/**
+ * struct udpstats - Counters filled in by udp_sendfile()
+ * @sent: datagrams sent, including retransmissions
+ * @retransmits: datagrams sent more than once
+ * @srtt_us: smoothed round trip time at the end of the transfer
+ * @cwnd: congestion window at the end of the transfer
+ */
+struct udpstats {
+  uint64_t sent;
+  uint64_t retransmits;
+  uint32_t srtt_us;
+  uint32_t cwnd;
+};
+
+/**
+ * udp_sendfile() - Send a whole file over a connected datagram socket.
+ * @udpfd: UDP socket connected to the receiver.
+ * @filefd: File to send, read with pread() so the offset is untouched.
+ * @stats: Optional counters, may be NULL.
+ *
+ * Return: bytes sent, or -1 if the receiver went silent.
+ */
+int64_t udp_sendfile(int udpfd, int filefd, struct udpstats *stats);
+
+/**
+ * udp_recvfile() - Receive a file sent by udp_sendfile().
+ * @udpfd: UDP socket connected to the sender.
+ * @filefd: File to write, written with pwrite() at each packet's offset.
+ * @size: File size announced over the control connection.
+ * @token: Token announced over the control connection.
+ *
+ * Sends UDP_HELLO until the first packet arrives, so the sender learns our
+ * address even if a HELLO is lost.
+ *
+ * Return: bytes received, or -1 if the sender went silent.
+ */
+int64_t udp_recvfile(int udpfd, int filefd, uint64_t size, uint64_t token);
+
+/**
+ * udp_listen() - Open the sender side of a data channel.
+ * @ctrlfd: Control connection, its local address is reused.
+ * @port: Filled in with the port the kernel picked.
+ *
+ * Return: unconnected UDP socket.
+ */
+int udp_listen(int ctrlfd, int *port)
+  __attribute__((__nonnull__(2)));
+
+/**
+ * udp_token() - A random token for one transfer.
+ *
+ * The sender announces it over the logged in control connection and only
+ * accepts a HELLO that carries it.
+ */
+uint64_t udp_token(void);
+
+/**
+ * udp_accept_hello() - Wait for the receiver's HELLO and connect to it.
+ * @udpfd: Socket from udp_listen().
+ * @ctrlfd: Control connection, the HELLO must come from its peer's address.
+ * @token: From udp_token(), the HELLO must carry it.
+ *
+ * Datagrams from anyone else, or without the token, are ignored, so a
+ * third party that can reach the port cannot take the file.
+ *
+ * Return: 0 on success, -1 on timeout.
+ */
+int udp_accept_hello(int udpfd, int ctrlfd, uint64_t token);
+
+/**
+ * udp_connect() - Open the receiver side of a data channel.
+ * @ctrlfd: Control connection, the data goes to the same peer address.
+ * @port: UDP port the sender announced.
+ *
+ * Return: UDP socket connected to the sender.
+ */
+int udp_connect(int ctrlfd, int port);
+
+/**
+ * udp_set_loss() - Drop outgoing datagrams on purpose.
+ * @permille: Drop probability in 1/1000, 0 turns the injector off.
+ *
+ * Used by the tests to exercise retransmission over loopback. The
+ * UDP_LOSS_ENV variable sets the same thing at startup.
+ */
+void udp_set_loss(unsigned int permille);
+
+#endif /* __UDPTRANSFER_H */
@@ -0,0 +1,213 @@
+/**
+ * @file upload.c
+ * @brief Streamed Uploads Into A Pipeline
+ *
+ * put - | gzip -d | tar x feeds the client's stdin to the first command
+ * without a file on either side. The client sends the line, then its input
+ * as FRAME_STDIN frames. On the server a child of the session takes the
+ * place of the put stage and splices the frames into its stdout pipe.
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "upload.h"
+#include "bufpool.h"
+#include "command_handler.h"
+#include "frames.h"
+#include "mystring.h"
+#include "syscalls.h"
+
+int
+upload_pipeline(const struct cmd_pipeline *list)
+{
+  return list && list->nstages > 1 && list->first->argc <= 2
+         && mystrcmp(list->first->argv[0], UPLOAD_COMMAND) == 0;
+}
+
+int
+upload_recv(int sockfd, int fd)
+{
+  struct framehdr hdr;
+
+  for (;;) {
+    if (frame_recv_hdr(sockfd, &hdr) == -1 || hdr.type != FRAME_STDIN) {
+      return 1;
+    }
+    if (hdr.len == 0) {
+      return 0;
+    }
+    if (frame_splice(sockfd, &fd, hdr.len) == -1) {
+      return 1;
+    }
+  }
+}
+
+/* fill in the header in front of len bytes of data, return the frame's size */
+static size_t
+__frame(char *frame, size_t len)
+{
+  struct framehdr *hdr = (struct framehdr *)frame;
+
+  hdr->type = FRAME_STDIN;
+  hdr->pad = 0;
+  hdr->job = 0;
+  hdr->len = htonl(len);
+  return sizeof *hdr + len;
+}
+
+/* send what the socket takes without blocking; -1 if the server hung up */
+static int
+__send(int sockfd, const char **p, size_t *left)
+{
+  ssize_t n;
+
+  while (*left > 0) {
+    if ((n = send(sockfd, *p, *left, MSG_DONTWAIT | MSG_NOSIGNAL)) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+    }
+    *p += n;
+    *left -= n;
+  }
+  return 0;
+}
+
+/* relay all the output waiting, so the command never waits on us; -1 once it ends */
+static int
+__drain(struct MyIO *io, int errfd, char *buf)
+{
+  struct pollfd pfd = { io->sockfd, POLLIN, 0 };
+  int status;
+  ssize_t n;
+
+  do {
+    if (errfd == -1) {
+      if ((n = mybuffered(io->sockfd, buf, FRAME_MAXLEN)) == 0
+          && (n = read(io->sockfd, buf, FRAME_MAXLEN)) <= 0) {
+        if (n == -1 && errno == EINTR) {
+          continue;
+        }
+        return -1;
+      }
+      writechars(io->writefd, buf, n);
+    } else if (frame_relay_one(io->sockfd, io->writefd, errfd, &status) != 0) {
+      return -1;
+    }
+  } while (mypending(io->sockfd) || poll(&pfd, 1, 0) == 1);
+  return 0;
+}
+
+/* stdin, or the operand opened; -1 after saying why not */
+static int
+__source(struct MyIO *io, int errfd)
+{
+  char *line = bufpool_get(), *mem = bufpool_get();
+  struct cmd_pipeline *list;
+  struct arena arena;
+  const char *err;
+  int fd = -2; /* not an upload */
+
+  mystrncpy(line, io->buf, BUFPOOL_BUFSIZE - 1);
+  line[BUFPOOL_BUFSIZE - 1] = '\0';
+  arena_init(&arena, mem, BUFPOOL_BUFSIZE);
+  if (cmd_parse(line, &arena, &list, &err) == -1) {
+    list = NULL;
+  }
+  if (upload_pipeline(list)) {
+    const char *name = list->first->argv[1];
+
+    if (name == NULL || mystrcmp(name, "-") == 0) {
+      fd = io->readfd;
+    } else if ((fd = open(name, O_RDONLY | O_CLOEXEC)) == -1) {
+      myfprintf(errfd != -1 ? errfd : sys_stderr, "%s: %s: %s\n", UPLOAD_COMMAND, name, strerror(errno));
+    }
+  } else if (errfd != -1 && script_inline(list) == 1) {
+    fd = io->readfd; /* a framed session takes a script's lines as frames too */
+  }
+  bufpool_put(mem);
+  bufpool_put(line);
+  return fd;
+}
+
+int
+upload_send(struct MyIO *io, int errfd)
+{
+  char frame[sizeof(struct framehdr) + FRAME_MAXLEN], *data = frame + sizeof(struct framehdr), *out;
+  const char *p = frame;
+  struct pollfd fds[2];
+  size_t left = 0;
+  int src, eof;
+  ssize_t n;
+
+  if ((src = __source(io, errfd)) == -2) {
+    return 0;
+  }
+  eof = src == -1;
+  if (eof) {
+    left = __frame(frame, 0); /* sent empty */
+  }
+  out = bufpool_get();
+
+  /*
+   * the command may write far more than it reads, and it cannot read while
+   * it waits to write. So a frame goes out only as far as the socket takes
+   * it, the next is read from src once it is gone, and meanwhile all the
+   * output waiting is relayed.
+   */
+  while (!eof || left > 0) {
+    fds[0] = (struct pollfd){ left > 0 ? -1 : src, POLLIN, 0 };
+    fds[1] = (struct pollfd){ io->sockfd, POLLIN | (left > 0 ? POLLOUT : 0), 0 };
+    if (poll(fds, 2, mypending(io->sockfd) ? 0 : -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    if (((fds[1].revents & ~POLLOUT) || mypending(io->sockfd)) && __drain(io, errfd, out) == -1) {
+      break;
+    }
+    if (fds[0].revents) {
+      if ((n = read(src, data, FRAME_MAXLEN)) > 0) {
+        left = __frame(frame, n);
+      } else if (n == 0 || errno != EINTR) {
+        left = __frame(frame, 0);
+        eof = 1;
+      }
+      p = frame;
+    }
+    if (left > 0 && __send(io->sockfd, &p, &left) == -1) {
+      break;
+    }
+  }
+  bufpool_put(out);
+  if (src != -1 && src != io->readfd) {
+    close(src);
+  }
+  return 1;
+}
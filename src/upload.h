@@ -0,0 +1,84 @@
+/**
+ * @file upload.h
+ * @brief Streamed Uploads Into A Pipeline
+ *
+ * @author 7etsuo
+ * @date 2023
+ *
+ * Copyright (C) 2023 7etsuo
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef __UPLOAD_H
+#define __UPLOAD_H
+
+#include "cmdparse.h"
+#include "filetransfer.h"
+
+#define UPLOAD_COMMAND "put" /* put [file|-] | command... */
+
+/**
+ * upload_pipeline() - Whether a command line starts with a streamed upload.
+ *
+ * @list: the parsed command line, see cmd_parse()
+ *
+ * Only the first pipeline streams, when its first stage is UPLOAD_COMMAND
+ * with at most one operand and more stages follow. Client and server both
+ * decide with this, so they agree on when FRAME_STDIN frames follow the
+ * line.
+ *
+ * Return: 1 if it does, 0 if not
+ */
+int upload_pipeline(const struct cmd_pipeline *list);
+
+/**
+ * upload_recv() - Copy a streamed upload into a pipe, on the server.
+ *
+ * @sockfd: the client socket
+ * @fd: the write end of the pipe to the next stage, -1 to drop the upload
+ *
+ * Takes FRAME_STDIN frames up to the empty one that ends them, starting
+ * with what myreadline() read ahead of the command line. Payloads are
+ * spliced from the socket into the pipe, so a full pipe stops the reads
+ * and TCP pushes back on the client. Once the next stage stops reading the
+ * rest is dropped, so the session stays in step with the client.
+ *
+ * Return: 0 at the end of the upload, 1 if the client hung up or sent
+ *         something other than an upload frame
+ */
+int upload_recv(int sockfd, int fd);
+
+/**
+ * upload_send() - Stream a local file or stdin after a command line.
+ *
+ * @io: the session; @io->buf holds the line just sent, @io->readfd is stdin
+ *      and @io->writefd where unframed output goes
+ * @errfd: where stderr frames go when the session is framed, -1 when it is
+ *         not and output is copied as it arrives
+ *
+ * The operand of UPLOAD_COMMAND is a file relative to the working
+ * directory, or - or none for stdin. When framed, stdin is also sent as
+ * the lines of a script the line reads, see script_inline(). The input goes out as FRAME_STDIN
+ * frames while the command's output is relayed, so neither side waits on
+ * the other: a frame is only written as far as the socket takes it without
+ * blocking. A file that cannot be opened is reported and sent empty.
+ *
+ * Return: 1 if the line was a streamed upload or script, 0 if not and
+ *         nothing was sent
+ */
+int upload_send(struct MyIO *io, int errfd)
+  __attribute__((__nonnull__(1)));
+
+#endif /* __UPLOAD_H */